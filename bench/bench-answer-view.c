@@ -0,0 +1,114 @@
+/* Scroll a ~1 MB answer through AnswerView and report frame times.
+ * Needs a display (run under Xvfb on headless machines). */
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "answer-view.h"
+#include "markdown-pango.h"
+
+#define BENCH_TARGET_BYTES (1024 * 1024)
+
+typedef struct
+{
+  GtkAdjustment *vadj;
+  GtkWidget *view;
+  GArray *intervals; /* element-type gint64, frame-to-frame in us */
+  gint64 last_frame_us;
+} BenchState;
+
+static gchar *
+bench_build_answer(void)
+{
+  GString *md = g_string_new("# Large answer\n\nHere is the full listing you asked for:\n\n```c\n");
+  for (guint i = 0; md->len < BENCH_TARGET_BYTES; i++)
+  {
+    if (i % 400 == 399)
+      g_string_append(md, "```\n\nAnd the **next** part, see `helper()` and https://example.com/docs.\n\n```c\n");
+    g_string_append_printf(md, "static int value_%u = compute(%u, \"line %u\"); /* keep going */\n", i, i * 7, i);
+  }
+  g_string_append(md, "```\n");
+  return g_string_free(md, FALSE);
+}
+
+static gint
+bench_cmp_i64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+static gboolean
+bench_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+  (void)widget;
+  BenchState *st = user_data;
+  gint64 now = gdk_frame_clock_get_frame_time(clock);
+  if (st->last_frame_us > 0)
+  {
+    gint64 interval = now - st->last_frame_us;
+    g_array_append_val(st->intervals, interval);
+  }
+  st->last_frame_us = now;
+
+  gdouble value = gtk_adjustment_get_value(st->vadj);
+  gdouble page = gtk_adjustment_get_page_size(st->vadj);
+  gdouble upper = gtk_adjustment_get_upper(st->vadj);
+  if (value + page >= upper)
+  {
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+  }
+  gtk_adjustment_set_value(st->vadj, value + page / 4.0);
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main(int argc, char **argv)
+{
+  gtk_init(&argc, &argv);
+
+  g_autofree gchar *answer = bench_build_answer();
+  gint64 t0 = g_get_monotonic_time();
+  GPtrArray *blocks = markdown_to_pango_blocks(answer, NULL);
+  gint64 render_us = g_get_monotonic_time() - t0;
+
+  GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size(GTK_WINDOW(window), 520, 480);
+  GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  GtkWidget *view = answer_view_new();
+  gtk_container_add(GTK_CONTAINER(scrolled), view);
+  gtk_container_add(GTK_CONTAINER(window), scrolled);
+
+  guint n_blocks = blocks->len;
+  answer_view_set_blocks(ANSWER_VIEW(view), blocks);
+
+  BenchState st = {0};
+  st.vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled));
+  st.view = view;
+  st.intervals = g_array_new(FALSE, FALSE, sizeof(gint64));
+  gtk_widget_add_tick_callback(window, bench_tick, &st, NULL);
+
+  gtk_widget_show_all(window);
+  gtk_main();
+
+  guint frames = 0;
+  gint64 draw_avg = 0, draw_max = 0;
+  answer_view_get_frame_stats(ANSWER_VIEW(view), &frames, &draw_avg, &draw_max);
+
+  g_array_sort(st.intervals, bench_cmp_i64);
+  guint n = st.intervals->len;
+  gint64 p50 = n ? g_array_index(st.intervals, gint64, n / 2) : 0;
+  gint64 p95 = n ? g_array_index(st.intervals, gint64, MIN(n - 1, n * 95 / 100)) : 0;
+  gint64 pmax = n ? g_array_index(st.intervals, gint64, n - 1) : 0;
+
+  printf("answer: %zu bytes, %u blocks, markdown %.1f ms\n", strlen(answer), n_blocks, render_us / 1000.0);
+  printf("scroll frames: %u  interval p50 %.2f ms  p95 %.2f ms  max %.2f ms\n", n, p50 / 1000.0, p95 / 1000.0, pmax / 1000.0);
+  printf("view draws: %u  avg %.2f ms  max %.2f ms\n", frames, draw_avg / 1000.0, draw_max / 1000.0);
+
+  g_array_unref(st.intervals);
+  gtk_widget_destroy(window);
+  return 0;
+}
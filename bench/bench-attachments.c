@@ -0,0 +1,274 @@
+/* Attachment upload benchmark.
+ *
+ *   bench-attachments [--megabytes N]
+ *
+ * Writes an N MB synthetic log, then:
+ *  - checks that a small attachment arrives at the mock server as valid
+ *    JSON with the exact text, also from a file read in several chunks;
+ *  - checks that a file changed after it was attached fails the request;
+ *  - uploads the whole log through openai-client and reports the peak
+ *    resident memory added during the upload and the throughput;
+ *  - for comparison, reports the peak added by building the same body in
+ *    memory with json-glib, which is what the client did before.
+ * Exits non-zero if the check fails or the streamed upload adds more than
+ * 16 MB. */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attachment.h"
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+
+#define BENCH_RSS_BUDGET_KB (16 * 1024)
+#define BENCH_PROMPT "Why does the service restart every few minutes?"
+
+static glong
+bench_status_kb(const gchar *field)
+{
+  g_autofree gchar *status = NULL;
+  if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+    return -1;
+  const gchar *line = strstr(status, field);
+  return line ? strtol(line + strlen(field), NULL, 10) : -1;
+}
+
+/* Resets VmHWM so it measures just the next step; FALSE if unsupported. */
+static gboolean
+bench_reset_peak(void)
+{
+  return g_file_set_contents("/proc/self/clear_refs", "5", 1, NULL);
+}
+
+typedef struct
+{
+  gboolean done;
+  gboolean ok;
+  glong peak_kb;
+} BenchRequest;
+
+static gboolean
+bench_sample_rss(gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->peak_kb = MAX(req->peak_kb, bench_status_kb("VmRSS:"));
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->ok = result->ok;
+  if (!result->ok)
+    g_printerr("bench-attachments: %s\n", result->error_message ? result->error_message : "request failed");
+  req->done = TRUE;
+}
+
+/* Sends @attachments with BENCH_PROMPT; returns the peak RSS seen, in KB. */
+static glong
+bench_send(const gchar *endpoint, GPtrArray *attachments, gboolean *ok)
+{
+  Conversation *conversation = conversation_new(2);
+  conversation_append(conversation, CONVERSATION_ROLE_USER, BENCH_PROMPT);
+
+  BenchRequest req = {FALSE, FALSE, bench_status_kb("VmRSS:")};
+  guint sampler = g_timeout_add(1, bench_sample_rss, &req);
+  openai_client_send_chat_async(endpoint, NULL, "mock", 0.0, conversation, attachments, NULL, bench_on_result, &req);
+  conversation_free(conversation);
+  while (!req.done)
+    g_main_context_iteration(NULL, TRUE);
+  g_source_remove(sampler);
+  bench_sample_rss(&req);
+
+  *ok = req.ok;
+  return req.peak_kb;
+}
+
+static gchar *
+bench_write_log(const gchar *dir, gsize bytes)
+{
+  static const gchar *const levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
+  static const gchar *const messages[] = {
+    "connection from 10.0.0.%u accepted",
+    "request \"GET /api/v1/items?page=%u\" took 12ms",
+    "retrying upload\tattempt=%u backoff=250ms",
+    "cache miss for key user:%u → fetching",
+    "worker %u exited with status 1; restarting",
+  };
+  g_autofree gchar *path = g_build_filename(dir, "service.log", NULL);
+  FILE *f = g_fopen(path, "w");
+  if (!f)
+    return NULL;
+  GRand *rand = g_rand_new_with_seed(7);
+  gsize written = 0;
+  for (guint i = 0; written < bytes; i++)
+  {
+    g_autofree gchar *message = g_strdup_printf(messages[i % G_N_ELEMENTS(messages)], g_rand_int_range(rand, 0, 255));
+    g_autofree gchar *line = g_strdup_printf("2024-05-%02u 12:%02u:%02u %s %s\n",
+                                             1 + i % 28,
+                                             i % 60,
+                                             (i / 60) % 60,
+                                             levels[g_rand_int_range(rand, 0, G_N_ELEMENTS(levels))],
+                                             message);
+    fputs(line, f);
+    written += strlen(line);
+  }
+  g_rand_free(rand);
+  fclose(f);
+  return g_steal_pointer(&path);
+}
+
+/* The received body must be JSON whose last message is the prompt followed
+ * by the attachment, byte for byte. */
+static gboolean
+bench_check_body(GBytes *body, const gchar *name, const gchar *text)
+{
+  if (!body)
+    return FALSE;
+  g_autoptr(JsonParser) parser = json_parser_new();
+  gsize len = 0;
+  const gchar *data = g_bytes_get_data(body, &len);
+  if (!json_parser_load_from_data(parser, data, (gssize)len, NULL))
+    return FALSE;
+  JsonObject *root = json_node_get_object(json_parser_get_root(parser));
+  JsonArray *messages = json_object_get_array_member(root, "messages");
+  JsonObject *last = json_array_get_object_element(messages, json_array_get_length(messages) - 1);
+  g_autofree gchar *expected = g_strdup_printf("%s\n\n--- %s ---\n%s\n--- end of %s ---", BENCH_PROMPT, name, text, name);
+  return g_strcmp0(json_object_get_string_member(last, "content"), expected) == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  gint megabytes = 50;
+  GOptionEntry entries[] = {
+    {"megabytes", 'm', 0, G_OPTION_ARG_INT, &megabytes, "Size of the uploaded log", "N"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark attachment uploads");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-attachments: %s\n", error->message);
+    return 2;
+  }
+
+  g_autofree gchar *dir = g_dir_make_tmp("bench-attachments-XXXXXX", &error);
+  g_autofree gchar *log_path = dir ? bench_write_log(dir, (gsize)megabytes * 1024 * 1024) : NULL;
+  MockServer *server = log_path ? mock_server_new(NULL, &error) : NULL;
+  if (!server)
+  {
+    g_printerr("bench-attachments: %s\n", error ? error->message : "cannot write the log");
+    return 2;
+  }
+  g_autofree gchar *endpoint = mock_server_get_tcp_endpoint(server);
+  gint status = 0;
+  gboolean ok = FALSE;
+
+  /* Correctness: quotes, backslashes, control characters and UTF-8. */
+  const gchar *tricky = "line \"one\"\\\n\ttab\r\x01 caf\xc3\xa9 \xe2\x86\x92 \xf0\x9f\x93\x8e end";
+  g_autoptr(GPtrArray) small = attachment_list_new();
+  attachment_add(small, attachment_new_text("tricky.txt", tricky, -1), NULL);
+  bench_send(endpoint, small, &ok);
+  gboolean body_ok = ok && bench_check_body(mock_server_get_last_body(server), "tricky.txt", tricky);
+  printf("escaping check     %s\n", body_ok ? "ok" : "FAILED");
+  if (!body_ok)
+    status = 1;
+
+  /* From a file: one byte, then four-byte sequences, so every 64 KB read
+   * boundary falls inside one. Then the file is cut short after being
+   * attached, which must fail the request rather than send garbage. */
+  g_autofree gchar *chunked_path = g_build_filename(dir, "chunked.txt", NULL);
+  g_autoptr(GString) chunked = g_string_new("a");
+  while (chunked->len < 256 * 1024)
+    g_string_append(chunked, "\xf0\x9f\x93\x8e");
+  g_string_append(chunked, tricky);
+  g_autoptr(GPtrArray) file = attachment_list_new();
+  Attachment *chunked_file = g_file_set_contents(chunked_path, chunked->str, (gssize)chunked->len, &error)
+                               ? attachment_new_file(chunked_path, &error)
+                               : NULL;
+  if (!chunked_file || !attachment_add(file, chunked_file, &error))
+  {
+    g_printerr("bench-attachments: %s\n", error->message);
+    return 2;
+  }
+  bench_send(endpoint, file, &ok);
+  g_autofree gchar *chunked_name = g_filename_display_name(chunked_path);
+  gboolean chunks_ok = ok && bench_check_body(mock_server_get_last_body(server), chunked_name, chunked->str);
+  printf("chunked file check %s\n", chunks_ok ? "ok" : "FAILED");
+  FILE *rewrite = g_fopen(chunked_path, "w"); /* the same file, emptied in place */
+  gboolean changed_ok = rewrite && fputs("cut short\n", rewrite) >= 0;
+  if (rewrite)
+    fclose(rewrite);
+  if (changed_ok)
+  {
+    bench_send(endpoint, file, &ok);
+    changed_ok = !ok;
+  }
+  printf("changed file check %s\n", changed_ok ? "ok" : "FAILED");
+  g_unlink(chunked_path);
+  if (!chunks_ok || !changed_ok)
+    status = 1;
+
+  /* Streamed upload of the whole log. */
+  mock_server_set_keep_body(server, FALSE);
+  g_autoptr(GPtrArray) big = attachment_list_new();
+  Attachment *log = attachment_new_file(log_path, &error);
+  if (!log || !attachment_add(big, log, &error))
+  {
+    g_printerr("bench-attachments: %s\n", error->message);
+    return 2;
+  }
+  glong base_kb = bench_status_kb("VmRSS:");
+  gboolean hwm = bench_reset_peak();
+  gint64 t0 = g_get_monotonic_time();
+  glong peak_kb = bench_send(endpoint, big, &ok);
+  gint64 upload_us = g_get_monotonic_time() - t0;
+  if (hwm)
+    peak_kb = MAX(peak_kb, bench_status_kb("VmHWM:"));
+  gsize received = mock_server_get_last_body_size(server);
+  g_clear_pointer(&big, g_ptr_array_unref);
+
+  printf("log size           %d MB\n", megabytes);
+  printf("body received      %.1f MB%s\n", received / (1024.0 * 1024.0), ok ? "" : " (request FAILED)");
+  printf("upload             %.1f ms  (%.0f MB/s)\n",
+         upload_us / 1000.0,
+         upload_us > 0 ? received / (1024.0 * 1024.0) / (upload_us / 1e6) : 0.0);
+  printf("streamed peak RSS  +%ld KB\n", peak_kb - base_kb);
+  if (!ok || peak_kb - base_kb > BENCH_RSS_BUDGET_KB)
+    status = 1;
+
+  /* The old way: the whole log in memory, escaped into one JSON string. */
+  base_kb = bench_status_kb("VmRSS:");
+  hwm = bench_reset_peak();
+  {
+    g_autofree gchar *contents = NULL;
+    g_file_get_contents(log_path, &contents, NULL, NULL);
+    g_autoptr(JsonBuilder) b = json_builder_new();
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "content");
+    json_builder_add_string_value(b, contents);
+    json_builder_end_object(b);
+    g_autoptr(JsonGenerator) gen = json_generator_new();
+    g_autoptr(JsonNode) root = json_builder_get_root(b);
+    json_generator_set_root(gen, root);
+    g_autofree gchar *body = json_generator_to_data(gen, NULL);
+    peak_kb = bench_status_kb("VmRSS:");
+  }
+  if (hwm)
+    peak_kb = MAX(peak_kb, bench_status_kb("VmHWM:"));
+  printf("in-memory peak RSS +%ld KB  (for comparison)\n", peak_kb - base_kb);
+
+  mock_server_free(server);
+  g_unlink(log_path);
+  g_rmdir(dir);
+  if (status != 0)
+    printf("FAIL: check failed or streamed upload above %d MB\n", BENCH_RSS_BUDGET_KB / 1024);
+  return status;
+}
@@ -0,0 +1,238 @@
+/* Native local-server backends vs the generic OpenAI-compatible path.
+ *
+ *   bench-backends [--questions N] [--think-ms MS]
+ *
+ * The mock server plays a local model server, scaled down in time: the
+ * model takes --load-ms to load and is unloaded after --idle-ms without
+ * requests (Ollama's five minutes), and every prompt byte not in the
+ * slot's cache costs --prompt-us. Each run asks N questions per
+ * conversation, --think-ms apart, and reports the time to the first byte
+ * of the answer for the first question and for the follow-ups:
+ *  - ollama: one conversation, generic path vs the Ollama backend, which
+ *    preloads the model on "focus" and asks for keep_alive;
+ *  - llama.cpp: two conversations in turn (two tabs) over two slots,
+ *    generic path vs the llama.cpp backend, which pins each conversation
+ *    to a slot and asks for cache_prompt.
+ * Exits non-zero if a native backend's follow-ups are not faster. */
+#include <glib.h>
+#include <stdio.h>
+
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+
+#define BENCH_CONVERSATION_TURNS 32
+#define BENCH_MAX_CONVERSATIONS 2
+
+typedef struct
+{
+  gboolean done;
+  gboolean ok;
+  gchar *content;
+} BenchRequest;
+
+typedef struct
+{
+  const gchar *label;
+  OpenaiClientBackend backend;
+  guint conversations;
+  guint load_ms;
+  guint idle_ms;
+  guint n_slots;
+} BenchRun;
+
+typedef struct
+{
+  gint64 first_us;
+  gint64 follow_up_us;
+  guint follow_ups;
+  guint failures;
+  guint loads;
+  guint64 cached_bytes;
+} BenchResult;
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->ok = result->ok;
+  if (result->ok)
+    req->content = g_strdup(result->content);
+  else
+    g_printerr("bench-backends: %s\n", result->error_message ? result->error_message : "request failed");
+  req->done = TRUE;
+}
+
+static gboolean
+bench_on_timeout(gpointer user_data)
+{
+  *(gboolean *)user_data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Waits while running the main context, so preloads and the mock server
+ * carry on meanwhile. */
+static void
+bench_sleep(guint ms)
+{
+  gboolean done = FALSE;
+  g_timeout_add(ms, bench_on_timeout, &done);
+  while (!done)
+    g_main_context_iteration(NULL, TRUE);
+}
+
+/* Sends the conversation, appends the answer and returns the elapsed time,
+ * or -1 on failure. */
+static gint64
+bench_ask(const gchar *endpoint, Conversation *conversation)
+{
+  BenchRequest req = {FALSE, FALSE, NULL};
+  gint64 t0 = g_get_monotonic_time();
+  openai_client_send_chat_async(endpoint, NULL, "mock", 0.0, conversation, NULL, NULL, bench_on_result, &req);
+  while (!req.done)
+    g_main_context_iteration(NULL, TRUE);
+  gint64 elapsed = g_get_monotonic_time() - t0;
+  if (!req.ok)
+    return -1;
+  conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, req.content);
+  g_free(req.content);
+  return elapsed;
+}
+
+static BenchResult
+bench_run(const BenchRun *run, gint questions, guint think_ms, guint prompt_us, const gchar *system, const gchar *answer)
+{
+  BenchResult result = {0};
+  g_autoptr(GError) error = NULL;
+  MockServer *server = mock_server_new(NULL, &error);
+  if (!server)
+  {
+    g_printerr("bench-backends: %s\n", error->message);
+    result.failures = 1;
+    return result;
+  }
+  mock_server_set_reply(server, answer);
+  mock_server_set_local_model(server, run->load_ms, run->idle_ms, prompt_us, run->n_slots);
+  g_autofree gchar *endpoint = mock_server_get_tcp_endpoint(server);
+  openai_client_set_backend(endpoint, run->backend);
+
+  Conversation *conversations[BENCH_MAX_CONVERSATIONS];
+  for (guint c = 0; c < run->conversations; c++)
+  {
+    conversations[c] = conversation_new(BENCH_CONVERSATION_TURNS);
+    g_autofree gchar *prompt = g_strdup_printf("Conversation %u. %s", c, system);
+    conversation_set_system(conversations[c], prompt);
+  }
+
+  /* The entry takes focus; a question is being typed. */
+  openai_client_preload(endpoint, NULL, "mock");
+  for (gint q = 0; q < questions; q++)
+  {
+    for (guint c = 0; c < run->conversations; c++)
+    {
+      bench_sleep(think_ms);
+      g_autofree gchar *question = g_strdup_printf("Question %d: and what happens to the pipe's buffer then?", q);
+      conversation_append(conversations[c], CONVERSATION_ROLE_USER, question);
+      gint64 elapsed = bench_ask(endpoint, conversations[c]);
+      if (elapsed < 0)
+        result.failures++;
+      else if (q == 0)
+        result.first_us += elapsed / run->conversations;
+      else
+      {
+        result.follow_up_us += elapsed;
+        result.follow_ups++;
+      }
+    }
+  }
+  if (result.follow_ups)
+    result.follow_up_us /= result.follow_ups;
+  result.loads = mock_server_get_load_count(server);
+  result.cached_bytes = mock_server_get_cached_bytes(server);
+
+  for (guint c = 0; c < run->conversations; c++)
+    conversation_free(conversations[c]);
+  mock_server_free(server);
+  printf("%-22s first %7.1f ms  follow-up %7.1f ms  loads %2u  cached %6.1f KB\n",
+         run->label,
+         result.first_us / 1000.0,
+         result.follow_up_us / 1000.0,
+         result.loads,
+         result.cached_bytes / 1024.0);
+  return result;
+}
+
+int
+main(int argc, char **argv)
+{
+  gint questions = 5;
+  gint think_ms = 350;
+  gint load_ms = 800;
+  gint idle_ms = 250;
+  gint prompt_us = 40;
+  GOptionEntry entries[] = {
+    {"questions", 'n', 0, G_OPTION_ARG_INT, &questions, "Questions per conversation", "N"},
+    {"think-ms", 't', 0, G_OPTION_ARG_INT, &think_ms, "Pause before each question", "MS"},
+    {"load-ms", 0, 0, G_OPTION_ARG_INT, &load_ms, "Time the mock model takes to load", "MS"},
+    {"idle-ms", 0, 0, G_OPTION_ARG_INT, &idle_ms, "Idle time before the mock model is unloaded", "MS"},
+    {"prompt-us", 0, 0, G_OPTION_ARG_INT, &prompt_us, "Prompt processing time per uncached byte", "US"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- compare native local-server backends with the generic path");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-backends: %s\n", error->message);
+    return 2;
+  }
+  if (questions < 2 || think_ms < 0 || load_ms < 0 || idle_ms < 0 || prompt_us < 0)
+  {
+    g_printerr("bench-backends: --questions must be at least 2 and the times not negative\n");
+    return 2;
+  }
+
+  /* A long system prompt and answers, so reprocessing the whole
+   * conversation is what a follow-up costs without the slot's cache. */
+  GString *system = g_string_new("You answer questions about Unix systems programming.");
+  while (system->len < 2048)
+    g_string_append(system, " Prefer short answers with one example, and name the relevant man page.");
+  GString *answer = g_string_new("When the reader is gone, write() fails with EPIPE.");
+  while (answer->len < 600)
+    g_string_append(answer, " The kernel raises SIGPIPE first, which terminates the process by default.");
+
+  const BenchRun runs[] = {
+    {"ollama    generic", OPENAI_CLIENT_BACKEND_OPENAI, 1, (guint)load_ms, (guint)idle_ms, 1},
+    {"ollama    native", OPENAI_CLIENT_BACKEND_OLLAMA, 1, (guint)load_ms, (guint)idle_ms, 1},
+    /* llama.cpp serves one model and never unloads it. */
+    {"llama.cpp generic", OPENAI_CLIENT_BACKEND_OPENAI, 2, 0, G_MAXUINT / 1000, 2},
+    {"llama.cpp native", OPENAI_CLIENT_BACKEND_LLAMA_CPP, 2, 0, G_MAXUINT / 1000, 2},
+  };
+  BenchResult results[G_N_ELEMENTS(runs)];
+  guint failures = 0;
+  for (guint i = 0; i < G_N_ELEMENTS(runs); i++)
+  {
+    results[i] = bench_run(&runs[i], questions, (guint)think_ms, (guint)prompt_us, system->str, answer->str);
+    failures += results[i].failures;
+  }
+  g_string_free(system, TRUE);
+  g_string_free(answer, TRUE);
+
+  if (failures > 0)
+  {
+    printf("FAIL: %u requests failed\n", failures);
+    return 1;
+  }
+  for (guint i = 0; i + 1 < G_N_ELEMENTS(runs); i += 2)
+  {
+    printf("%-22s follow-ups %.1fx faster\n",
+           runs[i + 1].label,
+           results[i + 1].follow_up_us > 0 ? (gdouble)results[i].follow_up_us / results[i + 1].follow_up_us : 0.0);
+    if (results[i + 1].follow_up_us >= results[i].follow_up_us)
+    {
+      printf("FAIL: %s follow-ups are not faster than the generic path\n", runs[i + 1].label);
+      return 1;
+    }
+  }
+  return 0;
+}
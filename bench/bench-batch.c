@@ -0,0 +1,277 @@
+/* Batch mode throughput and resume.
+ *
+ *   bench-batch [--lines N] [--jobs N] [--delay-ms MS]
+ *
+ * Writes N input lines and runs them as a batch against the mock server,
+ * which answers each request after --delay-ms: first one request at a time,
+ * then --jobs at a time, reporting requests/s for both. The mock server
+ * speaks plain HTTP/1.1, so the jobs share pooled keep-alive connections.
+ * Then the batch is run again, stopped halfway, its last record torn as a
+ * crash would leave it and an early record lost, opened and freed without
+ * running, and resumed. Exits non-zero if an output is not complete and in
+ * input order, if an answer written after the lost record is gone before
+ * the batch resumes, if the resumed run asks a line that was already
+ * answered, or if --jobs at a time is not at least twice as fast as one. */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch.h"
+#include "mock-server.h"
+#include "request-scheduler.h"
+
+#define BENCH_TEMPLATE "Summarize in one line: " BATCH_PLACEHOLDER
+#define BENCH_MIN_SPEEDUP 2.0
+
+typedef struct
+{
+  guint cancel_at; /* 0 = run to the end */
+  gboolean done;
+  gboolean failed;
+  BatchProgress progress;
+} BenchRun;
+
+static void
+bench_on_progress(Batch *batch, const BatchProgress *progress, gpointer user_data)
+{
+  BenchRun *run = user_data;
+  if (run->cancel_at && progress->written >= run->cancel_at)
+    batch_cancel(batch);
+}
+
+static void
+bench_on_done(Batch *batch, const BatchProgress *progress, const GError *error, gpointer user_data)
+{
+  (void)batch;
+  BenchRun *run = user_data;
+  run->progress = *progress;
+  run->done = TRUE;
+  if (error && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  {
+    g_printerr("bench-batch: %s\n", error->message);
+    run->failed = TRUE;
+  }
+}
+
+static gboolean
+bench_run(const gchar *endpoint,
+          const gchar *input,
+          const gchar *output,
+          guint jobs,
+          guint cancel_at,
+          BatchProgress *progress)
+{
+  g_autoptr(GError) error = NULL;
+  Batch *batch = batch_open(BENCH_TEMPLATE, input, output, &error);
+  if (!batch)
+  {
+    g_printerr("bench-batch: %s\n", error->message);
+    return FALSE;
+  }
+  request_scheduler_set_limit(request_scheduler_get_default(), endpoint, jobs + 1);
+  BatchOptions options = {
+    .endpoint = endpoint,
+    .model = "batch",
+    .jobs = jobs,
+    .owner = 1,
+  };
+  BenchRun run = {.cancel_at = cancel_at};
+  batch_start(batch, &options, bench_on_progress, bench_on_done, &run);
+  while (!run.done)
+    g_main_context_iteration(NULL, TRUE);
+  batch_free(batch);
+  *progress = run.progress;
+  return !run.failed;
+}
+
+/* Every input line answered once, in order. */
+static gboolean
+bench_check_output(const gchar *output, guint lines)
+{
+  g_autofree gchar *data = NULL;
+  if (!g_file_get_contents(output, &data, NULL, NULL))
+    return FALSE;
+  g_auto(GStrv) records = g_strsplit(data, "\n", -1);
+  guint n = 0;
+  for (; records[n] && *records[n]; n++)
+  {
+    g_autoptr(JsonParser) parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, records[n], -1, NULL))
+      return FALSE;
+    JsonObject *obj = json_node_get_object(json_parser_get_root(parser));
+    if (json_object_get_int_member_with_default(obj, "line", 0) != n + 1 || !json_object_has_member(obj, "answer"))
+      return FALSE;
+  }
+  return n == lines && records[n] && !records[n + 1];
+}
+
+static guint
+bench_count_answers(const gchar *output)
+{
+  g_autofree gchar *data = NULL;
+  if (!g_file_get_contents(output, &data, NULL, NULL))
+    return 0;
+  guint n = 0;
+  for (const gchar *p = data; (p = strstr(p, "\"answer\":")); p++)
+    n++;
+  return n;
+}
+
+/* Leaves a gap where @line's record was. */
+static void
+bench_drop_record(const gchar *output, guint line)
+{
+  g_autofree gchar *data = NULL;
+  if (!g_file_get_contents(output, &data, NULL, NULL))
+    return;
+  g_autofree gchar *prefix = g_strdup_printf("{\"line\":%u,", line);
+  g_auto(GStrv) records = g_strsplit(data, "\n", -1);
+  GString *out = g_string_new(NULL);
+  for (guint i = 0; records[i] && records[i + 1]; i++)
+  {
+    if (!g_str_has_prefix(records[i], prefix))
+      g_string_append_printf(out, "%s\n", records[i]);
+  }
+  g_string_append(out, records[0] ? records[g_strv_length(records) - 1] : "");
+  g_file_set_contents(output, out->str, (gssize)out->len, NULL);
+  g_string_free(out, TRUE);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint lines = 100;
+  gint jobs = 8;
+  gint delay_ms = 20;
+  GOptionEntry entries[] = {
+    {"lines", 'n', 0, G_OPTION_ARG_INT, &lines, "Input lines", "N"},
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Requests at once in the parallel run", "N"},
+    {"delay-ms", 0, 0, G_OPTION_ARG_INT, &delay_ms, "Time the mock server takes to answer", "MS"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- measure batch throughput and resuming");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-batch: %s\n", error->message);
+    return 2;
+  }
+  if (lines < 4 || jobs < 2 || jobs > BATCH_MAX_JOBS || delay_ms < 0)
+  {
+    g_printerr("bench-batch: --lines must be at least 4, --jobs between 2 and %d, --delay-ms not negative\n",
+               BATCH_MAX_JOBS);
+    return 2;
+  }
+
+  MockServer *server = mock_server_new(NULL, &error);
+  if (!server)
+  {
+    g_printerr("bench-batch: %s\n", error->message);
+    return 2;
+  }
+  mock_server_set_reply(server, "A one-line summary.");
+  mock_server_set_model_delay(server, "batch", (guint)delay_ms);
+  g_autofree gchar *endpoint = mock_server_get_tcp_endpoint(server);
+
+  g_autofree gchar *dir = g_dir_make_tmp("bench-batch-XXXXXX", &error);
+  if (!dir)
+  {
+    g_printerr("bench-batch: %s\n", error->message);
+    return 2;
+  }
+  g_autofree gchar *input = g_build_filename(dir, "input.txt", NULL);
+  g_autofree gchar *output = g_build_filename(dir, "input.txt.answers.jsonl", NULL);
+  GString *text = g_string_new(NULL);
+  for (gint i = 1; i <= lines; i++)
+    g_string_append_printf(text,
+                           "item %d: the build failed on the %s runner after %d minutes\n",
+                           i,
+                           i % 2 ? "arm64" : "x86_64",
+                           i % 17 + 3);
+  g_file_set_contents(input, text->str, (gssize)text->len, NULL);
+  g_string_free(text, TRUE);
+
+  gboolean ok = TRUE;
+  BatchProgress serial = {0};
+  BatchProgress parallel = {0};
+  ok &= bench_run(endpoint, input, output, 1, 0, &serial);
+  ok &= bench_check_output(output, (guint)lines);
+  g_remove(output);
+  ok &= bench_run(endpoint, input, output, (guint)jobs, 0, &parallel);
+  ok &= bench_check_output(output, (guint)lines);
+  g_remove(output);
+  if (!ok)
+  {
+    printf("FAIL: a batch did not write every line in order\n");
+    return 1;
+  }
+  gdouble speedup = batch_progress_get_rate(&parallel) / MAX(batch_progress_get_rate(&serial), 1e-9);
+  printf("1 job              %7.1f requests/s  (%.2f s for %d lines)\n",
+         batch_progress_get_rate(&serial),
+         serial.elapsed_us / 1e6,
+         lines);
+  printf("%-2d jobs            %7.1f requests/s  (%.2f s, %.1fx)\n",
+         jobs,
+         batch_progress_get_rate(&parallel),
+         parallel.elapsed_us / 1e6,
+         speedup);
+
+  /* Stop halfway, tear the last record, lose the second, resume. */
+  BatchProgress first = {0};
+  BatchProgress resumed = {0};
+  ok &= bench_run(endpoint, input, output, (guint)jobs, (guint)lines / 2, &first);
+  FILE *fp = g_fopen(output, "ab");
+  if (fp)
+  {
+    fputs("{\"line\":", fp);
+    fclose(fp);
+  }
+  /* Requests cancelled on their way to the server belong to the first run. */
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+  bench_drop_record(output, 2);
+  guint answered = bench_count_answers(output);
+  Batch *unstarted = batch_open(BENCH_TEMPLATE, input, output, NULL);
+  batch_free(unstarted);
+  gboolean kept_unstarted = bench_count_answers(output) == answered;
+  guint before = mock_server_get_request_count(server);
+  ok &= bench_run(endpoint, input, output, (guint)jobs, 0, &resumed);
+  guint asked = mock_server_get_request_count(server) - before;
+  ok &= bench_check_output(output, (guint)lines);
+  printf("resume             stopped at %u of %d lines, %u answered; resumed with %u kept and %u requests\n",
+         first.written,
+         lines,
+         answered,
+         resumed.resumed,
+         asked);
+
+  g_remove(output);
+  g_remove(input);
+  g_rmdir(dir);
+  mock_server_free(server);
+
+  if (!ok)
+  {
+    printf("FAIL: the resumed batch did not write every line in order\n");
+    return 1;
+  }
+  if (!kept_unstarted)
+  {
+    printf("FAIL: opening the batch without running it lost answers\n");
+    return 1;
+  }
+  if (resumed.resumed != answered || asked != (guint)lines - answered)
+  {
+    printf("FAIL: the resumed batch asked lines that were already written\n");
+    return 1;
+  }
+  if (speedup < BENCH_MIN_SPEEDUP)
+  {
+    printf("FAIL: %d jobs at a time are less than %.0fx as fast as one\n", jobs, BENCH_MIN_SPEEDUP);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,242 @@
+/* Answers fitted to the popup: time and tokens over a prompt corpus.
+ *
+ *   bench-budget [--token-us US] [--text-width PX] [--text-height PX]
+ *                [--char-width PX] [--line-height PX]
+ *
+ * The mock server writes each prompt's answer at --token-us per token, as
+ * long as an unconstrained model typically makes it (the lengths in
+ * bench_corpus[]), and stops at the request's max_tokens. Every prompt is
+ * asked once without a limit and once with the budget of a popup whose
+ * text area is --text-width by --text-height in a font of --char-width and
+ * --line-height, the defaults being a 400 px popup on a 1080 px monitor at
+ * 10 pt. Each answer that was cut is then continued once, as Ctrl+M does.
+ *
+ * The mock server does not read the brevity hint, so only the max_tokens
+ * part of the saving is measured; a model that follows the hint is cut
+ * less often. Exits non-zero if an answer that fits was cut, a
+ * continuation does not pick up where its answer stopped, or the budget
+ * does not save both time and tokens. */
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+#include "output-budget.h"
+
+typedef struct
+{
+  const gchar *prompt;
+  guint answer_tokens; /* unconstrained */
+} BenchPrompt;
+
+static const BenchPrompt bench_corpus[] = {
+  {"What is the capital of Australia?", 12},
+  {"Convert 72 Fahrenheit to Celsius.", 25},
+  {"Synonym for ubiquitous?", 15},
+  {"Define idempotent.", 60},
+  {"What does SIGPIPE mean?", 120},
+  {"Write a bash one-liner that counts the lines of all .c files.", 90},
+  {"How do I find which process is listening on port 8080?", 150},
+  {"How do I undo the last git commit but keep the changes?", 220},
+  {"Summarize what a B-tree is.", 380},
+  {"Explain the difference between a mutex and a semaphore.", 650},
+  {"Review this approach: caching DNS results forever.", 700},
+  {"Why is my Python script slower in a container?", 900},
+  {"Compare PostgreSQL and SQLite for a desktop app.", 1100},
+  {"Explain how TCP congestion control works.", 1400},
+  {"Design a rate limiter for a public API.", 1800},
+  {"Explain Rust lifetimes step by step.", 2000},
+};
+
+typedef struct
+{
+  gint64 t0;
+  gint64 done_us; /* 0 until it came */
+  gboolean ok;
+  gboolean truncated;
+  gint64 tokens;
+  gchar *content;
+} BenchRequest;
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->ok = result->ok;
+  if (!result->ok)
+    g_printerr("bench-budget: %s\n", result->error_message ? result->error_message : "request failed");
+  req->truncated = result->truncated;
+  req->tokens = result->completion_tokens;
+  req->content = g_strdup(result->content);
+  req->done_us = g_get_monotonic_time() - req->t0;
+}
+
+static void
+bench_ask(const gchar *endpoint, gint max_tokens, const Conversation *conversation, BenchRequest *req)
+{
+  memset(req, 0, sizeof(*req));
+  req->t0 = g_get_monotonic_time();
+  openai_client_send_chat_full_async(endpoint,
+                                     NULL,
+                                     "bench",
+                                     0.0,
+                                     max_tokens,
+                                     conversation,
+                                     NULL,
+                                     NULL,
+                                     bench_on_result,
+                                     req);
+  while (!req->done_us)
+    g_main_context_iteration(NULL, TRUE);
+}
+
+/* @tokens worth of answer, in paragraphs of a few sentences. */
+static gchar *
+bench_make_answer(guint tokens)
+{
+  gsize bytes = (gsize)tokens * 4;
+  GString *text = g_string_new(NULL);
+  for (guint i = 1; text->len < bytes; i++)
+    g_string_append_printf(text, "Sentence %u adds one more detail to the answer.%s", i, i % 4 ? " " : "\n\n");
+  g_string_truncate(text, bytes);
+  return g_string_free(text, FALSE);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint token_us = 500;
+  gint text_width = 348;
+  gint text_height = 270;
+  gdouble char_width = 7.5;
+  gdouble line_height = 17.0;
+  GOptionEntry entries[] = {
+    {"token-us", 0, 0, G_OPTION_ARG_INT, &token_us, "Time the mock model takes per token", "US"},
+    {"text-width", 0, 0, G_OPTION_ARG_INT, &text_width, "Width of the popup's text area", "PX"},
+    {"text-height", 0, 0, G_OPTION_ARG_INT, &text_height, "Height of the popup's text area at its tallest", "PX"},
+    {"char-width", 0, 0, G_OPTION_ARG_DOUBLE, &char_width, "Average character width of the font", "PX"},
+    {"line-height", 0, 0, G_OPTION_ARG_DOUBLE, &line_height, "Line height of the font", "PX"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- measure answers fitted to the popup");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-budget: %s\n", error->message);
+    return 2;
+  }
+  OutputBudget budget;
+  if (token_us < 0 || !output_budget_compute(&budget, text_width, text_height, char_width, line_height))
+  {
+    g_printerr("bench-budget: the sizes must be positive and --token-us not negative\n");
+    return 2;
+  }
+
+  MockServer *server = mock_server_new(NULL, &error);
+  if (!server)
+  {
+    g_printerr("bench-budget: %s\n", error->message);
+    return 2;
+  }
+  mock_server_set_token_time(server, (guint)token_us);
+  g_autofree gchar *endpoint = mock_server_get_tcp_endpoint(server);
+  g_autofree gchar *hint = output_budget_get_hint(&budget);
+
+  gint64 full_us = 0;
+  gint64 full_tokens = 0;
+  gint64 fitted_us = 0;
+  gint64 fitted_tokens = 0;
+  gint64 continued_us = 0;
+  gint64 continued_tokens = 0;
+  guint cut = 0;
+  guint failures = 0;
+  guint wrongly_cut = 0;
+  guint bad_continuations = 0;
+  for (guint i = 0; i < G_N_ELEMENTS(bench_corpus); i++)
+  {
+    const BenchPrompt *p = &bench_corpus[i];
+    g_autofree gchar *answer = bench_make_answer(p->answer_tokens);
+    mock_server_set_reply(server, answer);
+
+    Conversation *conversation = conversation_new(4);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, p->prompt);
+    BenchRequest full;
+    bench_ask(endpoint, 0, conversation, &full);
+
+    conversation_set_system(conversation, hint);
+    BenchRequest fitted;
+    bench_ask(endpoint, budget.max_tokens, conversation, &fitted);
+
+    BenchRequest more = {0};
+    if (fitted.ok && fitted.truncated)
+    {
+      conversation_append(conversation, CONVERSATION_ROLE_ASSISTANT, fitted.content);
+      conversation_append(conversation, CONVERSATION_ROLE_USER, OUTPUT_BUDGET_CONTINUE_PROMPT);
+      bench_ask(endpoint, budget.max_tokens, conversation, &more);
+      g_autofree gchar *combined = g_strconcat(fitted.content, more.content, NULL);
+      if (more.ok && !g_str_has_prefix(answer, combined))
+        bad_continuations++;
+    }
+    conversation_free(conversation);
+
+    if (!full.ok || !fitted.ok || (fitted.truncated && !more.ok))
+      failures++;
+    else
+    {
+      full_us += full.done_us;
+      full_tokens += full.tokens;
+      fitted_us += fitted.done_us;
+      fitted_tokens += fitted.tokens;
+      continued_us += fitted.done_us + more.done_us;
+      continued_tokens += fitted.tokens + more.tokens;
+      cut += fitted.truncated;
+      if (fitted.truncated && p->answer_tokens <= (guint)budget.max_tokens)
+        wrongly_cut++;
+    }
+    g_free(full.content);
+    g_free(fitted.content);
+    g_free(more.content);
+  }
+  mock_server_free(server);
+
+  if (failures > 0)
+  {
+    printf("FAIL: %u prompts failed\n", failures);
+    return 1;
+  }
+  guint n = G_N_ELEMENTS(bench_corpus);
+  printf("budget             %u lines of %u characters, max_tokens %d\n",
+         budget.lines,
+         budget.chars_per_line,
+         budget.max_tokens);
+  printf("unconstrained      %7.1f ms/answer  %6" G_GINT64_FORMAT " tokens\n", full_us / 1000.0 / n, full_tokens);
+  printf("fitted             %7.1f ms/answer  %6" G_GINT64_FORMAT " tokens  (%u of %u cut, %.0f%% fewer tokens)\n",
+         fitted_us / 1000.0 / n,
+         fitted_tokens,
+         cut,
+         n,
+         full_tokens > 0 ? 100.0 * (full_tokens - fitted_tokens) / full_tokens : 0.0);
+  printf("fitted, continued  %7.1f ms/answer  %6" G_GINT64_FORMAT " tokens  (every cut answer continued once)\n",
+         continued_us / 1000.0 / n,
+         continued_tokens);
+
+  if (wrongly_cut > 0)
+  {
+    printf("FAIL: %u answers within the budget were cut\n", wrongly_cut);
+    return 1;
+  }
+  if (bad_continuations > 0)
+  {
+    printf("FAIL: %u continuations did not pick up where their answer stopped\n", bad_continuations);
+    return 1;
+  }
+  if (fitted_tokens >= full_tokens || fitted_us >= full_us)
+  {
+    printf("FAIL: fitting answers to the popup did not save both time and tokens\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,137 @@
+/* Loopback TCP vs unix socket request latency.
+ *
+ *   bench-endpoints [--requests N]
+ *
+ * Starts the mock server on both transports and sends N sequential chat
+ * requests over each through openai-client, first reusing connections and
+ * then with the server closing every connection. Reports latency
+ * percentiles per transport; exits non-zero if any request fails. */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+
+#define BENCH_WARMUP 50
+
+typedef struct
+{
+  gboolean done;
+  gboolean ok;
+} BenchRequest;
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->ok = result->ok;
+  if (!result->ok)
+    g_printerr("bench-endpoints: %s\n", result->error_message ? result->error_message : "request failed");
+  req->done = TRUE;
+}
+
+static gboolean
+bench_request(const gchar *endpoint, const Conversation *conversation)
+{
+  BenchRequest req = {FALSE, FALSE};
+  openai_client_send_chat_async(endpoint, NULL, "mock", 0.0, conversation, NULL, NULL, bench_on_result, &req);
+  while (!req.done)
+    g_main_context_iteration(NULL, TRUE);
+  return req.ok;
+}
+
+static gint
+bench_cmp_i64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+static guint
+bench_run(const gchar *label, const gchar *endpoint, const Conversation *conversation, gint requests)
+{
+  guint failures = 0;
+  for (gint i = 0; i < BENCH_WARMUP; i++)
+    failures += bench_request(endpoint, conversation) ? 0 : 1;
+
+  g_autoptr(GArray) times = g_array_new(FALSE, FALSE, sizeof(gint64));
+  gint64 total = 0;
+  for (gint i = 0; i < requests; i++)
+  {
+    gint64 t0 = g_get_monotonic_time();
+    failures += bench_request(endpoint, conversation) ? 0 : 1;
+    gint64 elapsed = g_get_monotonic_time() - t0;
+    total += elapsed;
+    g_array_append_val(times, elapsed);
+  }
+
+  g_array_sort(times, bench_cmp_i64);
+  gint64 p50 = times->len ? g_array_index(times, gint64, times->len / 2) : 0;
+  gint64 p99 = times->len ? g_array_index(times, gint64, (times->len * 99) / 100) : 0;
+  printf("%-28s mean %7.1f us  p50 %7.1f us  p99 %7.1f us\n",
+         label,
+         times->len ? (gdouble)total / times->len : 0.0,
+         (gdouble)p50,
+         (gdouble)p99);
+  return failures;
+}
+
+int
+main(int argc, char **argv)
+{
+  gint requests = 2000;
+  GOptionEntry entries[] = {
+    {"requests", 'n', 0, G_OPTION_ARG_INT, &requests, "Requests per transport and mode", "N"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- compare loopback TCP and unix socket endpoints");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-endpoints: %s\n", error->message);
+    return 2;
+  }
+
+  g_autofree gchar *dir = g_dir_make_tmp("bench-endpoints-XXXXXX", &error);
+  if (!dir)
+  {
+    g_printerr("bench-endpoints: %s\n", error->message);
+    return 2;
+  }
+  g_autofree gchar *socket_path = g_build_filename(dir, "llm.sock", NULL);
+  MockServer *server = mock_server_new(socket_path, &error);
+  if (!server)
+  {
+    g_printerr("bench-endpoints: %s\n", error->message);
+    g_rmdir(dir);
+    return 2;
+  }
+  g_autofree gchar *tcp = mock_server_get_tcp_endpoint(server);
+  g_autofree gchar *uds = mock_server_get_unix_endpoint(server);
+
+  Conversation *conversation = conversation_new(2);
+  conversation_append(conversation, CONVERSATION_ROLE_USER, "What does SIGPIPE mean?");
+
+  printf("requests           %d per run, sequential\n", requests);
+  guint failures = 0;
+  failures += bench_run("tcp  keep-alive", tcp, conversation, requests);
+  failures += bench_run("unix keep-alive", uds, conversation, requests);
+  mock_server_set_close_connections(server, TRUE);
+  failures += bench_run("tcp  new connection", tcp, conversation, requests);
+  failures += bench_run("unix new connection", uds, conversation, requests);
+
+  conversation_free(conversation);
+  mock_server_free(server);
+  g_rmdir(dir);
+
+  if (failures > 0)
+  {
+    printf("FAIL: %u requests failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
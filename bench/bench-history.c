@@ -0,0 +1,274 @@
+/* History store benchmark.
+ *
+ *   bench-history [--exchanges N] [--queries N]
+ *
+ * Writes N synthetic exchanges to a temporary history log, reopens it and
+ * reports the time to rebuild the index, resident memory, and search
+ * latency percentiles. Exits non-zero if the 99th percentile search takes
+ * longer than 10 ms, if an exchange appended after a record torn by a
+ * crash is not found, or if an exchange too large to read back is
+ * written. */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+#define BENCH_VOCAB_WORDS 20000
+#define BENCH_SEARCH_BUDGET_US 10000
+
+static const gchar *const bench_syllables[] = {
+  "ka", "lo", "mi", "ne", "ru", "sa", "te", "vo", "zi", "pa", "qu", "ex", "on", "ar", "il", "um", "be", "do",
+};
+
+static gchar **
+bench_make_vocab(GRand *rand)
+{
+  gchar **vocab = g_new0(gchar *, BENCH_VOCAB_WORDS + 1);
+  for (guint i = 0; i < BENCH_VOCAB_WORDS; i++)
+  {
+    GString *w = g_string_new(NULL);
+    guint n = (guint)g_rand_int_range(rand, 2, 5);
+    for (guint j = 0; j < n; j++)
+      g_string_append(w, bench_syllables[g_rand_int_range(rand, 0, G_N_ELEMENTS(bench_syllables))]);
+    vocab[i] = g_string_free(w, FALSE);
+  }
+  return vocab;
+}
+
+/* Zipf-ish: low indices are much more frequent, like real text. */
+static const gchar *
+bench_word(GRand *rand, gchar **vocab)
+{
+  gdouble u = g_rand_double(rand);
+  return vocab[(guint)(u * u * u * BENCH_VOCAB_WORDS) % BENCH_VOCAB_WORDS];
+}
+
+static gchar *
+bench_sentence(GRand *rand, gchar **vocab, guint min_words, guint max_words)
+{
+  GString *s = g_string_new(NULL);
+  guint n = (guint)g_rand_int_range(rand, (gint32)min_words, (gint32)max_words + 1);
+  for (guint i = 0; i < n; i++)
+  {
+    if (i > 0)
+      g_string_append_c(s, (i % 12 == 11) ? '\n' : ' ');
+    g_string_append(s, bench_word(rand, vocab));
+  }
+  return g_string_free(s, FALSE);
+}
+
+static void
+bench_wait_loaded(History *history)
+{
+  while (!history_is_loaded(history))
+    g_main_context_iteration(NULL, TRUE);
+}
+
+static glong
+bench_rss_kb(void)
+{
+  g_autofree gchar *status = NULL;
+  if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+    return -1;
+  const gchar *line = strstr(status, "VmRSS:");
+  return line ? strtol(line + 6, NULL, 10) : -1;
+}
+
+/* A record torn by a crash, whose header promises more than was written,
+ * followed by an exchange appended after it: the running instance and a
+ * reopened one must both find the exchanges on either side. */
+static gboolean
+bench_check_torn(const gchar *dir)
+{
+  /* The log's record header ("OAH1", u32 LE length, see history.c) for a
+   * 1 MB record, and the start of its gzip member. */
+  static const guint8 torn[] = {'O', 'A', 'H', '1', 0x00, 0x00, 0x10, 0x00, 0x1f, 0x8b, 0x08};
+  g_autofree gchar *path = g_build_filename(dir, "torn.log", NULL);
+  History *history = history_new(path, NULL, NULL);
+  if (!history)
+    return FALSE;
+  bench_wait_loaded(history);
+  history_append(history, 1, "bench-model", "asked before the crash", "kept");
+  FILE *f = fopen(path, "ab");
+  if (!f || fwrite(torn, 1, sizeof(torn), f) != sizeof(torn) || fclose(f) != 0)
+  {
+    history_free(history);
+    return FALSE;
+  }
+  history_append(history, 2, "bench-model", "asked after the crash", "found");
+  guint live = history_get_count(history);
+  history_free(history);
+
+  history = history_new(path, NULL, NULL);
+  bench_wait_loaded(history);
+  guint reopened = history_get_count(history);
+  history_free(history);
+  g_unlink(path);
+  printf("torn record        %u of 2 exchanges found while running, %u after reopening\n", live, reopened);
+  return live == 2 && reopened == 2;
+}
+
+/* An answer too large for the reader must be refused rather than written
+ * as a record that could never be read back. */
+static gboolean
+bench_check_oversized(const gchar *dir)
+{
+  g_autofree gchar *path = g_build_filename(dir, "oversized.log", NULL);
+  History *history = history_new(path, NULL, NULL);
+  if (!history)
+    return FALSE;
+  bench_wait_loaded(history);
+  /* Random printable text compresses to well over 16 MB. */
+  gsize len = 24 * 1024 * 1024;
+  gchar *answer = g_malloc(len + 1);
+  GRand *rand = g_rand_new_with_seed(3);
+  for (gsize i = 0; i < len; i++)
+    answer[i] = (gchar)g_rand_int_range(rand, ' ', '~' + 1);
+  answer[len] = '\0';
+  g_rand_free(rand);
+  gboolean written = history_append(history, 1, "bench-model", "dump everything", answer);
+  g_free(answer);
+  history_append(history, 2, "bench-model", "asked after it", "found");
+  history_free(history);
+
+  history = history_new(path, NULL, NULL);
+  bench_wait_loaded(history);
+  guint reopened = history_get_count(history);
+  history_free(history);
+  g_unlink(path);
+  printf("oversized record   %s, %u of 1 exchange after reopening\n", written ? "WRITTEN" : "refused", reopened);
+  return !written && reopened == 1;
+}
+
+static gint
+bench_cmp_i64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint exchanges = 100000;
+  gint queries = 2000;
+  GOptionEntry entries[] = {
+    {"exchanges", 'n', 0, G_OPTION_ARG_INT, &exchanges, "Number of exchanges to write", "N"},
+    {"queries", 'q', 0, G_OPTION_ARG_INT, &queries, "Number of searches to time", "N"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark the history store");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-history: %s\n", error->message);
+    return 2;
+  }
+
+  g_autofree gchar *dir = g_dir_make_tmp("bench-history-XXXXXX", &error);
+  if (!dir)
+  {
+    g_printerr("bench-history: %s\n", error->message);
+    return 2;
+  }
+  gboolean torn_ok = bench_check_torn(dir);
+  gboolean oversized_ok = bench_check_oversized(dir);
+  g_autofree gchar *path = g_build_filename(dir, "history.log", NULL);
+
+  GRand *rand = g_rand_new_with_seed(42);
+  gchar **vocab = bench_make_vocab(rand);
+
+  History *history = history_new(path, NULL, NULL);
+  if (!history)
+    return 2;
+  bench_wait_loaded(history);
+  gint64 t0 = g_get_monotonic_time();
+  gint64 conversation = 1;
+  for (gint i = 0; i < exchanges; i++)
+  {
+    if (g_rand_int_range(rand, 0, 3) == 0)
+      conversation++;
+    g_autofree gchar *prompt = bench_sentence(rand, vocab, 6, 24);
+    g_autofree gchar *answer = bench_sentence(rand, vocab, 60, 300);
+    history_append(history, conversation, "bench-model", prompt, answer);
+  }
+  gint64 write_us = g_get_monotonic_time() - t0;
+  history_free(history);
+
+  GStatBuf st;
+  g_stat(path, &st);
+  glong rss_before = bench_rss_kb();
+  t0 = g_get_monotonic_time();
+  history = history_new(path, NULL, NULL);
+  bench_wait_loaded(history);
+  gint64 load_us = g_get_monotonic_time() - t0;
+  glong rss_after = bench_rss_kb();
+
+  printf("exchanges          %u\n", history_get_count(history));
+  printf("file size          %.1f MB\n", st.st_size / (1024.0 * 1024.0));
+  printf("append             %.1f us/exchange\n", (gdouble)write_us / MAX(exchanges, 1));
+  printf("index rebuild      %.1f ms\n", load_us / 1000.0);
+  printf("index RSS          %ld KB\n", rss_after - rss_before);
+
+  g_autoptr(GArray) times = g_array_new(FALSE, FALSE, sizeof(gint64));
+  guint64 total_hits = 0;
+  for (gint i = 0; i < queries; i++)
+  {
+    GString *q = g_string_new(NULL);
+    guint words = (guint)g_rand_int_range(rand, 1, 4);
+    for (guint j = 0; j < words; j++)
+    {
+      if (j > 0)
+        g_string_append_c(q, ' ');
+      g_string_append(q, bench_word(rand, vocab));
+    }
+    /* Half of the queries are still being typed: the last word is a prefix. */
+    if (i % 2 == 0 && q->len > 3)
+      g_string_truncate(q, q->len - 2);
+
+    HistoryHit hits[20];
+    gint64 s0 = g_get_monotonic_time();
+    total_hits += history_search(history, q->str, hits, G_N_ELEMENTS(hits));
+    gint64 elapsed = g_get_monotonic_time() - s0;
+    g_array_append_val(times, elapsed);
+    g_string_free(q, TRUE);
+  }
+
+  g_array_sort(times, bench_cmp_i64);
+  gint64 p50 = times->len ? g_array_index(times, gint64, times->len / 2) : 0;
+  gint64 p99 = times->len ? g_array_index(times, gint64, (times->len * 99) / 100) : 0;
+  gint64 worst = times->len ? g_array_index(times, gint64, times->len - 1) : 0;
+  printf("search             p50 %.3f ms  p99 %.3f ms  max %.3f ms  (%.1f hits avg)\n",
+         p50 / 1000.0,
+         p99 / 1000.0,
+         worst / 1000.0,
+         times->len ? (gdouble)total_hits / times->len : 0.0);
+
+  history_free(history);
+  g_unlink(path);
+  g_rmdir(dir);
+  g_strfreev(vocab);
+  g_rand_free(rand);
+
+  if (p99 > BENCH_SEARCH_BUDGET_US)
+  {
+    printf("FAIL: p99 search above %d ms\n", BENCH_SEARCH_BUDGET_US / 1000);
+    return 1;
+  }
+  if (!torn_ok)
+  {
+    printf("FAIL: an exchange appended after a torn record was lost\n");
+    return 1;
+  }
+  if (!oversized_ok)
+  {
+    printf("FAIL: an exchange too large to read back was written\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,287 @@
+/* Headless throughput benchmark for markdown_to_pango().
+ *
+ *   bench-markdown [--min-time SECONDS] [FILE|DIR]...
+ *
+ * Every input is rendered repeatedly; the report lists MB/s, heap
+ * allocations per KB of input and the worst single render. Besides the
+ * given files a set of generated adversarial inputs is always included.
+ *
+ * The adversarial inputs are also rendered at two sizes; rendering must
+ * scale linearly, and the exit status is non-zero if any of them grows
+ * clearly faster than the input, or if a comment spanning two chunks of
+ * a code block or an upper-case SQL keyword is not highlighted. */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "markdown-pango.h"
+
+/* Count heap allocations by interposing the allocator; GLib allocates
+ * through malloc() since 2.46. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static guint64 bench_allocs = 0;
+
+void *
+malloc(size_t size)
+{
+  __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+  __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+#define BENCH_ADVERSARIAL_BYTES (16 * 1024)
+#define BENCH_SCALING_BYTES (64 * 1024)
+#define BENCH_SCALING_FACTOR 8
+#define BENCH_SCALING_MAX_RATIO 16.0 /* linear is ~8, quadratic ~64 */
+
+/* Inputs that have made regex-based renderers backtrack or go quadratic. */
+static const struct
+{
+  const gchar *name;
+  const gchar *prefix;
+  const gchar *unit;
+} bench_adversarial[] = {
+  {"adv:stars", "", "*"},
+  {"adv:bold-openers", "", "**a "},
+  {"adv:italic-openers", "", "*a"},
+  {"adv:unclosed-fences", "", "```x\n"},
+  {"adv:backticks", "", "`a"},
+  {"adv:brackets", "", "[a]("},
+  {"adv:link-no-close", "", "[a](http://"},
+  {"adv:audio-tags", "", "<audio_file>"},
+  {"adv:escaped-dollars", "", "\\$"},
+  {"adv:long-url", "see https://", "a.b/c?d=e&"},
+};
+
+typedef struct
+{
+  gchar *name;
+  gchar *text;
+} BenchDoc;
+
+static void
+bench_doc_free(BenchDoc *doc)
+{
+  g_free(doc->name);
+  g_free(doc->text);
+  g_free(doc);
+}
+
+static void
+bench_add_doc(GPtrArray *docs, const gchar *name, gchar *text)
+{
+  BenchDoc *doc = g_new0(BenchDoc, 1);
+  doc->name = g_strdup(name);
+  doc->text = text;
+  g_ptr_array_add(docs, doc);
+}
+
+static gchar *
+bench_repeat(const gchar *prefix, const gchar *unit, gsize target)
+{
+  GString *s = g_string_sized_new(target + strlen(unit));
+  g_string_append(s, prefix);
+  while (s->len < target)
+    g_string_append(s, unit);
+  return g_string_free(s, FALSE);
+}
+
+static void
+bench_add_adversarial(GPtrArray *docs, gsize size)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(bench_adversarial); i++)
+    bench_add_doc(docs, bench_adversarial[i].name, bench_repeat(bench_adversarial[i].prefix, bench_adversarial[i].unit, size));
+}
+
+/* Best of three, to keep scheduler noise out of the ratio. */
+static gint64
+bench_best_render_us(const gchar *text)
+{
+  gint64 best = G_MAXINT64;
+  for (guint i = 0; i < 3; i++)
+  {
+    gint64 t0 = g_get_monotonic_time();
+    g_free(markdown_to_pango(text, NULL));
+    best = MIN(best, g_get_monotonic_time() - t0);
+  }
+  return MAX(best, 1);
+}
+
+static gboolean
+bench_check_scaling(void)
+{
+  gboolean ok = TRUE;
+  printf("\n%-28s %10s %10s %8s\n", "scaling (x8 input)", "small ms", "large ms", "ratio");
+  for (guint i = 0; i < G_N_ELEMENTS(bench_adversarial); i++)
+  {
+    g_autofree gchar *small = bench_repeat(bench_adversarial[i].prefix, bench_adversarial[i].unit, BENCH_SCALING_BYTES);
+    g_autofree gchar *large =
+      bench_repeat(bench_adversarial[i].prefix, bench_adversarial[i].unit, BENCH_SCALING_BYTES * BENCH_SCALING_FACTOR);
+    gint64 t_small = bench_best_render_us(small);
+    gint64 t_large = bench_best_render_us(large);
+    gdouble ratio = (gdouble)t_large / (gdouble)t_small;
+    gboolean pass = ratio <= BENCH_SCALING_MAX_RATIO;
+    ok = ok && pass;
+    printf("%-28s %10.3f %10.3f %8.1f%s\n",
+           bench_adversarial[i].name,
+           t_small / 1000.0,
+           t_large / 1000.0,
+           ratio,
+           pass ? "" : "  FAIL (superlinear)");
+  }
+  return ok;
+}
+
+/* Code blocks are split into MARKDOWN_BLOCK_LINES-line chunks and each is
+ * highlighted when it scrolls into view. A comment opened in one chunk
+ * must still read as a comment in the next, whichever is highlighted
+ * first, and SQL is matched in any case. */
+static gboolean
+bench_check_highlight(void)
+{
+  GString *md = g_string_new("```c\n");
+  for (guint i = 1; i < MARKDOWN_BLOCK_LINES; i++)
+    g_string_append(md, "int x;\n");
+  g_string_append(md, "/* opened in the first chunk\n   still inside\n*/\nint after;\n```\n\n");
+  g_string_append(md, "```sql\nSELECT name FROM users WHERE active = TRUE\n```\n");
+  g_autoptr(GPtrArray) blocks = markdown_to_pango_blocks(md->str, NULL);
+  g_string_free(md, TRUE);
+
+  GString *out = g_string_new(NULL);
+  for (guint i = blocks->len; i > 0; i--)
+    markdown_block_highlight(g_ptr_array_index(blocks, i - 1), SYNTAX_HIGHLIGHT_BUDGET_US);
+  for (guint i = 0; i < blocks->len; i++)
+    g_string_append(out, ((MarkdownBlock *)g_ptr_array_index(blocks, i))->markup);
+  gboolean comment_ok = strstr(out->str, "italic\">   still inside") != NULL;
+  gboolean sql_ok = strstr(out->str, "bold\">SELECT</span>") && strstr(out->str, "\">TRUE</span>");
+  g_string_free(out, TRUE);
+
+  printf("\nhighlight          comment across chunks %s, SQL keywords %s\n",
+         comment_ok ? "ok" : "FAIL",
+         sql_ok ? "ok" : "FAIL");
+  return comment_ok && sql_ok;
+}
+
+static gint
+bench_cmp_path(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+static void
+bench_add_path(GPtrArray *docs, const gchar *path)
+{
+  if (g_file_test(path, G_FILE_TEST_IS_DIR))
+  {
+    g_autoptr(GDir) dir = g_dir_open(path, 0, NULL);
+    if (!dir)
+      return;
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+    const gchar *name = NULL;
+    while ((name = g_dir_read_name(dir)))
+    {
+      if (g_str_has_suffix(name, ".md"))
+        g_ptr_array_add(names, g_build_filename(path, name, NULL));
+    }
+    g_ptr_array_sort(names, bench_cmp_path);
+    for (guint i = 0; i < names->len; i++)
+      bench_add_path(docs, g_ptr_array_index(names, i));
+    return;
+  }
+
+  gchar *text = NULL;
+  g_autoptr(GError) error = NULL;
+  if (!g_file_get_contents(path, &text, NULL, &error))
+  {
+    g_printerr("bench-markdown: %s\n", error->message);
+    return;
+  }
+  g_autofree gchar *base = g_path_get_basename(path);
+  bench_add_doc(docs, base, text);
+}
+
+static void
+bench_run(const BenchDoc *doc, gdouble min_time)
+{
+  gsize bytes = strlen(doc->text);
+
+  /* Warm-up, also keeps first-call costs out of the allocation count. */
+  g_free(markdown_to_pango(doc->text, NULL));
+
+  guint iterations = 0;
+  gint64 worst = 0;
+  gint64 total = 0;
+  guint64 allocs_before = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+  while (iterations < 3 || (total < (gint64)(min_time * G_USEC_PER_SEC) && iterations < 100000))
+  {
+    gint64 t0 = g_get_monotonic_time();
+    gchar *markup = markdown_to_pango(doc->text, NULL);
+    gint64 elapsed = g_get_monotonic_time() - t0;
+    g_free(markup);
+
+    total += elapsed;
+    worst = MAX(worst, elapsed);
+    iterations++;
+  }
+  guint64 allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - allocs_before;
+
+  gdouble mb_per_s = total > 0 ? ((gdouble)bytes * iterations / (1024.0 * 1024.0)) / ((gdouble)total / G_USEC_PER_SEC) : 0.0;
+  gdouble allocs_per_kb = bytes > 0 ? ((gdouble)allocs / iterations) / ((gdouble)bytes / 1024.0) : 0.0;
+  printf("%-28s %9zu %7u %10.2f %10.1f %10.3f %10.3f\n",
+         doc->name,
+         bytes,
+         iterations,
+         mb_per_s,
+         allocs_per_kb,
+         (gdouble)total / iterations / 1000.0,
+         (gdouble)worst / 1000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+  gdouble min_time = 0.5;
+  gchar **paths = NULL;
+  GOptionEntry entries[] = {
+    {"min-time", 't', 0, G_OPTION_ARG_DOUBLE, &min_time, "Minimum time per document in seconds", "SECONDS"},
+    {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths, NULL, "[FILE|DIR]..."},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark markdown_to_pango()");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-markdown: %s\n", error->message);
+    return 2;
+  }
+
+  g_autoptr(GPtrArray) docs = g_ptr_array_new_with_free_func((GDestroyNotify)bench_doc_free);
+  for (guint i = 0; paths && paths[i]; i++)
+    bench_add_path(docs, paths[i]);
+  bench_add_adversarial(docs, BENCH_ADVERSARIAL_BYTES);
+  g_strfreev(paths);
+
+  printf("%-28s %9s %7s %10s %10s %10s %10s\n", "document", "bytes", "iters", "MB/s", "allocs/KB", "avg ms", "worst ms");
+  for (guint i = 0; i < docs->len; i++)
+    bench_run(g_ptr_array_index(docs, i), min_time);
+  gboolean highlight_ok = bench_check_highlight();
+  return bench_check_scaling() && highlight_ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/* Progressive answers: a draft model alongside the strong one.
+ *
+ *   bench-progressive [--questions N] [--draft-ms MS] [--strong-ms MS]
+ *
+ * The mock server answers the "draft" model after --draft-ms and the
+ * "strong" model after --strong-ms. Each question is asked once of the
+ * strong model alone and once of both at the same time, as the panel does
+ * with a draft model set, and the time to a useful answer (the first one
+ * on screen) and to the final answer are reported for both. Exits non-zero
+ * if the draft does not bring the first answer forward or the strong
+ * answer comes later than without it. */
+#include <glib.h>
+#include <stdio.h>
+
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+
+/* The final answer may come this much later with the draft alongside. */
+#define BENCH_FINAL_SLACK 1.1
+
+typedef struct
+{
+  gint64 t0;
+  gint64 done_us; /* 0 until it came */
+  gboolean ok;
+} BenchRequest;
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchRequest *req = user_data;
+  req->ok = result->ok;
+  if (!result->ok)
+    g_printerr("bench-progressive: %s\n", result->error_message ? result->error_message : "request failed");
+  req->done_us = g_get_monotonic_time() - req->t0;
+}
+
+static void
+bench_send(const gchar *endpoint, const gchar *model, const Conversation *conversation, BenchRequest *req)
+{
+  req->t0 = g_get_monotonic_time();
+  req->done_us = 0;
+  openai_client_send_chat_async(endpoint, NULL, model, 0.0, conversation, NULL, NULL, bench_on_result, req);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint questions = 20;
+  gint draft_ms = 150;
+  gint strong_ms = 1200;
+  GOptionEntry entries[] = {
+    {"questions", 'n', 0, G_OPTION_ARG_INT, &questions, "Questions to ask each way", "N"},
+    {"draft-ms", 0, 0, G_OPTION_ARG_INT, &draft_ms, "Time the draft model takes to answer", "MS"},
+    {"strong-ms", 0, 0, G_OPTION_ARG_INT, &strong_ms, "Time the strong model takes to answer", "MS"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- compare draft-then-answer with the single-model path");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-progressive: %s\n", error->message);
+    return 2;
+  }
+  if (questions < 1 || draft_ms < 0 || strong_ms < 0)
+  {
+    g_printerr("bench-progressive: --questions must be positive and the times not negative\n");
+    return 2;
+  }
+
+  MockServer *server = mock_server_new(NULL, &error);
+  if (!server)
+  {
+    g_printerr("bench-progressive: %s\n", error->message);
+    return 2;
+  }
+  mock_server_set_reply(server, "SIGPIPE is sent to a process that writes to a pipe with no reader.");
+  mock_server_set_model_delay(server, "draft", (guint)draft_ms);
+  mock_server_set_model_delay(server, "strong", (guint)strong_ms);
+  g_autofree gchar *endpoint = mock_server_get_tcp_endpoint(server);
+
+  gint64 single_us = 0;
+  gint64 useful_us = 0;
+  gint64 final_us = 0;
+  guint failures = 0;
+  for (gint q = 0; q < questions; q++)
+  {
+    Conversation *conversation = conversation_new(2);
+    g_autofree gchar *question = g_strdup_printf("Question %d: what does SIGPIPE mean?", q);
+    conversation_append(conversation, CONVERSATION_ROLE_USER, question);
+
+    BenchRequest single;
+    bench_send(endpoint, "strong", conversation, &single);
+    while (!single.done_us)
+      g_main_context_iteration(NULL, TRUE);
+
+    BenchRequest draft;
+    BenchRequest strong;
+    bench_send(endpoint, "draft", conversation, &draft);
+    bench_send(endpoint, "strong", conversation, &strong);
+    while (!draft.done_us || !strong.done_us)
+      g_main_context_iteration(NULL, TRUE);
+    conversation_free(conversation);
+
+    if (!single.ok || !draft.ok || !strong.ok)
+    {
+      failures++;
+      continue;
+    }
+    single_us += single.done_us;
+    /* The draft is only shown if it beats the answer. */
+    useful_us += MIN(draft.done_us, strong.done_us);
+    final_us += strong.done_us;
+  }
+  guint requests = mock_server_get_request_count(server);
+  mock_server_free(server);
+
+  if (failures > 0)
+  {
+    printf("FAIL: %u questions failed\n", failures);
+    return 1;
+  }
+  printf("single model       useful %7.1f ms  final %7.1f ms\n",
+         single_us / 1000.0 / questions,
+         single_us / 1000.0 / questions);
+  printf("draft alongside    useful %7.1f ms  final %7.1f ms  (%.1fx sooner)\n",
+         useful_us / 1000.0 / questions,
+         final_us / 1000.0 / questions,
+         useful_us > 0 ? (gdouble)single_us / useful_us : 0.0);
+  printf("requests           %u (the draft costs one more per question)\n", requests);
+
+  if (useful_us >= single_us)
+  {
+    printf("FAIL: the draft did not bring the first answer forward\n");
+    return 1;
+  }
+  if (final_us > single_us * BENCH_FINAL_SLACK)
+  {
+    printf("FAIL: the final answer came more than %.0f%% later with the draft alongside\n",
+           (BENCH_FINAL_SLACK - 1.0) * 100.0);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/* Client-side rate limiter benchmark.
+ *
+ *   bench-ratelimit [--quota N] [--window-ms MS]
+ *
+ * The mock server allows N requests per window, refilled continuously, and
+ * answers 429 beyond that. Sends 3N requests at once through openai-client
+ * twice:
+ *  - cold: to an endpoint the limiter has never heard from, so nothing is
+ *    held back, which is how every burst went before the limiter;
+ *  - warm: after one request has brought back the quota headers, so the
+ *    limiter holds what would not fit.
+ * Reports the 429s and the time to get every answer for both. Exits
+ * non-zero if the warm burst got any 429 or lost a request. */
+#include <glib.h>
+#include <stdio.h>
+
+#include "conversation.h"
+#include "mock-server.h"
+#include "openai-client.h"
+
+typedef struct
+{
+  guint pending;
+  guint ok;
+  guint limited;
+  guint failed;
+} BenchBurst;
+
+static void
+bench_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BenchBurst *burst = user_data;
+  if (result->ok)
+    burst->ok++;
+  else if (result->http_status == 429)
+    burst->limited++;
+  else
+  {
+    g_printerr("bench-ratelimit: %s\n", result->error_message ? result->error_message : "request failed");
+    burst->failed++;
+  }
+  burst->pending--;
+}
+
+/* Sends @count requests at once and waits for every answer; returns the
+ * elapsed time in microseconds. */
+static gint64
+bench_burst(const gchar *endpoint, guint count, BenchBurst *burst)
+{
+  Conversation *conversation = conversation_new(2);
+  conversation_append(conversation, CONVERSATION_ROLE_USER, "ping");
+  *burst = (BenchBurst){count, 0, 0, 0};
+  gint64 t0 = g_get_monotonic_time();
+  for (guint i = 0; i < count; i++)
+    openai_client_send_chat_async(endpoint, "sk-bench", "mock", 0.0, conversation, NULL, NULL, bench_on_result, burst);
+  conversation_free(conversation);
+  while (burst->pending > 0)
+    g_main_context_iteration(NULL, TRUE);
+  return g_get_monotonic_time() - t0;
+}
+
+static void
+bench_report(const gchar *name, const BenchBurst *burst, gint64 elapsed_us, guint rejected)
+{
+  printf("%-5s  ok %3u  429 %3u  failed %u  server rejected %3u  %.2f s\n",
+         name,
+         burst->ok,
+         burst->limited,
+         burst->failed,
+         rejected,
+         elapsed_us / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint quota = 10;
+  gint window_ms = 2000;
+  GOptionEntry entries[] = {
+    {"quota", 'q', 0, G_OPTION_ARG_INT, &quota, "Requests the server allows per window", "N"},
+    {"window-ms", 'w', 0, G_OPTION_ARG_INT, &window_ms, "Window in milliseconds", "MS"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark the client-side rate limiter");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-ratelimit: %s\n", error->message);
+    return 2;
+  }
+  if (quota < 1 || window_ms < 1)
+  {
+    g_printerr("bench-ratelimit: --quota and --window-ms must be positive\n");
+    return 2;
+  }
+  guint count = 3 * (guint)quota;
+
+  /* A server per pass: a new port is a new endpoint to the limiter. */
+  MockServer *cold_server = mock_server_new(NULL, &error);
+  MockServer *warm_server = cold_server ? mock_server_new(NULL, &error) : NULL;
+  if (!warm_server)
+  {
+    g_printerr("bench-ratelimit: %s\n", error->message);
+    return 2;
+  }
+
+  BenchBurst burst;
+  mock_server_set_rate_limit(cold_server, (guint)quota, (guint)window_ms);
+  g_autofree gchar *cold_endpoint = mock_server_get_tcp_endpoint(cold_server);
+  gint64 elapsed_us = bench_burst(cold_endpoint, count, &burst);
+  bench_report("cold", &burst, elapsed_us, mock_server_get_rejected_count(cold_server));
+
+  mock_server_set_rate_limit(warm_server, (guint)quota, (guint)window_ms);
+  g_autofree gchar *warm_endpoint = mock_server_get_tcp_endpoint(warm_server);
+  bench_burst(warm_endpoint, 1, &burst);
+  elapsed_us = bench_burst(warm_endpoint, count - 1, &burst);
+  guint rejected = mock_server_get_rejected_count(warm_server);
+  bench_report("warm", &burst, elapsed_us, rejected);
+  printf("ideal  %.2f s to refill %u requests\n", (count - (guint)quota) * (window_ms / 1000.0) / quota, count - quota);
+
+  mock_server_free(cold_server);
+  mock_server_free(warm_server);
+  if (rejected > 0 || burst.ok != count - 1)
+  {
+    printf("FAIL: the limiter let requests through into a 429\n");
+    return 1;
+  }
+  return 0;
+}
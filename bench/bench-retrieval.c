@@ -0,0 +1,174 @@
+/* Vector index benchmark.
+ *
+ *   bench-retrieval [--chunks N] [--dim N] [--queries N]
+ *
+ * Writes N random unit vectors to a temporary index, reopens it and
+ * reports the time to save and map it, resident memory, and latency
+ * percentiles of a top-4 search over every vector. Exits non-zero if the
+ * 99th percentile search takes longer than 50 ms or a stored vector does
+ * not find itself first. */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vector-index.h"
+
+#define BENCH_CHUNKS_PER_FILE 8
+#define BENCH_SEARCH_BUDGET_US 50000
+
+static void
+bench_random_vector(GRand *rand, gfloat *vector, guint dim)
+{
+  for (guint i = 0; i < dim; i++)
+    vector[i] = (gfloat)g_rand_double_range(rand, -1.0, 1.0);
+  vector_index_normalize(vector, dim);
+}
+
+static glong
+bench_rss_kb(void)
+{
+  g_autofree gchar *status = NULL;
+  if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+    return -1;
+  const gchar *line = strstr(status, "VmRSS:");
+  return line ? strtol(line + 6, NULL, 10) : -1;
+}
+
+static gint
+bench_cmp_i64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+int
+main(int argc, char **argv)
+{
+  gint chunks = 50000;
+  gint dim = 768;
+  gint queries = 200;
+  GOptionEntry entries[] = {
+    {"chunks", 'n', 0, G_OPTION_ARG_INT, &chunks, "Number of chunks to index", "N"},
+    {"dim", 'd', 0, G_OPTION_ARG_INT, &dim, "Embedding dimensions", "N"},
+    {"queries", 'q', 0, G_OPTION_ARG_INT, &queries, "Number of searches to time", "N"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark the retrieval vector index");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-retrieval: %s\n", error->message);
+    return 2;
+  }
+  if (chunks < 1 || dim < 1 || queries < 1)
+  {
+    g_printerr("bench-retrieval: --chunks, --dim and --queries must be positive\n");
+    return 2;
+  }
+
+  g_autofree gchar *dir = g_dir_make_tmp("bench-retrieval-XXXXXX", &error);
+  if (!dir)
+  {
+    g_printerr("bench-retrieval: %s\n", error->message);
+    return 2;
+  }
+  g_autofree gchar *path = g_build_filename(dir, "retrieval.idx", NULL);
+
+  GRand *rand = g_rand_new_with_seed(42);
+  g_autofree gfloat *vector = g_new(gfloat, dim);
+  VectorIndexWriter *writer = vector_index_writer_new((guint)dim, "bench-model");
+  for (gint i = 0; i < chunks; i++)
+  {
+    if (i % BENCH_CHUNKS_PER_FILE == 0)
+    {
+      g_autofree gchar *file = g_strdup_printf("/notes/%06d.md", i / BENCH_CHUNKS_PER_FILE);
+      vector_index_writer_add_file(writer, file, 1700000000, 4096);
+    }
+    g_autofree gchar *text = g_strdup_printf("chunk %d", i);
+    bench_random_vector(rand, vector, (guint)dim);
+    vector_index_writer_add_chunk(writer, text, vector);
+  }
+  gint64 t0 = g_get_monotonic_time();
+  gboolean saved = vector_index_writer_save(writer, path, &error);
+  gint64 save_us = g_get_monotonic_time() - t0;
+  vector_index_writer_free(writer);
+  if (!saved)
+  {
+    g_printerr("bench-retrieval: %s\n", error->message);
+    return 2;
+  }
+
+  GStatBuf st;
+  g_stat(path, &st);
+  glong rss_before = bench_rss_kb();
+  t0 = g_get_monotonic_time();
+  VectorIndex *index = vector_index_open(path, &error);
+  gint64 open_us = g_get_monotonic_time() - t0;
+  if (!index)
+  {
+    g_printerr("bench-retrieval: %s\n", error->message);
+    return 2;
+  }
+
+  printf("chunks             %u in %u files, %u dimensions\n",
+         vector_index_get_count(index),
+         vector_index_get_file_count(index),
+         vector_index_get_dim(index));
+  printf("file size          %.1f MB\n", st.st_size / (1024.0 * 1024.0));
+  printf("save               %.1f ms\n", save_us / 1000.0);
+  printf("open               %.3f ms\n", open_us / 1000.0);
+
+  /* Queries alternate between random vectors and stored ones, which must
+   * come back as their own best hit. */
+  g_autoptr(GArray) times = g_array_new(FALSE, FALSE, sizeof(gint64));
+  guint misses = 0;
+  for (gint i = 0; i < queries; i++)
+  {
+    guint self = (guint)g_rand_int_range(rand, 0, chunks);
+    if (i % 2 == 0)
+      memcpy(vector, vector_index_get_vector(index, self), (gsize)dim * sizeof(gfloat));
+    else
+      bench_random_vector(rand, vector, (guint)dim);
+
+    VectorIndexHit hits[4];
+    gint64 s0 = g_get_monotonic_time();
+    guint n = vector_index_search(index, vector, hits, G_N_ELEMENTS(hits));
+    gint64 elapsed = g_get_monotonic_time() - s0;
+    g_array_append_val(times, elapsed);
+    if (i % 2 == 0 && (n == 0 || hits[0].chunk != self))
+      misses++;
+  }
+  glong rss_after = bench_rss_kb();
+
+  g_array_sort(times, bench_cmp_i64);
+  gint64 p50 = g_array_index(times, gint64, times->len / 2);
+  gint64 p99 = g_array_index(times, gint64, (times->len * 99) / 100);
+  gint64 worst = g_array_index(times, gint64, times->len - 1);
+  printf("search             p50 %.3f ms  p99 %.3f ms  max %.3f ms  (%.2f GB/s)\n",
+         p50 / 1000.0,
+         p99 / 1000.0,
+         worst / 1000.0,
+         p50 > 0 ? (gdouble)chunks * dim * sizeof(gfloat) / p50 / 1000.0 : 0.0);
+  printf("mapped RSS         %ld KB\n", rss_after - rss_before);
+
+  vector_index_unref(index);
+  g_unlink(path);
+  g_rmdir(dir);
+  g_rand_free(rand);
+
+  if (misses > 0)
+  {
+    printf("FAIL: %u stored vectors did not find themselves first\n", misses);
+    return 1;
+  }
+  if (p99 > BENCH_SEARCH_BUDGET_US)
+  {
+    printf("FAIL: p99 search above %d ms\n", BENCH_SEARCH_BUDGET_US / 1000);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,197 @@
+/* Model routing benchmark.
+ *
+ *   bench-routing [--rounds N]
+ *
+ * Classifies a labelled set of prompts and reports how often the class
+ * matches the label and how long classifying takes. Then routes the set N
+ * times over three simulated models (small, medium and large, with the
+ * latencies below and some jitter) and reports the mean latency against
+ * always asking the large model; halfway through, the small model starts
+ * failing, and the router must move its prompts up. Last, the set is
+ * routed as follow-ups in a conversation the medium model answered.
+ * Exits non-zero if fewer than 80% of the prompts are classified as
+ * labelled, if routing is not faster than the large model alone, if the
+ * failing model keeps getting prompts, or if a follow-up goes to the small
+ * model. */
+#include <glib.h>
+#include <stdio.h>
+
+#include "model-router.h"
+
+#define BENCH_MIN_AGREEMENT 0.8
+
+typedef struct
+{
+  ModelRouterClass klass;
+  const gchar *prompt;
+} BenchPrompt;
+
+static const BenchPrompt bench_prompts[] = {
+  {MODEL_ROUTER_CLASS_SIMPLE, "What is the capital of Australia?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "convert 72 fahrenheit to celsius"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "Who wrote The Mythical Man-Month?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "define idempotent"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "When was Linux first released?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "synonym for fast"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "what's the default port of postgres"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "How many bytes in a kibibyte?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "where is /etc/fstab documented"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "spell necessary"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "unix timestamp 1700000000 in UTC"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "tar flag for gzip"},
+  /* Keywords inside other words: "plan", "how", "list", "design". */
+  {MODEL_ROUTER_CLASS_SIMPLE, "Which planet has the most moons?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "The docs say 443, however, which port does smtps use?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "Which port does sshd listen on?"},
+  {MODEL_ROUTER_CLASS_SIMPLE, "Which IP range is designated for documentation?"},
+  {MODEL_ROUTER_CLASS_MODERATE, "How do I list open files of a process?"},
+  {MODEL_ROUTER_CLASS_MODERATE, "Summarize the difference in a sentence: TCP keepalive"},
+  {MODEL_ROUTER_CLASS_MODERATE, "translate 'the build is broken again' to German"},
+  {MODEL_ROUTER_CLASS_MODERATE, "Write a polite reply declining the meeting on Friday."},
+  {MODEL_ROUTER_CLASS_MODERATE, "give me an example of a systemd timer unit"},
+  {MODEL_ROUTER_CLASS_MODERATE, "suggest names for a backup tool"},
+  {MODEL_ROUTER_CLASS_MODERATE, "rewrite this more formally: we ship it when it's done"},
+  {MODEL_ROUTER_CLASS_MODERATE, "list the signals that cannot be caught"},
+  {MODEL_ROUTER_CLASS_HARD, "Explain why my epoll loop spins at 100% CPU after the peer closes the socket."},
+  {MODEL_ROUTER_CLASS_HARD, "Design a schema for storing chat history with full-text search and retention limits."},
+  {MODEL_ROUTER_CLASS_HARD, "Refactor this:\n```c\nfor (i = 0; i < n; i++) { if (a[i]) { b[j++] = a[i]; } }\n```"},
+  {MODEL_ROUTER_CLASS_HARD, "Compare io_uring and epoll for a proxy, step by step, with the trade-offs."},
+  {MODEL_ROUTER_CLASS_HARD, "why does this deadlock?\nmutex_lock(&a);\nmutex_lock(&b);\nmutex_unlock(&b);"},
+  {MODEL_ROUTER_CLASS_HARD, "Prove that the greedy algorithm is optimal for interval scheduling."},
+  {MODEL_ROUTER_CLASS_HARD, "debug: the service starts fine by hand but exits with status 203 under systemd"},
+  {MODEL_ROUTER_CLASS_HARD, "Review this plan for migrating the build to meson and point out the risks."},
+  {MODEL_ROUTER_CLASS_HARD, "implement an LRU cache in C with O(1) lookup and eviction"},
+  {MODEL_ROUTER_CLASS_HARD, "def merge(a, b):\n    return sorted(a + b)\nhow would you make this linear?"},
+  /* "who" inside "whole" must not make it look simpler. */
+  {MODEL_ROUTER_CLASS_HARD, "Explain the whole boot sequence of a Linux machine."},
+};
+
+static const gchar *const bench_models[] = {"small", "medium", "large", NULL};
+static const gint64 bench_latency_us[] = {300000, 900000, 2500000};
+
+static guint
+bench_model_index(const gchar *model)
+{
+  for (guint i = 0; bench_models[i]; i++)
+    if (g_strcmp0(bench_models[i], model) == 0)
+      return i;
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  gint rounds = 20;
+  GOptionEntry entries[] = {
+    {"rounds", 'n', 0, G_OPTION_ARG_INT, &rounds, "Times the prompt set is routed", "N"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- benchmark prompt classification and model routing");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("bench-routing: %s\n", error->message);
+    return 2;
+  }
+  if (rounds < 2)
+  {
+    g_printerr("bench-routing: --rounds must be at least 2\n");
+    return 2;
+  }
+
+  guint n = G_N_ELEMENTS(bench_prompts);
+  guint agree = 0;
+  guint confusion[MODEL_ROUTER_CLASS_COUNT][MODEL_ROUTER_CLASS_COUNT] = {{0}};
+  const guint repeats = 1000;
+  gint64 t0 = g_get_monotonic_time();
+  for (guint r = 0; r < repeats; r++)
+  {
+    for (guint i = 0; i < n; i++)
+    {
+      ModelRouterClass klass = model_router_classify(bench_prompts[i].prompt);
+      if (r == 0)
+      {
+        confusion[bench_prompts[i].klass][klass]++;
+        agree += klass == bench_prompts[i].klass;
+      }
+    }
+  }
+  gdouble classify_us = (gdouble)(g_get_monotonic_time() - t0) / (repeats * n);
+  gdouble agreement = (gdouble)agree / n;
+  printf("classify           %.2f us per prompt, %u of %u as labelled (%.0f%%)\n",
+         classify_us,
+         agree,
+         n,
+         agreement * 100.0);
+  for (guint c = 0; c < MODEL_ROUTER_CLASS_COUNT; c++)
+    printf("  %-9s -> simple %2u  moderate %2u  hard %2u\n",
+           model_router_class_get_name(c),
+           confusion[c][MODEL_ROUTER_CLASS_SIMPLE],
+           confusion[c][MODEL_ROUTER_CLASS_MODERATE],
+           confusion[c][MODEL_ROUTER_CLASS_HARD]);
+
+  ModelRouter *router = model_router_new();
+  model_router_configure(router, "bench", bench_models);
+  GRand *rand = g_rand_new_with_seed(7);
+  gint64 routed_us = 0;
+  gint64 large_us = 0;
+  guint picks[G_N_ELEMENTS(bench_latency_us)] = {0};
+  guint failing_picks = 0;
+  guint requests = 0;
+  for (gint round = 0; round < rounds; round++)
+  {
+    gboolean small_failing = round >= rounds / 2;
+    for (guint i = 0; i < n; i++)
+    {
+      guint m = bench_model_index(model_router_pick(router, bench_prompts[i].prompt));
+      gdouble jitter = g_rand_double_range(rand, 0.8, 1.2);
+      gint64 latency = (gint64)(bench_latency_us[m] * jitter);
+      gboolean ok = !(m == 0 && small_failing);
+      model_router_record(router, bench_models[m], ok, latency);
+      routed_us += latency;
+      large_us += (gint64)(bench_latency_us[2] * jitter);
+      picks[m]++;
+      /* The first few failures are how the router finds out. */
+      if (!ok && round > rounds / 2)
+        failing_picks++;
+      requests++;
+    }
+  }
+  /* Follow-ups in a conversation the medium model answered. */
+  guint downgrades = 0;
+  for (guint i = 0; i < n; i++)
+    downgrades += bench_model_index(model_router_pick_at_least(router, bench_prompts[i].prompt, "medium")) < 1;
+  model_router_free(router);
+  g_rand_free(rand);
+
+  printf("routed             mean %.0f ms, large only %.0f ms (%.1fx faster)\n",
+         routed_us / 1000.0 / requests,
+         large_us / 1000.0 / requests,
+         routed_us > 0 ? (gdouble)large_us / routed_us : 0.0);
+  printf("picks              small %u  medium %u  large %u\n", picks[0], picks[1], picks[2]);
+  printf("failing model      %u prompts after the round it started failing\n", failing_picks);
+  printf("follow-ups         %u of %u went to a smaller model than the conversation's\n", downgrades, n);
+
+  if (agreement < BENCH_MIN_AGREEMENT)
+  {
+    printf("FAIL: fewer than %.0f%% of the prompts classified as labelled\n", BENCH_MIN_AGREEMENT * 100.0);
+    return 1;
+  }
+  if (routed_us >= large_us)
+  {
+    printf("FAIL: routing is not faster than the large model alone\n");
+    return 1;
+  }
+  if (failing_picks > 0)
+  {
+    printf("FAIL: the failing model kept getting prompts\n");
+    return 1;
+  }
+  if (downgrades > 0)
+  {
+    printf("FAIL: a follow-up was routed to a smaller model than its conversation's\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,600 @@
+#include "mock-server.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#define MOCK_SERVER_PATH "/v1/chat/completions"
+#define MOCK_SERVER_OLLAMA_PATH "/api/chat"
+#define MOCK_SERVER_PROPS_PATH "/props"
+
+struct _MockServer
+{
+  SoupServer *soup;
+  gchar *socket_path;
+  guint port;
+  gchar *content;
+  gchar *response;
+  gboolean close_connections;
+  guint requests;
+  gboolean discard_body;
+  gsize body_size;
+  GBytes *last_body;
+  /* Request quota, refilled continuously like the providers' buckets. */
+  guint quota;
+  gint64 quota_window_us;
+  gdouble quota_level;
+  gint64 quota_stamp;
+  guint rejected;
+  /* Local model emulation; off while n_slots is 0. */
+  guint load_ms;
+  guint idle_ms;
+  guint prompt_us_per_byte;
+  guint n_slots;
+  gchar **slot_cache; /* the prompt each slot has cached, or NULL */
+  guint next_slot;
+  gint64 ready_at; /* when the model is (or was) loaded */
+  gint64 loaded_until;
+  guint loads;
+  guint64 cached_bytes;
+  GHashTable *model_delays; /* model -> answer delay in ms, or NULL */
+  guint token_us; /* generation emulation; off while 0 */
+  guint64 completion_tokens;
+};
+
+/* @finish_reason and "usage" are left out if NULL and 0. */
+static gchar *
+mock_server_build_response(const gchar *content, const gchar *finish_reason, gint64 completion_tokens)
+{
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "object");
+  json_builder_add_string_value(b, "chat.completion");
+  json_builder_set_member_name(b, "choices");
+  json_builder_begin_array(b);
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "index");
+  json_builder_add_int_value(b, 0);
+  json_builder_set_member_name(b, "message");
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "role");
+  json_builder_add_string_value(b, "assistant");
+  json_builder_set_member_name(b, "content");
+  json_builder_add_string_value(b, content);
+  json_builder_end_object(b);
+  if (finish_reason)
+  {
+    json_builder_set_member_name(b, "finish_reason");
+    json_builder_add_string_value(b, finish_reason);
+  }
+  json_builder_end_object(b);
+  json_builder_end_array(b);
+  if (completion_tokens > 0)
+  {
+    json_builder_set_member_name(b, "usage");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "completion_tokens");
+    json_builder_add_int_value(b, completion_tokens);
+    json_builder_end_object(b);
+  }
+  json_builder_end_object(b);
+
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  return json_generator_to_data(gen, NULL);
+}
+
+/* Takes one request from the quota and adds the x-ratelimit-*-requests
+ * headers, or answers 429 with Retry-After. FALSE if rejected. */
+static gboolean
+mock_server_take_quota(MockServer *server, SoupServerMessage *msg)
+{
+  SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+  gint64 now = g_get_monotonic_time();
+  gdouble rate = (gdouble)server->quota / (gdouble)server->quota_window_us;
+  server->quota_level = MIN((gdouble)server->quota, server->quota_level + rate * (gdouble)(now - server->quota_stamp));
+  server->quota_stamp = now;
+
+  gboolean ok = server->quota_level >= 1.0;
+  if (ok)
+    server->quota_level -= 1.0;
+  g_autofree gchar *limit = g_strdup_printf("%u", server->quota);
+  g_autofree gchar *remaining = g_strdup_printf("%u", (guint)server->quota_level);
+  g_autofree gchar *reset = g_strdup_printf("%ums", (guint)(((gdouble)server->quota - server->quota_level) / rate / 1000.0) + 1);
+  soup_message_headers_append(hdrs, "x-ratelimit-limit-requests", limit);
+  soup_message_headers_append(hdrs, "x-ratelimit-remaining-requests", remaining);
+  soup_message_headers_append(hdrs, "x-ratelimit-reset-requests", reset);
+  if (ok)
+    return TRUE;
+
+  server->rejected++;
+  g_autofree gchar *retry_after = g_strdup_printf("%u", (guint)((1.0 - server->quota_level) / rate / G_USEC_PER_SEC) + 1);
+  soup_message_headers_append(hdrs, "Retry-After", retry_after);
+  static const gchar body[] = "{\"error\":{\"message\":\"Rate limit reached for requests.\",\"type\":\"requests\"}}";
+  soup_server_message_set_status(msg, 429, NULL);
+  soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_STATIC, body, strlen(body));
+  return FALSE;
+}
+
+static void
+mock_server_on_got_chunk(SoupServerMessage *msg, GBytes *chunk, gpointer user_data)
+{
+  (void)msg;
+  MockServer *server = user_data;
+  server->body_size += g_bytes_get_size(chunk);
+}
+
+static void
+mock_server_on_early(SoupServer *soup, SoupServerMessage *msg, const char *path, GHashTable *query, gpointer user_data)
+{
+  (void)soup;
+  (void)path;
+  (void)query;
+  MockServer *server = user_data;
+  server->body_size = 0;
+  g_clear_pointer(&server->last_body, g_bytes_unref);
+  soup_message_body_set_accumulate(soup_server_message_get_request_body(msg), !server->discard_body);
+  g_signal_connect(msg, "got-chunk", G_CALLBACK(mock_server_on_got_chunk), server);
+}
+
+/* Ollama's /api/chat answer; an empty chat only loads the model. @cut
+ * answers stopped at num_predict. */
+static gchar *
+mock_server_build_ollama_response(const gchar *content,
+                                  gboolean load_only,
+                                  gboolean cut,
+                                  gint64 eval_count,
+                                  gint64 load_ns)
+{
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "model");
+  json_builder_add_string_value(b, "mock");
+  if (!load_only)
+  {
+    json_builder_set_member_name(b, "message");
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "role");
+    json_builder_add_string_value(b, "assistant");
+    json_builder_set_member_name(b, "content");
+    json_builder_add_string_value(b, content);
+    json_builder_end_object(b);
+  }
+  json_builder_set_member_name(b, "done");
+  json_builder_add_boolean_value(b, TRUE);
+  json_builder_set_member_name(b, "done_reason");
+  json_builder_add_string_value(b, load_only ? "load" : cut ? "length" : "stop");
+  json_builder_set_member_name(b, "load_duration");
+  json_builder_add_int_value(b, load_ns);
+  if (eval_count > 0)
+  {
+    json_builder_set_member_name(b, "eval_count");
+    json_builder_add_int_value(b, eval_count);
+  }
+  json_builder_end_object(b);
+
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  return json_generator_to_data(gen, NULL);
+}
+
+/* "30m", "10s", "1h" or plain seconds, as Ollama takes keep_alive. */
+static gint64
+mock_server_parse_keep_alive(JsonNode *node, gint64 fallback_us)
+{
+  if (!node || !JSON_NODE_HOLDS_VALUE(node))
+    return fallback_us;
+  if (json_node_get_value_type(node) != G_TYPE_STRING)
+    return (gint64)(json_node_get_double(node) * G_USEC_PER_SEC);
+  const gchar *value = json_node_get_string(node);
+  gchar *end = NULL;
+  gdouble n = g_ascii_strtod(value, &end);
+  if (end == value)
+    return fallback_us;
+  gdouble unit = *end == 'h' ? 3600.0 : *end == 'm' ? 60.0 : 1.0;
+  return (gint64)(n * unit * G_USEC_PER_SEC);
+}
+
+static gboolean
+mock_server_on_delay_done(gpointer user_data)
+{
+  soup_server_message_unpause(user_data);
+  g_object_unref(user_data);
+  return G_SOURCE_REMOVE;
+}
+
+/* How long a local server would take before answering @body, updating the
+ * model and slot state as it would. @load_only is set for an empty chat. */
+static gint64
+mock_server_local_delay(MockServer *server, GBytes *body, gboolean *load_only)
+{
+  *load_only = FALSE;
+  g_autoptr(JsonParser) parser = json_parser_new();
+  gsize size = 0;
+  const gchar *data = body ? g_bytes_get_data(body, &size) : NULL;
+  if (!data || !json_parser_load_from_data(parser, data, (gssize)size, NULL))
+    return 0;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return 0;
+  JsonObject *obj = json_node_get_object(root);
+
+  /* A request that arrives while the model is still loading waits for the
+   * rest of the load. */
+  gint64 now = g_get_monotonic_time();
+  if (now >= server->loaded_until)
+  {
+    server->ready_at = now + (gint64)server->load_ms * 1000;
+    server->loads++;
+  }
+  gint64 delay_us = MAX(0, server->ready_at - now);
+  gint64 keep_us = mock_server_parse_keep_alive(json_object_get_member(obj, "keep_alive"), (gint64)server->idle_ms * 1000);
+
+  GString *prompt = g_string_new(NULL);
+  JsonNode *messages = json_object_get_member(obj, "messages");
+  JsonArray *array = messages && JSON_NODE_HOLDS_ARRAY(messages) ? json_node_get_array(messages) : NULL;
+  for (guint i = 0; array && i < json_array_get_length(array); i++)
+  {
+    JsonObject *message = json_array_get_object_element(array, i);
+    if (!message)
+      continue;
+    g_string_append_printf(prompt,
+                           "<%s>%s",
+                           json_object_get_string_member_with_default(message, "role", ""),
+                           json_object_get_string_member_with_default(message, "content", ""));
+  }
+  *load_only = prompt->len == 0;
+
+  if (!*load_only)
+  {
+    gint64 id_slot = json_object_get_int_member_with_default(obj, "id_slot", -1);
+    guint slot = id_slot >= 0 && id_slot < server->n_slots ? (guint)id_slot : server->next_slot++ % server->n_slots;
+    const gchar *cached = server->slot_cache[slot];
+    gsize common = 0;
+    while (cached && cached[common] && common < prompt->len && cached[common] == prompt->str[common])
+      common++;
+    server->cached_bytes += common;
+    delay_us += (gint64)(prompt->len - common) * server->prompt_us_per_byte;
+
+    g_free(server->slot_cache[slot]);
+    gboolean cache_prompt = json_object_get_boolean_member_with_default(obj, "cache_prompt", FALSE);
+    server->slot_cache[slot] = cache_prompt ? g_strdup(prompt->str) : NULL;
+  }
+  g_string_free(prompt, TRUE);
+  server->loaded_until = now + delay_us + keep_us;
+  return delay_us;
+}
+
+/* The delay set for the request's "model", 0 if none. */
+static gint64
+mock_server_model_delay(MockServer *server, GBytes *body)
+{
+  g_autoptr(JsonParser) parser = json_parser_new();
+  gsize size = 0;
+  const gchar *data = body ? g_bytes_get_data(body, &size) : NULL;
+  if (!data || !json_parser_load_from_data(parser, data, (gssize)size, NULL))
+    return 0;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return 0;
+  const gchar *model = json_object_get_string_member_with_default(json_node_get_object(root), "model", "");
+  return (gint64)GPOINTER_TO_UINT(g_hash_table_lookup(server->model_delays, model)) * 1000;
+}
+
+/* The part of the reply a request gets with generation emulation on: from
+ * where the conversation's assistant turns left it (they are earlier parts
+ * of the same reply when the model was asked to continue) up to the
+ * request's max_tokens, or Ollama's options.num_predict. */
+static gchar *
+mock_server_generate(MockServer *server, GBytes *body, gint64 *tokens, gboolean *cut)
+{
+  gsize len = strlen(server->content);
+  gsize from = 0;
+  gint64 max_tokens = 0;
+  g_autoptr(JsonParser) parser = json_parser_new();
+  gsize size = 0;
+  const gchar *data = body ? g_bytes_get_data(body, &size) : NULL;
+  if (data && json_parser_load_from_data(parser, data, (gssize)size, NULL) &&
+      JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+  {
+    JsonObject *obj = json_node_get_object(json_parser_get_root(parser));
+    max_tokens = json_object_get_int_member_with_default(obj, "max_tokens", 0);
+    JsonNode *options = json_object_get_member(obj, "options");
+    if (options && JSON_NODE_HOLDS_OBJECT(options))
+      max_tokens = json_object_get_int_member_with_default(json_node_get_object(options), "num_predict", max_tokens);
+
+    JsonNode *messages = json_object_get_member(obj, "messages");
+    JsonArray *array = messages && JSON_NODE_HOLDS_ARRAY(messages) ? json_node_get_array(messages) : NULL;
+    for (guint i = 0; array && i < json_array_get_length(array); i++)
+    {
+      JsonObject *message = json_array_get_object_element(array, i);
+      if (!message || g_strcmp0(json_object_get_string_member_with_default(message, "role", ""), "assistant") != 0)
+        continue;
+      const gchar *part = json_object_get_string_member_with_default(message, "content", "");
+      gsize part_len = strlen(part);
+      from = part_len > 0 && part_len <= len - from && strncmp(server->content + from, part, part_len) == 0
+               ? from + part_len
+               : 0;
+    }
+  }
+
+  gsize to = len;
+  if (max_tokens > 0 && (gsize)max_tokens * 4 < len - from)
+  {
+    to = from + (gsize)max_tokens * 4;
+    while (to > from && (server->content[to] & 0xc0) == 0x80)
+      to--;
+  }
+  *cut = to < len;
+  *tokens = (gint64)(to - from + 3) / 4;
+  server->completion_tokens += (guint64)*tokens;
+  return g_strndup(server->content + from, to - from);
+}
+
+static void
+mock_server_on_chat(SoupServer *soup,
+                    SoupServerMessage *msg,
+                    const char *path,
+                    GHashTable *query,
+                    gpointer user_data)
+{
+  (void)soup;
+  (void)query;
+  MockServer *server = user_data;
+
+  if (g_strcmp0(soup_server_message_get_method(msg), "POST") != 0)
+  {
+    soup_server_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+    return;
+  }
+
+  server->requests++;
+  if (!server->discard_body)
+    server->last_body = soup_message_body_flatten(soup_server_message_get_request_body(msg));
+  if (server->close_connections)
+    soup_message_headers_append(soup_server_message_get_response_headers(msg), "Connection", "close");
+  if (server->quota && !mock_server_take_quota(server, msg))
+    return;
+
+  gint64 delay_us = 0;
+  gboolean load_only = FALSE;
+  if (server->n_slots)
+    delay_us = mock_server_local_delay(server, server->last_body, &load_only);
+  if (server->model_delays)
+    delay_us += mock_server_model_delay(server, server->last_body);
+  g_autofree gchar *generated = NULL;
+  gint64 tokens = 0;
+  gboolean cut = FALSE;
+  if (server->token_us && !load_only)
+  {
+    generated = mock_server_generate(server, server->last_body, &tokens, &cut);
+    delay_us += tokens * server->token_us;
+  }
+  soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+  if (g_strcmp0(path, MOCK_SERVER_OLLAMA_PATH) == 0)
+  {
+    gchar *response = mock_server_build_ollama_response(generated ? generated : server->content,
+                                                        load_only,
+                                                        cut,
+                                                        tokens,
+                                                        delay_us * 1000);
+    soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_TAKE, response, strlen(response));
+  }
+  else if (generated)
+  {
+    gchar *response = mock_server_build_response(generated, cut ? "length" : "stop", tokens);
+    soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_TAKE, response, strlen(response));
+  }
+  else
+    soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_COPY, server->response, strlen(server->response));
+  if (delay_us > 0)
+  {
+    soup_server_message_pause(msg);
+    g_timeout_add((guint)((delay_us + 999) / 1000), mock_server_on_delay_done, g_object_ref(msg));
+  }
+}
+
+static void
+mock_server_on_props(SoupServer *soup,
+                     SoupServerMessage *msg,
+                     const char *path,
+                     GHashTable *query,
+                     gpointer user_data)
+{
+  (void)soup;
+  (void)path;
+  (void)query;
+  MockServer *server = user_data;
+  if (!server->n_slots)
+  {
+    soup_server_message_set_status(msg, SOUP_STATUS_NOT_FOUND, NULL);
+    return;
+  }
+  gchar *body = g_strdup_printf("{\"total_slots\":%u}", server->n_slots);
+  soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+  soup_server_message_set_response(msg, "application/json", SOUP_MEMORY_TAKE, body, strlen(body));
+}
+
+MockServer *
+mock_server_new(const gchar *socket_path, GError **error)
+{
+  MockServer *server = g_new0(MockServer, 1);
+  server->soup = soup_server_new("server-header", "mock-server", NULL);
+  server->socket_path = g_strdup(socket_path);
+  server->content = g_strdup("ok");
+  server->response = mock_server_build_response(server->content, NULL, 0);
+  soup_server_add_early_handler(server->soup, MOCK_SERVER_PATH, mock_server_on_early, server, NULL);
+  soup_server_add_handler(server->soup, MOCK_SERVER_PATH, mock_server_on_chat, server, NULL);
+  soup_server_add_early_handler(server->soup, MOCK_SERVER_OLLAMA_PATH, mock_server_on_early, server, NULL);
+  soup_server_add_handler(server->soup, MOCK_SERVER_OLLAMA_PATH, mock_server_on_chat, server, NULL);
+  soup_server_add_handler(server->soup, MOCK_SERVER_PROPS_PATH, mock_server_on_props, server, NULL);
+
+  if (!soup_server_listen_local(server->soup, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, error))
+  {
+    mock_server_free(server);
+    return NULL;
+  }
+  GSList *uris = soup_server_get_uris(server->soup);
+  server->port = uris ? (guint)g_uri_get_port(uris->data) : 0;
+  g_slist_free_full(uris, (GDestroyNotify)g_uri_unref);
+
+  if (socket_path)
+  {
+    g_unlink(socket_path);
+    g_autoptr(GSocket) socket = g_socket_new(G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, error);
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new(socket_path);
+    if (!socket || !g_socket_bind(socket, address, FALSE, error) || !g_socket_listen(socket, error) ||
+        !soup_server_listen_socket(server->soup, socket, 0, error))
+    {
+      mock_server_free(server);
+      return NULL;
+    }
+  }
+  return server;
+}
+
+void
+mock_server_free(MockServer *server)
+{
+  if (!server)
+    return;
+  if (server->soup)
+    soup_server_disconnect(server->soup);
+  g_clear_object(&server->soup);
+  if (server->socket_path)
+    g_unlink(server->socket_path);
+  g_free(server->socket_path);
+  for (guint i = 0; i < server->n_slots; i++)
+    g_free(server->slot_cache[i]);
+  g_free(server->slot_cache);
+  g_free(server->content);
+  g_free(server->response);
+  g_clear_pointer(&server->last_body, g_bytes_unref);
+  g_clear_pointer(&server->model_delays, g_hash_table_unref);
+  g_free(server);
+}
+
+gchar *
+mock_server_get_tcp_endpoint(MockServer *server)
+{
+  return g_strdup_printf("http://127.0.0.1:%u" MOCK_SERVER_PATH, server->port);
+}
+
+gchar *
+mock_server_get_unix_endpoint(MockServer *server)
+{
+  if (!server->socket_path)
+    return NULL;
+  return g_strdup_printf("unix:%s:" MOCK_SERVER_PATH, server->socket_path);
+}
+
+void
+mock_server_set_reply(MockServer *server, const gchar *content)
+{
+  g_free(server->content);
+  g_free(server->response);
+  server->content = g_strdup(content ? content : "");
+  server->response = mock_server_build_response(server->content, NULL, 0);
+}
+
+void
+mock_server_set_close_connections(MockServer *server, gboolean close_connections)
+{
+  server->close_connections = close_connections;
+}
+
+guint
+mock_server_get_request_count(MockServer *server)
+{
+  return server->requests;
+}
+
+void
+mock_server_set_keep_body(MockServer *server, gboolean keep)
+{
+  server->discard_body = !keep;
+}
+
+GBytes *
+mock_server_get_last_body(MockServer *server)
+{
+  return server->last_body;
+}
+
+gsize
+mock_server_get_last_body_size(MockServer *server)
+{
+  return server->body_size;
+}
+
+void
+mock_server_set_rate_limit(MockServer *server, guint requests, guint window_ms)
+{
+  server->quota = requests;
+  server->quota_window_us = MAX(1, (gint64)window_ms * 1000);
+  server->quota_level = requests;
+  server->quota_stamp = g_get_monotonic_time();
+  server->rejected = 0;
+}
+
+guint
+mock_server_get_rejected_count(MockServer *server)
+{
+  return server->rejected;
+}
+
+void
+mock_server_set_local_model(MockServer *server, guint load_ms, guint idle_ms, guint prompt_us_per_byte, guint n_slots)
+{
+  for (guint i = 0; i < server->n_slots; i++)
+    g_free(server->slot_cache[i]);
+  g_free(server->slot_cache);
+  server->load_ms = load_ms;
+  server->idle_ms = idle_ms;
+  server->prompt_us_per_byte = prompt_us_per_byte;
+  server->n_slots = n_slots;
+  server->slot_cache = g_new0(gchar *, MAX(n_slots, 1));
+  server->next_slot = 0;
+  server->ready_at = 0;
+  server->loaded_until = 0;
+  server->loads = 0;
+  server->cached_bytes = 0;
+}
+
+guint
+mock_server_get_load_count(MockServer *server)
+{
+  return server->loads;
+}
+
+guint64
+mock_server_get_cached_bytes(MockServer *server)
+{
+  return server->cached_bytes;
+}
+
+void
+mock_server_set_model_delay(MockServer *server, const gchar *model, guint delay_ms)
+{
+  if (!server->model_delays)
+    server->model_delays = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_replace(server->model_delays, g_strdup(model), GUINT_TO_POINTER(delay_ms));
+}
+
+void
+mock_server_set_token_time(MockServer *server, guint us_per_token)
+{
+  server->token_us = us_per_token;
+  server->completion_tokens = 0;
+}
+
+guint64
+mock_server_get_completion_tokens(MockServer *server)
+{
+  return server->completion_tokens;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glib.h>
+
+/* A minimal OpenAI-compatible chat endpoint for benchmarks, served from the
+ * calling thread's main context on loopback TCP and on a unix socket.
+ * Every POST to /v1/chat/completions (or Ollama's /api/chat) gets the same
+ * canned answer. */
+typedef struct _MockServer MockServer;
+
+MockServer *mock_server_new(const gchar *socket_path, GError **error);
+void mock_server_free(MockServer *server);
+
+/* Endpoints in the form the settings accept. */
+gchar *mock_server_get_tcp_endpoint(MockServer *server);
+gchar *mock_server_get_unix_endpoint(MockServer *server);
+
+void mock_server_set_reply(MockServer *server, const gchar *content);
+/* Answers with "Connection: close", so every request opens a new connection. */
+void mock_server_set_close_connections(MockServer *server, gboolean close_connections);
+guint mock_server_get_request_count(MockServer *server);
+
+/* Allows @requests per @window_ms, refilled continuously, and reports the
+ * quota in x-ratelimit-*-requests headers. Requests over it get 429 with
+ * Retry-After. 0 turns the limit off. */
+void mock_server_set_rate_limit(MockServer *server, guint requests, guint window_ms);
+/* Requests answered 429 since the limit was set. */
+guint mock_server_get_rejected_count(MockServer *server);
+
+/* Request bodies are kept by default. With @keep FALSE they are only
+ * counted, so large uploads do not inflate the benchmark's memory. */
+void mock_server_set_keep_body(MockServer *server, gboolean keep);
+/* The last request body (NULL if not kept) and its size in bytes. */
+GBytes *mock_server_get_last_body(MockServer *server);
+gsize mock_server_get_last_body_size(MockServer *server);
+
+/* Answers like a local server: the model takes @load_ms to load and is
+ * unloaded after @idle_ms without requests (or the request's Ollama
+ * "keep_alive"), and each prompt byte not already in the slot's cache
+ * costs @prompt_us_per_byte. Requests go to their "id_slot", else to the
+ * next of @n_slots in turn; a slot only keeps its cache for requests with
+ * "cache_prompt". GET /props reports @n_slots as llama.cpp does. Needs
+ * request bodies kept; @n_slots 0 turns it off. */
+void mock_server_set_local_model(MockServer *server,
+                                 guint load_ms,
+                                 guint idle_ms,
+                                 guint prompt_us_per_byte,
+                                 guint n_slots);
+/* Times the model was loaded and prompt bytes served from a slot's cache. */
+guint mock_server_get_load_count(MockServer *server);
+guint64 mock_server_get_cached_bytes(MockServer *server);
+
+/* Answers requests for @model after @delay_ms, as a model that takes that
+ * long to write its answer. Needs request bodies kept. */
+void mock_server_set_model_delay(MockServer *server, const gchar *model, guint delay_ms);
+
+/* Writes the reply as a model generating it would: each token (about four
+ * bytes) takes @us_per_token, a request's "max_tokens" (Ollama's
+ * options.num_predict) cuts it short with finish_reason "length", and
+ * "usage" reports the tokens written. A conversation whose assistant turns
+ * are the start of the reply gets the rest of it, as when the model is
+ * asked to continue. Needs request bodies kept; 0 turns it off. */
+void mock_server_set_token_time(MockServer *server, guint us_per_token);
+/* Tokens written since the token time was set. */
+guint64 mock_server_get_completion_tokens(MockServer *server);
@@ -0,0 +1,376 @@
+#include "answer-view.h"
+
+#include <string.h>
+
+#include "log.h"
+#include "markdown-pango.h"
+#include "syntax-highlight.h"
+
+#define ANSWER_VIEW_PADDING 14     /* matches the popover label margins */
+#define ANSWER_VIEW_OVERSCAN_PX 600 /* laid out beyond the visible area */
+#define ANSWER_VIEW_KEEP_PX 2400    /* layouts further away are dropped */
+#define ANSWER_VIEW_SLOW_FRAME_US 16000
+
+typedef struct
+{
+  PangoLayout *layout; /* NULL until the block comes near the viewport */
+  gint y;              /* offset from the top of the content */
+  gint height;         /* measured once laid out, estimated before */
+} AnswerViewBlock;
+
+struct _AnswerView
+{
+  GtkDrawingArea parent_instance;
+
+  GPtrArray *source; /* element-type MarkdownBlock* */
+  GArray *blocks;    /* element-type AnswerViewBlock */
+  GArray *live;      /* element-type guint, indices of blocks holding a layout */
+  gboolean offsets_dirty;
+  gint total_height;
+
+  gint layout_width;
+  gint line_height;
+  gint char_width;
+  guint size_source_id;
+
+  guint frames;
+  gint64 frame_total_us;
+  gint64 frame_max_us;
+};
+
+G_DEFINE_TYPE(AnswerView, answer_view, GTK_TYPE_DRAWING_AREA)
+
+static void
+answer_view_update_metrics(AnswerView *self)
+{
+  PangoContext *ctx = gtk_widget_get_pango_context(GTK_WIDGET(self));
+  PangoFontMetrics *m = pango_context_get_metrics(ctx, pango_context_get_font_description(ctx), NULL);
+  self->line_height = MAX(1, PANGO_PIXELS(pango_font_metrics_get_ascent(m) + pango_font_metrics_get_descent(m)));
+  self->char_width = MAX(1, PANGO_PIXELS(pango_font_metrics_get_approximate_char_width(m)));
+  pango_font_metrics_unref(m);
+}
+
+static gint
+answer_view_estimate_height(AnswerView *self, const MarkdownBlock *src)
+{
+  guint per_line = (guint)MAX(1, self->layout_width / self->char_width);
+  guint lines = MAX(src->n_lines, (src->n_chars + per_line - 1) / per_line);
+  return (gint)lines * self->line_height;
+}
+
+static void
+answer_view_drop_layouts(AnswerView *self)
+{
+  for (guint i = 0; self->live && i < self->live->len; i++)
+  {
+    AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, g_array_index(self->live, guint, i));
+    g_clear_object(&b->layout);
+  }
+  if (self->live)
+    g_array_set_size(self->live, 0);
+}
+
+static void
+answer_view_reestimate(AnswerView *self)
+{
+  answer_view_drop_layouts(self);
+  for (guint i = 0; self->blocks && i < self->blocks->len; i++)
+  {
+    AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, i);
+    b->height = answer_view_estimate_height(self, g_ptr_array_index(self->source, i));
+  }
+  self->offsets_dirty = TRUE;
+}
+
+static void
+answer_view_update_offsets(AnswerView *self)
+{
+  if (!self->offsets_dirty)
+    return;
+  self->offsets_dirty = FALSE;
+
+  gint y = 0;
+  for (guint i = 0; self->blocks && i < self->blocks->len; i++)
+  {
+    AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, i);
+    b->y = y;
+    y += b->height;
+  }
+  self->total_height = y;
+}
+
+static gboolean
+answer_view_size_idle(gpointer user_data)
+{
+  AnswerView *self = user_data;
+  self->size_source_id = 0;
+  answer_view_update_offsets(self);
+  gtk_widget_set_size_request(GTK_WIDGET(self), -1, self->total_height + 2 * ANSWER_VIEW_PADDING);
+  return G_SOURCE_REMOVE;
+}
+
+/* Height changes found while drawing are applied outside the draw cycle. */
+static void
+answer_view_queue_size_update(AnswerView *self)
+{
+  if (self->size_source_id != 0)
+    return;
+  self->size_source_id = g_idle_add(answer_view_size_idle, self);
+}
+
+/* Index of the last block starting at or above @y. */
+static guint
+answer_view_find_block(AnswerView *self, gint y)
+{
+  guint lo = 0;
+  guint hi = self->blocks->len;
+  while (hi - lo > 1)
+  {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_array_index(self->blocks, AnswerViewBlock, mid).y <= y)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static gboolean
+answer_view_ensure_layout(AnswerView *self, guint index)
+{
+  AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, index);
+  if (b->layout)
+    return FALSE;
+
+  /* Code is highlighted the first time its block comes into view. */
+  MarkdownBlock *src = g_ptr_array_index(self->source, index);
+  markdown_block_highlight(src, SYNTAX_HIGHLIGHT_BUDGET_US);
+  gsize len = strlen(src->markup);
+  if (len > 0 && src->markup[len - 1] == '\n')
+    len--;
+
+  b->layout = gtk_widget_create_pango_layout(GTK_WIDGET(self), NULL);
+  pango_layout_set_width(b->layout, self->layout_width * PANGO_SCALE);
+  pango_layout_set_wrap(b->layout, PANGO_WRAP_WORD_CHAR);
+  pango_layout_set_markup(b->layout, src->markup, (gint)len);
+  g_array_append_val(self->live, index);
+
+  gint height = 0;
+  pango_layout_get_pixel_size(b->layout, NULL, &height);
+  if (height == b->height)
+    return FALSE;
+  b->height = height;
+  return TRUE;
+}
+
+static void
+answer_view_evict(AnswerView *self, gint top, gint bottom)
+{
+  guint kept = 0;
+  for (guint i = 0; i < self->live->len; i++)
+  {
+    guint index = g_array_index(self->live, guint, i);
+    AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, index);
+    if (b->y + b->height < top || b->y > bottom)
+      g_clear_object(&b->layout);
+    else
+      g_array_index(self->live, guint, kept++) = index;
+  }
+  g_array_set_size(self->live, kept);
+}
+
+static gboolean
+answer_view_draw(GtkWidget *widget, cairo_t *cr)
+{
+  AnswerView *self = ANSWER_VIEW(widget);
+  if (!self->blocks || self->blocks->len == 0)
+    return FALSE;
+
+  GdkRectangle clip = {0};
+  if (!gdk_cairo_get_clip_rectangle(cr, &clip))
+    return FALSE;
+
+  gint64 t0 = g_get_monotonic_time();
+
+  gint width = MAX(20, gtk_widget_get_allocated_width(widget) - 2 * ANSWER_VIEW_PADDING);
+  if (width != self->layout_width)
+  {
+    self->layout_width = width;
+    answer_view_reestimate(self);
+    answer_view_queue_size_update(self);
+  }
+  answer_view_update_offsets(self);
+
+  /* Content coordinates: widget y minus the top padding. */
+  gint clip_top = clip.y - ANSWER_VIEW_PADDING;
+  gint clip_bottom = clip_top + clip.height;
+  gint layout_bottom = clip_bottom + ANSWER_VIEW_OVERSCAN_PX;
+
+  GtkStyleContext *style = gtk_widget_get_style_context(widget);
+  gboolean changed = FALSE;
+  guint laid_out = 0;
+  guint i = answer_view_find_block(self, MAX(0, clip_top - ANSWER_VIEW_OVERSCAN_PX));
+  gint y = g_array_index(self->blocks, AnswerViewBlock, i).y;
+  for (; i < self->blocks->len && y <= layout_bottom; i++)
+  {
+    AnswerViewBlock *b = &g_array_index(self->blocks, AnswerViewBlock, i);
+    b->y = y;
+    if (answer_view_ensure_layout(self, i))
+      changed = TRUE;
+    laid_out++;
+
+    if (y + b->height >= clip_top && y <= clip_bottom)
+      gtk_render_layout(style, cr, ANSWER_VIEW_PADDING, ANSWER_VIEW_PADDING + y, b->layout);
+    y += b->height;
+  }
+
+  if (changed)
+  {
+    /* Blocks below the drawn range still carry offsets from the estimates. */
+    self->offsets_dirty = TRUE;
+    answer_view_queue_size_update(self);
+  }
+  answer_view_evict(self, clip_top - ANSWER_VIEW_KEEP_PX, clip_bottom + ANSWER_VIEW_KEEP_PX);
+
+  gint64 elapsed = g_get_monotonic_time() - t0;
+  self->frames++;
+  self->frame_total_us += elapsed;
+  self->frame_max_us = MAX(self->frame_max_us, elapsed);
+  if (elapsed > ANSWER_VIEW_SLOW_FRAME_US)
+    openai_ask_log("answer-view slow frame clip_y=%d laid_out=%u live=%u us=%" G_GINT64_FORMAT,
+                   clip.y,
+                   laid_out,
+                   self->live->len,
+                   elapsed);
+
+  return FALSE;
+}
+
+static void
+answer_view_style_updated(GtkWidget *widget)
+{
+  AnswerView *self = ANSWER_VIEW(widget);
+  GTK_WIDGET_CLASS(answer_view_parent_class)->style_updated(widget);
+
+  answer_view_update_metrics(self);
+  if (self->blocks)
+  {
+    answer_view_reestimate(self);
+    answer_view_queue_size_update(self);
+  }
+}
+
+static void
+answer_view_clear(AnswerView *self)
+{
+  answer_view_drop_layouts(self);
+  g_clear_pointer(&self->blocks, g_array_unref);
+  g_clear_pointer(&self->source, g_ptr_array_unref);
+  self->total_height = 0;
+  self->offsets_dirty = FALSE;
+}
+
+static void
+answer_view_dispose(GObject *object)
+{
+  AnswerView *self = ANSWER_VIEW(object);
+  if (self->size_source_id != 0)
+  {
+    g_source_remove(self->size_source_id);
+    self->size_source_id = 0;
+  }
+  answer_view_clear(self);
+  G_OBJECT_CLASS(answer_view_parent_class)->dispose(object);
+}
+
+static void
+answer_view_finalize(GObject *object)
+{
+  AnswerView *self = ANSWER_VIEW(object);
+  g_clear_pointer(&self->live, g_array_unref);
+  G_OBJECT_CLASS(answer_view_parent_class)->finalize(object);
+}
+
+static void
+answer_view_class_init(AnswerViewClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+  gobject_class->dispose = answer_view_dispose;
+  gobject_class->finalize = answer_view_finalize;
+
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(klass);
+  widget_class->draw = answer_view_draw;
+  widget_class->style_updated = answer_view_style_updated;
+}
+
+static void
+answer_view_init(AnswerView *self)
+{
+  self->live = g_array_new(FALSE, FALSE, sizeof(guint));
+  self->line_height = 16;
+  self->char_width = 8;
+  self->layout_width = 400;
+}
+
+GtkWidget *
+answer_view_new(void)
+{
+  return g_object_new(ANSWER_TYPE_VIEW, NULL);
+}
+
+void
+answer_view_set_blocks(AnswerView *self, GPtrArray *blocks)
+{
+  g_return_if_fail(ANSWER_IS_VIEW(self));
+
+  if (self->frames > 0)
+    openai_ask_log("answer-view frames=%u avg_us=%" G_GINT64_FORMAT " max_us=%" G_GINT64_FORMAT,
+                   self->frames,
+                   self->frame_total_us / self->frames,
+                   self->frame_max_us);
+  self->frames = 0;
+  self->frame_total_us = 0;
+  self->frame_max_us = 0;
+
+  answer_view_clear(self);
+  if (blocks)
+  {
+    self->source = blocks;
+    self->blocks = g_array_sized_new(FALSE, TRUE, sizeof(AnswerViewBlock), blocks->len);
+    g_array_set_size(self->blocks, blocks->len);
+    answer_view_reestimate(self);
+    answer_view_update_offsets(self);
+    openai_ask_log("answer-view blocks=%u estimated_h=%d", blocks->len, self->total_height);
+  }
+
+  gtk_widget_set_size_request(GTK_WIDGET(self), -1, self->total_height + 2 * ANSWER_VIEW_PADDING);
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+gchar *
+answer_view_get_text(AnswerView *self)
+{
+  g_return_val_if_fail(ANSWER_IS_VIEW(self), NULL);
+
+  GString *out = g_string_new(NULL);
+  for (guint i = 0; self->source && i < self->source->len; i++)
+  {
+    const MarkdownBlock *src = g_ptr_array_index(self->source, i);
+    g_autofree gchar *text = NULL;
+    if (pango_parse_markup(src->markup, -1, 0, NULL, &text, NULL, NULL))
+      g_string_append(out, text);
+  }
+  return g_string_free(out, FALSE);
+}
+
+void
+answer_view_get_frame_stats(AnswerView *self, guint *out_frames, gint64 *out_avg_us, gint64 *out_max_us)
+{
+  g_return_if_fail(ANSWER_IS_VIEW(self));
+  if (out_frames)
+    *out_frames = self->frames;
+  if (out_avg_us)
+    *out_avg_us = self->frames > 0 ? self->frame_total_us / self->frames : 0;
+  if (out_max_us)
+    *out_max_us = self->frame_max_us;
+}
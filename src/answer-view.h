@@ -0,0 +1,21 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+#define ANSWER_TYPE_VIEW (answer_view_get_type())
+G_DECLARE_FINAL_TYPE(AnswerView, answer_view, ANSWER, VIEW, GtkDrawingArea)
+
+/* A read-only answer view for very large documents. Markup is kept as
+ * MarkdownBlock chunks; only blocks near the visible area are laid out,
+ * the rest contribute estimated heights. Meant to live in a
+ * GtkScrolledWindow. */
+GtkWidget *answer_view_new(void);
+
+/* Takes ownership of @blocks (element-type MarkdownBlock*). NULL clears. */
+void answer_view_set_blocks(AnswerView *view, GPtrArray *blocks);
+
+/* Returns the plain text of the whole document, newly allocated. */
+gchar *answer_view_get_text(AnswerView *view);
+
+/* Draw timings since the last answer_view_set_blocks(). */
+void answer_view_get_frame_stats(AnswerView *view, guint *out_frames, gint64 *out_avg_us, gint64 *out_max_us);
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include "attachment.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Files with a NUL byte this early are treated as binary. */
+#define ATTACHMENT_SNIFF_BYTES 8192
+
+struct _Attachment
+{
+  gchar *name;
+  gint fd; /* -1 for text */
+  gint64 mtime_ns; /* of the file when it was attached */
+  gchar *text;
+  gsize len;
+};
+
+static gint64
+attachment_mtime_ns(const struct stat *st)
+{
+  return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st->st_mtim.tv_nsec;
+}
+
+static gboolean
+attachment_set_errno(const Attachment *attachment, const gchar *what, GError **error)
+{
+  gint saved = errno;
+  g_set_error(error,
+              G_IO_ERROR,
+              g_io_error_from_errno(saved),
+              "Could not %s %s: %s",
+              what,
+              attachment->name,
+              g_strerror(saved));
+  return FALSE;
+}
+
+/* FALSE if a read came up short or the file is no longer the size and age
+ * it was when attached. */
+static gboolean
+attachment_check_unchanged(const Attachment *attachment, gboolean complete, GError **error)
+{
+  struct stat st;
+  if (fstat(attachment->fd, &st) != 0)
+    return attachment_set_errno(attachment, "read", error);
+  if (complete && (gsize)st.st_size == attachment->len && attachment_mtime_ns(&st) == attachment->mtime_ns)
+    return TRUE;
+  g_set_error(error,
+              G_IO_ERROR,
+              G_IO_ERROR_FAILED,
+              "%s changed after it was attached; attach it again.",
+              attachment->name);
+  return FALSE;
+}
+
+Attachment *
+attachment_new_file(const gchar *path, GError **error)
+{
+  g_autoptr(Attachment) attachment = g_new0(Attachment, 1);
+  attachment->name = g_filename_display_name(path);
+  attachment->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (attachment->fd < 0)
+  {
+    attachment_set_errno(attachment, "open", error);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(attachment->fd, &st) != 0)
+  {
+    attachment_set_errno(attachment, "open", error);
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode))
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE, "%s is not a regular file.", attachment->name);
+    return NULL;
+  }
+  if ((guint64)st.st_size > ATTACHMENT_MAX_BYTES)
+  {
+    g_set_error(error,
+                G_IO_ERROR,
+                G_IO_ERROR_FAILED,
+                "%s is too large to attach (%.1f MB, limit %d MB).",
+                attachment->name,
+                st.st_size / (1024.0 * 1024.0),
+                ATTACHMENT_MAX_BYTES / (1024 * 1024));
+    return NULL;
+  }
+  attachment->len = (gsize)st.st_size;
+  attachment->mtime_ns = attachment_mtime_ns(&st);
+
+  guchar head[ATTACHMENT_SNIFF_BYTES];
+  gsize sniff = MIN(attachment->len, sizeof(head));
+  if (!attachment_read(attachment, 0, head, sniff, error))
+    return NULL;
+  if (memchr(head, '\0', sniff))
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s does not look like a text file.", attachment->name);
+    return NULL;
+  }
+  return g_steal_pointer(&attachment);
+}
+
+Attachment *
+attachment_new_text(const gchar *name, const gchar *text, gssize len)
+{
+  Attachment *attachment = g_new0(Attachment, 1);
+  attachment->name = g_strdup(name);
+  attachment->len = len < 0 ? strlen(text) : (gsize)len;
+  attachment->text = g_strndup(text, attachment->len);
+  attachment->fd = -1;
+  return attachment;
+}
+
+void
+attachment_free(Attachment *attachment)
+{
+  if (!attachment)
+    return;
+  if (attachment->fd >= 0)
+    close(attachment->fd);
+  g_free(attachment->text);
+  g_free(attachment->name);
+  g_free(attachment);
+}
+
+const gchar *
+attachment_get_name(const Attachment *attachment)
+{
+  return attachment->name;
+}
+
+gsize
+attachment_get_size(const Attachment *attachment)
+{
+  return attachment->len;
+}
+
+gboolean
+attachment_read(const Attachment *attachment, gsize offset, guchar *buf, gsize len, GError **error)
+{
+  g_return_val_if_fail(offset + len <= attachment->len, FALSE);
+  if (attachment->fd < 0)
+  {
+    memcpy(buf, attachment->text + offset, len);
+    return TRUE;
+  }
+
+  gsize done = 0;
+  while (done < len)
+  {
+    gssize n = pread(attachment->fd, buf + done, len - done, (off_t)(offset + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return attachment_set_errno(attachment, "read", error);
+    if (n == 0)
+      break;
+    done += (gsize)n;
+  }
+  /* Checked after reading, so a write that raced the read is caught too. */
+  return attachment_check_unchanged(attachment, done == len, error);
+}
+
+gsize
+attachment_estimate_tokens(gsize bytes)
+{
+  return (bytes + 3) / 4;
+}
+
+GPtrArray *
+attachment_list_new(void)
+{
+  return g_ptr_array_new_with_free_func((GDestroyNotify)attachment_free);
+}
+
+gsize
+attachment_list_get_bytes(GPtrArray *attachments)
+{
+  gsize total = 0;
+  for (guint i = 0; attachments && i < attachments->len; i++)
+    total += ((Attachment *)g_ptr_array_index(attachments, i))->len;
+  return total;
+}
+
+gboolean
+attachment_add(GPtrArray *attachments, Attachment *attachment, GError **error)
+{
+  if (attachments->len >= ATTACHMENT_MAX_COUNT)
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "At most %d attachments per question.", ATTACHMENT_MAX_COUNT);
+    attachment_free(attachment);
+    return FALSE;
+  }
+  if (attachment_list_get_bytes(attachments) + attachment->len > ATTACHMENT_MAX_BYTES)
+  {
+    g_set_error(error,
+                G_IO_ERROR,
+                G_IO_ERROR_FAILED,
+                "Attachments are limited to %d MB per question.",
+                ATTACHMENT_MAX_BYTES / (1024 * 1024));
+    attachment_free(attachment);
+    return FALSE;
+  }
+  g_ptr_array_add(attachments, attachment);
+  return TRUE;
+}
+
+gboolean
+attachment_add_references(GPtrArray *attachments, const gchar *prompt, GError **error)
+{
+  g_autoptr(GPtrArray) found = attachment_list_new();
+  g_auto(GStrv) words = g_strsplit_set(prompt, " \t\n", -1);
+  for (guint i = 0; words[i]; i++)
+  {
+    const gchar *word = words[i];
+    if (word[0] != '@' || (word[1] != '/' && !g_str_has_prefix(word + 1, "~/")))
+      continue;
+
+    g_autofree gchar *path = word[1] == '~' ? g_build_filename(g_get_home_dir(), word + 3, NULL) : g_strdup(word + 1);
+    Attachment *attachment = attachment_new_file(path, error);
+    if (!attachment || !attachment_add(found, attachment, error))
+      return FALSE;
+  }
+
+  if (found->len == 0)
+    return TRUE;
+  if (attachments->len + found->len > ATTACHMENT_MAX_COUNT ||
+      attachment_list_get_bytes(attachments) + attachment_list_get_bytes(found) > ATTACHMENT_MAX_BYTES)
+  {
+    g_set_error(error,
+                G_IO_ERROR,
+                G_IO_ERROR_FAILED,
+                "Attachments are limited to %d files and %d MB per question.",
+                ATTACHMENT_MAX_COUNT,
+                ATTACHMENT_MAX_BYTES / (1024 * 1024));
+    return FALSE;
+  }
+  while (found->len > 0)
+    g_ptr_array_add(attachments, g_ptr_array_steal_index(found, 0));
+  return TRUE;
+}
+
+gchar *
+attachment_list_describe(GPtrArray *attachments, gsize prompt_bytes)
+{
+  GString *out = g_string_new(NULL);
+  for (guint i = 0; i < attachments->len; i++)
+  {
+    const Attachment *attachment = g_ptr_array_index(attachments, i);
+    g_autofree gchar *size = g_format_size(attachment->len);
+    g_string_append_printf(out, "%s%s (%s)", i > 0 ? "\n" : "", attachment->name, size);
+  }
+  gsize tokens = attachment_estimate_tokens(prompt_bytes + attachment_list_get_bytes(attachments));
+  if (tokens >= 10000)
+    g_string_append_printf(out, "\n≈ %" G_GSIZE_FORMAT "k tokens", tokens / 1000);
+  else
+    g_string_append_printf(out, "\n≈ %" G_GSIZE_FORMAT " tokens", tokens);
+  return g_string_free(out, FALSE);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glib.h>
+
+/* Limits for everything attached to one question. */
+#define ATTACHMENT_MAX_BYTES (64 * 1024 * 1024)
+#define ATTACHMENT_MAX_COUNT 8
+
+/* A file or a piece of text sent along with a question. Files are kept
+ * open and read a chunk at a time while the request body is streamed (see
+ * body-stream.h), so a large log never exists as one escaped string in
+ * memory. Their size and mtime are recorded when attached. */
+typedef struct _Attachment Attachment;
+
+Attachment *attachment_new_file(const gchar *path, GError **error);
+Attachment *attachment_new_text(const gchar *name, const gchar *text, gssize len);
+void attachment_free(Attachment *attachment);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Attachment, attachment_free)
+
+const gchar *attachment_get_name(const Attachment *attachment);
+gsize attachment_get_size(const Attachment *attachment);
+
+/* Reads @len bytes at @offset into @buf. Fails if the file was truncated
+ * or modified since it was attached, so a request never sends something
+ * other than what its Content-Length was counted from. */
+gboolean attachment_read(const Attachment *attachment, gsize offset, guchar *buf, gsize len, GError **error);
+
+/* Rough token count for @bytes of text (about four bytes per token). */
+gsize attachment_estimate_tokens(gsize bytes);
+
+/* A list for attachment_add(): element-type Attachment, owned. */
+GPtrArray *attachment_list_new(void);
+gsize attachment_list_get_bytes(GPtrArray *attachments);
+
+/* Appends @attachment (taking ownership) unless that would exceed the
+ * count or size limits. */
+gboolean attachment_add(GPtrArray *attachments, Attachment *attachment, GError **error);
+
+/* Attaches every "@/path" or "@~/path" word of @prompt. The prompt text is
+ * left as it is. On error nothing is added. */
+gboolean attachment_add_references(GPtrArray *attachments, const gchar *prompt, GError **error);
+
+/* One "name (size)" line per attachment, then the estimated token count
+ * of the whole question, for previews. */
+gchar *attachment_list_describe(GPtrArray *attachments, gsize prompt_bytes);
@@ -0,0 +1,696 @@
+#define _GNU_SOURCE
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "conversation.h"
+#include "log.h"
+#include "openai-client.h"
+#include "request-scheduler.h"
+
+typedef struct
+{
+  gsize offset;
+  gsize len;
+  guint number; /* in the input file, from 1 */
+} BatchLine;
+
+struct _Batch
+{
+  gint ref_count; /* the caller's, and one per job */
+  gchar *template;
+  gchar *output_path;
+  GMappedFile *input;
+  GArray *lines; /* BatchLine, non-empty lines only */
+  GHashTable *kept; /* line index -> record an earlier run wrote after its first gap */
+  gint fd;
+  /* While an earlier run's output has records to drop, the new output is
+   * written here and replaces it once nothing in it can be lost; see
+   * batch_resume(). */
+  gchar *temp_path;
+  gboolean closed; /* batch_close_output() ran */
+
+  gchar *endpoint;
+  gchar *api_key;
+  gchar *model;
+  gdouble temperature;
+  gchar *system_prompt;
+  guint jobs;
+  guint64 owner;
+  GCancellable *cancellable;
+  /* Records of the lines from progress.written to next - 1; NULL until the
+   * line is answered. */
+  GPtrArray *pending;
+  guint next; /* index of the next line to start */
+  gint64 started_us;
+  BatchProgress progress;
+  GError *error; /* the output could not be written */
+  gboolean started;
+  gboolean finished;
+  BatchProgressFunc progress_func;
+  BatchDoneFunc done_func;
+  gpointer user_data;
+};
+
+typedef struct
+{
+  Batch *batch;
+  guint index;
+  guint attempt;
+  RequestTicket *ticket;
+  Conversation *conversation;
+} BatchJob;
+
+static void batch_pump(Batch *batch);
+
+static Batch *
+batch_ref(Batch *batch)
+{
+  batch->ref_count++;
+  return batch;
+}
+
+static void
+batch_unref(Batch *batch)
+{
+  if (--batch->ref_count > 0)
+    return;
+  if (batch->fd >= 0)
+    close(batch->fd);
+  g_clear_pointer(&batch->input, g_mapped_file_unref);
+  g_clear_pointer(&batch->lines, g_array_unref);
+  g_clear_pointer(&batch->kept, g_hash_table_unref);
+  g_clear_pointer(&batch->pending, g_ptr_array_unref);
+  g_clear_object(&batch->cancellable);
+  g_clear_error(&batch->error);
+  g_free(batch->template);
+  g_free(batch->output_path);
+  g_free(batch->temp_path);
+  g_free(batch->endpoint);
+  g_free(batch->api_key);
+  g_free(batch->model);
+  g_free(batch->system_prompt);
+  g_free(batch);
+}
+
+gchar *
+batch_expand(const gchar *template, const gchar *input)
+{
+  if (!strstr(template, BATCH_PLACEHOLDER))
+    return g_strconcat(template, "\n\n", input, NULL);
+  g_auto(GStrv) parts = g_strsplit(template, BATCH_PLACEHOLDER, -1);
+  return g_strjoinv(input, parts);
+}
+
+gchar *
+batch_default_output_path(const gchar *input_path)
+{
+  return g_strconcat(input_path, ".answers.jsonl", NULL);
+}
+
+/* Lines are trimmed; blank ones are skipped but still counted, so a
+ * record's "line" is the one an editor shows. */
+static void
+batch_index_lines(Batch *batch)
+{
+  const gchar *data = g_mapped_file_get_contents(batch->input);
+  gsize len = g_mapped_file_get_length(batch->input);
+  guint number = 0;
+  for (gsize start = 0; start < len;)
+  {
+    const gchar *nl = memchr(data + start, '\n', len - start);
+    gsize end = nl ? (gsize)(nl - data) : len;
+    gsize from = start;
+    gsize to = end;
+    while (from < to && g_ascii_isspace(data[from]))
+      from++;
+    while (to > from && g_ascii_isspace(data[to - 1]))
+      to--;
+    number++;
+    if (to > from)
+    {
+      BatchLine line = {from, to - from, number};
+      g_array_append_val(batch->lines, line);
+    }
+    start = end + 1;
+  }
+}
+
+static gchar *
+batch_get_line(const Batch *batch, guint index)
+{
+  const BatchLine *line = &g_array_index(batch->lines, BatchLine, index);
+  return g_utf8_make_valid(g_mapped_file_get_contents(batch->input) + line->offset, (gssize)line->len);
+}
+
+static gboolean
+batch_find_line(const Batch *batch, guint number, guint *index)
+{
+  guint lo = 0;
+  guint hi = batch->lines->len;
+  while (lo < hi)
+  {
+    guint mid = lo + (hi - lo) / 2;
+    guint at = g_array_index(batch->lines, BatchLine, mid).number;
+    if (at == number)
+    {
+      *index = mid;
+      return TRUE;
+    }
+    if (at < number)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return FALSE;
+}
+
+/* Whether @text is a record of one of the input lines, whose text has not
+ * changed since; @index is that line's. */
+static gboolean
+batch_parse_record(const Batch *batch, const gchar *text, gsize len, guint *index, gboolean *answered)
+{
+  g_autoptr(JsonParser) parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, text, (gssize)len, NULL))
+    return FALSE;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return FALSE;
+  JsonObject *obj = json_node_get_object(root);
+  gint64 number = json_object_get_int_member_with_default(obj, "line", 0);
+  const gchar *input = json_object_get_string_member_with_default(obj, "input", NULL);
+  if (number <= 0 || number > G_MAXUINT || !input || !batch_find_line(batch, (guint)number, index))
+    return FALSE;
+  g_autofree gchar *line = batch_get_line(batch, *index);
+  if (g_strcmp0(line, input) != 0)
+    return FALSE;
+  *answered = json_object_get_string_member_with_default(obj, "answer", NULL) != NULL;
+  return TRUE;
+}
+
+static gboolean
+batch_write_all(gint fd, const gchar *data, gsize len)
+{
+  gsize done = 0;
+  while (done < len)
+  {
+    ssize_t w = write(fd, data + done, len - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+    {
+      if (w == 0)
+        errno = ENOSPC;
+      return FALSE;
+    }
+    done += (gsize)w;
+  }
+  return TRUE;
+}
+
+static void
+batch_set_write_error(Batch *batch, const gchar *path)
+{
+  gint saved = errno;
+  if (batch->error)
+    return;
+  g_autofree gchar *display = g_filename_display_name(path);
+  g_set_error(&batch->error, G_IO_ERROR, g_io_error_from_errno(saved), "Cannot write %s: %s", display, g_strerror(saved));
+  openai_ask_log("batch: %s", batch->error->message);
+  g_cancellable_cancel(batch->cancellable);
+}
+
+/* The new output takes the place of the earlier run's. */
+static void
+batch_commit_output(Batch *batch)
+{
+  if (!batch->temp_path)
+    return;
+  if (fdatasync(batch->fd) != 0 || rename(batch->temp_path, batch->output_path) != 0)
+    batch_set_write_error(batch, batch->output_path);
+  else
+    openai_ask_log("batch: %s replaced with its resumed output", batch->output_path);
+  g_clear_pointer(&batch->temp_path, g_free);
+}
+
+/* Keeps what an earlier run wrote to the output; see batch.h. The output
+ * file is not changed here: records to drop are left out of a temporary
+ * copy instead, so a batch that never runs, or stops before the answers
+ * kept past the gap are written again, loses nothing. */
+static gboolean
+batch_resume(Batch *batch, GError **error)
+{
+  g_autoptr(GMappedFile) map = g_mapped_file_new(batch->output_path, FALSE, error);
+  if (!map)
+    return FALSE;
+  const gchar *data = g_mapped_file_get_contents(map);
+  gsize len = g_mapped_file_get_length(map);
+  gsize keep = 0;
+  guint next = 0;
+  gboolean gap = FALSE;
+  for (gsize start = 0; start < len;)
+  {
+    const gchar *nl = memchr(data + start, '\n', len - start);
+    if (!nl)
+      break; /* torn by an interrupted write */
+    gsize end = (gsize)(nl - data) + 1;
+    guint index = 0;
+    gboolean answered = FALSE;
+    if (!batch_parse_record(batch, data + start, end - start - 1, &index, &answered))
+      gap = TRUE;
+    else if (!gap && answered && index == next)
+    {
+      next++;
+      keep = end;
+    }
+    else
+    {
+      gap = TRUE;
+      if (answered && index >= next)
+        g_hash_table_replace(batch->kept, GUINT_TO_POINTER(index), g_strndup(data + start, end - start));
+    }
+    start = end;
+  }
+
+  if (keep < len)
+  {
+    g_autofree gchar *temp_path = g_strconcat(batch->output_path, ".partial", NULL);
+    gint fd = open(temp_path, O_RDWR | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || !batch_write_all(fd, data, keep))
+    {
+      gint saved = errno;
+      g_autofree gchar *display = g_filename_display_name(temp_path);
+      g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved), "Cannot write %s: %s", display, g_strerror(saved));
+      if (fd >= 0)
+      {
+        close(fd);
+        g_unlink(temp_path);
+      }
+      return FALSE;
+    }
+    close(batch->fd);
+    batch->fd = fd;
+    batch->temp_path = g_steal_pointer(&temp_path);
+  }
+  batch->next = next;
+  batch->progress.written = next;
+  batch->progress.resumed = next;
+  if (len > 0)
+    openai_ask_log("batch: resuming %s after %u records (%u more kept, %zu bytes left out)",
+                   batch->output_path,
+                   next,
+                   g_hash_table_size(batch->kept),
+                   (size_t)(len - keep));
+  return TRUE;
+}
+
+Batch *
+batch_open(const gchar *template, const gchar *input_path, const gchar *output_path, GError **error)
+{
+  if (!template || !*template)
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "The prompt template is empty.");
+    return NULL;
+  }
+  GMappedFile *input = g_mapped_file_new(input_path, FALSE, error);
+  if (!input)
+    return NULL;
+  gint fd = open(output_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    gint saved = errno;
+    g_autofree gchar *display = g_filename_display_name(output_path);
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved), "Cannot open %s: %s", display, g_strerror(saved));
+    g_mapped_file_unref(input);
+    return NULL;
+  }
+
+  Batch *batch = g_new0(Batch, 1);
+  batch->ref_count = 1;
+  batch->template = g_strdup(template);
+  batch->output_path = g_strdup(output_path);
+  batch->input = input;
+  batch->fd = fd;
+  batch->lines = g_array_new(FALSE, FALSE, sizeof(BatchLine));
+  batch->kept = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  batch->pending = g_ptr_array_new_with_free_func(g_free);
+  batch->cancellable = g_cancellable_new();
+  batch_index_lines(batch);
+  batch->progress.total = batch->lines->len;
+  if (!batch_resume(batch, error))
+  {
+    batch_unref(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void
+batch_free(Batch *batch)
+{
+  if (!batch)
+    return;
+  batch->finished = TRUE;
+  g_cancellable_cancel(batch->cancellable);
+  batch_close_output(batch);
+  batch_unref(batch);
+}
+
+const BatchProgress *
+batch_get_progress(const Batch *batch)
+{
+  return &batch->progress;
+}
+
+const gchar *
+batch_get_output_path(const Batch *batch)
+{
+  return batch->output_path;
+}
+
+gdouble
+batch_progress_get_rate(const BatchProgress *progress)
+{
+  if (progress->elapsed_us <= 0)
+    return 0.0;
+  return progress->requests * (gdouble)G_USEC_PER_SEC / progress->elapsed_us;
+}
+
+gchar *
+batch_progress_describe(const BatchProgress *progress)
+{
+  GString *out = g_string_new(NULL);
+  g_string_append_printf(out,
+                         "%u of %u lines · %.1f requests/s",
+                         progress->written,
+                         progress->total,
+                         batch_progress_get_rate(progress));
+  if (progress->failed > 0)
+    g_string_append_printf(out, " · %u failed", progress->failed);
+  return g_string_free(out, FALSE);
+}
+
+static gchar *
+batch_format_record(const Batch *batch, guint index, const OpenaiClientResult *result)
+{
+  g_autofree gchar *input = batch_get_line(batch, index);
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "line");
+  json_builder_add_int_value(b, g_array_index(batch->lines, BatchLine, index).number);
+  json_builder_set_member_name(b, "input");
+  json_builder_add_string_value(b, input);
+  if (result->ok)
+  {
+    json_builder_set_member_name(b, "answer");
+    json_builder_add_string_value(b, result->content ? result->content : "");
+  }
+  else
+  {
+    json_builder_set_member_name(b, "error");
+    json_builder_add_string_value(b, result->error_message ? result->error_message : "Request failed.");
+  }
+  json_builder_end_object(b);
+
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  g_autofree gchar *json = json_generator_to_data(gen, NULL);
+  return g_strconcat(json, "\n", NULL);
+}
+
+static gint
+batch_cmp_index(gconstpointer a, gconstpointer b)
+{
+  guint x = GPOINTER_TO_UINT(a);
+  guint y = GPOINTER_TO_UINT(b);
+  return (x > y) - (x < y);
+}
+
+/* Writes what is answered but not yet in the output, out of order after
+ * the first gap like an interrupted run leaves it, so the next run keeps
+ * it; then the output takes its final place. A batch that never started
+ * leaves the earlier output as it was. */
+static void
+batch_close_output(Batch *batch)
+{
+  if (batch->closed)
+    return;
+  batch->closed = TRUE;
+  if (!batch->started)
+  {
+    if (batch->temp_path)
+      g_unlink(batch->temp_path);
+    g_clear_pointer(&batch->temp_path, g_free);
+    return;
+  }
+
+  g_autoptr(GString) out = g_string_new(NULL);
+  for (guint i = 0; i < batch->pending->len; i++)
+  {
+    const gchar *record = g_ptr_array_index(batch->pending, i);
+    if (record)
+      g_string_append(out, record);
+  }
+  g_autoptr(GList) kept = g_list_sort(g_hash_table_get_keys(batch->kept), batch_cmp_index);
+  for (GList *l = kept; l; l = l->next)
+    g_string_append(out, g_hash_table_lookup(batch->kept, l->data));
+  if (out->len > 0 && !batch->error && !batch_write_all(batch->fd, out->str, out->len))
+    batch_set_write_error(batch, batch->temp_path ? batch->temp_path : batch->output_path);
+  if (out->len > 0)
+    openai_ask_log("batch: %zu bytes of answers after a gap kept for the next run", (size_t)out->len);
+  if (!batch->error)
+    batch_commit_output(batch);
+}
+
+/* Writes the records at the front of the window that are ready, with one
+ * write so an interruption can only tear the last of them. */
+static gboolean
+batch_flush(Batch *batch)
+{
+  guint n = 0;
+  while (n < batch->pending->len && g_ptr_array_index(batch->pending, n))
+    n++;
+  if (n == 0)
+    return FALSE;
+
+  g_autoptr(GString) out = g_string_new(NULL);
+  for (guint i = 0; i < n; i++)
+    g_string_append(out, g_ptr_array_index(batch->pending, i));
+  g_ptr_array_remove_range(batch->pending, 0, n);
+  batch->progress.written += n;
+
+  if (!batch->error && !batch_write_all(batch->fd, out->str, out->len))
+    batch_set_write_error(batch, batch->temp_path ? batch->temp_path : batch->output_path);
+  else if (g_hash_table_size(batch->kept) == 0)
+    batch_commit_output(batch);
+  return TRUE;
+}
+
+/* Transport errors, rate limits and server errors may go away. */
+static gboolean
+batch_should_retry(const OpenaiClientResult *result)
+{
+  return result->http_status == 0 || result->http_status == 429 || result->http_status >= 500;
+}
+
+static void batch_submit(Batch *batch, guint index, guint attempt);
+
+static void
+batch_job_finish(BatchJob *job)
+{
+  Batch *batch = job->batch;
+  if (job->ticket)
+    request_ticket_done(job->ticket);
+  g_clear_pointer(&job->conversation, conversation_free);
+  g_free(job);
+  batch->progress.running--;
+  batch_pump(batch);
+  batch_unref(batch);
+}
+
+static void
+batch_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  BatchJob *job = user_data;
+  Batch *batch = job->batch;
+  if (!g_cancellable_is_cancelled(batch->cancellable))
+  {
+    batch->progress.requests++;
+    if (!result->ok && job->attempt + 1 < BATCH_ATTEMPTS && batch_should_retry(result))
+    {
+      openai_ask_log("batch: line %u failed (%s), asking again",
+                     g_array_index(batch->lines, BatchLine, job->index).number,
+                     result->error_message ? result->error_message : "no message");
+      batch_submit(batch, job->index, job->attempt + 1);
+    }
+    else
+    {
+      batch->progress.failed += !result->ok;
+      guint slot = job->index - batch->progress.written;
+      g_free(g_ptr_array_index(batch->pending, slot));
+      g_ptr_array_index(batch->pending, slot) = batch_format_record(batch, job->index, result);
+    }
+  }
+  batch_job_finish(job);
+}
+
+static void
+batch_on_start(RequestTicket *ticket, gpointer user_data)
+{
+  BatchJob *job = user_data;
+  Batch *batch = job->batch;
+  job->ticket = ticket;
+  if (!ticket || g_cancellable_is_cancelled(batch->cancellable))
+    return batch_job_finish(job);
+
+  g_autofree gchar *line = batch_get_line(batch, job->index);
+  g_autofree gchar *prompt = batch_expand(batch->template, line);
+  job->conversation = conversation_new(1);
+  if (batch->system_prompt && *batch->system_prompt)
+    conversation_set_system(job->conversation, batch->system_prompt);
+  conversation_append(job->conversation, CONVERSATION_ROLE_USER, prompt);
+  openai_client_send_chat_async(batch->endpoint,
+                                batch->api_key,
+                                batch->model,
+                                batch->temperature,
+                                job->conversation,
+                                NULL,
+                                batch->cancellable,
+                                batch_on_result,
+                                job);
+}
+
+static void
+batch_submit(Batch *batch, guint index, guint attempt)
+{
+  BatchJob *job = g_new0(BatchJob, 1);
+  job->batch = batch_ref(batch);
+  job->index = index;
+  job->attempt = attempt;
+  batch->progress.running++;
+  request_scheduler_submit(request_scheduler_get_default(),
+                           batch->endpoint,
+                           REQUEST_PRIORITY_BACKGROUND,
+                           batch->owner,
+                           batch->cancellable,
+                           batch_on_start,
+                           job);
+}
+
+static void
+batch_finish(Batch *batch)
+{
+  batch->finished = TRUE;
+  batch_close_output(batch);
+  g_autoptr(GError) error = NULL;
+  if (batch->error)
+    error = g_error_copy(batch->error);
+  else if (batch->progress.written < batch->progress.total)
+    error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED, "The batch was cancelled.");
+  openai_ask_log("batch: %s after %u of %u lines, %u requests in %.1f s (%.1f/s), %u failed",
+                 error ? "stopped" : "done",
+                 batch->progress.written,
+                 batch->progress.total,
+                 batch->progress.requests,
+                 batch->progress.elapsed_us / 1e6,
+                 batch_progress_get_rate(&batch->progress),
+                 batch->progress.failed);
+  if (batch->done_func)
+    batch->done_func(batch, &batch->progress, error, batch->user_data);
+}
+
+/* Starts lines while there is room, writes what is ready and reports. */
+static void
+batch_pump(Batch *batch)
+{
+  if (!batch->started || batch->finished)
+    return;
+  gboolean stopping = g_cancellable_is_cancelled(batch->cancellable);
+  guint window = batch->jobs * BATCH_WINDOW_FACTOR;
+  gboolean wrote = FALSE;
+  for (;;)
+  {
+    while (!stopping && batch->next < batch->lines->len)
+    {
+      gpointer record = NULL;
+      if (g_hash_table_steal_extended(batch->kept, GUINT_TO_POINTER(batch->next), NULL, &record))
+      {
+        g_ptr_array_add(batch->pending, record);
+        batch->next++;
+        batch->progress.resumed++;
+        continue;
+      }
+      if (batch->progress.running >= batch->jobs || batch->pending->len >= window)
+        break;
+      g_ptr_array_add(batch->pending, NULL);
+      batch_submit(batch, batch->next++, 0);
+    }
+    /* Writing frees room in the window for more lines. */
+    if (!batch_flush(batch))
+      break;
+    wrote = TRUE;
+    if (batch->error)
+      break;
+  }
+
+  batch->progress.elapsed_us = g_get_monotonic_time() - batch->started_us;
+  if (!batch->error && batch->progress.written == batch->progress.total)
+    batch_finish(batch);
+  else if ((stopping || batch->error) && batch->progress.running == 0)
+    batch_finish(batch);
+  else if (wrote && batch->progress_func)
+    batch->progress_func(batch, &batch->progress, batch->user_data);
+}
+
+static gboolean
+batch_on_idle_pump(gpointer user_data)
+{
+  Batch *batch = user_data;
+  batch_pump(batch);
+  batch_unref(batch);
+  return G_SOURCE_REMOVE;
+}
+
+void
+batch_start(Batch *batch,
+            const BatchOptions *options,
+            BatchProgressFunc progress,
+            BatchDoneFunc done,
+            gpointer user_data)
+{
+  g_return_if_fail(!batch->started);
+  batch->endpoint = g_strdup(options->endpoint);
+  batch->api_key = options->api_key && *options->api_key ? g_strdup(options->api_key) : NULL;
+  batch->model = g_strdup(options->model);
+  batch->temperature = options->temperature;
+  batch->system_prompt = g_strdup(options->system_prompt);
+  batch->jobs = CLAMP(options->jobs ? options->jobs : BATCH_DEFAULT_JOBS, 1, BATCH_MAX_JOBS);
+  batch->owner = options->owner;
+  batch->progress_func = progress;
+  batch->done_func = done;
+  batch->user_data = user_data;
+  batch->started = TRUE;
+  batch->started_us = g_get_monotonic_time();
+  openai_ask_log("batch: %u lines to %s, %u already written, %u jobs, model=%s",
+                 batch->progress.total,
+                 batch->output_path,
+                 batch->progress.written,
+                 batch->jobs,
+                 batch->model);
+  /* From the main loop, so @done never runs inside this call. */
+  g_idle_add(batch_on_idle_pump, batch_ref(batch));
+}
+
+void
+batch_cancel(Batch *batch)
+{
+  g_cancellable_cancel(batch->cancellable);
+  if (batch->started)
+    g_idle_add(batch_on_idle_pump, batch_ref(batch));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/* Stands for the input line in a batch's prompt template. A template
+ * without it gets the line after a blank line. */
+#define BATCH_PLACEHOLDER "{}"
+#define BATCH_DEFAULT_JOBS 4
+#define BATCH_MAX_JOBS 32
+/* Lines answered ahead of one still running are held in memory until it
+ * comes; no more are started once this many jobs' worth are waiting. */
+#define BATCH_WINDOW_FACTOR 8
+/* A line that fails this many times is written with its error. */
+#define BATCH_ATTEMPTS 2
+
+/* Batch mode: one prompt template asked of every non-empty line of an input
+ * file, with at most a fixed number of requests queued or in flight. Each
+ * request goes through the request scheduler at background priority, so an
+ * endpoint's limit (and its last slot, kept for questions) still holds.
+ *
+ * Answers are appended to the output file as JSON lines,
+ *
+ *   {"line":12,"input":"...","answer":"..."}   or   {...,"error":"..."}
+ *
+ * strictly in input order, each record with a single write. Opening a
+ * batch whose output already exists resumes it: the records up to the
+ * first failed or damaged one are kept, and answers found after it are
+ * written again without asking. Until they have been, the new output goes
+ * to a ".partial" file next to the old one, which it then replaces; a
+ * batch that stops first writes them, and whatever else it has answered,
+ * at the end. The old output is left as it was by a batch that is freed
+ * without being started. Main thread only. */
+typedef struct _Batch Batch;
+
+typedef struct
+{
+  guint total; /* non-empty input lines */
+  guint written; /* records in the output, including resumed ones */
+  guint resumed; /* kept from an earlier run */
+  guint failed; /* written with an error in place of an answer */
+  guint running; /* requests queued or in flight */
+  guint requests; /* came back in this run, retries included */
+  gint64 elapsed_us; /* since batch_start() */
+} BatchProgress;
+
+typedef struct
+{
+  const gchar *endpoint;
+  const gchar *api_key; /* NULL or empty for none */
+  const gchar *model;
+  gdouble temperature;
+  const gchar *system_prompt; /* NULL or empty for none */
+  guint jobs; /* requests queued or in flight at most; 0 = BATCH_DEFAULT_JOBS */
+  guint64 owner; /* in the request scheduler */
+} BatchOptions;
+
+typedef void (*BatchProgressFunc)(Batch *batch, const BatchProgress *progress, gpointer user_data);
+/* @error is NULL once every line has a record, G_IO_ERROR_CANCELLED after
+ * batch_cancel(), or why the output could not be written. */
+typedef void (*BatchDoneFunc)(Batch *batch, const BatchProgress *progress, const GError *error, gpointer user_data);
+
+/* Reads @input_path and whatever an earlier run left in @output_path,
+ * which is created if needed. Nothing is sent until batch_start(). */
+Batch *batch_open(const gchar *template, const gchar *input_path, const gchar *output_path, GError **error);
+/* Cancels whatever is running and writes out what was answered; no
+ * callback is called after this. */
+void batch_free(Batch *batch);
+
+/* @options is copied. @progress is called whenever records are written. */
+void batch_start(Batch *batch,
+                 const BatchOptions *options,
+                 BatchProgressFunc progress,
+                 BatchDoneFunc done,
+                 gpointer user_data);
+/* Stops starting lines and cancels the running ones; @done follows once
+ * they have all come back. The output stays resumable. */
+void batch_cancel(Batch *batch);
+
+const BatchProgress *batch_get_progress(const Batch *batch);
+const gchar *batch_get_output_path(const Batch *batch);
+
+/* "37 of 120 lines · 4.2 requests/s · 2 failed", for status lines. */
+gchar *batch_progress_describe(const BatchProgress *progress);
+gdouble batch_progress_get_rate(const BatchProgress *progress);
+
+/* @template with every BATCH_PLACEHOLDER replaced by @input. */
+gchar *batch_expand(const gchar *template, const gchar *input);
+/* @input_path with ".answers.jsonl" appended. */
+gchar *batch_default_output_path(const gchar *input_path);
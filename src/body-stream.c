@@ -0,0 +1,290 @@
+#include "body-stream.h"
+
+#include <string.h>
+
+/* Attachment bytes read from disk at a time. */
+#define BODY_STREAM_CHUNK (64 * 1024)
+/* Longest UTF-8 sequence; a shorter tail of a chunk may be cut off. */
+#define BODY_STREAM_MAX_SEQUENCE 4
+
+typedef struct
+{
+  GBytes *raw;                   /* already JSON */
+  const Attachment *attachment; /* escaped while reading */
+} BodySegment;
+
+struct _OpenaiBodyStream
+{
+  GInputStream parent_instance;
+
+  GPtrArray *attachments;
+  GArray *segments; /* element-type BodySegment */
+  goffset size;
+
+  guint current;
+  gsize offset; /* input bytes of the current segment consumed */
+  guchar *chunk; /* attachment bytes [chunk_start, chunk_start + chunk_len) */
+  const Attachment *chunk_attachment;
+  gsize chunk_start;
+  gsize chunk_len;
+  GError *error; /* from sizing, reported by the first read */
+  gchar pending[8]; /* an escape that did not fit the caller's buffer */
+  gsize pending_len;
+  gsize pending_pos;
+};
+
+G_DEFINE_TYPE(OpenaiBodyStream, openai_body_stream, G_TYPE_INPUT_STREAM)
+
+/* JSON-escapes @in into at most @out_len bytes of @out without splitting an
+ * escape or a UTF-8 sequence; with @out NULL it only counts. Invalid UTF-8
+ * becomes U+FFFD. Unless @last, a UTF-8 sequence cut off by the end of @in
+ * is left for the next call. Returns the bytes produced and sets @consumed. */
+static gsize
+body_stream_escape(const guchar *in, gsize in_len, gboolean last, gchar *out, gsize out_len, gsize *consumed)
+{
+  gsize i = 0;
+  gsize o = 0;
+  while (i < in_len && o < out_len)
+  {
+    guchar c = in[i];
+    if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+    {
+      gsize j = i + 1;
+      while (j < in_len && in[j] >= 0x20 && in[j] < 0x80 && in[j] != '"' && in[j] != '\\')
+        j++;
+      gsize n = MIN(j - i, out_len - o);
+      if (out)
+        memcpy(out + o, in + i, n);
+      o += n;
+      i += n;
+      continue;
+    }
+
+    gchar buf[8];
+    const gchar *src = buf;
+    gsize n = 2;
+    gsize advance = 1;
+    if (c < 0x80)
+    {
+      switch (c)
+      {
+      case '"':
+        src = "\\\"";
+        break;
+      case '\\':
+        src = "\\\\";
+        break;
+      case '\n':
+        src = "\\n";
+        break;
+      case '\r':
+        src = "\\r";
+        break;
+      case '\t':
+        src = "\\t";
+        break;
+      default:
+        n = (gsize)g_snprintf(buf, sizeof(buf), "\\u%04x", c);
+        break;
+      }
+    }
+    else
+    {
+      gunichar ch = g_utf8_get_char_validated((const gchar *)in + i, (gssize)(in_len - i));
+      if (ch == (gunichar)-2 && !last && in_len - i < BODY_STREAM_MAX_SEQUENCE)
+        break;
+      if (ch == (gunichar)-1 || ch == (gunichar)-2)
+      {
+        src = "\\ufffd";
+        n = 6;
+      }
+      else
+      {
+        src = (const gchar *)in + i;
+        n = advance = (gsize)g_utf8_skip[c];
+      }
+    }
+    if (o + n > out_len)
+      break;
+    if (out)
+      memcpy(out + o, src, n);
+    o += n;
+    i += advance;
+  }
+  *consumed = i;
+  return o;
+}
+
+static void
+body_stream_add_raw(OpenaiBodyStream *self, const gchar *json)
+{
+  BodySegment seg = {g_bytes_new(json, strlen(json)), NULL};
+  g_array_append_val(self->segments, seg);
+  self->size += (goffset)strlen(json);
+}
+
+static void
+body_stream_add_text(OpenaiBodyStream *self, const gchar *text)
+{
+  gsize len = strlen(text);
+  gchar *json = g_malloc(len * 6 + 1);
+  gsize consumed = 0;
+  gsize n = body_stream_escape((const guchar *)text, len, TRUE, json, len * 6, &consumed);
+  json[n] = '\0';
+  body_stream_add_raw(self, json);
+  g_free(json);
+}
+
+static void
+body_stream_add_attachment(OpenaiBodyStream *self, const Attachment *attachment)
+{
+  g_autofree gchar *header = g_strdup_printf("\n\n--- %s ---\n", attachment_get_name(attachment));
+  g_autofree gchar *footer = g_strdup_printf("\n--- end of %s ---", attachment_get_name(attachment));
+  body_stream_add_text(self, header);
+
+  BodySegment seg = {NULL, attachment};
+  g_array_append_val(self->segments, seg);
+  gsize len = attachment_get_size(attachment);
+  gsize offset = 0;
+  while (offset < len && !self->error)
+  {
+    gsize n = MIN(len - offset, BODY_STREAM_CHUNK);
+    if (!attachment_read(attachment, offset, self->chunk, n, &self->error))
+      break;
+    gsize consumed = 0;
+    self->size += (goffset)body_stream_escape(self->chunk, n, offset + n == len, NULL, G_MAXSIZE, &consumed);
+    offset += consumed;
+  }
+
+  body_stream_add_text(self, footer);
+}
+
+/* Makes sure the chunk holds the attachment bytes at the current offset,
+ * and at least a whole UTF-8 sequence of them unless the file ends sooner. */
+static gboolean
+body_stream_fill(OpenaiBodyStream *self, const Attachment *attachment, gsize len, GError **error)
+{
+  gsize end = self->chunk_start + self->chunk_len;
+  if (self->chunk_attachment == attachment && self->offset >= self->chunk_start &&
+      (end == len || end - self->offset >= BODY_STREAM_MAX_SEQUENCE))
+    return TRUE;
+
+  gsize n = MIN(len - self->offset, BODY_STREAM_CHUNK);
+  self->chunk_attachment = NULL;
+  if (!attachment_read(attachment, self->offset, self->chunk, n, error))
+    return FALSE;
+  self->chunk_attachment = attachment;
+  self->chunk_start = self->offset;
+  self->chunk_len = n;
+  return TRUE;
+}
+
+static gssize
+openai_body_stream_read(GInputStream *stream, void *buffer, gsize count, GCancellable *cancellable, GError **error)
+{
+  OpenaiBodyStream *self = OPENAI_BODY_STREAM(stream);
+  gchar *out = buffer;
+  gsize written = 0;
+
+  if (g_cancellable_set_error_if_cancelled(cancellable, error))
+    return -1;
+  if (self->error)
+  {
+    g_propagate_error(error, g_error_copy(self->error));
+    return -1;
+  }
+
+  while (written < count && (self->pending_pos < self->pending_len || self->current < self->segments->len))
+  {
+    if (self->pending_pos < self->pending_len)
+    {
+      gsize n = MIN(self->pending_len - self->pending_pos, count - written);
+      memcpy(out + written, self->pending + self->pending_pos, n);
+      self->pending_pos += n;
+      written += n;
+      continue;
+    }
+
+    BodySegment *seg = &g_array_index(self->segments, BodySegment, self->current);
+    gsize len = 0;
+    if (seg->raw)
+    {
+      const gchar *data = g_bytes_get_data(seg->raw, &len);
+      gsize n = MIN(len - self->offset, count - written);
+      memcpy(out + written, data + self->offset, n);
+      self->offset += n;
+      written += n;
+    }
+    else
+    {
+      len = attachment_get_size(seg->attachment);
+      if (!body_stream_fill(self, seg->attachment, len, error))
+        return -1;
+      const guchar *data = self->chunk + (self->offset - self->chunk_start);
+      gsize avail = self->chunk_start + self->chunk_len - self->offset;
+      gboolean last = self->chunk_start + self->chunk_len == len;
+      gsize consumed = 0;
+      gsize n = body_stream_escape(data, avail, last, out + written, count - written, &consumed);
+      if (consumed == 0)
+      {
+        /* The next escape is longer than the space left; hand it out in pieces. */
+        self->pending_len = body_stream_escape(data, avail, last, self->pending, sizeof(self->pending), &consumed);
+        self->pending_pos = 0;
+      }
+      self->offset += consumed;
+      written += n;
+    }
+
+    if (self->offset == len)
+    {
+      self->current++;
+      self->offset = 0;
+    }
+  }
+  return (gssize)written;
+}
+
+static void
+openai_body_stream_finalize(GObject *object)
+{
+  OpenaiBodyStream *self = OPENAI_BODY_STREAM(object);
+  for (guint i = 0; i < self->segments->len; i++)
+    g_clear_pointer(&g_array_index(self->segments, BodySegment, i).raw, g_bytes_unref);
+  g_array_unref(self->segments);
+  g_ptr_array_unref(self->attachments);
+  g_free(self->chunk);
+  g_clear_error(&self->error);
+  G_OBJECT_CLASS(openai_body_stream_parent_class)->finalize(object);
+}
+
+static void
+openai_body_stream_class_init(OpenaiBodyStreamClass *klass)
+{
+  G_OBJECT_CLASS(klass)->finalize = openai_body_stream_finalize;
+  G_INPUT_STREAM_CLASS(klass)->read_fn = openai_body_stream_read;
+}
+
+static void
+openai_body_stream_init(OpenaiBodyStream *self)
+{
+  self->segments = g_array_new(FALSE, FALSE, sizeof(BodySegment));
+  self->chunk = g_malloc(BODY_STREAM_CHUNK);
+}
+
+GInputStream *
+openai_body_stream_new(const gchar *prefix, GPtrArray *attachments, const gchar *suffix)
+{
+  OpenaiBodyStream *self = g_object_new(OPENAI_TYPE_BODY_STREAM, NULL);
+  self->attachments = g_ptr_array_ref(attachments);
+  body_stream_add_raw(self, prefix);
+  for (guint i = 0; i < attachments->len; i++)
+    body_stream_add_attachment(self, g_ptr_array_index(attachments, i));
+  body_stream_add_raw(self, suffix);
+  return G_INPUT_STREAM(self);
+}
+
+goffset
+openai_body_stream_get_size(OpenaiBodyStream *stream)
+{
+  return stream->size;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "attachment.h"
+
+#define OPENAI_TYPE_BODY_STREAM (openai_body_stream_get_type())
+G_DECLARE_FINAL_TYPE(OpenaiBodyStream, openai_body_stream, OPENAI, BODY_STREAM, GInputStream)
+
+/* A JSON request body read as @prefix, then each attachment JSON-escaped
+ * on the fly (with a short header and footer), then @suffix. @prefix must
+ * end inside a string value and @suffix continue it. Attachments are
+ * read from disk in fixed-size chunks and escaped a read() at a time, so
+ * memory use does not grow with their size. If one cannot be read, or
+ * changed since it was attached, reading the stream fails. Holds a
+ * reference to @attachments. */
+GInputStream *openai_body_stream_new(const gchar *prefix, GPtrArray *attachments, const gchar *suffix);
+
+/* Exact number of bytes the stream produces, for Content-Length. */
+goffset openai_body_stream_get_size(OpenaiBodyStream *stream);
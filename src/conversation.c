@@ -0,0 +1,250 @@
+#include "conversation.h"
+
+#include <string.h>
+
+/* Dropped turns stay in the arena until it is compacted, which happens once
+ * it holds this much more than the live turns (and at least twice as much). */
+#define CONVERSATION_ARENA_SLACK (64 * 1024)
+
+struct _Conversation
+{
+  GStringChunk *arena;
+  gsize arena_bytes;
+  gsize live_bytes;
+
+  gboolean has_system;
+  ConversationTurn system;
+  gboolean has_summary;
+  ConversationTurn summary;
+
+  ConversationTurn *ring;
+  guint capacity;
+  guint head; /* oldest turn */
+  guint count;
+  guint64 next_seq;
+};
+
+/* Sent as a second system message, ahead of the remaining turns. */
+#define CONVERSATION_SUMMARY_PREFIX "Summary of the earlier conversation:\n"
+
+static const gchar *const conversation_roles[] = {
+  [CONVERSATION_ROLE_SYSTEM] = "system",
+  [CONVERSATION_ROLE_USER] = "user",
+  [CONVERSATION_ROLE_ASSISTANT] = "assistant",
+};
+
+const gchar *
+conversation_role_to_string(ConversationRole role)
+{
+  if ((guint)role >= G_N_ELEMENTS(conversation_roles))
+    return "user";
+  return conversation_roles[role];
+}
+
+Conversation *
+conversation_new(guint capacity)
+{
+  Conversation *conversation = g_new0(Conversation, 1);
+  conversation->capacity = MAX(capacity, 1);
+  conversation->ring = g_new0(ConversationTurn, conversation->capacity);
+  conversation->arena = g_string_chunk_new(4096);
+  return conversation;
+}
+
+void
+conversation_free(Conversation *conversation)
+{
+  if (!conversation)
+    return;
+  g_string_chunk_free(conversation->arena);
+  g_free(conversation->ring);
+  g_free(conversation);
+}
+
+void
+conversation_clear(Conversation *conversation)
+{
+  g_string_chunk_clear(conversation->arena);
+  conversation->arena_bytes = 0;
+  conversation->live_bytes = 0;
+  conversation->has_system = FALSE;
+  conversation->has_summary = FALSE;
+  conversation->head = 0;
+  conversation->count = 0;
+  conversation->next_seq = 0;
+}
+
+static void
+conversation_store(Conversation *conversation, ConversationTurn *turn, ConversationRole role, const gchar *content)
+{
+  gsize len = content ? strlen(content) : 0;
+  turn->role = role;
+  turn->len = len;
+  turn->content = g_string_chunk_insert_len(conversation->arena, content ? content : "", (gssize)len);
+  conversation->arena_bytes += len + 1;
+  conversation->live_bytes += len + 1;
+}
+
+static void
+conversation_compact(Conversation *conversation)
+{
+  if (conversation->arena_bytes <= 2 * conversation->live_bytes + CONVERSATION_ARENA_SLACK)
+    return;
+
+  GStringChunk *old = conversation->arena;
+  conversation->arena = g_string_chunk_new(MAX(conversation->live_bytes, 4096));
+  conversation->arena_bytes = conversation->live_bytes;
+  if (conversation->has_system)
+    conversation->system.content =
+      g_string_chunk_insert_len(conversation->arena, conversation->system.content, (gssize)conversation->system.len);
+  if (conversation->has_summary)
+    conversation->summary.content =
+      g_string_chunk_insert_len(conversation->arena, conversation->summary.content, (gssize)conversation->summary.len);
+  for (guint i = 0; i < conversation->count; i++)
+  {
+    ConversationTurn *turn = &conversation->ring[(conversation->head + i) % conversation->capacity];
+    turn->content = g_string_chunk_insert_len(conversation->arena, turn->content, (gssize)turn->len);
+  }
+  g_string_chunk_free(old);
+}
+
+void
+conversation_set_system(Conversation *conversation, const gchar *content)
+{
+  if (conversation->has_system)
+    conversation->live_bytes -= conversation->system.len + 1;
+  conversation->has_system = content && *content;
+  if (conversation->has_system)
+    conversation_store(conversation, &conversation->system, CONVERSATION_ROLE_SYSTEM, content);
+  conversation_compact(conversation);
+}
+
+void
+conversation_append(Conversation *conversation, ConversationRole role, const gchar *content)
+{
+  ConversationTurn *turn;
+  if (conversation->count == conversation->capacity)
+  {
+    turn = &conversation->ring[conversation->head];
+    conversation->live_bytes -= turn->len + 1;
+    conversation->head = (conversation->head + 1) % conversation->capacity;
+  }
+  else
+  {
+    turn = &conversation->ring[(conversation->head + conversation->count) % conversation->capacity];
+    conversation->count++;
+  }
+  conversation_store(conversation, turn, role, content);
+  conversation->next_seq++;
+  conversation_compact(conversation);
+}
+
+void
+conversation_drop_last(Conversation *conversation)
+{
+  if (conversation->count == 0)
+    return;
+  conversation->count--;
+  conversation->live_bytes -= conversation->ring[(conversation->head + conversation->count) % conversation->capacity].len + 1;
+  conversation->next_seq--;
+  conversation_compact(conversation);
+}
+
+guint
+conversation_get_length(const Conversation *conversation)
+{
+  return conversation->count + (conversation->has_system ? 1 : 0) + (conversation->has_summary ? 1 : 0);
+}
+
+const ConversationTurn *
+conversation_get_turn(const Conversation *conversation, guint index)
+{
+  if (conversation->has_system)
+  {
+    if (index == 0)
+      return &conversation->system;
+    index--;
+  }
+  if (conversation->has_summary)
+  {
+    if (index == 0)
+      return &conversation->summary;
+    index--;
+  }
+  if (index >= conversation->count)
+    return NULL;
+  return &conversation->ring[(conversation->head + index) % conversation->capacity];
+}
+
+const ConversationTurn *
+conversation_get_last(const Conversation *conversation, ConversationRole role)
+{
+  for (guint i = conversation->count; i > 0; i--)
+  {
+    const ConversationTurn *turn = &conversation->ring[(conversation->head + i - 1) % conversation->capacity];
+    if (turn->role == role)
+      return turn;
+  }
+  if (conversation->has_system && role == CONVERSATION_ROLE_SYSTEM)
+    return &conversation->system;
+  return NULL;
+}
+
+guint64
+conversation_get_next_seq(const Conversation *conversation)
+{
+  return conversation->next_seq;
+}
+
+guint
+conversation_get_turn_count(const Conversation *conversation)
+{
+  return conversation->count;
+}
+
+gchar *
+conversation_format_transcript(const Conversation *conversation, guint64 before_seq)
+{
+  guint64 first_seq = conversation->next_seq - conversation->count;
+  guint n = before_seq > first_seq ? (guint)MIN(before_seq - first_seq, conversation->count) : 0;
+  if (n == 0)
+    return NULL;
+
+  GString *out = g_string_new(NULL);
+  if (conversation->has_summary)
+  {
+    g_string_append_len(out, conversation->summary.content, (gssize)conversation->summary.len);
+    g_string_append(out, "\n\n");
+  }
+  for (guint i = 0; i < n; i++)
+  {
+    const ConversationTurn *turn = &conversation->ring[(conversation->head + i) % conversation->capacity];
+    g_string_append(out, turn->role == CONVERSATION_ROLE_ASSISTANT ? "Assistant: " : "User: ");
+    g_string_append_len(out, turn->content, (gssize)turn->len);
+    g_string_append(out, "\n\n");
+  }
+  return g_string_free(out, FALSE);
+}
+
+void
+conversation_summarize_before(Conversation *conversation, guint64 before_seq, const gchar *summary)
+{
+  guint64 first_seq = conversation->next_seq - conversation->count;
+  guint n = before_seq > first_seq ? (guint)MIN(before_seq - first_seq, conversation->count) : 0;
+  for (guint i = 0; i < n; i++)
+  {
+    conversation->live_bytes -= conversation->ring[conversation->head].len + 1;
+    conversation->head = (conversation->head + 1) % conversation->capacity;
+    conversation->count--;
+  }
+
+  if (conversation->has_summary)
+    conversation->live_bytes -= conversation->summary.len + 1;
+  conversation->has_summary = summary && *summary;
+  if (conversation->has_summary)
+  {
+    g_autofree gchar *content = g_strconcat(CONVERSATION_SUMMARY_PREFIX, summary, NULL);
+    conversation_store(conversation, &conversation->summary, CONVERSATION_ROLE_SYSTEM, content);
+  }
+  conversation_compact(conversation);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glib.h>
+
+typedef enum
+{
+  CONVERSATION_ROLE_SYSTEM,
+  CONVERSATION_ROLE_USER,
+  CONVERSATION_ROLE_ASSISTANT,
+} ConversationRole;
+
+typedef struct
+{
+  ConversationRole role;
+  const gchar *content; /* owned by the conversation */
+  gsize len;
+} ConversationTurn;
+
+/* A chat session: an optional pinned system prompt plus a fixed-capacity
+ * ring of turns whose text lives in one string arena. Appending to a full
+ * ring drops the oldest turn in O(1); clearing releases the whole session
+ * at once. */
+typedef struct _Conversation Conversation;
+
+Conversation *conversation_new(guint capacity);
+void conversation_free(Conversation *conversation);
+void conversation_clear(Conversation *conversation);
+
+const gchar *conversation_role_to_string(ConversationRole role);
+
+/* Replaces the pinned system prompt; NULL or "" removes it. */
+void conversation_set_system(Conversation *conversation, const gchar *content);
+void conversation_append(Conversation *conversation, ConversationRole role, const gchar *content);
+/* Drops the newest turn, e.g. an answer to be asked for again; its number
+ * is given to the next one appended. */
+void conversation_drop_last(Conversation *conversation);
+
+/* Number of turns including the system prompt, which comes first, and the
+ * summary of compacted turns, which comes next. */
+guint conversation_get_length(const Conversation *conversation);
+const ConversationTurn *conversation_get_turn(const Conversation *conversation, guint index);
+
+/* The newest turn with @role, or NULL. */
+const ConversationTurn *conversation_get_last(const Conversation *conversation, ConversationRole role);
+
+/* Appended turns are numbered from 0 until the next clear; this is the
+ * number the next one gets. */
+guint64 conversation_get_next_seq(const Conversation *conversation);
+/* Number of turns in the ring, not counting the system prompt or summary. */
+guint conversation_get_turn_count(const Conversation *conversation);
+
+/* The current summary followed by the turns numbered below @before_seq, as
+ * "User: ..." / "Assistant: ..." paragraphs, for a summarization request.
+ * NULL if there is nothing to summarize. */
+gchar *conversation_format_transcript(const Conversation *conversation, guint64 before_seq);
+/* Replaces the summary with @summary and drops the turns numbered below
+ * @before_seq (some may already have fallen out of the ring). */
+void conversation_summarize_before(Conversation *conversation, guint64 before_seq, const gchar *summary);
@@ -0,0 +1,253 @@
+#include "engine-client.h"
+
+#include "keyring.h"
+#include "log.h"
+
+typedef struct
+{
+  guint64 tag;
+  gchar *endpoint;
+  gchar *model;
+  gdouble temperature;
+  GVariant *messages; /* a(ss), kept for the in-process fallback */
+  GCancellable *cancellable;
+  OpenaiClientCallback callback;
+  gpointer user_data;
+} EngineClientCtx;
+
+static void
+engine_client_ctx_free(EngineClientCtx *ctx)
+{
+  g_free(ctx->endpoint);
+  g_free(ctx->model);
+  g_clear_pointer(&ctx->messages, g_variant_unref);
+  g_clear_object(&ctx->cancellable);
+  g_free(ctx);
+}
+
+static GDBusConnection *
+engine_client_get_bus(void)
+{
+  static GDBusConnection *bus = NULL;
+  if (!bus)
+  {
+    g_autoptr(GError) error = NULL;
+    bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (!bus)
+      openai_ask_log("engine: no session bus: %s", error ? error->message : "");
+  }
+  return bus;
+}
+
+static void
+engine_client_complete(EngineClientCtx *ctx, gboolean ok, gint http_status, const gchar *content, const gchar *error)
+{
+  OpenaiClientResult result = {
+    .ok = ok,
+    .http_status = http_status,
+    .content = (gchar *)(ok ? content : NULL),
+    .error_message = (gchar *)(ok ? NULL : (error && *error ? error : "Request failed.")),
+  };
+  if (ctx->callback)
+    ctx->callback(&result, ctx->user_data);
+}
+
+/* The engine is not installed, not running and not activatable, or failed
+ * to start: none of these mean the request itself went wrong. */
+static gboolean
+engine_client_is_unavailable(const GError *error)
+{
+  return g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_EXEC_FAILED) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_CHILD_EXITED) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_SERVICE_NOT_FOUND) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_SERVICE_INVALID) ||
+         g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_FAILED);
+}
+
+static void
+engine_client_on_local_result(OpenaiClientResult *result, gpointer user_data)
+{
+  EngineClientCtx *ctx = user_data;
+  if (ctx->callback)
+    ctx->callback(result, ctx->user_data);
+  engine_client_ctx_free(ctx);
+}
+
+static void
+engine_client_send_local(EngineClientCtx *ctx)
+{
+  g_autofree gchar *api_key = keyring_lookup_api_key(ctx->endpoint);
+  if (!api_key || !*api_key)
+  {
+    engine_client_complete(ctx, FALSE, 0, NULL, "No API key found for this endpoint.");
+    return engine_client_ctx_free(ctx);
+  }
+
+  Conversation *conversation = engine_conversation_from_variant(ctx->messages);
+  /* The request body is built before this returns. */
+  openai_client_send_chat_async(ctx->endpoint,
+                                api_key,
+                                ctx->model,
+                                ctx->temperature,
+                                conversation,
+                                NULL,
+                                ctx->cancellable,
+                                engine_client_on_local_result,
+                                ctx);
+  conversation_free(conversation);
+}
+
+static void
+engine_client_on_ask_finish(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  EngineClientCtx *ctx = user_data;
+  GDBusConnection *bus = G_DBUS_CONNECTION(source);
+
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GVariant) reply = g_dbus_connection_call_finish(bus, res, &error);
+  if (reply)
+  {
+    gboolean ok = FALSE;
+    gint32 status = 0;
+    const gchar *content = NULL;
+    const gchar *message = NULL;
+    g_variant_get(reply, "(bi&s&s)", &ok, &status, &content, &message);
+    openai_ask_log("engine: reply ok=%d status=%d", ok, status);
+    engine_client_complete(ctx, ok, status, content, message);
+    return engine_client_ctx_free(ctx);
+  }
+
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  {
+    /* Only our side of the call is gone; stop the engine's request too. */
+    g_dbus_connection_call(bus,
+                           ENGINE_BUS_NAME,
+                           ENGINE_OBJECT_PATH,
+                           ENGINE_INTERFACE,
+                           "Cancel",
+                           g_variant_new("(t)", ctx->tag),
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                           -1,
+                           NULL,
+                           NULL,
+                           NULL);
+    engine_client_complete(ctx, FALSE, 0, NULL, error->message);
+    return engine_client_ctx_free(ctx);
+  }
+
+  if (engine_client_is_unavailable(error))
+  {
+    openai_ask_log("engine: unavailable (%s), sending in-process", error->message);
+    return engine_client_send_local(ctx);
+  }
+
+  /* Typically NoReply or Disconnected: the engine crashed or was killed. */
+  openai_ask_log("engine: call failed: %s", error->message);
+  g_autofree gchar *message = g_strdup_printf("The xfce-ask engine failed: %s", error->message);
+  engine_client_complete(ctx, FALSE, 0, NULL, message);
+  engine_client_ctx_free(ctx);
+}
+
+Conversation *
+engine_conversation_from_variant(GVariant *messages)
+{
+  gsize n = g_variant_n_children(messages);
+  Conversation *conversation = conversation_new((guint)MAX(n, 1));
+  for (gsize i = 0; i < n; i++)
+  {
+    const gchar *role = NULL;
+    const gchar *content = NULL;
+    g_variant_get_child(messages, i, "(&s&s)", &role, &content);
+    ConversationRole r = CONVERSATION_ROLE_USER;
+    if (g_strcmp0(role, "system") == 0)
+      r = CONVERSATION_ROLE_SYSTEM;
+    else if (g_strcmp0(role, "assistant") == 0)
+      r = CONVERSATION_ROLE_ASSISTANT;
+    /* Only the first system message is the pinned prompt; a later one is a
+     * summary of compacted turns and keeps its place in the ring. */
+    if (r == CONVERSATION_ROLE_SYSTEM && i == 0)
+      conversation_set_system(conversation, content);
+    else
+      conversation_append(conversation, r, content);
+  }
+  return conversation;
+}
+
+void
+engine_client_send_chat_async(const gchar *endpoint,
+                              const gchar *model,
+                              gdouble temperature,
+                              const Conversation *conversation,
+                              GCancellable *cancellable,
+                              OpenaiClientCallback callback,
+                              gpointer user_data)
+{
+  g_return_if_fail(endpoint && *endpoint);
+  g_return_if_fail(model && *model);
+  g_return_if_fail(conversation != NULL);
+
+  static guint64 next_tag = 0;
+
+  GVariantBuilder messages;
+  g_variant_builder_init(&messages, G_VARIANT_TYPE("a(ss)"));
+  guint n_turns = conversation_get_length(conversation);
+  for (guint i = 0; i < n_turns; i++)
+  {
+    const ConversationTurn *turn = conversation_get_turn(conversation, i);
+    g_variant_builder_add(&messages, "(ss)", conversation_role_to_string(turn->role), turn->content);
+  }
+
+  EngineClientCtx *ctx = g_new0(EngineClientCtx, 1);
+  ctx->tag = ++next_tag;
+  ctx->endpoint = g_strdup(endpoint);
+  ctx->model = g_strdup(model);
+  ctx->temperature = temperature;
+  ctx->messages = g_variant_ref_sink(g_variant_builder_end(&messages));
+  ctx->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+  ctx->callback = callback;
+  ctx->user_data = user_data;
+
+  GDBusConnection *bus = engine_client_get_bus();
+  if (!bus)
+    return engine_client_send_local(ctx);
+
+  /* No timeout: the engine answers when the provider does, and the caller
+   * cancels through @cancellable. */
+  g_dbus_connection_call(bus,
+                         ENGINE_BUS_NAME,
+                         ENGINE_OBJECT_PATH,
+                         ENGINE_INTERFACE,
+                         "Ask",
+                         g_variant_new("(tssd@a(ss))", ctx->tag, endpoint, model, temperature, ctx->messages),
+                         G_VARIANT_TYPE("(biss)"),
+                         G_DBUS_CALL_FLAGS_NONE,
+                         G_MAXINT,
+                         cancellable,
+                         engine_client_on_ask_finish,
+                         ctx);
+}
+
+void
+engine_client_forget_key(const gchar *endpoint)
+{
+  if (!endpoint || !*endpoint)
+    return;
+  GDBusConnection *bus = engine_client_get_bus();
+  if (!bus)
+    return;
+  g_dbus_connection_call(bus,
+                         ENGINE_BUS_NAME,
+                         ENGINE_OBJECT_PATH,
+                         ENGINE_INTERFACE,
+                         "ForgetKey",
+                         g_variant_new("(s)", endpoint),
+                         NULL,
+                         G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                         -1,
+                         NULL,
+                         NULL,
+                         NULL);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "conversation.h"
+#include "openai-client.h"
+
+/* xfce-ask-engine: an optional D-Bus activated daemon that sends chat
+ * requests for every panel instance (and the CLI) from one process, with
+ * one connection pool and one keyring cache. */
+#define ENGINE_BUS_NAME "com.rab.XfceAsk.Engine"
+#define ENGINE_OBJECT_PATH "/com/rab/XfceAsk/Engine"
+#define ENGINE_INTERFACE "com.rab.XfceAsk.Engine1"
+
+/* Same contract as openai_client_send_chat_async(), but the request runs in
+ * the engine, which looks up the API key itself. If the engine cannot be
+ * started the request runs in-process instead; if it dies mid-request the
+ * callback gets an error. @conversation is copied before returning. */
+void engine_client_send_chat_async(const gchar *endpoint,
+                                   const gchar *model,
+                                   gdouble temperature,
+                                   const Conversation *conversation,
+                                   GCancellable *cancellable,
+                                   OpenaiClientCallback callback,
+                                   gpointer user_data);
+
+/* Rebuilds a conversation from an Ask call's a(ss) messages. */
+Conversation *engine_conversation_from_variant(GVariant *messages);
+
+/* Tells a running engine to drop its cached key for @endpoint, e.g. after
+ * the key was changed or cleared. Does not start the engine. */
+void engine_client_forget_key(const gchar *endpoint);
@@ -0,0 +1,830 @@
+#define _GNU_SOURCE
+#include "history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/* On-disk format: a sequence of records, each
+ *
+ *   "OAH1" | u32 LE length | gzip member of length bytes
+ *
+ * The gzip member holds "timestamp\0conversation\0model\0prompt\0answer".
+ * A conversation field followed by " replaces" marks an exchange that takes
+ * the place of the conversation's previous one (see history_replace_last());
+ * readers that predate it parse the number and ignore the rest.
+ * Records are written with a single append and fdatasync()ed, so a crash
+ * can only leave a torn record, at the end until later appends follow it. The reader skips
+ * it for the next magic whose record is complete and passes its gzip CRC.
+ * Nothing before it is ever rewritten. */
+#define HISTORY_MAGIC "OAH1"
+#define HISTORY_HEADER_BYTES 8
+#define HISTORY_REPLACES " replaces"
+#define HISTORY_MAX_RECORD_BYTES (16 * 1024 * 1024)
+#define HISTORY_TERM_MIN_BYTES 2
+#define HISTORY_TERM_MAX_BYTES 48
+#define HISTORY_PREVIEW_CHARS 96
+#define HISTORY_PREFIX_EXPANSIONS 64
+
+typedef struct
+{
+  gint64 offset;
+  gint64 timestamp;
+  gint64 conversation;
+  const gchar *preview;
+} HistoryRecord;
+
+/* Postings are record ids in ascending order; ids are positions in records. */
+typedef struct
+{
+  GArray *records; /* element-type HistoryRecord */
+  GHashTable *terms; /* term -> GArray of guint32 */
+  GHashTable *conversations; /* gint64* -> GArray of guint32 */
+  GPtrArray *vocab; /* terms, sorted once vocab_sorted is set */
+  gboolean vocab_sorted;
+  GStringChunk *strings;
+  GString *scratch;
+  gint64 end; /* file offset up to which records have been indexed */
+  guint superseded; /* records replaced by a later one, not in conversations */
+} HistoryIndex;
+
+struct _History
+{
+  gchar *path;
+  gint fd;
+  HistoryIndex *index; /* NULL while loading */
+  GCancellable *cancellable;
+  HistoryLoadedFunc loaded;
+  gpointer loaded_data;
+};
+
+static const gchar *const history_stopwords[] = {
+  "an", "and", "are", "as", "at", "be", "but", "by", "can", "do", "for", "from", "has", "have", "how", "if", "in",
+  "is", "it", "its", "not", "of", "on", "or", "that", "the", "this", "to", "was", "what", "with", "you", "your",
+};
+
+static gint
+history_cmp_str(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+static gboolean
+history_is_stopword(const gchar *term)
+{
+  return bsearch(&term, history_stopwords, G_N_ELEMENTS(history_stopwords), sizeof(history_stopwords[0]), history_cmp_str) !=
+         NULL;
+}
+
+static void
+history_postings_free(gpointer data)
+{
+  g_array_unref(data);
+}
+
+static HistoryIndex *
+history_index_new(void)
+{
+  HistoryIndex *index = g_new0(HistoryIndex, 1);
+  index->records = g_array_new(FALSE, FALSE, sizeof(HistoryRecord));
+  index->terms = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, history_postings_free);
+  index->conversations = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, history_postings_free);
+  index->vocab = g_ptr_array_new();
+  index->strings = g_string_chunk_new(64 * 1024);
+  index->scratch = g_string_new(NULL);
+  return index;
+}
+
+static void
+history_index_free(gpointer data)
+{
+  HistoryIndex *index = data;
+  if (!index)
+    return;
+  g_array_unref(index->records);
+  g_hash_table_unref(index->terms);
+  g_hash_table_unref(index->conversations);
+  g_ptr_array_unref(index->vocab);
+  g_string_chunk_free(index->strings);
+  g_string_free(index->scratch, TRUE);
+  g_free(index);
+}
+
+static void
+history_postings_add(GArray *postings, guint32 id)
+{
+  if (postings->len == 0 || g_array_index(postings, guint32, postings->len - 1) != id)
+    g_array_append_val(postings, id);
+}
+
+/* First position in the sorted vocabulary whose term is >= @term. */
+static guint
+history_vocab_lower_bound(HistoryIndex *index, const gchar *term)
+{
+  guint lo = 0, hi = index->vocab->len;
+  while (lo < hi)
+  {
+    guint mid = lo + (hi - lo) / 2;
+    if (strcmp(g_ptr_array_index(index->vocab, mid), term) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void
+history_index_term(HistoryIndex *index, const gchar *term, guint32 id)
+{
+  GArray *postings = g_hash_table_lookup(index->terms, term);
+  if (!postings)
+  {
+    gchar *key = g_string_chunk_insert(index->strings, term);
+    postings = g_array_new(FALSE, FALSE, sizeof(guint32));
+    g_hash_table_insert(index->terms, key, postings);
+    if (index->vocab_sorted)
+      g_ptr_array_insert(index->vocab, (gint)history_vocab_lower_bound(index, key), key);
+    else
+      g_ptr_array_add(index->vocab, key);
+  }
+  history_postings_add(postings, id);
+}
+
+typedef void (*HistoryTermFunc)(const gchar *term, gpointer user_data);
+
+/* Splits @text into lower-cased alphanumeric words. Returns TRUE if the
+ * text ends inside a word. */
+static gboolean
+history_tokenize(GString *scratch, const gchar *text, gsize len, HistoryTermFunc func, gpointer user_data)
+{
+  const gchar *p = text;
+  const gchar *end = text + len;
+  gboolean in_word = FALSE;
+  g_string_truncate(scratch, 0);
+
+  while (p < end)
+  {
+    gunichar c = g_utf8_get_char_validated(p, end - p);
+    if (c == (gunichar)-1 || c == (gunichar)-2)
+    {
+      p++;
+      c = ' ';
+    }
+    else
+    {
+      p = g_utf8_next_char(p);
+    }
+
+    if (g_unichar_isalnum(c))
+    {
+      if (scratch->len < HISTORY_TERM_MAX_BYTES)
+        g_string_append_unichar(scratch, g_unichar_tolower(c));
+      in_word = TRUE;
+      continue;
+    }
+    if (in_word && scratch->len >= HISTORY_TERM_MIN_BYTES)
+      func(scratch->str, user_data);
+    g_string_truncate(scratch, 0);
+    in_word = FALSE;
+  }
+  if (in_word && scratch->len >= HISTORY_TERM_MIN_BYTES)
+    func(scratch->str, user_data);
+  g_string_truncate(scratch, 0);
+  return in_word;
+}
+
+typedef struct
+{
+  HistoryIndex *index;
+  guint32 id;
+} HistoryIndexCtx;
+
+static void
+history_index_term_cb(const gchar *term, gpointer user_data)
+{
+  HistoryIndexCtx *ctx = user_data;
+  if (!history_is_stopword(term))
+    history_index_term(ctx->index, term, ctx->id);
+}
+
+static gboolean
+history_convert(GConverter *converter, const guint8 *in, gsize in_len, GByteArray *out)
+{
+  guint8 buf[16 * 1024];
+  gsize pos = 0;
+  for (;;)
+  {
+    gsize bytes_read = 0, bytes_written = 0;
+    GConverterResult r = g_converter_convert(
+      converter, in + pos, in_len - pos, buf, sizeof(buf), G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, NULL);
+    if (r == G_CONVERTER_ERROR)
+      return FALSE;
+    pos += bytes_read;
+    g_byte_array_append(out, buf, (guint)bytes_written);
+    if (r == G_CONVERTER_FINISHED)
+      return TRUE;
+    if (bytes_read == 0 && bytes_written == 0)
+      return FALSE;
+  }
+}
+
+typedef struct
+{
+  gint64 timestamp;
+  gint64 conversation;
+  gboolean replaces;
+  const gchar *model;
+  const gchar *prompt;
+  const gchar *answer;
+  gsize answer_len;
+} HistoryFields;
+
+/* Decompresses a record payload into @raw and points @fields into it. */
+static gboolean
+history_decode(const guint8 *payload, gsize len, GByteArray *raw, HistoryFields *fields)
+{
+  g_autoptr(GZlibDecompressor) gz = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  g_byte_array_set_size(raw, 0);
+  if (!history_convert(G_CONVERTER(gz), payload, len, raw))
+    return FALSE;
+
+  const guint8 nul = 0;
+  g_byte_array_append(raw, &nul, 1);
+  const gchar *p = (const gchar *)raw->data;
+  const gchar *end = p + raw->len - 1;
+  const gchar *field[5] = {0};
+  for (guint i = 0; i < 5; i++)
+  {
+    if (p > end)
+      return FALSE;
+    field[i] = p;
+    if (i < 4)
+      p += strlen(p) + 1;
+  }
+
+  fields->timestamp = g_ascii_strtoll(field[0], NULL, 10);
+  gchar *rest = NULL;
+  fields->conversation = g_ascii_strtoll(field[1], &rest, 10);
+  fields->replaces = g_strcmp0(rest, HISTORY_REPLACES) == 0;
+  fields->model = field[2];
+  fields->prompt = field[3];
+  fields->answer = field[4];
+  fields->answer_len = (gsize)(end - field[4]);
+  return TRUE;
+}
+
+static void
+history_index_record(HistoryIndex *index, gint64 offset, const HistoryFields *fields)
+{
+  guint32 id = index->records->len;
+  HistoryRecord rec = {
+    .offset = offset,
+    .timestamp = fields->timestamp,
+    .conversation = fields->conversation,
+  };
+
+  g_autofree gchar *preview = g_utf8_substring(fields->prompt, 0, HISTORY_PREVIEW_CHARS);
+  g_strdelimit(preview, "\r\n\t", ' ');
+  rec.preview = g_string_chunk_insert(index->strings, preview);
+  g_array_append_val(index->records, rec);
+
+  GArray *turns = g_hash_table_lookup(index->conversations, &fields->conversation);
+  if (!turns)
+  {
+    turns = g_array_new(FALSE, FALSE, sizeof(guint32));
+    g_hash_table_insert(index->conversations, g_memdup2(&fields->conversation, sizeof(gint64)), turns);
+  }
+  if (fields->replaces && turns->len > 0)
+  {
+    /* Its postings stay: a search hit leads to the same conversation. */
+    g_array_set_size(turns, turns->len - 1);
+    index->superseded++;
+  }
+  g_array_append_val(turns, id);
+
+  HistoryIndexCtx ctx = {index, id};
+  history_tokenize(index->scratch, fields->prompt, strlen(fields->prompt), history_index_term_cb, &ctx);
+  gsize answer_len = fields->answer_len;
+  if (answer_len > HISTORY_ANSWER_INDEX_BYTES)
+    answer_len = HISTORY_ANSWER_INDEX_BYTES;
+  history_tokenize(index->scratch, fields->answer, answer_len, history_index_term_cb, &ctx);
+}
+
+static const guint8 *
+history_find_magic(const guint8 *data, gsize len, gsize from)
+{
+  if (from >= len)
+    return NULL;
+  return memmem(data + from, len - from, HISTORY_MAGIC, 4);
+}
+
+/* Offset of the first record after @from in @data that is complete and
+ * decodes, or @len if there is none. */
+static gsize
+history_find_record(const guint8 *data, gsize len, gsize from, GByteArray *raw)
+{
+  for (const guint8 *next = history_find_magic(data, len, from); next;
+       next = history_find_magic(data, len, (gsize)(next - data) + 1))
+  {
+    gsize pos = (gsize)(next - data);
+    if (pos + HISTORY_HEADER_BYTES > len)
+      break;
+    guint32 payload_len = 0;
+    memcpy(&payload_len, next + 4, sizeof(payload_len));
+    payload_len = GUINT32_FROM_LE(payload_len);
+    HistoryFields fields;
+    if (payload_len <= HISTORY_MAX_RECORD_BYTES && pos + HISTORY_HEADER_BYTES + payload_len <= len &&
+        history_decode(next + HISTORY_HEADER_BYTES, payload_len, raw, &fields))
+      return pos;
+  }
+  return len;
+}
+
+/* Indexes every complete record in @data, which starts at file offset
+ * @base. Returns how many bytes were consumed; an incomplete record at the
+ * end is left for the next scan. */
+static gsize
+history_index_scan(HistoryIndex *index, const guint8 *data, gsize len, gint64 base, GCancellable *cancellable)
+{
+  g_autoptr(GByteArray) raw = g_byte_array_new();
+  gsize pos = 0;
+  guint skipped = 0;
+
+  while (pos + HISTORY_HEADER_BYTES <= len)
+  {
+    if (memcmp(data + pos, HISTORY_MAGIC, 4) != 0)
+    {
+      const guint8 *next = history_find_magic(data, len, pos + 1);
+      pos = next ? (gsize)(next - data) : len;
+      skipped++;
+      continue;
+    }
+
+    guint32 payload_len = 0;
+    memcpy(&payload_len, data + pos + 4, sizeof(payload_len));
+    payload_len = GUINT32_FROM_LE(payload_len);
+    if (payload_len > HISTORY_MAX_RECORD_BYTES)
+    {
+      pos++;
+      continue;
+    }
+    if (pos + HISTORY_HEADER_BYTES + payload_len > len)
+    {
+      /* Still being written, unless a whole record follows: then a crash
+       * tore this one and others were appended after it. */
+      gsize next = history_find_record(data, len, pos + 1, raw);
+      if (next == len)
+        break;
+      pos = next;
+      skipped++;
+      continue;
+    }
+
+    HistoryFields fields;
+    if (!history_decode(data + pos + HISTORY_HEADER_BYTES, payload_len, raw, &fields))
+    {
+      pos++;
+      continue;
+    }
+    history_index_record(index, base + (gint64)pos, &fields);
+    pos += HISTORY_HEADER_BYTES + payload_len;
+
+    if ((index->records->len & 1023) == 0 && g_cancellable_is_cancelled(cancellable))
+      break;
+  }
+
+  if (skipped > 0)
+    openai_ask_log("history skipped %u damaged region(s)", skipped);
+  return pos;
+}
+
+static void
+history_load_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+  (void)source_object;
+  const gchar *path = task_data;
+  HistoryIndex *index = history_index_new();
+  gint64 t0 = g_get_monotonic_time();
+
+  g_autoptr(GError) error = NULL;
+  GMappedFile *map = g_mapped_file_new(path, FALSE, &error);
+  if (map)
+  {
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(map);
+    gsize len = g_mapped_file_get_length(map);
+    if (data && len > 0)
+      index->end = (gint64)history_index_scan(index, data, len, 0, cancellable);
+    g_mapped_file_unref(map);
+  }
+
+  g_ptr_array_sort(index->vocab, history_cmp_str);
+  index->vocab_sorted = TRUE;
+  openai_ask_log("history indexed records=%u terms=%u in %.1f ms",
+                 index->records->len,
+                 index->vocab->len,
+                 (g_get_monotonic_time() - t0) / 1000.0);
+  g_task_return_pointer(task, index, history_index_free);
+}
+
+/* Indexes records appended since the last scan, by us or another instance. */
+static void
+history_index_tail(History *history)
+{
+  HistoryIndex *index = history->index;
+  struct stat st;
+  if (!index || fstat(history->fd, &st) != 0 || st.st_size <= index->end)
+    return;
+
+  gsize len = (gsize)(st.st_size - index->end);
+  g_autofree guint8 *buf = g_malloc(len);
+  gsize got = 0;
+  while (got < len)
+  {
+    ssize_t n = pread(history->fd, buf + got, len - got, (off_t)(index->end + (gint64)got));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += (gsize)n;
+  }
+  index->end += (gint64)history_index_scan(index, buf, got, index->end, NULL);
+}
+
+static void
+history_on_loaded(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  (void)source_object;
+  GCancellable *cancellable = g_task_get_cancellable(G_TASK(res));
+  HistoryIndex *index = g_task_propagate_pointer(G_TASK(res), NULL);
+  if (g_cancellable_is_cancelled(cancellable))
+  {
+    history_index_free(index);
+    return;
+  }
+
+  History *history = user_data;
+  history->index = index;
+  history_index_tail(history);
+  if (history->loaded)
+    history->loaded(history->loaded_data);
+}
+
+gchar *
+history_default_path(void)
+{
+  const gchar *data = g_get_user_data_dir();
+  if (!data || !*data)
+    data = g_get_home_dir();
+  g_autofree gchar *dir = g_build_filename(data, "openai-ask", NULL);
+  g_mkdir_with_parents(dir, 0700);
+  return g_build_filename(dir, "history.log", NULL);
+}
+
+History *
+history_new(const gchar *path, HistoryLoadedFunc loaded, gpointer user_data)
+{
+  gint fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+  {
+    openai_ask_log("history open failed path=%s err=%s", path, g_strerror(errno));
+    return NULL;
+  }
+
+  History *history = g_new0(History, 1);
+  history->path = g_strdup(path);
+  history->fd = fd;
+  history->cancellable = g_cancellable_new();
+  history->loaded = loaded;
+  history->loaded_data = user_data;
+
+  GTask *task = g_task_new(NULL, history->cancellable, history_on_loaded, history);
+  g_task_set_task_data(task, g_strdup(path), g_free);
+  g_task_run_in_thread(task, history_load_thread);
+  g_object_unref(task);
+  return history;
+}
+
+void
+history_free(History *history)
+{
+  if (!history)
+    return;
+  g_cancellable_cancel(history->cancellable);
+  g_object_unref(history->cancellable);
+  history_index_free(history->index);
+  close(history->fd);
+  g_free(history->path);
+  g_free(history);
+}
+
+gboolean
+history_is_loaded(History *history)
+{
+  return history && history->index;
+}
+
+guint
+history_get_count(History *history)
+{
+  return history_is_loaded(history) ? history->index->records->len - history->index->superseded : 0;
+}
+
+static gboolean
+history_write(History *history,
+              gint64 conversation,
+              gboolean replaces,
+              const gchar *model,
+              const gchar *prompt,
+              const gchar *answer)
+{
+  if (!history)
+    return FALSE;
+
+  g_autoptr(GString) raw = g_string_new(NULL);
+  g_string_append_printf(raw, "%" G_GINT64_FORMAT, g_get_real_time() / G_USEC_PER_SEC);
+  g_string_append_c(raw, '\0');
+  g_string_append_printf(raw, "%" G_GINT64_FORMAT "%s", conversation, replaces ? HISTORY_REPLACES : "");
+  g_string_append_c(raw, '\0');
+  g_string_append(raw, model ? model : "");
+  g_string_append_c(raw, '\0');
+  g_string_append(raw, prompt ? prompt : "");
+  g_string_append_c(raw, '\0');
+  g_string_append(raw, answer ? answer : "");
+
+  g_autoptr(GByteArray) record = g_byte_array_new();
+  g_byte_array_append(record, (const guint8 *)HISTORY_MAGIC, 4);
+  g_byte_array_set_size(record, HISTORY_HEADER_BYTES);
+  g_autoptr(GZlibCompressor) gz = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+  if (!history_convert(G_CONVERTER(gz), (const guint8 *)raw->str, raw->len, record))
+    return FALSE;
+  if (record->len - HISTORY_HEADER_BYTES > HISTORY_MAX_RECORD_BYTES)
+  {
+    /* The reader would skip it as corrupt. */
+    openai_ask_log("history record too large bytes=%u, not written", record->len - HISTORY_HEADER_BYTES);
+    return FALSE;
+  }
+  guint32 payload_len = GUINT32_TO_LE(record->len - HISTORY_HEADER_BYTES);
+  memcpy(record->data + 4, &payload_len, sizeof(payload_len));
+
+  /* One write per record: concurrent writers cannot interleave inside it. */
+  gsize done = 0;
+  while (done < record->len)
+  {
+    ssize_t n = write(history->fd, record->data + done, record->len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      openai_ask_log("history write failed err=%s", g_strerror(errno));
+      return FALSE;
+    }
+    done += (gsize)n;
+  }
+  if (fdatasync(history->fd) != 0)
+    openai_ask_log("history fdatasync failed err=%s", g_strerror(errno));
+
+  history_index_tail(history);
+  return TRUE;
+}
+
+gboolean
+history_append(History *history,
+               gint64 conversation,
+               const gchar *model,
+               const gchar *prompt,
+               const gchar *answer)
+{
+  return history_write(history, conversation, FALSE, model, prompt, answer);
+}
+
+gboolean
+history_replace_last(History *history,
+                     gint64 conversation,
+                     const gchar *model,
+                     const gchar *prompt,
+                     const gchar *answer)
+{
+  return history_write(history, conversation, TRUE, model, prompt, answer);
+}
+
+/* A query word: one postings list, or several for a prefix. */
+typedef struct
+{
+  GArray *lists[HISTORY_PREFIX_EXPANSIONS];
+  guint n_lists;
+} HistoryQueryTerm;
+
+typedef struct
+{
+  HistoryIndex *index;
+  GArray *terms; /* element-type HistoryQueryTerm */
+  gboolean last_is_prefix;
+  gchar *last;
+  gboolean missing;
+} HistoryQuery;
+
+static void
+history_query_add(HistoryQuery *q, const gchar *term, gboolean prefix)
+{
+  HistoryQueryTerm qt = {0};
+  if (prefix)
+  {
+    gsize len = strlen(term);
+    for (guint i = history_vocab_lower_bound(q->index, term);
+         i < q->index->vocab->len && qt.n_lists < HISTORY_PREFIX_EXPANSIONS;
+         i++)
+    {
+      const gchar *cand = g_ptr_array_index(q->index->vocab, i);
+      if (strncmp(cand, term, len) != 0)
+        break;
+      qt.lists[qt.n_lists++] = g_hash_table_lookup(q->index->terms, cand);
+    }
+  }
+  else if (!history_is_stopword(term))
+  {
+    GArray *postings = g_hash_table_lookup(q->index->terms, term);
+    if (postings)
+      qt.lists[qt.n_lists++] = postings;
+  }
+  else
+  {
+    return; /* never indexed, so it cannot narrow the result */
+  }
+
+  if (qt.n_lists == 0)
+    q->missing = TRUE;
+  else
+    g_array_append_val(q->terms, qt);
+}
+
+static void
+history_query_term_cb(const gchar *term, gpointer user_data)
+{
+  HistoryQuery *q = user_data;
+  /* The last word is only known after tokenizing; delay it by one. */
+  if (q->last)
+    history_query_add(q, q->last, FALSE);
+  g_free(q->last);
+  q->last = g_strdup(term);
+}
+
+/* Largest id <= @bound in @qt, or -1. */
+static gint64
+history_query_term_max_le(const HistoryQueryTerm *qt, gint64 bound)
+{
+  gint64 best = -1;
+  for (guint i = 0; i < qt->n_lists; i++)
+  {
+    GArray *list = qt->lists[i];
+    guint lo = 0, hi = list->len;
+    while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      if ((gint64)g_array_index(list, guint32, mid) <= bound)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo > 0)
+      best = MAX(best, (gint64)g_array_index(list, guint32, lo - 1));
+  }
+  return best;
+}
+
+static void
+history_hits_add(HistoryIndex *index, HistoryHit *hits, guint *n_hits, guint32 id)
+{
+  const HistoryRecord *rec = &g_array_index(index->records, HistoryRecord, id);
+  for (guint i = 0; i < *n_hits; i++)
+  {
+    if (hits[i].conversation == rec->conversation)
+      return;
+  }
+  hits[*n_hits].conversation = rec->conversation;
+  hits[*n_hits].timestamp = rec->timestamp;
+  hits[*n_hits].preview = rec->preview;
+  (*n_hits)++;
+}
+
+guint
+history_search(History *history, const gchar *query, HistoryHit *hits, guint max_hits)
+{
+  if (!history_is_loaded(history) || max_hits == 0)
+    return 0;
+
+  HistoryIndex *index = history->index;
+  guint n_hits = 0;
+  HistoryQuery q = {
+    .index = index,
+    .terms = g_array_new(FALSE, FALSE, sizeof(HistoryQueryTerm)),
+  };
+  gboolean open_word =
+    history_tokenize(index->scratch, query ? query : "", query ? strlen(query) : 0, history_query_term_cb, &q);
+  if (q.last)
+    history_query_add(&q, q.last, open_word);
+  g_free(q.last);
+
+  if (q.missing)
+  {
+    g_array_unref(q.terms);
+    return 0;
+  }
+
+  /* Walk ids downwards, leapfrogging every word to the largest id all share. */
+  gint64 bound = (gint64)index->records->len - 1;
+  while (bound >= 0 && n_hits < max_hits)
+  {
+    gint64 cand = bound;
+    gboolean settled = FALSE;
+    while (!settled && cand >= 0)
+    {
+      settled = TRUE;
+      for (guint i = 0; i < q.terms->len; i++)
+      {
+        gint64 v = history_query_term_max_le(&g_array_index(q.terms, HistoryQueryTerm, i), cand);
+        if (v < cand)
+        {
+          cand = v;
+          settled = FALSE;
+          if (cand < 0)
+            break;
+        }
+      }
+    }
+    if (cand < 0)
+      break;
+    history_hits_add(index, hits, &n_hits, (guint32)cand);
+    bound = cand - 1;
+  }
+
+  g_array_unref(q.terms);
+  return n_hits;
+}
+
+void
+history_exchange_free(HistoryExchange *exchange)
+{
+  if (!exchange)
+    return;
+  g_free(exchange->model);
+  g_free(exchange->prompt);
+  g_free(exchange->answer);
+  g_free(exchange);
+}
+
+static gboolean
+history_pread_all(gint fd, guint8 *buf, gsize len, gint64 offset)
+{
+  gsize got = 0;
+  while (got < len)
+  {
+    ssize_t n = pread(fd, buf + got, len - got, (off_t)(offset + (gint64)got));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    got += (gsize)n;
+  }
+  return TRUE;
+}
+
+GPtrArray *
+history_get_conversation(History *history, gint64 conversation)
+{
+  GPtrArray *out = g_ptr_array_new_with_free_func((GDestroyNotify)history_exchange_free);
+  if (!history_is_loaded(history))
+    return out;
+
+  GArray *turns = g_hash_table_lookup(history->index->conversations, &conversation);
+  g_autoptr(GByteArray) raw = g_byte_array_new();
+  for (guint i = 0; turns && i < turns->len; i++)
+  {
+    const HistoryRecord *rec = &g_array_index(history->index->records, HistoryRecord, g_array_index(turns, guint32, i));
+    guint8 header[HISTORY_HEADER_BYTES];
+    if (!history_pread_all(history->fd, header, sizeof(header), rec->offset))
+      continue;
+    guint32 payload_len = 0;
+    memcpy(&payload_len, header + 4, sizeof(payload_len));
+    payload_len = GUINT32_FROM_LE(payload_len);
+    if (payload_len > HISTORY_MAX_RECORD_BYTES)
+      continue;
+    g_autofree guint8 *payload = g_malloc(payload_len);
+    HistoryFields fields;
+    if (!history_pread_all(history->fd, payload, payload_len, rec->offset + HISTORY_HEADER_BYTES) ||
+        !history_decode(payload, payload_len, raw, &fields))
+      continue;
+
+    HistoryExchange *ex = g_new0(HistoryExchange, 1);
+    ex->model = g_strdup(fields.model);
+    ex->prompt = g_strdup(fields.prompt);
+    ex->answer = g_strndup(fields.answer, fields.answer_len);
+    g_ptr_array_add(out, ex);
+  }
+  return out;
+}
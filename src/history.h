@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glib.h>
+
+/* Maximum number of bytes of an answer that is added to the search index;
+ * prompts are always indexed in full. */
+#define HISTORY_ANSWER_INDEX_BYTES 1024
+
+typedef struct _History History;
+
+typedef struct
+{
+  gint64 conversation;
+  gint64 timestamp; /* unix seconds */
+  const gchar *preview; /* owned by the History */
+} HistoryHit;
+
+typedef struct
+{
+  gchar *model;
+  gchar *prompt;
+  gchar *answer;
+} HistoryExchange;
+
+typedef void (*HistoryLoadedFunc)(gpointer user_data);
+
+/* $XDG_DATA_HOME/openai-ask/history.log */
+gchar *history_default_path(void);
+
+/* Opens (creating if needed) the append-only log at @path and builds the
+ * search index on a worker thread; @loaded runs on the main context once
+ * searches are possible. Returns NULL if the file cannot be opened. */
+History *history_new(const gchar *path, HistoryLoadedFunc loaded, gpointer user_data);
+void history_free(History *history);
+
+gboolean history_is_loaded(History *history);
+guint history_get_count(History *history);
+
+/* Appends one exchange as a single compressed record, flushes it to disk
+ * and indexes it. An exchange that compresses to more than the reader
+ * accepts is not written, and FALSE is returned. */
+gboolean history_append(History *history,
+                        gint64 conversation,
+                        const gchar *model,
+                        const gchar *prompt,
+                        const gchar *answer);
+/* Like history_append(), but the exchange takes the place of
+ * @conversation's last one, e.g. a question asked again of another model.
+ * The superseded record stays in the log; restoring and counting skip it. */
+gboolean history_replace_last(History *history,
+                              gint64 conversation,
+                              const gchar *model,
+                              const gchar *prompt,
+                              const gchar *answer);
+
+/* Newest first, at most one hit per conversation. Every word of @query must
+ * match; the last one also matches as a prefix while it is being typed. An
+ * empty query lists the most recent conversations. */
+guint history_search(History *history, const gchar *query, HistoryHit *hits, guint max_hits);
+
+/* Returns the exchanges of @conversation in order (element-type HistoryExchange*). */
+GPtrArray *history_get_conversation(History *history, gint64 conversation);
+void history_exchange_free(HistoryExchange *exchange);
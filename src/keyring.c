@@ -2,6 +2,37 @@
 
 #include <libsecret/secret.h>
 
+#include "metrics.h"
+
+/* Keys found in the keyring, by endpoint. The secret service is a D-Bus
+ * round trip (and may prompt), so each key is looked up once per process.
+ * Main thread only, like the rest of this module. */
+static GHashTable *keyring_cache = NULL;
+
+static gchar *
+keyring_cache_get(const gchar *endpoint)
+{
+  return keyring_cache ? g_strdup(g_hash_table_lookup(keyring_cache, endpoint)) : NULL;
+}
+
+static void
+keyring_cache_set(const gchar *endpoint, const gchar *api_key)
+{
+  if (!keyring_cache)
+    keyring_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  if (api_key)
+    g_hash_table_replace(keyring_cache, g_strdup(endpoint), g_strdup(api_key));
+  else
+    g_hash_table_remove(keyring_cache, endpoint);
+}
+
+void
+keyring_forget_cached(const gchar *endpoint)
+{
+  if (endpoint)
+    keyring_cache_set(endpoint, NULL);
+}
+
 static const SecretSchema *
 openai_ask_secret_schema(void)
 {
@@ -30,6 +61,11 @@ keyring_lookup_api_key(const gchar *endpoint)
   if (!endpoint || !*endpoint)
     return NULL;
 
+  gchar *cached = keyring_cache_get(endpoint);
+  metrics_record_cache(METRICS_CACHE_KEYRING, cached != NULL);
+  if (cached)
+    return cached;
+
   g_autoptr(GError) error = NULL;
   gchar *pw = secret_password_lookup_sync(openai_ask_secret_schema(), NULL, &error, "endpoint", endpoint, NULL);
   if (error)
@@ -38,6 +74,7 @@ keyring_lookup_api_key(const gchar *endpoint)
     return NULL;
   gchar *dup = g_strdup(pw);
   secret_password_free(pw);
+  keyring_cache_set(endpoint, dup);
   return dup;
 }
 
@@ -58,6 +95,7 @@ keyring_store_api_key(const gchar *endpoint, const gchar *api_key)
     "endpoint",
     endpoint,
     NULL);
+  keyring_cache_set(endpoint, ok && !error ? api_key : NULL);
   return ok && !error;
 }
 
@@ -69,5 +107,6 @@ keyring_clear_api_key(const gchar *endpoint)
 
   g_autoptr(GError) error = NULL;
   gboolean ok = secret_password_clear_sync(openai_ask_secret_schema(), NULL, &error, "endpoint", endpoint, NULL);
+  keyring_cache_set(endpoint, NULL);
   return ok && !error;
 }
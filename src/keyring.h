@@ -6,3 +6,5 @@ gchar *keyring_lookup_api_key(const gchar *endpoint);
 gboolean keyring_store_api_key(const gchar *endpoint, const gchar *api_key);
 gboolean keyring_clear_api_key(const gchar *endpoint);
 
+/* Drops this process's cached copy, e.g. after another process changed it. */
+void keyring_forget_cached(const gchar *endpoint);
@@ -2,144 +2,304 @@
 
 #include <string.h>
 
-static gchar *
-rgba_to_hex(const GdkRGBA *rgba)
+#include "syntax-highlight.h"
+
+/* Total highlighting time for one markdown_to_pango() call. Larger answers
+ * go through the block API and are highlighted lazily as they are shown. */
+#define MARKDOWN_HIGHLIGHT_BUDGET_US 8000
+
+static void
+get_code_colors(const MarkdownColors *colors, gchar **out_bg, gchar **out_fg)
 {
-  guint r = (guint)(CLAMP(rgba->red, 0.0, 1.0) * 255.0);
-  guint g = (guint)(CLAMP(rgba->green, 0.0, 1.0) * 255.0);
-  guint b = (guint)(CLAMP(rgba->blue, 0.0, 1.0) * 255.0);
-  return g_strdup_printf("#%02x%02x%02x", r, g, b);
+  *out_bg = g_strdup(colors && colors->code_bg ? colors->code_bg : "#404040");
+  *out_fg = g_strdup(colors && colors->code_fg ? colors->code_fg : "#ffffff");
 }
 
+/* Inline rendering is a single left-to-right scan so that its cost is
+ * linear in the line length whatever the input looks like. Openers search
+ * for their closer through per-delimiter caches: a cached position stays
+ * valid until the scan passes it, and "not found" is remembered as the end
+ * of the line, so runs of unmatched delimiters never rescan the text. */
+
+enum
+{
+  INLINE_NO_BOLD = 1 << 0,
+  INLINE_NO_ITALIC = 1 << 1,
+  INLINE_NO_LINKS = 1 << 2,
+};
+
+typedef struct
+{
+  const gchar *line_end;
+  const gchar *bg;
+  const gchar *fg;
+  const gchar *next_backtick;
+  const gchar *next_star;
+  const gchar *next_star2;
+  const gchar *next_bracket;
+  const gchar *next_url_stop;
+} InlineScan;
+
 static void
-get_code_colors(GtkWidget *style_widget, gchar **out_bg, gchar **out_fg)
+append_escaped(GString *out, const gchar *p, const gchar *end)
 {
-  *out_bg = g_strdup("#404040");
-  *out_fg = g_strdup("#ffffff");
+  const gchar *run = p;
+  for (; p < end; p++)
+  {
+    const gchar *rep = NULL;
+    switch (*p)
+    {
+      case '&':
+        rep = "&amp;";
+        break;
+      case '<':
+        rep = "&lt;";
+        break;
+      case '>':
+        rep = "&gt;";
+        break;
+      case '"':
+        rep = "&quot;";
+        break;
+      case '\'':
+        rep = "&#39;";
+        break;
+      default:
+        break;
+    }
+    if (!rep)
+      continue;
+    g_string_append_len(out, run, p - run);
+    g_string_append(out, rep);
+    run = p + 1;
+  }
+  g_string_append_len(out, run, end - run);
+}
 
-  if (!style_widget)
-    return;
+/* Next occurrence of @needle at or after @p, or line_end. */
+static const gchar *
+inline_next(const InlineScan *s, const gchar **cache, const gchar *p, const gchar *needle)
+{
+  if (*cache && *cache >= p)
+    return *cache;
 
-  GtkStyleContext *ctx = gtk_widget_get_style_context(style_widget);
-  if (!ctx)
-    return;
+  gsize n = strlen(needle);
+  const gchar *q = p;
+  *cache = s->line_end;
+  while (q + n <= s->line_end && (q = memchr(q, needle[0], s->line_end - q)))
+  {
+    if ((gsize)(s->line_end - q) >= n && memcmp(q, needle, n) == 0)
+    {
+      *cache = q;
+      break;
+    }
+    q++;
+  }
+  return *cache;
+}
 
-  GdkRGBA bg = {0};
-  GdkRGBA fg = {0};
-  gtk_style_context_get_background_color(ctx, GTK_STATE_FLAG_SELECTED, &bg);
-  gtk_style_context_get_color(ctx, GTK_STATE_FLAG_SELECTED, &fg);
+/* Next whitespace, ')' or end of line: where a link target must stop. */
+static const gchar *
+inline_next_url_stop(InlineScan *s, const gchar *p)
+{
+  if (s->next_url_stop && s->next_url_stop >= p)
+    return s->next_url_stop;
+  const gchar *q = p;
+  while (q < s->line_end && *q != ')' && !g_ascii_isspace(*q))
+    q++;
+  s->next_url_stop = q;
+  return q;
+}
 
-  g_free(*out_bg);
-  g_free(*out_fg);
-  *out_bg = rgba_to_hex(&bg);
-  *out_fg = rgba_to_hex(&fg);
+static gboolean
+is_url_start(const gchar *p, const gchar *end)
+{
+  gsize left = (gsize)(end - p);
+  return (left > 8 && strncmp(p, "https://", 8) == 0) || (left > 7 && strncmp(p, "http://", 7) == 0);
 }
 
-static gchar *
-wrap_inline_code(const gchar *escaped, const gchar *bg, const gchar *fg)
+static void
+append_link(GString *out, const gchar *href, const gchar *href_end)
 {
-  return g_strdup_printf(
-    "<span font_family=\"monospace\" background=\"%s\" foreground=\"%s\">%s</span>",
-    bg,
-    fg,
-    escaped ? escaped : "");
+  g_string_append(out, "<a href=\"");
+  append_escaped(out, href, href_end);
+  g_string_append(out, "\">");
 }
 
+static void inline_render(InlineScan *s, GString *out, const gchar *p, const gchar *end, guint flags);
+
+/* Matches [label](https://...) or [label](#anchor) at @p. */
 static gboolean
-linkify_bare_url_eval(const GMatchInfo *match_info, GString *res, gpointer user_data)
+inline_match_link(InlineScan *s, const gchar *p, const gchar *end, const gchar **out_close, const gchar **out_href_end)
 {
-  (void)user_data;
-  g_autofree gchar *url = g_match_info_fetch(match_info, 1);
-  if (!url)
+  const gchar *close = inline_next(s, &s->next_bracket, p + 1, "]");
+  if (close >= end || close == p + 1 || close + 1 >= end || close[1] != '(')
     return FALSE;
 
-  gsize len = strlen(url);
-  gsize trimmed_len = len;
-  while (trimmed_len > 0 && strchr(")]>.,;!?", url[trimmed_len - 1]))
-    trimmed_len--;
-
-  g_autofree gchar *core = g_strndup(url, trimmed_len);
-  g_string_append_printf(res, "<a href=\"%s\">%s</a>", core, core);
+  const gchar *href = close + 2;
+  if (!is_url_start(href, end) && !(href < end && *href == '#'))
+    return FALSE;
 
-  if (trimmed_len < len)
-    g_string_append(res, url + trimmed_len);
+  const gchar *href_end = inline_next_url_stop(s, href);
+  if (href_end >= end || *href_end != ')' || href_end == href + (*href == '#' ? 1 : 0))
+    return FALSE;
 
-  return FALSE;
+  *out_close = close;
+  *out_href_end = href_end;
+  return TRUE;
 }
 
-typedef struct
-{
-  const gchar *bg;
-  const gchar *fg;
-} InlineColors;
-
-static gboolean
-bold_code_eval(const GMatchInfo *match_info, GString *res, gpointer user_data)
+/* Renders the URL at @p; returns the position after it, or NULL if there is
+ * nothing after the scheme. */
+static const gchar *
+inline_bare_url(GString *out, const gchar *plain, const gchar *p, const gchar *end)
 {
-  InlineColors *c = user_data;
-  g_autofree gchar *code = g_match_info_fetch(match_info, 1);
-  g_string_append_printf(
-    res,
-    "<b><span font_family=\"monospace\" background=\"%s\" foreground=\"%s\">%s</span></b>",
-    c->bg,
-    c->fg,
-    code ? code : "");
-  return FALSE;
+  const gchar *q = p + (p[4] == 's' ? 8 : 7);
+  if (q >= end || g_ascii_isspace(*q) || *q == '<' || *q == '[')
+    return NULL;
+  while (q < end && !g_ascii_isspace(*q) && *q != '<' && *q != '[')
+    q++;
+
+  const gchar *core_end = q;
+  while (core_end > p && strchr(")]>.,;!?", core_end[-1]))
+    core_end--;
+
+  append_escaped(out, plain, p);
+  append_link(out, p, core_end);
+  append_escaped(out, p, core_end);
+  g_string_append(out, "</a>");
+  append_escaped(out, core_end, q);
+  return q;
 }
 
-static gchar *
-process_inline(const gchar *text, const gchar *bg, const gchar *fg)
+static void
+inline_render(InlineScan *s, GString *out, const gchar *p, const gchar *end, guint flags)
 {
-  if (!text)
-    return g_strdup("");
+  const gchar *plain = p;
+  while (p < end)
+  {
+    const gchar *next = NULL;
+    gchar c = *p;
 
-  g_autofree gchar *escaped = g_markup_escape_text(text, -1);
+    if (c == '`')
+    {
+      const gchar *close = inline_next(s, &s->next_backtick, p + 1, "`");
+      if (close < end)
+      {
+        append_escaped(out, plain, p);
+        g_string_append_printf(out, "<span font_family=\"monospace\" background=\"%s\" foreground=\"%s\">", s->bg, s->fg);
+        append_escaped(out, p + 1, close);
+        g_string_append(out, "</span>");
+        next = close + 1;
+      }
+    }
+    else if (c == '*' && p + 1 < end && p[1] == '*' && !(flags & INLINE_NO_BOLD))
+    {
+      const gchar *close = inline_next(s, &s->next_star2, p + 2, "**");
+      if (close < end && close > p + 2)
+      {
+        append_escaped(out, plain, p);
+        g_string_append(out, "<b>");
+        inline_render(s, out, p + 2, close, flags | INLINE_NO_BOLD);
+        g_string_append(out, "</b>");
+        next = close + 2;
+      }
+    }
+    else if (c == '*' && !(flags & INLINE_NO_ITALIC))
+    {
+      const gchar *close = inline_next(s, &s->next_star, p + 1, "*");
+      if (close < end && close > p + 1)
+      {
+        append_escaped(out, plain, p);
+        g_string_append(out, "<i>");
+        inline_render(s, out, p + 1, close, flags | INLINE_NO_BOLD | INLINE_NO_ITALIC);
+        g_string_append(out, "</i>");
+        next = close + 1;
+      }
+    }
+    else if (c == '[' && !(flags & INLINE_NO_LINKS))
+    {
+      const gchar *close = NULL;
+      const gchar *href_end = NULL;
+      if (inline_match_link(s, p, end, &close, &href_end))
+      {
+        append_escaped(out, plain, p);
+        append_link(out, close + 2, href_end);
+        inline_render(s, out, p + 1, close, flags | INLINE_NO_LINKS);
+        g_string_append(out, "</a>");
+        next = href_end + 1;
+      }
+    }
+    else if (c == 'h' && !(flags & INLINE_NO_LINKS) && is_url_start(p, end))
+    {
+      next = inline_bare_url(out, plain, p, end);
+    }
 
-  /* Markdown links: [label](https://...) */
-  g_autoptr(GRegex) md_link = g_regex_new("\\[([^\\]]+)\\]\\((https?://[^\\s)]+|#[^\\s)]+)\\)", 0, 0, NULL);
-  g_autofree gchar *stage0 = g_regex_replace(md_link, escaped, -1, 0, "<a href=\"\\2\">\\1</a>", 0, NULL);
+    if (next)
+    {
+      p = next;
+      plain = p;
+    }
+    else
+    {
+      p++;
+    }
+  }
+  append_escaped(out, plain, end);
+}
 
-  /* Bare URLs (avoid those already inside href="..."). */
-  g_autoptr(GRegex) bare_url = g_regex_new("(?<!href=\")((?:https?://)[^\\s<\\[]+)", 0, 0, NULL);
-  g_autofree gchar *stage1 = g_regex_replace_eval(bare_url, stage0, -1, 0, 0, linkify_bare_url_eval, NULL, NULL);
+static void
+process_inline(GString *out, const gchar *text, const gchar *bg, const gchar *fg)
+{
+  if (!text)
+    return;
 
-  /* Bold inline-code: **`code`** */
-  InlineColors colors = {bg, fg};
-  g_autoptr(GRegex) bold_code = g_regex_new("\\*\\*`([^`]+)`\\*\\*", 0, 0, NULL);
-  g_autofree gchar *stage2 = g_regex_replace_eval(bold_code, stage1, -1, 0, 0, bold_code_eval, &colors, NULL);
+  InlineScan s = {0};
+  s.line_end = text + strlen(text);
+  s.bg = bg;
+  s.fg = fg;
+  inline_render(&s, out, text, s.line_end, 0);
+}
 
-  /* Bold: **text** */
-  g_autoptr(GRegex) bold = g_regex_new("\\*\\*([^\\n]+?)\\*\\*", G_REGEX_UNGREEDY, 0, NULL);
-  g_autofree gchar *stage3 = g_regex_replace(bold, stage2, -1, 0, "<b>\\1</b>", 0, NULL);
+/* Drops <audio_file>...</audio_file> (and one newline before it). */
+static gchar *
+strip_audio_tags(const gchar *text)
+{
+  static const gchar open_tag[] = "<audio_file>";
+  static const gchar close_tag[] = "</audio_file>";
 
-  /* Inline code: `code` */
-  GString *out = g_string_new(NULL);
-  const gchar *p = stage3;
-  while (*p)
+  GString *out = g_string_sized_new(strlen(text));
+  const gchar *p = text;
+  for (;;)
   {
-    const gchar *bt1 = strchr(p, '`');
-    if (!bt1)
-    {
-      g_string_append(out, p);
+    const gchar *open = strstr(p, open_tag);
+    if (!open)
       break;
-    }
-    const gchar *bt2 = strchr(bt1 + 1, '`');
-    if (!bt2)
-    {
-      g_string_append(out, p);
-      break;
-    }
-    g_string_append_len(out, p, bt1 - p);
-    g_autofree gchar *code = g_strndup(bt1 + 1, bt2 - (bt1 + 1));
-    g_autofree gchar *code_span = wrap_inline_code(code, bg, fg);
-    g_string_append(out, code_span);
-    p = bt2 + 1;
+    const gchar *close = strstr(open + strlen(open_tag), close_tag);
+    if (!close)
+      break; /* no later opener can have a closer either */
+
+    const gchar *keep_end = open;
+    if (keep_end > p && keep_end[-1] == '\n')
+      keep_end--;
+    g_string_append_len(out, p, keep_end - p);
+    p = close + strlen(close_tag);
   }
-  g_autofree gchar *stage4 = g_string_free(out, FALSE);
+  g_string_append(out, p);
+  return g_string_free(out, FALSE);
+}
 
-  /* Italic: *text* */
-  g_autoptr(GRegex) italic = g_regex_new("\\*([^\\*\\n]+)\\*", 0, 0, NULL);
-  return g_regex_replace(italic, stage4, -1, 0, "<i>\\1</i>", 0, NULL);
+static void
+unescape_dollars(gchar *text)
+{
+  gchar *w = text;
+  for (const gchar *r = text; *r; r++)
+  {
+    if (r[0] == '\\' && r[1] == '$')
+      r++;
+    *w++ = *r;
+  }
+  *w = '\0';
 }
 
 static gchar *
@@ -148,20 +308,11 @@ render_headers_and_lists(const gchar *text, const gchar *bg, const gchar *fg)
   if (!text)
     return g_strdup("");
 
-  g_autoptr(GRegex) audio = g_regex_new("\\n?<audio_file>.*?</audio_file>", G_REGEX_DOTALL, 0, NULL);
-  g_autofree gchar *no_audio = g_regex_replace(audio, text, -1, 0, "", 0, NULL);
-
-  g_autofree gchar *unescaped_dollars = g_strdup(no_audio ? no_audio : "");
-  for (gchar *p = unescaped_dollars; p && *p; p++)
-  {
-    if (p[0] == '\\' && p[1] == '$')
-    {
-      memmove(p, p + 1, strlen(p));
-    }
-  }
+  g_autofree gchar *unescaped_dollars = strip_audio_tags(text);
+  unescape_dollars(unescaped_dollars);
 
   g_auto(GStrv) lines = g_strsplit(unescaped_dollars, "\n", -1);
-  GString *out = g_string_new(NULL);
+  GString *out = g_string_sized_new(strlen(unescaped_dollars) + 64);
   for (gint i = 0; lines[i]; i++)
   {
     const gchar *line = lines[i];
@@ -179,9 +330,8 @@ render_headers_and_lists(const gchar *text, const gchar *bg, const gchar *fg)
     /* Bullets: - item / * item */
     if ((trim[0] == '-' || trim[0] == '*') && trim[1] == ' ')
     {
-      g_autofree gchar *rest = process_inline(trim + 2, bg, fg);
       g_string_append(out, "• ");
-      g_string_append(out, rest);
+      process_inline(out, trim + 2, bg, fg);
       g_string_append_c(out, '\n');
       continue;
     }
@@ -197,7 +347,6 @@ render_headers_and_lists(const gchar *text, const gchar *bg, const gchar *fg)
     if (level > 0 && *h == ' ')
     {
       const gchar *content = h + 1;
-      g_autofree gchar *inline_markup = process_inline(content, bg, fg);
       const gchar *size = "large";
       if (level == 1)
         size = "xx-large";
@@ -207,12 +356,13 @@ render_headers_and_lists(const gchar *text, const gchar *bg, const gchar *fg)
         size = "large";
       else if (level == 4)
         size = "medium";
-      g_string_append_printf(out, "<span size=\"%s\"><b>%s</b></span>\n", size, inline_markup);
+      g_string_append_printf(out, "<span size=\"%s\"><b>", size);
+      process_inline(out, content, bg, fg);
+      g_string_append(out, "</b></span>\n");
       continue;
     }
 
-    g_autofree gchar *inline_markup = process_inline(line, bg, fg);
-    g_string_append(out, inline_markup);
+    process_inline(out, line, bg, fg);
     if (lines[i + 1])
       g_string_append_c(out, '\n');
   }
@@ -220,10 +370,11 @@ render_headers_and_lists(const gchar *text, const gchar *bg, const gchar *fg)
   return g_string_free(out, FALSE);
 }
 
+/* Opening markup of a code block: optional language caption plus the span
+ * that render_code_block() fills and closes. */
 static gchar *
-render_code_block(const gchar *code, const gchar *lang, const gchar *bg, const gchar *fg)
+render_code_open(const gchar *lang, const gchar *bg, const gchar *fg)
 {
-  g_autofree gchar *escaped = g_markup_escape_text(code ? code : "", -1);
   g_autofree gchar *lang_line = NULL;
   if (lang && *lang)
   {
@@ -231,62 +382,233 @@ render_code_block(const gchar *code, const gchar *lang, const gchar *bg, const g
     lang_line = g_strdup_printf("<span size=\"small\" foreground=\"#888888\">%s</span>\n", lang_escaped);
   }
   return g_strdup_printf(
-    "%s<span font_family=\"monospace\" background=\"%s\" foreground=\"%s\">%s</span>",
-    lang_line ? lang_line : "",
-    bg,
-    fg,
-    escaped);
+    "%s<span font_family=\"monospace\" background=\"%s\" foreground=\"%s\">", lang_line ? lang_line : "", bg, fg);
 }
 
-gchar *
-markdown_to_pango(const gchar *markdown, GtkWidget *style_widget)
+static gchar *
+render_code_block(const gchar *code, const gchar *lang, const gchar *bg, const gchar *fg)
+{
+  g_autofree gchar *escaped = g_markup_escape_text(code ? code : "", -1);
+  g_autofree gchar *open = render_code_open(lang, bg, fg);
+  return g_strconcat(open, escaped, "</span>", NULL);
+}
+
+static void
+markdown_blocks_add(GPtrArray *blocks, gchar *markup, guint n_lines, guint n_chars)
+{
+  MarkdownBlock *block = g_new0(MarkdownBlock, 1);
+  block->markup = markup;
+  block->n_lines = MAX(1, n_lines);
+  block->n_chars = n_chars;
+  g_ptr_array_add(blocks, block);
+}
+
+/* Text markup is line-oriented (no tag spans a newline), so it can be cut at
+ * any newline. Each block keeps its trailing newline so that concatenating
+ * the blocks reproduces the original markup. */
+static void
+markdown_blocks_add_text(GPtrArray *blocks, const gchar *markup)
+{
+  const gchar *start = markup;
+  const gchar *p = markup;
+  guint lines = 0;
+  while (*p)
+  {
+    if (*p++ != '\n')
+      continue;
+    if (++lines < MARKDOWN_BLOCK_LINES)
+      continue;
+    markdown_blocks_add(blocks, g_strndup(start, p - start), lines, (guint)(p - start));
+    start = p;
+    lines = 0;
+  }
+  if (p > start)
+    markdown_blocks_add(blocks, g_strndup(start, p - start), lines + 1, (guint)(p - start));
+}
+
+static void
+markdown_blocks_add_code(GPtrArray *blocks, const gchar *code, const gchar *lang, const gchar *bg, const gchar *fg)
 {
+  const gchar *start = code ? code : "";
+  gboolean first = TRUE;
+  SyntaxState state = SYNTAX_STATE_CODE;
+  do
+  {
+    const gchar *p = start;
+    guint lines = 0;
+    while (*p && lines < MARKDOWN_BLOCK_LINES)
+    {
+      if (*p++ == '\n')
+        lines++;
+    }
+    /* Keep the newline that ends a chunk out of its span; it is re-added below. */
+    gsize len = (gsize)(p - start);
+    if (len > 0 && *p && start[len - 1] == '\n')
+      len--;
+    gchar *chunk = g_strndup(start, len);
+    gchar *markup = render_code_block(chunk, first ? lang : NULL, bg, fg);
+    gchar *with_nl = g_strconcat(markup, "\n", NULL);
+    g_free(markup);
+    markdown_blocks_add(blocks, with_nl, lines + ((first && lang && *lang) ? 2 : 1), (guint)len);
+
+    /* Keep what is needed to highlight the chunk later. */
+    MarkdownBlock *block = g_ptr_array_index(blocks, blocks->len - 1);
+    if (syntax_highlight_supported(lang))
+    {
+      block->code = chunk;
+      block->lang = g_strdup(lang);
+      block->code_open = render_code_open(first ? lang : NULL, bg, fg);
+      /* Chunks are highlighted in any order, so find each one's start now. */
+      block->code_state = state;
+      if (*p)
+        state = syntax_highlight_scan(chunk, len, lang, state);
+    }
+    else
+    {
+      g_free(chunk);
+    }
+    first = FALSE;
+    start = p;
+  } while (*start);
+}
+
+typedef struct
+{
+  const gchar *start; /* opening ``` */
+  const gchar *end;   /* just past the closing ``` */
+  const gchar *lang;
+  gsize lang_len;
+  const gchar *code;
+  gsize code_len;
+} CodeFence;
+
+/* Finds the next ```lang ... ``` block at or after @p. One forward pass:
+ * if an opener has no closer, no later opener can have one either. */
+static gboolean
+find_code_fence(const gchar *p, CodeFence *fence)
+{
+  const gchar *open = strstr(p, "```");
+  if (!open)
+    return FALSE;
+
+  const gchar *q = open + 3;
+  const gchar *lang = q;
+  while (g_ascii_isalnum(*q) || *q == '_' || *q == '+' || *q == '-')
+    q++;
+  gsize lang_len = (gsize)(q - lang);
+  while (g_ascii_isspace(*q))
+    q++;
+
+  const gchar *close = strstr(q, "```");
+  if (!close)
+    return FALSE;
+
+  fence->start = open;
+  fence->end = close + 3;
+  fence->lang = lang;
+  fence->lang_len = lang_len;
+  fence->code = q;
+  fence->code_len = (gsize)(close - q);
+  return TRUE;
+}
+
+void
+markdown_block_free(MarkdownBlock *block)
+{
+  if (!block)
+    return;
+  g_free(block->markup);
+  g_free(block->code);
+  g_free(block->lang);
+  g_free(block->code_open);
+  g_free(block);
+}
+
+gboolean
+markdown_block_highlight(MarkdownBlock *block, gint64 budget_us)
+{
+  if (!block || !block->code)
+    return FALSE;
+
+  GString *out = g_string_new(block->code_open);
+  syntax_highlight_append(out, block->code, strlen(block->code), block->lang, block->code_state, budget_us);
+  g_string_append(out, "</span>\n");
+
+  g_free(block->markup);
+  block->markup = g_string_free(out, FALSE);
+  g_clear_pointer(&block->code, g_free);
+  g_clear_pointer(&block->lang, g_free);
+  g_clear_pointer(&block->code_open, g_free);
+  return TRUE;
+}
+
+GPtrArray *
+markdown_to_pango_blocks(const gchar *markdown, const MarkdownColors *colors)
+{
+  GPtrArray *blocks = g_ptr_array_new_with_free_func((GDestroyNotify)markdown_block_free);
+
   g_autofree gchar *bg = NULL;
   g_autofree gchar *fg = NULL;
-  get_code_colors(style_widget, &bg, &fg);
+  get_code_colors(colors, &bg, &fg);
 
   if (!markdown)
-    return g_strdup("");
-
-  g_autoptr(GRegex) code_re = g_regex_new("```([A-Za-z0-9_+-]+)?\\s*([\\s\\S]*?)```", G_REGEX_DOTALL, 0, NULL);
+    return blocks;
 
-  GString *out = g_string_new(NULL);
-  GMatchInfo *mi = NULL;
-  gboolean matched = g_regex_match(code_re, markdown, 0, &mi);
+  CodeFence fence = {0};
   gsize last_end = 0;
 
-  while (matched)
+  while (find_code_fence(markdown + last_end, &fence))
   {
-    gint start = 0, end = 0;
-    g_match_info_fetch_pos(mi, 0, &start, &end);
+    gsize start = (gsize)(fence.start - markdown);
 
-    if (start > (gint)last_end)
+    if (start > last_end)
     {
-      g_autofree gchar *segment = g_strndup(markdown + last_end, (gsize)start - last_end);
+      g_autofree gchar *segment = g_strndup(markdown + last_end, start - last_end);
       g_autofree gchar *rendered = render_headers_and_lists(segment, bg, fg);
-      g_string_append(out, rendered);
-      if (out->len > 0 && out->str[out->len - 1] != '\n')
-        g_string_append_c(out, '\n');
+      markdown_blocks_add_text(blocks, rendered);
+      if (blocks->len > 0)
+      {
+        MarkdownBlock *last = g_ptr_array_index(blocks, blocks->len - 1);
+        if (!g_str_has_suffix(last->markup, "\n"))
+        {
+          gchar *with_nl = g_strconcat(last->markup, "\n", NULL);
+          g_free(last->markup);
+          last->markup = with_nl;
+        }
+      }
     }
 
-    g_autofree gchar *lang = g_match_info_fetch(mi, 1);
-    g_autofree gchar *code = g_match_info_fetch(mi, 2);
-    g_autofree gchar *code_markup = render_code_block(code, lang, bg, fg);
-    g_string_append(out, code_markup);
-    g_string_append_c(out, '\n');
+    g_autofree gchar *lang = g_strndup(fence.lang, fence.lang_len);
+    g_autofree gchar *code = g_strndup(fence.code, fence.code_len);
+    markdown_blocks_add_code(blocks, code, lang, bg, fg);
 
-    last_end = (gsize)end;
-    matched = g_match_info_next(mi, NULL);
+    last_end = (gsize)(fence.end - markdown);
   }
 
-  if (mi)
-    g_match_info_free(mi);
-
   if (last_end < strlen(markdown))
   {
     g_autofree gchar *tail = g_strdup(markdown + last_end);
     g_autofree gchar *rendered = render_headers_and_lists(tail, bg, fg);
-    g_string_append(out, rendered);
+    markdown_blocks_add_text(blocks, rendered);
+  }
+
+  return blocks;
+}
+
+gchar *
+markdown_to_pango(const gchar *markdown, const MarkdownColors *colors)
+{
+  g_autoptr(GPtrArray) blocks = markdown_to_pango_blocks(markdown, colors);
+
+  const gint64 deadline = g_get_monotonic_time() + MARKDOWN_HIGHLIGHT_BUDGET_US;
+  GString *out = g_string_new(NULL);
+  for (guint i = 0; i < blocks->len; i++)
+  {
+    MarkdownBlock *block = g_ptr_array_index(blocks, i);
+    gint64 left = deadline - g_get_monotonic_time();
+    if (block->code && left > 0)
+      markdown_block_highlight(block, left);
+    g_string_append(out, block->markup);
   }
 
   return g_string_free(out, FALSE);
@@ -1,7 +1,43 @@
 #pragma once
 
-#include <gtk/gtk.h>
+#include <glib.h>
+
+#include "syntax-highlight.h"
+
+/* Source lines per block when a document is split for incremental layout. */
+#define MARKDOWN_BLOCK_LINES 64
+
+typedef struct
+{
+  gchar *markup;  /* Pango markup, including its trailing newline */
+  guint n_lines;  /* rendered lines before wrapping */
+  guint n_chars;  /* markup length, used for wrap estimates */
+
+  /* Fenced code in a known language, not yet highlighted; NULL otherwise. */
+  gchar *code;
+  gchar *lang;
+  gchar *code_open;
+  SyntaxState code_state; /* left open by the block's previous chunk */
+} MarkdownBlock;
+
+/* Inline and fenced code colours as "#rrggbb"; NULL fields (or a NULL
+ * pointer) fall back to light text on a dark grey background. */
+typedef struct
+{
+  const gchar *code_bg;
+  const gchar *code_fg;
+} MarkdownColors;
+
+void markdown_block_free(MarkdownBlock *block);
+
+/* Replaces a code block's monochrome markup with syntax-highlighted markup,
+ * spending at most @budget_us. Returns FALSE if there was nothing to do. */
+gboolean markdown_block_highlight(MarkdownBlock *block, gint64 budget_us);
 
 /* Returns newly-allocated Pango markup suitable for GtkLabel. */
-gchar *markdown_to_pango(const gchar *markdown, GtkWidget *style_widget);
+gchar *markdown_to_pango(const gchar *markdown, const MarkdownColors *colors);
 
+/* Same rendering as markdown_to_pango(), split into independently parsable
+ * blocks of at most MARKDOWN_BLOCK_LINES lines. Concatenating the blocks'
+ * markup gives the full document. element-type MarkdownBlock* */
+GPtrArray *markdown_to_pango_blocks(const gchar *markdown, const MarkdownColors *colors);
@@ -0,0 +1,324 @@
+#include "metrics.h"
+
+#include "log.h"
+
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS (METRICS_SUB * 42) /* up to 2^45 us, about a year */
+#define METRICS_HTTP_STATUS_MAX 600
+
+typedef struct
+{
+  guint64 counts[METRICS_BUCKETS];
+  guint64 count;
+  gint64 sum_us;
+  gint64 max_us;
+} MetricsHistogramData;
+
+typedef struct
+{
+  guint64 outcomes[METRICS_OUTCOME_COUNT];
+  guint64 statuses[METRICS_HTTP_STATUS_MAX]; /* 0 = no response */
+  guint64 bytes_out;
+  guint64 bytes_in;
+  guint64 prompt_tokens;
+  guint64 completion_tokens;
+  guint64 cache_hits[METRICS_CACHE_COUNT];
+  guint64 cache_misses[METRICS_CACHE_COUNT];
+  MetricsHistogramData histograms[METRICS_HISTOGRAM_COUNT];
+  guint64 generation; /* bumped by every record */
+} MetricsRegistry;
+
+static MetricsRegistry registry;
+
+static const gchar *const outcome_names[METRICS_OUTCOME_COUNT] = {
+  "ok", "http_error", "bad_response", "transport_error", "cancelled", "rate_limited",
+};
+static const gchar *const histogram_names[METRICS_HISTOGRAM_COUNT] = {
+  "first_byte", "total", "queue_wait",
+};
+static const gchar *const histogram_labels[METRICS_HISTOGRAM_COUNT] = {
+  "First byte", "Total", "Queue wait",
+};
+static const gchar *const cache_names[METRICS_CACHE_COUNT] = {"keyring", "geometry", "models"};
+static const gchar *const cache_labels[METRICS_CACHE_COUNT] = {"Key cache", "Geometry cache", "Models cache"};
+
+/* Prometheus "le" bounds, in seconds. */
+static const gdouble export_bounds[] = {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120};
+
+/* The first 2 * METRICS_SUB values get a bucket each; above that every
+ * power of two is split into METRICS_SUB equal buckets. */
+static guint
+metrics_bucket_index(gint64 us)
+{
+  guint64 v = (guint64)MAX(us, 0);
+  if (v < 2 * METRICS_SUB)
+    return (guint)v;
+  guint shift = g_bit_storage(v) - (METRICS_SUB_BITS + 1);
+  return MIN(METRICS_SUB * shift + (guint)(v >> shift), METRICS_BUCKETS - 1);
+}
+
+/* Largest value that lands in bucket @index. */
+static gint64
+metrics_bucket_upper(guint index)
+{
+  if (index < 2 * METRICS_SUB)
+    return index;
+  guint shift = index / METRICS_SUB - 1;
+  return ((gint64)(index - METRICS_SUB * shift + 1) << shift) - 1;
+}
+
+void
+metrics_record_request(MetricsOutcome outcome, gint http_status, gsize bytes_out, gsize bytes_in)
+{
+  registry.outcomes[outcome]++;
+  if (http_status >= 0 && http_status < METRICS_HTTP_STATUS_MAX)
+    registry.statuses[http_status]++;
+  registry.bytes_out += bytes_out;
+  registry.bytes_in += bytes_in;
+  registry.generation++;
+}
+
+void
+metrics_record_latency(MetricsHistogram histogram, gint64 us)
+{
+  MetricsHistogramData *h = &registry.histograms[histogram];
+  us = MAX(us, 0);
+  h->counts[metrics_bucket_index(us)]++;
+  h->count++;
+  h->sum_us += us;
+  h->max_us = MAX(h->max_us, us);
+  registry.generation++;
+}
+
+void
+metrics_record_usage(gint64 prompt_tokens, gint64 completion_tokens)
+{
+  registry.prompt_tokens += (guint64)MAX(prompt_tokens, 0);
+  registry.completion_tokens += (guint64)MAX(completion_tokens, 0);
+  registry.generation++;
+}
+
+void
+metrics_record_cache(MetricsCache cache, gboolean hit)
+{
+  if (hit)
+    registry.cache_hits[cache]++;
+  else
+    registry.cache_misses[cache]++;
+  registry.generation++;
+}
+
+gint64
+metrics_get_quantile(MetricsHistogram histogram, gdouble q)
+{
+  const MetricsHistogramData *h = &registry.histograms[histogram];
+  if (h->count == 0)
+    return -1;
+  guint64 rank = (guint64)(CLAMP(q, 0.0, 1.0) * (gdouble)h->count);
+  rank = CLAMP(rank, 1, h->count);
+  guint64 seen = 0;
+  for (guint i = 0; i < METRICS_BUCKETS; i++)
+  {
+    seen += h->counts[i];
+    if (seen >= rank)
+      return MIN(metrics_bucket_upper(i), h->max_us);
+  }
+  return h->max_us;
+}
+
+static void
+metrics_append_histogram(GString *out, MetricsHistogram histogram)
+{
+  const MetricsHistogramData *h = &registry.histograms[histogram];
+  const gchar *name = histogram_names[histogram];
+  gchar num[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf(out, "# TYPE xfce_ask_%s_seconds histogram\n", name);
+  guint64 cumulative = 0;
+  guint i = 0;
+  for (guint b = 0; b < G_N_ELEMENTS(export_bounds); b++)
+  {
+    gint64 bound_us = (gint64)(export_bounds[b] * G_USEC_PER_SEC);
+    for (; i < METRICS_BUCKETS && metrics_bucket_upper(i) <= bound_us; i++)
+      cumulative += h->counts[i];
+    g_ascii_dtostr(num, sizeof num, export_bounds[b]);
+    g_string_append_printf(out,
+                           "xfce_ask_%s_seconds_bucket{le=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                           name,
+                           num,
+                           cumulative);
+  }
+  g_string_append_printf(out, "xfce_ask_%s_seconds_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n", name, h->count);
+  g_ascii_dtostr(num, sizeof num, (gdouble)h->sum_us / G_USEC_PER_SEC);
+  g_string_append_printf(out, "xfce_ask_%s_seconds_sum %s\n", name, num);
+  g_string_append_printf(out, "xfce_ask_%s_seconds_count %" G_GUINT64_FORMAT "\n", name, h->count);
+}
+
+gchar *
+metrics_format_prometheus(void)
+{
+  GString *out = g_string_new(NULL);
+
+  g_string_append(out, "# HELP xfce_ask_requests_total Chat requests by outcome.\n");
+  g_string_append(out, "# TYPE xfce_ask_requests_total counter\n");
+  for (guint i = 0; i < METRICS_OUTCOME_COUNT; i++)
+    g_string_append_printf(out,
+                           "xfce_ask_requests_total{outcome=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                           outcome_names[i],
+                           registry.outcomes[i]);
+
+  g_string_append(out, "# HELP xfce_ask_responses_total Responses by HTTP status (0 = none).\n");
+  g_string_append(out, "# TYPE xfce_ask_responses_total counter\n");
+  for (guint i = 0; i < METRICS_HTTP_STATUS_MAX; i++)
+    if (registry.statuses[i])
+      g_string_append_printf(out,
+                             "xfce_ask_responses_total{status=\"%u\"} %" G_GUINT64_FORMAT "\n",
+                             i,
+                             registry.statuses[i]);
+
+  g_string_append(out, "# TYPE xfce_ask_request_bytes_total counter\n");
+  g_string_append_printf(out, "xfce_ask_request_bytes_total %" G_GUINT64_FORMAT "\n", registry.bytes_out);
+  g_string_append(out, "# TYPE xfce_ask_response_bytes_total counter\n");
+  g_string_append_printf(out, "xfce_ask_response_bytes_total %" G_GUINT64_FORMAT "\n", registry.bytes_in);
+  g_string_append(out, "# HELP xfce_ask_tokens_total Token usage reported by the provider.\n");
+  g_string_append(out, "# TYPE xfce_ask_tokens_total counter\n");
+  g_string_append_printf(out, "xfce_ask_tokens_total{kind=\"prompt\"} %" G_GUINT64_FORMAT "\n", registry.prompt_tokens);
+  g_string_append_printf(out,
+                         "xfce_ask_tokens_total{kind=\"completion\"} %" G_GUINT64_FORMAT "\n",
+                         registry.completion_tokens);
+
+  g_string_append(out, "# TYPE xfce_ask_cache_lookups_total counter\n");
+  for (guint i = 0; i < METRICS_CACHE_COUNT; i++)
+  {
+    g_string_append_printf(out,
+                           "xfce_ask_cache_lookups_total{cache=\"%s\",result=\"hit\"} %" G_GUINT64_FORMAT "\n",
+                           cache_names[i],
+                           registry.cache_hits[i]);
+    g_string_append_printf(out,
+                           "xfce_ask_cache_lookups_total{cache=\"%s\",result=\"miss\"} %" G_GUINT64_FORMAT "\n",
+                           cache_names[i],
+                           registry.cache_misses[i]);
+  }
+
+  for (guint i = 0; i < METRICS_HISTOGRAM_COUNT; i++)
+    metrics_append_histogram(out, i);
+  return g_string_free(out, FALSE);
+}
+
+gchar *
+metrics_format_summary(void)
+{
+  GString *out = g_string_new(NULL);
+
+  guint64 failed = 0;
+  for (guint i = METRICS_OUTCOME_HTTP_ERROR; i < METRICS_OUTCOME_COUNT; i++)
+    if (i != METRICS_OUTCOME_CANCELLED)
+      failed += registry.outcomes[i];
+  g_string_append_printf(out,
+                         "Requests: %" G_GUINT64_FORMAT " ok, %" G_GUINT64_FORMAT " failed, %" G_GUINT64_FORMAT
+                         " cancelled\n",
+                         registry.outcomes[METRICS_OUTCOME_OK],
+                         failed,
+                         registry.outcomes[METRICS_OUTCOME_CANCELLED]);
+
+  for (guint i = 0; i < METRICS_HISTOGRAM_COUNT; i++)
+  {
+    if (registry.histograms[i].count == 0)
+      continue;
+    g_string_append_printf(out,
+                           "%s: p50 %.2f s, p90 %.2f s, p99 %.2f s\n",
+                           histogram_labels[i],
+                           metrics_get_quantile(i, 0.5) / 1e6,
+                           metrics_get_quantile(i, 0.9) / 1e6,
+                           metrics_get_quantile(i, 0.99) / 1e6);
+  }
+
+  g_autofree gchar *sent = g_format_size(registry.bytes_out);
+  g_autofree gchar *received = g_format_size(registry.bytes_in);
+  g_string_append_printf(out, "Traffic: %s sent, %s received\n", sent, received);
+  g_string_append_printf(out,
+                         "Tokens: %" G_GUINT64_FORMAT " prompt, %" G_GUINT64_FORMAT " completion\n",
+                         registry.prompt_tokens,
+                         registry.completion_tokens);
+
+  for (guint i = 0; i < METRICS_CACHE_COUNT; i++)
+  {
+    guint64 lookups = registry.cache_hits[i] + registry.cache_misses[i];
+    if (lookups)
+      g_string_append_printf(out,
+                             "%s: %.0f%% hits of %" G_GUINT64_FORMAT "\n",
+                             cache_labels[i],
+                             100.0 * (gdouble)registry.cache_hits[i] / (gdouble)lookups,
+                             lookups);
+  }
+  if (out->len && out->str[out->len - 1] == '\n')
+    g_string_truncate(out, out->len - 1);
+  return g_string_free(out, FALSE);
+}
+
+const gchar *
+metrics_get_export_dir(void)
+{
+  static gchar *dir = NULL;
+  if (dir)
+    return dir;
+  const gchar *env = g_getenv("XFCE_ASK_METRICS_DIR");
+  if (env && *env)
+    dir = g_strdup(env);
+  else
+    dir = g_build_filename(g_get_user_cache_dir(), "openai-ask", "metrics", NULL);
+  return dir;
+}
+
+typedef struct
+{
+  gchar *name;
+  gchar *path;
+  guint64 written; /* generation last written */
+} MetricsExport;
+
+static GPtrArray *exports = NULL;
+
+static gboolean
+metrics_on_export(gpointer user_data)
+{
+  MetricsExport *export = user_data;
+  if (export->written == registry.generation)
+    return G_SOURCE_CONTINUE;
+
+  g_autofree gchar *text = metrics_format_prometheus();
+  g_autoptr(GError) error = NULL;
+  g_mkdir_with_parents(metrics_get_export_dir(), 0700);
+  /* Replaced atomically, so a collector never reads half a file. */
+  if (!g_file_set_contents(export->path, text, -1, &error))
+    openai_ask_log("metrics: cannot write %s: %s", export->path, error->message);
+  export->written = registry.generation;
+  return G_SOURCE_CONTINUE;
+}
+
+void
+metrics_start_export(const gchar *name)
+{
+  if (!exports)
+    exports = g_ptr_array_new();
+  for (guint i = 0; i < exports->len; i++)
+    if (g_strcmp0(((MetricsExport *)g_ptr_array_index(exports, i))->name, name) == 0)
+      return;
+
+  MetricsExport *export = g_new0(MetricsExport, 1);
+  export->name = g_strdup(name);
+  g_autofree gchar *file = g_strconcat(name, ".prom", NULL);
+  export->path = g_build_filename(metrics_get_export_dir(), file, NULL);
+  export->written = G_MAXUINT64;
+  g_ptr_array_add(exports, export);
+  g_timeout_add_seconds(METRICS_EXPORT_INTERVAL_S, metrics_on_export, export);
+  openai_ask_log("metrics: exporting to %s", export->path);
+}
+
+void
+metrics_flush_exports(void)
+{
+  for (guint i = 0; exports && i < exports->len; i++)
+    metrics_on_export(g_ptr_array_index(exports, i));
+}
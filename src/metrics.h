@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glib.h>
+
+/* Seconds between writes of the Prometheus text file. */
+#define METRICS_EXPORT_INTERVAL_S 30
+
+typedef enum
+{
+  METRICS_OUTCOME_OK,
+  METRICS_OUTCOME_HTTP_ERROR, /* non-2xx */
+  METRICS_OUTCOME_BAD_RESPONSE, /* 2xx without an answer in it */
+  METRICS_OUTCOME_TRANSPORT_ERROR,
+  METRICS_OUTCOME_CANCELLED,
+  METRICS_OUTCOME_RATE_LIMITED, /* refused by the client-side rate limiter */
+  METRICS_OUTCOME_COUNT,
+} MetricsOutcome;
+
+typedef enum
+{
+  METRICS_HISTOGRAM_FIRST_BYTE, /* request sent to response headers */
+  METRICS_HISTOGRAM_TOTAL, /* request sent to whole response read */
+  METRICS_HISTOGRAM_QUEUE_WAIT, /* time in the request scheduler's queue */
+  METRICS_HISTOGRAM_COUNT,
+} MetricsHistogram;
+
+typedef enum
+{
+  METRICS_CACHE_KEYRING, /* API key lookups */
+  METRICS_CACHE_GEOMETRY, /* popup anchor and monitor geometry */
+  METRICS_CACHE_MODELS, /* model lists younger than MODEL_CACHE_TTL_S */
+  METRICS_CACHE_COUNT,
+} MetricsCache;
+
+/* A process-wide registry of request counters, latency histograms, traffic,
+ * token usage and cache hit rates since the process started. Histograms
+ * are log-linear in microseconds (16 buckets per power of two, so any
+ * quantile is within about 6%) and never allocate. Main thread only. */
+
+/* @http_status is 0 when no response came and -1 when nothing was sent. */
+void metrics_record_request(MetricsOutcome outcome, gint http_status, gsize bytes_out, gsize bytes_in);
+void metrics_record_latency(MetricsHistogram histogram, gint64 us);
+/* From the "usage" member of a response. */
+void metrics_record_usage(gint64 prompt_tokens, gint64 completion_tokens);
+void metrics_record_cache(MetricsCache cache, gboolean hit);
+
+/* @q in [0, 1]; -1 if nothing was recorded. */
+gint64 metrics_get_quantile(MetricsHistogram histogram, gdouble q);
+
+/* Prometheus text exposition format, metric names prefixed "xfce_ask_". */
+gchar *metrics_format_prometheus(void);
+/* A few lines for people: outcomes, latency quantiles, traffic, tokens and
+ * cache hit rates. */
+gchar *metrics_format_summary(void);
+
+/* Writes metrics_format_prometheus() to @name.prom in the metrics directory
+ * every METRICS_EXPORT_INTERVAL_S seconds while anything changed, e.g. for
+ * node_exporter's textfile collector. */
+void metrics_start_export(const gchar *name);
+/* Writes every started export now if anything changed, e.g. before exit. */
+void metrics_flush_exports(void);
+/* $XDG_CACHE_HOME/openai-ask/metrics, or $XFCE_ASK_METRICS_DIR. */
+const gchar *metrics_get_export_dir(void);
@@ -0,0 +1,222 @@
+#include "model-cache.h"
+
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "openai-client.h"
+
+typedef struct
+{
+  gint64 fetched; /* unix seconds */
+  GStrv models;
+} ModelCacheEntry;
+
+static GHashTable *model_cache_entries = NULL; /* endpoint -> ModelCacheEntry */
+static gint64 model_cache_mtime = -1; /* of the file when last read */
+
+static void
+model_cache_entry_free(gpointer data)
+{
+  ModelCacheEntry *entry = data;
+  g_strfreev(entry->models);
+  g_free(entry);
+}
+
+gchar *
+model_cache_default_path(void)
+{
+  const gchar *cache = g_get_user_cache_dir();
+  if (!cache || !*cache)
+    cache = g_get_home_dir();
+  return g_build_filename(cache, "openai-ask", "models.json", NULL);
+}
+
+static gint64
+model_cache_file_mtime(const gchar *path)
+{
+  GStatBuf st;
+  return g_stat(path, &st) == 0 ? (gint64)st.st_mtime : -1;
+}
+
+/* {"<endpoint>": {"fetched": <unix s>, "models": ["id", ...]}, ...} */
+static void
+model_cache_parse(const gchar *path)
+{
+  g_hash_table_remove_all(model_cache_entries);
+  g_autoptr(JsonParser) parser = json_parser_new();
+  if (!json_parser_load_from_file(parser, path, NULL))
+    return;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return;
+
+  JsonObject *obj = json_node_get_object(root);
+  g_autoptr(GList) endpoints = json_object_get_members(obj);
+  for (GList *l = endpoints; l; l = l->next)
+  {
+    JsonNode *node = json_object_get_member(obj, l->data);
+    if (!JSON_NODE_HOLDS_OBJECT(node))
+      continue;
+    JsonObject *e = json_node_get_object(node);
+    JsonNode *list = json_object_get_member(e, "models");
+    if (!list || !JSON_NODE_HOLDS_ARRAY(list))
+      continue;
+
+    JsonArray *array = json_node_get_array(list);
+    GPtrArray *models = g_ptr_array_new();
+    for (guint i = 0; i < json_array_get_length(array); i++)
+    {
+      const gchar *id = json_array_get_string_element(array, i);
+      if (id && *id)
+        g_ptr_array_add(models, g_strdup(id));
+    }
+    g_ptr_array_add(models, NULL);
+
+    ModelCacheEntry *entry = g_new0(ModelCacheEntry, 1);
+    entry->fetched = json_object_get_int_member_with_default(e, "fetched", 0);
+    entry->models = (GStrv)g_ptr_array_free(models, FALSE);
+    g_hash_table_replace(model_cache_entries, g_strdup(l->data), entry);
+  }
+}
+
+/* Reads the file again whenever another panel instance has written it. */
+static void
+model_cache_load(void)
+{
+  if (!model_cache_entries)
+    model_cache_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, model_cache_entry_free);
+
+  g_autofree gchar *path = model_cache_default_path();
+  gint64 mtime = model_cache_file_mtime(path);
+  if (mtime == model_cache_mtime)
+    return;
+  model_cache_mtime = mtime;
+  if (mtime >= 0)
+    model_cache_parse(path);
+}
+
+static void
+model_cache_save(void)
+{
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, model_cache_entries);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const ModelCacheEntry *entry = value;
+    json_builder_set_member_name(b, key);
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "fetched");
+    json_builder_add_int_value(b, entry->fetched);
+    json_builder_set_member_name(b, "models");
+    json_builder_begin_array(b);
+    for (guint i = 0; entry->models[i]; i++)
+      json_builder_add_string_value(b, entry->models[i]);
+    json_builder_end_array(b);
+    json_builder_end_object(b);
+  }
+  json_builder_end_object(b);
+
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  gsize len = 0;
+  g_autofree gchar *data = json_generator_to_data(gen, &len);
+
+  g_autofree gchar *path = model_cache_default_path();
+  g_autofree gchar *dir = g_path_get_dirname(path);
+  g_mkdir_with_parents(dir, 0700);
+  g_autoptr(GError) error = NULL;
+  if (!g_file_set_contents(path, data, (gssize)len, &error))
+  {
+    openai_ask_log("models: cannot write %s: %s", path, error->message);
+    return;
+  }
+  model_cache_mtime = model_cache_file_mtime(path);
+}
+
+GStrv
+model_cache_lookup(const gchar *endpoint, gboolean *fresh)
+{
+  if (fresh)
+    *fresh = FALSE;
+  if (!endpoint || !*endpoint)
+    return NULL;
+
+  model_cache_load();
+  const ModelCacheEntry *entry = g_hash_table_lookup(model_cache_entries, endpoint);
+  gint64 age = entry ? g_get_real_time() / G_USEC_PER_SEC - entry->fetched : -1;
+  gboolean is_fresh = entry && age >= 0 && age < MODEL_CACHE_TTL_S;
+  metrics_record_cache(METRICS_CACHE_MODELS, is_fresh);
+  if (fresh)
+    *fresh = is_fresh;
+  return entry ? g_strdupv(entry->models) : NULL;
+}
+
+void
+model_cache_store(const gchar *endpoint, const gchar *const *models)
+{
+  g_return_if_fail(endpoint != NULL && models != NULL);
+
+  model_cache_load();
+  ModelCacheEntry *entry = g_new0(ModelCacheEntry, 1);
+  entry->fetched = g_get_real_time() / G_USEC_PER_SEC;
+  entry->models = g_strdupv((gchar **)models);
+  g_hash_table_replace(model_cache_entries, g_strdup(endpoint), entry);
+  model_cache_save();
+}
+
+typedef struct
+{
+  gchar *endpoint;
+  GCancellable *cancellable;
+  ModelCacheCallback callback;
+  gpointer user_data;
+} ModelCacheRefresh;
+
+static void
+model_cache_on_models(GStrv models, const GError *error, gpointer user_data)
+{
+  ModelCacheRefresh *refresh = user_data;
+  if (models)
+  {
+    openai_ask_log("models: %u for %s", g_strv_length(models), refresh->endpoint);
+    model_cache_store(refresh->endpoint, (const gchar *const *)models);
+  }
+  else
+    openai_ask_log("models: refresh of %s failed: %s", refresh->endpoint, error ? error->message : "unknown error");
+
+  if (refresh->cancellable && g_cancellable_is_cancelled(refresh->cancellable))
+  {
+    g_autoptr(GError) cancelled = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED, "Operation was cancelled");
+    refresh->callback(NULL, cancelled, refresh->user_data);
+  }
+  else
+    refresh->callback(models, error, refresh->user_data);
+
+  g_clear_object(&refresh->cancellable);
+  g_free(refresh->endpoint);
+  g_free(refresh);
+}
+
+void
+model_cache_refresh_async(const gchar *endpoint,
+                          const gchar *api_key,
+                          GCancellable *cancellable,
+                          ModelCacheCallback callback,
+                          gpointer user_data)
+{
+  g_return_if_fail(endpoint != NULL);
+  g_return_if_fail(callback != NULL);
+
+  ModelCacheRefresh *refresh = g_new0(ModelCacheRefresh, 1);
+  refresh->endpoint = g_strdup(endpoint);
+  refresh->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+  refresh->callback = callback;
+  refresh->user_data = user_data;
+  openai_client_list_models_async(endpoint, api_key, cancellable, model_cache_on_models, refresh);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/* A model list younger than this is not fetched again. */
+#define MODEL_CACHE_TTL_S (6 * 60 * 60)
+
+/* The models each endpoint's server offered, kept in
+ * $XDG_CACHE_HOME/openai-ask/models.json so the Properties dialog can
+ * offer them at once and refresh them in the background. Main thread
+ * only. */
+
+/* The models last fetched for @endpoint (free with g_strfreev()), or NULL
+ * if it never answered. @fresh, if not NULL, is set to whether they are
+ * younger than MODEL_CACHE_TTL_S. */
+GStrv model_cache_lookup(const gchar *endpoint, gboolean *fresh);
+void model_cache_store(const gchar *endpoint, const gchar *const *models);
+
+/* Same as openai_client_list_models_async(), storing what arrives. The
+ * callback is never called with a list once @cancellable is cancelled. */
+typedef void (*ModelCacheCallback)(GStrv models, const GError *error, gpointer user_data);
+void model_cache_refresh_async(const gchar *endpoint,
+                               const gchar *api_key,
+                               GCancellable *cancellable,
+                               ModelCacheCallback callback,
+                               gpointer user_data);
+
+/* $XDG_CACHE_HOME/openai-ask/models.json */
+gchar *model_cache_default_path(void);
@@ -0,0 +1,294 @@
+#include "model-router.h"
+
+#include <string.h>
+
+#include "log.h"
+
+/* Only the start of a prompt is searched for keywords. */
+#define MODEL_ROUTER_SCAN_BYTES 4096
+#define MODEL_ROUTER_LONG_BYTES 600
+#define MODEL_ROUTER_MEDIUM_BYTES 200
+
+typedef struct
+{
+  gchar *name;
+  guint samples;
+  gdouble latency_us; /* average of successful requests; 0 = none yet */
+  gdouble error_rate;
+  gint64 failed_us; /* monotonic time of the last failure */
+} ModelRouterModel;
+
+struct _ModelRouter
+{
+  gchar *endpoint;
+  GArray *models; /* ModelRouterModel, smallest first */
+};
+
+/* Matched as whole words, so "plan" is not found in "planet" nor "who" in
+ * "whole"; the forms of a word that matter are listed. */
+static const gchar *const model_router_hard_words[] = {
+  "explain", "explained", "explaining", "why", "design", "designing", "refactor", "refactoring", "debug", "debugging",
+  "prove", "proof", "compare", "comparing", "comparison", "difference", "step by step", "analyze", "analyse",
+  "analysis", "analyzing", "analysing", "implement", "implementing", "optimize", "optimise", "optimizing", "optimising",
+  "optimization", "optimisation", "review", "trade-off", "trade-offs", "tradeoff", "tradeoffs", "architect",
+  "architecture", "algorithm", "algorithms", "derive", "plan", "planning",
+};
+static const gchar *const model_router_moderate_words[] = {
+  "how", "summarize", "summarise", "summary", "translate", "rewrite", "write", "list", "example", "examples", "suggest",
+  "suggestions", "pros and cons",
+};
+static const gchar *const model_router_simple_words[] = {
+  "what is", "what's", "who", "when", "where", "define", "convert", "spell", "capital of", "how many", "synonym",
+};
+
+static const gchar *const model_router_class_names[] = {
+  [MODEL_ROUTER_CLASS_SIMPLE] = "simple",
+  [MODEL_ROUTER_CLASS_MODERATE] = "moderate",
+  [MODEL_ROUTER_CLASS_HARD] = "hard",
+};
+
+static void
+model_router_model_clear(gpointer data)
+{
+  ModelRouterModel *model = data;
+  g_free(model->name);
+}
+
+ModelRouter *
+model_router_new(void)
+{
+  ModelRouter *router = g_new0(ModelRouter, 1);
+  router->models = g_array_new(FALSE, TRUE, sizeof(ModelRouterModel));
+  g_array_set_clear_func(router->models, model_router_model_clear);
+  return router;
+}
+
+void
+model_router_free(ModelRouter *router)
+{
+  if (!router)
+    return;
+  g_array_unref(router->models);
+  g_free(router->endpoint);
+  g_free(router);
+}
+
+static ModelRouterModel *
+model_router_find(const ModelRouter *router, const gchar *name, guint *index)
+{
+  for (guint i = 0; name && i < router->models->len; i++)
+  {
+    ModelRouterModel *model = &g_array_index(router->models, ModelRouterModel, i);
+    if (g_strcmp0(model->name, name) == 0)
+    {
+      if (index)
+        *index = i;
+      return model;
+    }
+  }
+  return NULL;
+}
+
+void
+model_router_configure(ModelRouter *router, const gchar *endpoint, const gchar *const *models)
+{
+  gboolean same_endpoint = g_strcmp0(router->endpoint, endpoint) == 0;
+  GArray *next = g_array_new(FALSE, TRUE, sizeof(ModelRouterModel));
+  g_array_set_clear_func(next, model_router_model_clear);
+  for (guint i = 0; models && models[i]; i++)
+  {
+    if (!*models[i])
+      continue;
+    ModelRouterModel model = {0};
+    ModelRouterModel *old = same_endpoint ? model_router_find(router, models[i], NULL) : NULL;
+    if (old)
+      model = *old;
+    model.name = g_strdup(models[i]);
+    g_array_append_val(next, model);
+  }
+  g_array_unref(router->models);
+  router->models = next;
+  g_free(router->endpoint);
+  router->endpoint = g_strdup(endpoint);
+}
+
+guint
+model_router_get_count(const ModelRouter *router)
+{
+  return router->models->len;
+}
+
+const gchar *
+model_router_class_get_name(ModelRouterClass klass)
+{
+  if ((guint)klass >= G_N_ELEMENTS(model_router_class_names))
+    return "simple";
+  return model_router_class_names[klass];
+}
+
+static guint
+model_router_count_words(const gchar *text, const gchar *const *words, guint n_words)
+{
+  guint hits = 0;
+  for (guint i = 0; i < n_words; i++)
+  {
+    gsize len = strlen(words[i]);
+    for (const gchar *p = strstr(text, words[i]); p; p = strstr(p + 1, words[i]))
+    {
+      if ((p == text || !g_ascii_isalnum(p[-1])) && !g_ascii_isalnum(p[len]))
+      {
+        hits++;
+        break;
+      }
+    }
+  }
+  return hits;
+}
+
+/* Fences, or several lines that end like statements or blocks. */
+static gboolean
+model_router_has_code(const gchar *text)
+{
+  if (strstr(text, "```") || strstr(text, "#include") || strstr(text, "def ") || strstr(text, "=>"))
+    return TRUE;
+  guint code_lines = 0;
+  for (const gchar *line = text; line && *line;)
+  {
+    const gchar *end = strchr(line, '\n');
+    const gchar *last = end ? end : line + strlen(line);
+    while (last > line && g_ascii_isspace(last[-1]))
+      last--;
+    if (last > line && (last[-1] == ';' || last[-1] == '{' || last[-1] == '}'))
+      code_lines++;
+    line = end ? end + 1 : NULL;
+  }
+  return code_lines >= 2;
+}
+
+ModelRouterClass
+model_router_classify(const gchar *prompt)
+{
+  if (!prompt || !*prompt)
+    return MODEL_ROUTER_CLASS_SIMPLE;
+  gsize len = strlen(prompt);
+  g_autofree gchar *text = g_ascii_strdown(prompt, MIN(len, MODEL_ROUTER_SCAN_BYTES));
+  if (model_router_has_code(text))
+    return MODEL_ROUTER_CLASS_HARD;
+
+  gint score = 0;
+  if (len > MODEL_ROUTER_LONG_BYTES)
+    score += 2;
+  else if (len > MODEL_ROUTER_MEDIUM_BYTES)
+    score += 1;
+  score += 2 * (gint)model_router_count_words(text, model_router_hard_words, G_N_ELEMENTS(model_router_hard_words));
+  score += (gint)model_router_count_words(text, model_router_moderate_words, G_N_ELEMENTS(model_router_moderate_words));
+  score -= (gint)model_router_count_words(text, model_router_simple_words, G_N_ELEMENTS(model_router_simple_words));
+
+  /* Several questions at once, or several paragraphs. */
+  guint questions = 0;
+  guint lines = 0;
+  for (const gchar *p = text; *p; p++)
+  {
+    questions += *p == '?';
+    lines += *p == '\n';
+  }
+  if (questions > 1 || lines > 3)
+    score++;
+
+  if (score >= 2)
+    return MODEL_ROUTER_CLASS_HARD;
+  return score == 1 ? MODEL_ROUTER_CLASS_MODERATE : MODEL_ROUTER_CLASS_SIMPLE;
+}
+
+static gboolean
+model_router_model_is_failing(const ModelRouterModel *model, gint64 now)
+{
+  return model->samples >= MODEL_ROUTER_MIN_SAMPLES && model->error_rate > MODEL_ROUTER_MAX_ERROR_RATE &&
+         now - model->failed_us < MODEL_ROUTER_RETRY_US;
+}
+
+const gchar *
+model_router_pick(ModelRouter *router, const gchar *prompt)
+{
+  return model_router_pick_at_least(router, prompt, NULL);
+}
+
+const gchar *
+model_router_pick_at_least(ModelRouter *router, const gchar *prompt, const gchar *model)
+{
+  guint n = router->models->len;
+  if (n == 0)
+    return NULL;
+
+  /* The classes are spread over the list: with two models, only hard
+   * prompts need the second; with three, each class gets its own. */
+  ModelRouterClass klass = model_router_classify(prompt);
+  guint first = klass * (n - 1) / (MODEL_ROUTER_CLASS_COUNT - 1);
+  guint smallest = 0;
+  if (model_router_find(router, model, &smallest))
+    first = MAX(first, smallest);
+
+  /* Models are listed smallest first, so one not measured yet is taken to
+   * be faster than the bigger ones; a bigger model is only preferred once
+   * it has proven faster (e.g. the small one runs on a busy machine). */
+  gint64 now = g_get_monotonic_time();
+  gint best = -1;
+  for (guint i = first; i < n; i++)
+  {
+    const ModelRouterModel *model = &g_array_index(router->models, ModelRouterModel, i);
+    if (model_router_model_is_failing(model, now))
+      continue;
+    if (best < 0)
+    {
+      best = (gint)i;
+      continue;
+    }
+    const ModelRouterModel *current = &g_array_index(router->models, ModelRouterModel, best);
+    if (model->latency_us > 0 && current->latency_us > 0 && model->latency_us < current->latency_us)
+      best = (gint)i;
+  }
+  /* Everything big enough is failing: take the one failing least. */
+  if (best < 0)
+  {
+    best = (gint)first;
+    for (guint i = first + 1; i < n; i++)
+      if (g_array_index(router->models, ModelRouterModel, i).error_rate <
+          g_array_index(router->models, ModelRouterModel, best).error_rate)
+        best = (gint)i;
+  }
+
+  const ModelRouterModel *picked = &g_array_index(router->models, ModelRouterModel, best);
+  openai_ask_log("route: %s prompt, %s (%.0f ms, %.0f%% errors over %u)",
+                 model_router_class_get_name(klass),
+                 picked->name,
+                 picked->latency_us / 1000.0,
+                 picked->error_rate * 100.0,
+                 picked->samples);
+  return picked->name;
+}
+
+const gchar *
+model_router_get_bigger(const ModelRouter *router, const gchar *model)
+{
+  guint index;
+  if (!model_router_find(router, model, &index) || index + 1 >= router->models->len)
+    return NULL;
+  return g_array_index(router->models, ModelRouterModel, index + 1).name;
+}
+
+void
+model_router_record(ModelRouter *router, const gchar *model, gboolean ok, gint64 latency_us)
+{
+  ModelRouterModel *entry = model_router_find(router, model, NULL);
+  if (!entry)
+    return;
+  /* The first samples weigh as much as the ones after them. */
+  gdouble alpha = MAX(MODEL_ROUTER_EWMA_ALPHA, 1.0 / (entry->samples + 1));
+  entry->error_rate += alpha * ((ok ? 0.0 : 1.0) - entry->error_rate);
+  if (!ok)
+    entry->failed_us = g_get_monotonic_time();
+  if (ok && latency_us > 0)
+    entry->latency_us = entry->latency_us > 0 ? entry->latency_us + MODEL_ROUTER_EWMA_ALPHA * (latency_us - entry->latency_us)
+                                              : (gdouble)latency_us;
+  entry->samples++;
+}
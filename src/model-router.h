@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glib.h>
+
+/* Weight of the newest sample in a model's latency and error averages. */
+#define MODEL_ROUTER_EWMA_ALPHA 0.3
+/* A model failing more often than this is passed over once it has
+ * MODEL_ROUTER_MIN_SAMPLES results, until MODEL_ROUTER_RETRY_US after its
+ * last failure. */
+#define MODEL_ROUTER_MAX_ERROR_RATE 0.5
+#define MODEL_ROUTER_MIN_SAMPLES 3
+#define MODEL_ROUTER_RETRY_US (60 * G_USEC_PER_SEC)
+
+/* How much model a prompt needs, from model_router_classify(). */
+typedef enum
+{
+  MODEL_ROUTER_CLASS_SIMPLE, /* short factual question, lookup, conversion */
+  MODEL_ROUTER_CLASS_MODERATE,
+  MODEL_ROUTER_CLASS_HARD, /* code, long prompts, reasoning, design */
+  MODEL_ROUTER_CLASS_COUNT,
+} ModelRouterClass;
+
+/* Routing mode: an ordered list of models on one endpoint, smallest first.
+ * Each prompt is classified locally and sent to the fastest model that is
+ * at least as big as its class needs and does not fail too often, going
+ * by the latency and errors seen so far. Main thread only. */
+typedef struct _ModelRouter ModelRouter;
+
+ModelRouter *model_router_new(void);
+void model_router_free(ModelRouter *router);
+
+/* Sets the NULL-terminated @models. Statistics are kept for models still
+ * in the list unless @endpoint changed. */
+void model_router_configure(ModelRouter *router, const gchar *endpoint, const gchar *const *models);
+guint model_router_get_count(const ModelRouter *router);
+
+/* Cheap heuristics over length, code and keywords; no request is made. */
+ModelRouterClass model_router_classify(const gchar *prompt);
+const gchar *model_router_class_get_name(ModelRouterClass klass);
+
+/* The model for @prompt (owned by @router), or NULL if no models are set. */
+const gchar *model_router_pick(ModelRouter *router, const gchar *prompt);
+/* Like model_router_pick(), but never a model smaller than @model, for a
+ * follow-up in a conversation @model answered. @model may be NULL or not
+ * in the list. */
+const gchar *model_router_pick_at_least(ModelRouter *router, const gchar *prompt, const gchar *model);
+/* The next bigger model after @model, or NULL if it is the biggest or not
+ * in the list. */
+const gchar *model_router_get_bigger(const ModelRouter *router, const gchar *model);
+
+/* The outcome of a request to @model; cancelled requests are not recorded. */
+void model_router_record(ModelRouter *router, const gchar *model, gboolean ok, gint64 latency_us);
@@ -1,15 +1,61 @@
 #include <gtk/gtk.h>
 #include <libxfce4panel/libxfce4panel.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "answer-view.h"
+#include "attachment.h"
+#include "batch.h"
+#include "conversation.h"
+#include "engine-client.h"
+#include "history.h"
 #include "keyring.h"
 #include "log.h"
 #include "markdown-pango.h"
+#include "metrics.h"
+#include "model-cache.h"
+#include "model-router.h"
 #include "openai-client.h"
+#include "output-budget.h"
+#include "rate-limiter.h"
+#include "request-scheduler.h"
+#include "retrieval.h"
+#include "settings.h"
 
 typedef struct _OpenaiAskPlugin OpenaiAskPlugin;
 typedef struct _OpenaiAskPluginClass OpenaiAskPluginClass;
 
+/* One conversation, shown as a tab in the popup. Each has its own requests,
+ * so a slow answer does not hold up a question asked in another tab. */
+typedef struct
+{
+  guint64 id; /* owner in the request scheduler */
+  Conversation *conversation;
+  gint64 conversation_id; /* groups exchanges in the history log */
+  GCancellable *cancellable;
+  gboolean in_flight;
+  gboolean queued; /* waiting for a free slot on the endpoint */
+  gboolean searching; /* looking up local documents for the question */
+  gint64 hold_until; /* held by the rate limiter until then; 0 = not */
+  GCancellable *compact_cancellable;
+  gboolean compact_in_flight;
+  gchar *title;
+  gchar *answer; /* last answer, markdown */
+  gchar *error; /* or why there is none */
+  gchar *model; /* asked the last question */
+  GPtrArray *attachments; /* of the last question, for asking it again */
+  /* A fast model asked the same question alongside (see draft_model); its
+   * answer is shown until the real one replaces it. */
+  gchar *draft_model; /* NULL if there is no draft for this question */
+  gchar *draft;
+  GCancellable *draft_cancellable;
+  gboolean draft_in_flight;
+  gint64 asked_us; /* when the question was sent, for the draft's head start */
+  Batch *batch; /* this tab shows a running batch (Ctrl+Enter), one of the plugin's batches */
+  gboolean truncated; /* the answer was cut at the output budget; Ctrl+M fetches the rest */
+  GtkWidget *tab;
+} OpenaiAskChat;
+
 struct _OpenaiAskPlugin
 {
   XfcePanelPlugin parent_instance;
@@ -24,21 +70,56 @@ struct _OpenaiAskPlugin
   GtkWidget *popover_stack;
   GtkWidget *popover_spinner;
   GtkWidget *popover_label;
-  guint relayout_source_id;
+  GtkWidget *answer_scrolled; /* "large" page, see ANSWER_VIEW_THRESHOLD_BYTES */
+  GtkWidget *answer_view;
+  guint relayout_source_id; /* idle while the popup is unmapped */
+  guint relayout_tick_id; /* frame clock tick while it is mapped */
+  gint64 last_resize_us;
+  gchar *pending_answer; /* applied on the next frame, see set_answer() */
+  guint answer_tick_id;
+  /* Updates since the popup was shown, logged when it hides. */
+  guint answers_applied;
+  guint answers_merged;
+  guint relayouts_applied;
+  guint relayouts_merged;
+  guint resizes_deferred;
   GtkCssProvider *frame_css;
 
-  GCancellable *request_cancellable;
-  gboolean request_in_flight;
-
-  GPtrArray *messages; /* element-type OpenaiChatMessage* */
-
-  gchar *endpoint;
-  gchar *model;
-  gchar *system_prompt;
-  gdouble temperature;
-  gint width_chars;
-  gint reply_width_px; /* 0 = match anchor width */
-  gint reply_opacity_pct; /* 0..100, affects background only */
+  /* Anchor and monitor geometry, recomputed only after the signals wired in
+   * openai_ask_plugin_watch_geometry() invalidate them. */
+  gboolean anchor_valid;
+  GdkRectangle anchor_rect;
+  gboolean monitor_valid;
+  gboolean monitor_found;
+  GdkRectangle monitor_geo;
+  GtkWidget *geometry_toplevel;
+  gulong geometry_configure_id;
+
+  guint lazy_init_id; /* builds the popup unless focus does first */
+  guint prewarm_source_id;
+  gboolean prewarmed;
+  gint64 show_key_press_us;
+  guint show_count;
+
+  GPtrArray *chats; /* OpenaiAskChat, in tab order */
+  OpenaiAskChat *chat; /* the one on screen */
+  GtkWidget *tab_bar;
+  GtkWidget *loading_label;
+  guint hold_tick_id; /* counts down held requests on the loading page */
+  GPtrArray *attachments; /* sent with the next question */
+  GPtrArray *batches; /* Batch, running; they outlive the popup and show in the panel */
+
+  History *history;
+  gboolean history_mode; /* entry text is a history query (Ctrl+R) */
+  GtkWidget *history_scrolled;
+  GtkWidget *history_list;
+  GtkWidget *history_placeholder;
+  GtkWidget *history_prev_child; /* non-NULL if a conversation was showing */
+
+  Retrieval *retrieval; /* NULL unless document directories are set */
+  ModelRouter *router; /* NULL unless route models are set */
+
+  OpenaiAskSettings settings;
 };
 
 struct _OpenaiAskPluginClass
@@ -46,19 +127,41 @@ struct _OpenaiAskPluginClass
   XfcePanelPluginClass parent_class;
 };
 
-static void openai_ask_plugin_cancel_inflight(OpenaiAskPlugin *self);
+static void openai_ask_plugin_update_attachments(OpenaiAskPlugin *self);
+static void openai_ask_plugin_ensure_popup(OpenaiAskPlugin *self);
 static void openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self);
 
 XFCE_PANEL_DEFINE_PLUGIN(OpenaiAskPlugin, openai_ask_plugin)
 
-static const gchar *KF_GROUP = "config";
-static const gchar *KF_ENDPOINT = "endpoint";
-static const gchar *KF_MODEL = "model";
-static const gchar *KF_SYSTEM_PROMPT = "system_prompt";
-static const gchar *KF_TEMPERATURE = "temperature";
-static const gchar *KF_WIDTH_CHARS = "width_chars";
-static const gchar *KF_REPLY_WIDTH_PX = "reply_width_px";
-static const gchar *KF_REPLY_OPACITY_PCT = "reply_opacity_pct";
+/* Answers above this size skip the GtkLabel and use the virtualized view. */
+#define ANSWER_VIEW_THRESHOLD_BYTES (32 * 1024)
+#define HISTORY_SEARCH_RESULTS 20
+#define FOLLOWUP_MAX_TURNS 6 /* plus the system prompt and summary */
+#define COMPACT_TEMPERATURE 0.2
+#define CHAT_MAX 6 /* conversations open at once, one tab each */
+#define CHAT_TITLE_CHARS 20
+#define LAZY_INIT_DELAY_S 5
+#define POPUP_BORDER 24 /* openai-ask-frame border width (12px) top+bottom */
+#define POPUP_SPACING 8 /* popover_box spacing */
+/* The popup is moved or resized at most this often, so a burst of content
+ * changes does not make it jitter. */
+#define POPUP_RESIZE_INTERVAL_US (100 * 1000)
+
+static const gchar *COMPACT_PROMPT =
+  "Summarize the conversation below in a short paragraph for the assistant to continue from. "
+  "Keep facts, names, numbers, code identifiers and decisions the user may refer back to. "
+  "Reply with the summary only.";
+
+/* For the startup measurements in the debug log. */
+static glong
+openai_ask_plugin_rss_kb(void)
+{
+  g_autofree gchar *status = NULL;
+  if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+    return 0;
+  const gchar *line = strstr(status, "VmRSS:");
+  return line ? strtol(line + strlen("VmRSS:"), NULL, 10) : 0;
+}
 
 static void
 openai_ask_plugin_apply_css(OpenaiAskPlugin *self)
@@ -85,6 +188,12 @@ openai_ask_plugin_apply_css(OpenaiAskPlugin *self)
     "}"
     "#openai-ask-header label {"
     "  font-weight: bold;"
+    "}"
+    "#openai-ask-tabs button {"
+    "  padding: 0 6px;"
+    "}"
+    "#openai-ask-tabs button.current label {"
+    "  font-weight: bold;"
     "}",
     -1,
     NULL);
@@ -94,13 +203,37 @@ openai_ask_plugin_apply_css(OpenaiAskPlugin *self)
   g_object_unref(provider);
 }
 
+static void
+openai_ask_plugin_rgba_to_hex(const GdkRGBA *rgba, gchar out[8])
+{
+  guint r = (guint)(CLAMP(rgba->red, 0.0, 1.0) * 255.0);
+  guint g = (guint)(CLAMP(rgba->green, 0.0, 1.0) * 255.0);
+  guint b = (guint)(CLAMP(rgba->blue, 0.0, 1.0) * 255.0);
+  g_snprintf(out, 8, "#%02x%02x%02x", r, g, b);
+}
+
+/* Code is drawn in the theme's selection colours of the answer label. */
+static void
+openai_ask_plugin_get_code_colors(OpenaiAskPlugin *self, MarkdownColors *colors, gchar bg[8], gchar fg[8])
+{
+  GtkStyleContext *ctx = gtk_widget_get_style_context(self->popover_label);
+  GdkRGBA bg_rgba = {0};
+  GdkRGBA fg_rgba = {0};
+  gtk_style_context_get_background_color(ctx, GTK_STATE_FLAG_SELECTED, &bg_rgba);
+  gtk_style_context_get_color(ctx, GTK_STATE_FLAG_SELECTED, &fg_rgba);
+  openai_ask_plugin_rgba_to_hex(&bg_rgba, bg);
+  openai_ask_plugin_rgba_to_hex(&fg_rgba, fg);
+  colors->code_bg = bg;
+  colors->code_fg = fg;
+}
+
 static void
 openai_ask_plugin_update_frame_opacity(OpenaiAskPlugin *self)
 {
   if (!self->frame || !self->frame_css)
     return;
 
-  gint pct = CLAMP(self->reply_opacity_pct, 0, 100);
+  gint pct = CLAMP(self->settings.reply_opacity_pct, 0, 100);
   gdouble alpha = ((gdouble)pct) / 100.0;
 
   g_autofree gchar *css = g_strdup_printf(
@@ -138,22 +271,161 @@ openai_ask_plugin_relayout_idle(gpointer user_data)
   OpenaiAskPlugin *self = user_data;
   self->relayout_source_id = 0;
   if (gtk_widget_get_visible(self->popup))
+  {
+    self->relayouts_applied++;
+    openai_ask_plugin_move_popup_near_entry(self);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* At most once per frame, and no sooner than POPUP_RESIZE_INTERVAL_US
+ * after the last move or resize. */
+static gboolean
+openai_ask_plugin_relayout_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  (void)widget;
+  OpenaiAskPlugin *self = user_data;
+  if (gdk_frame_clock_get_frame_time(frame_clock) - self->last_resize_us < POPUP_RESIZE_INTERVAL_US)
+  {
+    self->resizes_deferred++;
+    return G_SOURCE_CONTINUE;
+  }
+  self->relayout_tick_id = 0;
+  if (gtk_widget_get_visible(self->popup))
+  {
+    self->relayouts_applied++;
     openai_ask_plugin_move_popup_near_entry(self);
+  }
   return G_SOURCE_REMOVE;
 }
 
 static void
 openai_ask_plugin_request_relayout(OpenaiAskPlugin *self)
 {
-  if (self->relayout_source_id != 0)
+  if (self->relayout_source_id != 0 || self->relayout_tick_id != 0)
+  {
+    self->relayouts_merged++;
+    return;
+  }
+  if (gtk_widget_get_mapped(self->popup))
+    self->relayout_tick_id =
+      gtk_widget_add_tick_callback(self->popup, openai_ask_plugin_relayout_tick, g_object_ref(self), g_object_unref);
+  else
+    self->relayout_source_id =
+      g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, openai_ask_plugin_relayout_idle, g_object_ref(self), g_object_unref);
+}
+
+/* A relayout waiting for the frame clock is dropped when the popup hides
+ * or the plugin goes away. */
+static void
+openai_ask_plugin_drop_relayout_tick(OpenaiAskPlugin *self)
+{
+  if (self->relayout_tick_id)
+    gtk_widget_remove_tick_callback(self->popup, self->relayout_tick_id);
+  self->relayout_tick_id = 0;
+}
+
+static void
+openai_ask_plugin_invalidate_geometry(OpenaiAskPlugin *self)
+{
+  self->anchor_valid = FALSE;
+  self->monitor_valid = FALSE;
+}
+
+static gboolean
+openai_ask_plugin_on_toplevel_configure(GtkWidget *widget, GdkEventConfigure *event, gpointer user_data)
+{
+  (void)widget;
+  (void)event;
+  openai_ask_plugin_invalidate_geometry(user_data);
+  return GDK_EVENT_PROPAGATE;
+}
+
+static void
+openai_ask_plugin_on_size_allocate(GtkWidget *widget, GdkRectangle *allocation, gpointer user_data)
+{
+  (void)widget;
+  (void)allocation;
+  openai_ask_plugin_invalidate_geometry(user_data);
+}
+
+static void
+openai_ask_plugin_on_monitors_changed(gpointer instance, gpointer user_data)
+{
+  (void)instance;
+  openai_ask_plugin_invalidate_geometry(user_data);
+}
+
+static void
+openai_ask_plugin_on_monitor_added_removed(GdkDisplay *display, GdkMonitor *monitor, gpointer user_data)
+{
+  (void)display;
+  (void)monitor;
+  openai_ask_plugin_invalidate_geometry(user_data);
+}
+
+static void
+openai_ask_plugin_on_hierarchy_changed(GtkWidget *widget, GtkWidget *previous_toplevel, gpointer user_data)
+{
+  (void)previous_toplevel;
+  OpenaiAskPlugin *self = user_data;
+  GtkWidget *toplevel = gtk_widget_get_toplevel(widget);
+  if (!gtk_widget_is_toplevel(toplevel))
+    toplevel = NULL;
+
+  openai_ask_plugin_invalidate_geometry(self);
+  if (toplevel == self->geometry_toplevel)
     return;
-  self->relayout_source_id =
-    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, openai_ask_plugin_relayout_idle, g_object_ref(self), g_object_unref);
+
+  if (self->geometry_toplevel)
+  {
+    g_signal_handler_disconnect(self->geometry_toplevel, self->geometry_configure_id);
+    g_object_remove_weak_pointer(G_OBJECT(self->geometry_toplevel), (gpointer *)&self->geometry_toplevel);
+    self->geometry_toplevel = NULL;
+    self->geometry_configure_id = 0;
+  }
+  if (toplevel)
+  {
+    self->geometry_toplevel = toplevel;
+    g_object_add_weak_pointer(G_OBJECT(toplevel), (gpointer *)&self->geometry_toplevel);
+    gtk_widget_add_events(toplevel, GDK_STRUCTURE_MASK);
+    self->geometry_configure_id =
+      g_signal_connect(toplevel, "configure-event", G_CALLBACK(openai_ask_plugin_on_toplevel_configure), self);
+  }
+}
+
+/* Geometry only changes when the panel is resized or moved, or monitors
+ * change; everything else (relayouts while answers update) reuses the cache. */
+static void
+openai_ask_plugin_watch_geometry(OpenaiAskPlugin *self)
+{
+  GtkWidget *plugin_widget = GTK_WIDGET(self);
+  g_signal_connect(plugin_widget, "size-allocate", G_CALLBACK(openai_ask_plugin_on_size_allocate), self);
+  g_signal_connect(plugin_widget, "hierarchy-changed", G_CALLBACK(openai_ask_plugin_on_hierarchy_changed), self);
+  openai_ask_plugin_on_hierarchy_changed(plugin_widget, NULL, self);
+
+  GdkScreen *screen = gtk_widget_get_screen(plugin_widget);
+  if (screen)
+    g_signal_connect_object(screen, "monitors-changed", G_CALLBACK(openai_ask_plugin_on_monitors_changed), self, 0);
+
+  GdkDisplay *display = gdk_display_get_default();
+  if (display)
+  {
+    g_signal_connect_object(display, "monitor-added", G_CALLBACK(openai_ask_plugin_on_monitor_added_removed), self, 0);
+    g_signal_connect_object(display, "monitor-removed", G_CALLBACK(openai_ask_plugin_on_monitor_added_removed), self, 0);
+  }
 }
 
 static gboolean
 openai_ask_plugin_get_anchor_rect(OpenaiAskPlugin *self, GdkRectangle *out_rect)
 {
+  metrics_record_cache(METRICS_CACHE_GEOMETRY, self->anchor_valid);
+  if (self->anchor_valid)
+  {
+    *out_rect = self->anchor_rect;
+    return TRUE;
+  }
+
   GtkWidget *plugin_widget = GTK_WIDGET(XFCE_PANEL_PLUGIN(self));
   GtkWidget *toplevel = gtk_widget_get_toplevel(plugin_widget);
   if (!GTK_IS_WIDGET(toplevel) || !gtk_widget_get_realized(toplevel))
@@ -216,10 +488,33 @@ openai_ask_plugin_get_anchor_rect(OpenaiAskPlugin *self, GdkRectangle *out_rect)
     return FALSE;
 
   *out_rect = rect;
+  self->anchor_rect = rect;
+  self->anchor_valid = TRUE;
   openai_ask_log("anchor union x=%d y=%d w=%d h=%d", rect.x, rect.y, rect.width, rect.height);
   return TRUE;
 }
 
+static gboolean
+openai_ask_plugin_get_monitor_geometry(OpenaiAskPlugin *self, gint anchor_x, gint anchor_y, GdkRectangle *out_geo)
+{
+  if (!self->monitor_valid)
+  {
+    self->monitor_valid = TRUE;
+    self->monitor_found = FALSE;
+    GdkDisplay *display = gdk_display_get_default();
+    GdkMonitor *mon = display ? gdk_display_get_monitor_at_point(display, anchor_x, anchor_y) : NULL;
+    if (mon)
+    {
+      gdk_monitor_get_geometry(mon, &self->monitor_geo);
+      self->monitor_found = TRUE;
+    }
+  }
+
+  if (self->monitor_found)
+    *out_geo = self->monitor_geo;
+  return self->monitor_found;
+}
+
 static void
 openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
 {
@@ -236,20 +531,18 @@ openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
   XfceScreenPosition pos = xfce_panel_plugin_get_screen_position(XFCE_PANEL_PLUGIN(self));
   const gint gap = 6;
   const gint margin = 8;
-  const gint border = 24; /* openai-ask-frame border width (12px) top+bottom */
-  const gint spacing = 8; /* popover_box spacing */
 
   /* Match the popup width to the union of wrapper allocations unless overridden. */
   gint popup_w = MAX(200, anchor.width);
-  if (self->reply_width_px > 0)
-    popup_w = self->reply_width_px;
+  if (self->settings.reply_width_px > 0)
+    popup_w = self->settings.reply_width_px;
   gint popup_h = 120;
 
   gint x = anchor_x;
   gint y = anchor_y + anchor.height + gap;
 
   /* Compute desired height from content natural height-for-width. */
-  gint content_w = MAX(60, popup_w - border);
+  gint content_w = MAX(60, popup_w - POPUP_BORDER);
   gint header_h = 0;
   if (self->header)
   {
@@ -272,6 +565,13 @@ openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
     gtk_widget_get_preferred_height_for_width(self->popover_label, label_w, &lmin, &lnat);
     content_h = MAX(lmin, lnat) + label_margin_v;
   }
+  else if (visible_child == self->answer_scrolled)
+  {
+    /* Only the view's (partly estimated) height; never lay out the document here. */
+    gint vmin = 0, vnat = 0;
+    gtk_widget_get_preferred_height(self->answer_view, &vmin, &vnat);
+    content_h = MAX(vmin, vnat);
+  }
   else
   {
     gint cmin = 0, cnat = 0;
@@ -279,7 +579,7 @@ openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
     content_h = MAX(cmin, cnat);
   }
 
-  gint desired_h = border + header_h + spacing + MAX(0, content_h);
+  gint desired_h = POPUP_BORDER + header_h + POPUP_SPACING + MAX(0, content_h);
 
   /* Clamp popup height:
    * - never larger than 1/3 of the monitor height
@@ -289,50 +589,43 @@ openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
   gint max_h = 0;
   gint max_h_fraction = 0;
 
-  GdkDisplay *display = gdk_display_get_default();
-  if (display)
+  GdkRectangle geo = {0};
+  if (openai_ask_plugin_get_monitor_geometry(self, anchor_x, anchor_y, &geo))
   {
-    GdkMonitor *mon = gdk_display_get_monitor_at_point(display, anchor_x, anchor_y);
-    if (mon)
-    {
-      GdkRectangle geo = {0};
-      gdk_monitor_get_geometry(mon, &geo);
-
-      max_h_fraction = MAX(120, geo.height / 3);
-
-      if (xfce_screen_position_is_bottom(pos))
-      {
-        max_h = (anchor_y - geo.y) - gap - margin;
-        popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
-        y = anchor_y - popup_h - gap;
-      }
-      else if (xfce_screen_position_is_top(pos))
-      {
-        max_h = (geo.y + geo.height - (anchor_y + anchor.height)) - gap - margin;
-        popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
-        y = anchor_y + anchor.height + gap;
-      }
-      else if (xfce_screen_position_is_left(pos))
-      {
-        x = anchor_x + anchor.width + gap;
-        max_h = geo.height - 2 * margin;
-        popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
-      }
-      else if (xfce_screen_position_is_right(pos))
-      {
-        x = anchor_x - popup_w - gap;
-        max_h = geo.height - 2 * margin;
-        popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
-      }
-      else
-      {
-        max_h = (geo.y + geo.height - (anchor_y + anchor.height)) - gap - margin;
-        popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
-      }
+    max_h_fraction = MAX(120, geo.height / 3);
 
-      x = CLAMP(x, geo.x + margin, geo.x + geo.width - popup_w - margin);
-      y = CLAMP(y, geo.y + margin, geo.y + geo.height - popup_h - margin);
+    if (xfce_screen_position_is_bottom(pos))
+    {
+      max_h = (anchor_y - geo.y) - gap - margin;
+      popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
+      y = anchor_y - popup_h - gap;
+    }
+    else if (xfce_screen_position_is_top(pos))
+    {
+      max_h = (geo.y + geo.height - (anchor_y + anchor.height)) - gap - margin;
+      popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
+      y = anchor_y + anchor.height + gap;
+    }
+    else if (xfce_screen_position_is_left(pos))
+    {
+      x = anchor_x + anchor.width + gap;
+      max_h = geo.height - 2 * margin;
+      popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
+    }
+    else if (xfce_screen_position_is_right(pos))
+    {
+      x = anchor_x - popup_w - gap;
+      max_h = geo.height - 2 * margin;
+      popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
+    }
+    else
+    {
+      max_h = (geo.y + geo.height - (anchor_y + anchor.height)) - gap - margin;
+      popup_h = MIN(desired_h, MIN(MAX(120, max_h), max_h_fraction));
     }
+
+    x = CLAMP(x, geo.x + margin, geo.x + geo.width - popup_w - margin);
+    y = CLAMP(y, geo.y + margin, geo.y + geo.height - popup_h - margin);
   }
 
   popup_h = MAX(120, popup_h);
@@ -346,34 +639,37 @@ openai_ask_plugin_move_popup_near_entry(OpenaiAskPlugin *self)
                  content_w);
   gtk_window_move(GTK_WINDOW(self->popup), x, y);
   gtk_window_resize(GTK_WINDOW(self->popup), popup_w, popup_h);
+  self->last_resize_us = g_get_monotonic_time();
 }
 
-static void
-openai_ask_plugin_set_request_state(OpenaiAskPlugin *self, gboolean in_flight)
-{
-  self->request_in_flight = in_flight;
-  gtk_editable_set_editable(GTK_EDITABLE(self->entry), !in_flight);
-  gtk_widget_set_sensitive(self->entry, !in_flight);
-
-  if (in_flight)
-  {
-    gtk_spinner_start(GTK_SPINNER(self->popover_spinner));
-    gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "loading");
-  }
-  else
-  {
-    gtk_spinner_stop(GTK_SPINNER(self->popover_spinner));
-  }
-}
-
-static void
-openai_ask_plugin_clear_messages(OpenaiAskPlugin *self)
+/* How much answer the popup shows at its tallest, a third of the monitor
+ * (see move_popup_near_entry()), in the answer label's font. */
+static gboolean
+openai_ask_plugin_get_output_budget(OpenaiAskPlugin *self, OutputBudget *budget)
 {
-  if (!self->messages)
-    return;
+  GdkRectangle anchor = {0};
+  GdkRectangle geo = {0};
+  if (!self->popover_label || !openai_ask_plugin_get_anchor_rect(self, &anchor) ||
+      !openai_ask_plugin_get_monitor_geometry(self, anchor.x, anchor.y, &geo))
+    return FALSE;
 
-  while (self->messages->len > 0)
-    g_ptr_array_remove_index(self->messages, self->messages->len - 1);
+  gint popup_w = self->settings.reply_width_px > 0 ? self->settings.reply_width_px : MAX(200, anchor.width);
+  gint header_h = 0;
+  if (self->header)
+    gtk_widget_get_preferred_height(self->header, NULL, &header_h);
+  gint label_margin_h =
+    gtk_widget_get_margin_start(self->popover_label) + gtk_widget_get_margin_end(self->popover_label);
+  gint label_margin_v =
+    gtk_widget_get_margin_top(self->popover_label) + gtk_widget_get_margin_bottom(self->popover_label);
+  gint text_w = popup_w - POPUP_BORDER - label_margin_h;
+  gint text_h = MAX(120, geo.height / 3) - POPUP_BORDER - header_h - POPUP_SPACING - label_margin_v;
+
+  PangoFontMetrics *metrics = pango_context_get_metrics(gtk_widget_get_pango_context(self->popover_label), NULL, NULL);
+  gdouble char_w = (gdouble)pango_font_metrics_get_approximate_char_width(metrics) / PANGO_SCALE;
+  gdouble line_h =
+    (gdouble)(pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics)) / PANGO_SCALE;
+  pango_font_metrics_unref(metrics);
+  return output_budget_compute(budget, text_w, text_h, char_w, line_h);
 }
 
 static gboolean
@@ -394,6 +690,63 @@ openai_ask_plugin_popover_show(OpenaiAskPlugin *self)
   openai_ask_log("popup show (after) visible=%d", gtk_widget_get_visible(self->popup));
 }
 
+/* Realize the popup and lay out representative markup off-screen, so the
+ * first answer does not pay for window/visual setup, CSS and font loading. */
+static gboolean
+openai_ask_plugin_prewarm_idle(gpointer user_data)
+{
+  OpenaiAskPlugin *self = user_data;
+  self->prewarm_source_id = 0;
+  if (self->prewarmed || gtk_widget_get_visible(self->popup))
+    return G_SOURCE_REMOVE;
+
+  gint64 t0 = g_get_monotonic_time();
+  gtk_widget_show_all(gtk_bin_get_child(GTK_BIN(self->popup)));
+  gtk_widget_realize(self->popup);
+
+  static const gchar sample[] = "# Heading\n"
+                                "Some **bold**, *italic* and `code` text.\n\n"
+                                "```c\n"
+                                "int main(void) { return 0; } // comment\n"
+                                "```\n";
+  MarkdownColors colors;
+  gchar bg[8], fg[8];
+  openai_ask_plugin_get_code_colors(self, &colors, bg, fg);
+  g_autofree gchar *markup = markdown_to_pango(sample, &colors);
+  PangoLayout *layout = gtk_widget_create_pango_layout(self->popover_label, NULL);
+  pango_layout_set_markup(layout, markup, -1);
+  pango_layout_set_width(layout, 400 * PANGO_SCALE);
+  gint w = 0, h = 0;
+  pango_layout_get_pixel_size(layout, &w, &h);
+  g_object_unref(layout);
+
+  /* Resolves CSS for the whole popup tree without mapping it. */
+  gint min_h = 0, nat_h = 0;
+  gtk_widget_get_preferred_height(self->popup, &min_h, &nat_h);
+
+  self->prewarmed = TRUE;
+  openai_ask_log("popup prewarmed in %.1f ms", (g_get_monotonic_time() - t0) / 1000.0);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+openai_ask_plugin_on_popup_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+  (void)widget;
+  (void)cr;
+  OpenaiAskPlugin *self = user_data;
+  if (self->show_key_press_us != 0)
+  {
+    self->show_count++;
+    openai_ask_log("key press to first paint %.1f ms (show #%u, prewarmed=%d)",
+                   (g_get_monotonic_time() - self->show_key_press_us) / 1000.0,
+                   self->show_count,
+                   self->prewarmed);
+    self->show_key_press_us = 0;
+  }
+  return GDK_EVENT_PROPAGATE;
+}
+
 static void
 openai_ask_plugin_popover_hide(OpenaiAskPlugin *self)
 {
@@ -409,18 +762,92 @@ openai_ask_plugin_on_screen_position_changed(XfcePanelPlugin *plugin,
   (void)plugin;
   (void)position;
   OpenaiAskPlugin *self = user_data;
-  if (gtk_widget_get_visible(self->popup))
+  openai_ask_plugin_invalidate_geometry(self);
+  if (self->popup && gtk_widget_get_visible(self->popup))
     openai_ask_plugin_move_popup_near_entry(self);
 }
 
+/* New content: the popup is shown if it is not on screen yet, otherwise
+ * only relaid out, so moves and resizes stay POPUP_RESIZE_INTERVAL_US
+ * apart. */
+static void
+openai_ask_plugin_content_changed(OpenaiAskPlugin *self)
+{
+  if (!openai_ask_plugin_popover_is_open(self))
+    openai_ask_plugin_popover_show(self);
+  else
+    openai_ask_plugin_request_relayout(self);
+}
+
+static void
+openai_ask_plugin_apply_answer(OpenaiAskPlugin *self, const gchar *answer)
+{
+  self->answers_applied++;
+  MarkdownColors colors;
+  gchar bg[8], fg[8];
+  openai_ask_plugin_get_code_colors(self, &colors, bg, fg);
+  if (answer && strlen(answer) > ANSWER_VIEW_THRESHOLD_BYTES)
+  {
+    openai_ask_log("answer len=%zu using virtualized view", strlen(answer));
+    gtk_label_set_text(GTK_LABEL(self->popover_label), "");
+    answer_view_set_blocks(ANSWER_VIEW(self->answer_view), markdown_to_pango_blocks(answer, &colors));
+    gtk_adjustment_set_value(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(self->answer_scrolled)), 0.0);
+    gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "large");
+  }
+  else
+  {
+    g_autofree gchar *markup = markdown_to_pango(answer ? answer : "", &colors);
+    answer_view_set_blocks(ANSWER_VIEW(self->answer_view), NULL);
+    gtk_label_set_markup(GTK_LABEL(self->popover_label), markup ? markup : "");
+    gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "answer");
+  }
+  openai_ask_plugin_content_changed(self);
+}
+
+static gboolean
+openai_ask_plugin_answer_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  (void)widget;
+  (void)frame_clock;
+  OpenaiAskPlugin *self = user_data;
+  self->answer_tick_id = 0;
+  g_autofree gchar *answer = g_steal_pointer(&self->pending_answer);
+  openai_ask_plugin_apply_answer(self, answer);
+  return G_SOURCE_REMOVE;
+}
+
+/* Something else takes the popup's page; a queued answer must not
+ * overwrite it. */
+static void
+openai_ask_plugin_drop_pending_answer(OpenaiAskPlugin *self)
+{
+  if (self->answer_tick_id)
+    gtk_widget_remove_tick_callback(self->popup, self->answer_tick_id);
+  self->answer_tick_id = 0;
+  g_clear_pointer(&self->pending_answer, g_free);
+}
+
+/* Parsing markdown and laying out the label costs milliseconds, so while
+ * the popup is on screen answers are applied once per frame clock tick and
+ * only the last one of a burst (tabs switched with key repeat, answers of
+ * several tabs arriving together) is rendered. Before the popup is shown it
+ * is rendered at once, so the first frame already has it. */
 static void
 openai_ask_plugin_set_answer(OpenaiAskPlugin *self, const gchar *answer)
 {
-  g_autofree gchar *markup = markdown_to_pango(answer ? answer : "", self->popover_label);
-  gtk_label_set_markup(GTK_LABEL(self->popover_label), markup ? markup : "");
-  gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "answer");
-  openai_ask_plugin_popover_show(self);
-  openai_ask_plugin_request_relayout(self);
+  if (!gtk_widget_get_mapped(self->popup))
+  {
+    openai_ask_plugin_drop_pending_answer(self);
+    openai_ask_plugin_apply_answer(self, answer);
+    return;
+  }
+  if (self->answer_tick_id)
+    self->answers_merged++;
+  g_free(self->pending_answer);
+  self->pending_answer = g_strdup(answer ? answer : "");
+  if (!self->answer_tick_id)
+    self->answer_tick_id =
+      gtk_widget_add_tick_callback(self->popup, openai_ask_plugin_answer_tick, g_object_ref(self), g_object_unref);
 }
 
 static void
@@ -428,110 +855,700 @@ openai_ask_plugin_set_error(OpenaiAskPlugin *self, const gchar *message)
 {
   g_autofree gchar *escaped = g_markup_escape_text(message ? message : "Request failed.", -1);
   g_autofree gchar *markup = g_strdup_printf("<b>Error</b>\n%s", escaped ? escaped : "");
+  openai_ask_plugin_drop_pending_answer(self);
   gtk_label_set_markup(GTK_LABEL(self->popover_label), markup);
+  answer_view_set_blocks(ANSWER_VIEW(self->answer_view), NULL);
   gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "answer");
-  openai_ask_plugin_popover_show(self);
-  openai_ask_plugin_request_relayout(self);
+  openai_ask_plugin_content_changed(self);
 }
 
 static void
 openai_ask_plugin_copy_answer(OpenaiAskPlugin *self)
 {
   GtkClipboard *cb = gtk_clipboard_get(GDK_SELECTION_CLIPBOARD);
+  if (gtk_stack_get_visible_child(GTK_STACK(self->popover_stack)) == self->answer_scrolled)
+  {
+    g_autofree gchar *text = answer_view_get_text(ANSWER_VIEW(self->answer_view));
+    if (text && *text)
+      gtk_clipboard_set_text(cb, text, -1);
+    return;
+  }
+
   const gchar *text = gtk_label_get_text(GTK_LABEL(self->popover_label));
   if (text && *text)
     gtk_clipboard_set_text(cb, text, -1);
 }
 
-static void
-openai_ask_plugin_on_popover_hide(GtkWidget *widget, OpenaiAskPlugin *self)
+static OpenaiAskChat *
+openai_ask_plugin_find_chat(OpenaiAskPlugin *self, guint64 id)
 {
-  (void)widget;
-  openai_ask_log("popover hide");
-  openai_ask_plugin_cancel_inflight(self);
-  openai_ask_plugin_clear_messages(self);
-  gtk_label_set_text(GTK_LABEL(self->popover_title), "XFCE Ask");
+  for (guint i = 0; self->chats && i < self->chats->len; i++)
+  {
+    OpenaiAskChat *chat = g_ptr_array_index(self->chats, i);
+    if (chat->id == id)
+      return chat;
+  }
+  return NULL;
 }
 
 static void
-openai_ask_plugin_begin_new(OpenaiAskPlugin *self)
+openai_ask_plugin_update_tab(OpenaiAskPlugin *self, OpenaiAskChat *chat)
 {
-  openai_ask_plugin_clear_messages(self);
-  gtk_label_set_text(GTK_LABEL(self->popover_title), "XFCE Ask");
+  g_autofree gchar *label = g_strdup_printf("%s%s", chat->in_flight ? "… " : "", chat->title ? chat->title : "New");
+  gtk_button_set_label(GTK_BUTTON(chat->tab), label);
+  GtkStyleContext *style = gtk_widget_get_style_context(chat->tab);
+  if (chat == self->chat)
+    gtk_style_context_add_class(style, "current");
+  else
+    gtk_style_context_remove_class(style, "current");
 }
 
 static void
-openai_ask_plugin_on_close_clicked(GtkButton *button, OpenaiAskPlugin *self)
+openai_ask_plugin_update_tabs(OpenaiAskPlugin *self)
 {
-  (void)button;
-  openai_ask_plugin_popover_hide(self);
+  for (guint i = 0; i < self->chats->len; i++)
+    openai_ask_plugin_update_tab(self, g_ptr_array_index(self->chats, i));
+  gtk_widget_set_visible(self->tab_bar, self->chats->len > 1);
 }
 
 static void
-openai_ask_plugin_on_copy_clicked(GtkButton *button, OpenaiAskPlugin *self)
+openai_ask_plugin_update_loading(OpenaiAskPlugin *self)
 {
-  (void)button;
-  openai_ask_plugin_copy_answer(self);
+  if (!self->chat->in_flight)
+  {
+    gtk_spinner_stop(GTK_SPINNER(self->popover_spinner));
+    return;
+  }
+  if (self->chat->draft)
+    return; /* stays on screen, with the spinner, until the answer comes */
+  gint64 hold_us = self->chat->hold_until - g_get_monotonic_time();
+  if (self->chat->hold_until && hold_us > 0)
+  {
+    g_autofree gchar *text = g_strdup_printf("Rate limit reached; sending in %" G_GINT64_FORMAT " s…",
+                                             (hold_us + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC);
+    gtk_label_set_text(GTK_LABEL(self->loading_label), text);
+  }
+  else if (self->chat->batch)
+  {
+    g_autofree gchar *status = batch_progress_describe(batch_get_progress(self->chat->batch));
+    g_autofree gchar *text = g_strdup_printf("Batch: %s…", status);
+    gtk_label_set_text(GTK_LABEL(self->loading_label), text);
+  }
+  else
+    gtk_label_set_text(GTK_LABEL(self->loading_label),
+                       self->chat->searching ? "Searching documents…"
+                       : self->chat->queued  ? "Waiting for a free connection…"
+                                             : "Thinking…");
+  openai_ask_plugin_drop_pending_answer(self);
+  gtk_spinner_start(GTK_SPINNER(self->popover_spinner));
+  gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "loading");
 }
 
 static void
-openai_ask_plugin_cancel_inflight(OpenaiAskPlugin *self)
+openai_ask_plugin_set_request_state(OpenaiAskPlugin *self, OpenaiAskChat *chat, gboolean in_flight, gboolean queued)
 {
-  if (!self->request_in_flight)
-    return;
-  if (self->request_cancellable)
-    g_cancellable_cancel(self->request_cancellable);
+  chat->in_flight = in_flight;
+  chat->queued = in_flight && queued;
+  chat->searching = FALSE;
+  chat->hold_until = 0;
+  openai_ask_plugin_update_tab(self, chat);
+  if (chat == self->chat && !self->history_mode)
+    openai_ask_plugin_update_loading(self);
 }
 
-static void
-openai_ask_plugin_append_system_if_needed(OpenaiAskPlugin *self)
+static gboolean
+openai_ask_plugin_on_hold_tick(gpointer user_data)
 {
-  if (!self->system_prompt || !*self->system_prompt)
-    return;
-  if (self->messages->len > 0)
-    return;
+  OpenaiAskPlugin *self = user_data;
+  gint64 now = g_get_monotonic_time();
+  gboolean holding = FALSE;
+  for (guint i = 0; i < self->chats->len; i++)
+  {
+    OpenaiAskChat *chat = g_ptr_array_index(self->chats, i);
+    if (chat->hold_until && chat->hold_until <= now)
+      chat->hold_until = 0;
+    holding |= chat->hold_until != 0;
+  }
+  if (!self->history_mode)
+    openai_ask_plugin_update_loading(self);
+  if (holding)
+    return G_SOURCE_CONTINUE;
+  self->hold_tick_id = 0;
+  return G_SOURCE_REMOVE;
+}
 
-  g_ptr_array_add(self->messages, openai_chat_message_new("system", self->system_prompt));
+/* Shows a countdown while the client holds @chat's request for the rate
+ * limit (see rate-limiter.h). */
+static void
+openai_ask_plugin_set_hold(OpenaiAskPlugin *self, OpenaiAskChat *chat, gint64 hold_us)
+{
+  chat->hold_until = g_get_monotonic_time() + hold_us;
+  if (!self->hold_tick_id)
+    self->hold_tick_id = g_timeout_add(250, openai_ask_plugin_on_hold_tick, self);
+  if (chat == self->chat && !self->history_mode)
+    openai_ask_plugin_update_loading(self);
 }
 
+/* With routing or drafts on, the header names the model whose answer is on
+ * screen, and Ctrl+B asks the next bigger one. An answer cut at the output
+ * budget says so. */
 static void
-openai_ask_plugin_trim_followup(OpenaiAskPlugin *self)
+openai_ask_plugin_update_title(OpenaiAskPlugin *self)
 {
-  const guint max_messages = 6;
-  if (self->messages->len <= max_messages)
+  OpenaiAskChat *chat = self->chat;
+  const gchar *title = conversation_get_turn_count(chat->conversation) > 1 ? "Follow-up" : "XFCE Ask";
+  if (chat->in_flight && chat->draft)
+  {
+    g_autofree gchar *text = g_strdup_printf("Draft · %s", chat->draft_model);
+    g_autofree gchar *tooltip =
+      g_strdup_printf("%s is still answering. Ctrl+D keeps this draft, Ctrl+Shift+D waits without it", chat->model);
+    gtk_label_set_text(GTK_LABEL(self->popover_title), text);
+    gtk_widget_set_tooltip_text(self->popover_title, tooltip);
     return;
-
-  guint remove_count = self->messages->len - max_messages;
-  for (guint i = 0; i < remove_count; i++)
+  }
+  gboolean drafting = self->settings.draft_model && *self->settings.draft_model;
+  const gchar *more = chat->truncated && !chat->in_flight ? " · Ctrl+M for more" : "";
+  if ((!self->router && !drafting) || !chat->model)
   {
-    g_ptr_array_remove_index(self->messages, 0);
+    g_autofree gchar *text = g_strconcat(title, more, NULL);
+    gtk_label_set_text(GTK_LABEL(self->popover_title), text);
+    gtk_widget_set_tooltip_text(self->popover_title, *more ? "The answer was cut to fit the popup" : NULL);
+    return;
   }
+  g_autofree gchar *text = g_strdup_printf("%s · %s%s", title, chat->model, more);
+  gtk_label_set_text(GTK_LABEL(self->popover_title), text);
+  gtk_widget_set_tooltip_text(self->popover_title,
+                              self->router && model_router_get_bigger(self->router, chat->model)
+                                ? "Ctrl+B asks the next bigger model"
+                                : NULL);
 }
 
+/* Puts @chat on screen, as it was left. */
 static void
-openai_ask_plugin_on_client_result(OpenaiClientResult *result, gpointer user_data)
+openai_ask_plugin_show_chat(OpenaiAskPlugin *self, OpenaiAskChat *chat)
 {
-  OpenaiAskPlugin *plugin = user_data;
+  self->chat = chat;
+  self->history_mode = FALSE;
+  self->history_prev_child = NULL;
+  openai_ask_plugin_update_tabs(self);
+  openai_ask_plugin_update_title(self);
 
-  openai_ask_plugin_set_request_state(plugin, FALSE);
-  if (!result->ok)
+  if (chat->in_flight && chat->draft)
   {
-    openai_ask_log("request failed http=%d err=%s",
-                   result->http_status,
-                   result->error_message ? result->error_message : "");
-    openai_ask_plugin_set_error(plugin, result->error_message ? result->error_message : "Request failed.");
-    g_object_unref(plugin);
-    return;
+    gtk_spinner_start(GTK_SPINNER(self->popover_spinner));
+    openai_ask_plugin_set_answer(self, chat->draft);
   }
-
-  openai_ask_log("request ok");
-  openai_ask_plugin_set_answer(plugin, result->content);
-  g_ptr_array_add(plugin->messages, openai_chat_message_new("assistant", result->content ? result->content : ""));
-  openai_ask_plugin_trim_followup(plugin);
-  g_object_unref(plugin);
+  else if (chat->in_flight)
+    openai_ask_plugin_update_loading(self);
+  else if (chat->error)
+    openai_ask_plugin_set_error(self, chat->error);
+  else
+  {
+    gtk_spinner_stop(GTK_SPINNER(self->popover_spinner));
+    openai_ask_plugin_set_answer(self, chat->answer);
+  }
+  openai_ask_plugin_request_relayout(self);
 }
 
-static gboolean
+static void
+openai_ask_plugin_on_tab_clicked(GtkButton *button, gpointer user_data)
+{
+  OpenaiAskPlugin *self = user_data;
+  guint64 id = *(const guint64 *)g_object_get_data(G_OBJECT(button), "chat-id");
+  OpenaiAskChat *chat = openai_ask_plugin_find_chat(self, id);
+  if (chat && chat != self->chat)
+    openai_ask_plugin_show_chat(self, chat);
+}
+
+/* Forgets @chat's draft, cancelling it if it has not come yet. */
+static void
+openai_ask_chat_drop_draft(OpenaiAskChat *chat)
+{
+  if (chat->draft_cancellable)
+    g_cancellable_cancel(chat->draft_cancellable);
+  g_clear_object(&chat->draft_cancellable);
+  g_clear_pointer(&chat->draft_model, g_free);
+  g_clear_pointer(&chat->draft, g_free);
+  chat->draft_in_flight = FALSE;
+}
+
+/* Stops the batch @chat shows, if any; the plugin frees it once it is done. */
+static void
+openai_ask_chat_cancel_batch(OpenaiAskChat *chat)
+{
+  if (chat->batch)
+    batch_cancel(chat->batch);
+  chat->batch = NULL;
+}
+
+/* Empties @chat for a new question; anything it was waiting for is
+ * cancelled. */
+static void
+openai_ask_plugin_reset_chat(OpenaiAskChat *chat)
+{
+  if (chat->cancellable)
+    g_cancellable_cancel(chat->cancellable);
+  if (chat->compact_cancellable)
+    g_cancellable_cancel(chat->compact_cancellable);
+  openai_ask_chat_drop_draft(chat);
+  openai_ask_chat_cancel_batch(chat);
+  chat->in_flight = chat->queued = chat->searching = FALSE;
+  chat->hold_until = 0;
+  chat->compact_in_flight = FALSE;
+  chat->truncated = FALSE;
+  conversation_clear(chat->conversation);
+  chat->conversation_id = g_get_real_time();
+  g_clear_pointer(&chat->title, g_free);
+  g_clear_pointer(&chat->answer, g_free);
+  g_clear_pointer(&chat->error, g_free);
+  g_clear_pointer(&chat->model, g_free);
+  g_clear_pointer(&chat->attachments, g_ptr_array_unref);
+}
+
+static void
+openai_ask_chat_free(OpenaiAskChat *chat)
+{
+  if (chat->cancellable)
+    g_cancellable_cancel(chat->cancellable);
+  if (chat->compact_cancellable)
+    g_cancellable_cancel(chat->compact_cancellable);
+  g_clear_object(&chat->cancellable);
+  g_clear_object(&chat->compact_cancellable);
+  openai_ask_chat_drop_draft(chat);
+  openai_ask_chat_cancel_batch(chat);
+  g_clear_pointer(&chat->conversation, conversation_free);
+  g_free(chat->title);
+  g_free(chat->answer);
+  g_free(chat->error);
+  g_free(chat->model);
+  g_clear_pointer(&chat->attachments, g_ptr_array_unref);
+  if (chat->tab)
+    gtk_widget_destroy(chat->tab);
+  g_free(chat);
+}
+
+/* Adds an empty conversation after the others, or NULL if CHAT_MAX are
+ * open. It is not shown. */
+static OpenaiAskChat *
+openai_ask_plugin_add_chat(OpenaiAskPlugin *self)
+{
+  if (self->chats->len >= CHAT_MAX)
+    return NULL;
+
+  OpenaiAskChat *chat = g_new0(OpenaiAskChat, 1);
+  chat->id = request_scheduler_new_owner();
+  chat->conversation = conversation_new(FOLLOWUP_MAX_TURNS);
+  chat->conversation_id = g_get_real_time();
+  chat->tab = gtk_button_new_with_label("");
+  gtk_button_set_relief(GTK_BUTTON(chat->tab), GTK_RELIEF_NONE);
+  gtk_widget_set_tooltip_text(chat->tab, "Ctrl+Tab switches, Ctrl+W closes");
+  GtkWidget *label = gtk_bin_get_child(GTK_BIN(chat->tab));
+  gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+  gtk_label_set_max_width_chars(GTK_LABEL(label), CHAT_TITLE_CHARS);
+  guint64 *id = g_new(guint64, 1);
+  *id = chat->id;
+  g_object_set_data_full(G_OBJECT(chat->tab), "chat-id", id, g_free);
+  g_signal_connect(chat->tab, "clicked", G_CALLBACK(openai_ask_plugin_on_tab_clicked), self);
+  gtk_box_pack_start(GTK_BOX(self->tab_bar), chat->tab, FALSE, FALSE, 0);
+  gtk_widget_show(chat->tab);
+  g_ptr_array_add(self->chats, chat);
+  openai_ask_log("chat %" G_GUINT64_FORMAT " opened, %u open", chat->id, self->chats->len);
+  return chat;
+}
+
+/* Closes @chat and shows a neighbour. Closing the last one ends it and
+ * closes the popup. */
+static void
+openai_ask_plugin_close_chat(OpenaiAskPlugin *self, OpenaiAskChat *chat)
+{
+  if (self->chats->len == 1)
+  {
+    openai_ask_plugin_reset_chat(chat);
+    openai_ask_plugin_popover_hide(self);
+    return;
+  }
+  guint index = 0;
+  g_ptr_array_find(self->chats, chat, &index);
+  openai_ask_log("chat %" G_GUINT64_FORMAT " closed", chat->id);
+  g_ptr_array_remove_index(self->chats, index);
+  if (chat == self->chat)
+    openai_ask_plugin_show_chat(self, g_ptr_array_index(self->chats, MIN(index, self->chats->len - 1)));
+  else
+    openai_ask_plugin_update_tabs(self);
+}
+
+static void
+openai_ask_plugin_switch_chat(OpenaiAskPlugin *self, gint delta)
+{
+  guint index = 0;
+  g_ptr_array_find(self->chats, self->chat, &index);
+  gint n = (gint)self->chats->len;
+  openai_ask_plugin_show_chat(self, g_ptr_array_index(self->chats, (((gint)index + delta) % n + n) % n));
+}
+
+static void
+openai_ask_plugin_on_popover_hide(GtkWidget *widget, OpenaiAskPlugin *self)
+{
+  (void)widget;
+  openai_ask_log("popover hide; answers rendered %u merged %u, relayouts %u merged %u, resizes deferred %u frames",
+                 self->answers_applied,
+                 self->answers_merged,
+                 self->relayouts_applied,
+                 self->relayouts_merged,
+                 self->resizes_deferred);
+  self->answers_applied = self->answers_merged = 0;
+  self->relayouts_applied = self->relayouts_merged = self->resizes_deferred = 0;
+  openai_ask_plugin_drop_pending_answer(self);
+  openai_ask_plugin_drop_relayout_tick(self);
+  if (!self->chats)
+    return;
+  /* Closing the popup ends the conversations that are done. Those still
+   * waiting for an answer keep their tab, which the next question opens
+   * next to a new one. */
+  for (guint i = self->chats->len; i > 0; i--)
+  {
+    OpenaiAskChat *chat = g_ptr_array_index(self->chats, i - 1);
+    if (!chat->in_flight)
+      g_ptr_array_remove_index(self->chats, i - 1);
+  }
+  OpenaiAskChat *chat = openai_ask_plugin_add_chat(self);
+  self->chat = chat ? chat : g_ptr_array_index(self->chats, self->chats->len - 1);
+  self->history_mode = FALSE;
+  self->history_prev_child = NULL;
+  openai_ask_plugin_update_tabs(self);
+  gtk_spinner_stop(GTK_SPINNER(self->popover_spinner));
+  openai_ask_plugin_update_title(self);
+}
+
+static void
+openai_ask_plugin_on_close_clicked(GtkButton *button, OpenaiAskPlugin *self)
+{
+  (void)button;
+  openai_ask_plugin_popover_hide(self);
+}
+
+static void
+openai_ask_plugin_on_copy_clicked(GtkButton *button, OpenaiAskPlugin *self)
+{
+  (void)button;
+  openai_ask_plugin_copy_answer(self);
+}
+
+/* The system prompt starts a new conversation, followed by the brevity
+ * hint if answers are fitted to the popup. Excerpts retrieved from local
+ * documents for a question (@context) go next to it, replacing those of
+ * the conversation's earlier questions. */
+static void
+openai_ask_plugin_append_system_if_needed(OpenaiAskPlugin *self, OpenaiAskChat *chat, const gchar *context)
+{
+  const gchar *prompt = self->settings.system_prompt ? self->settings.system_prompt : "";
+  g_autofree gchar *hint = NULL;
+  OutputBudget budget;
+  if (self->settings.fit_answers && openai_ask_plugin_get_output_budget(self, &budget))
+    hint = output_budget_get_hint(&budget);
+  g_autofree gchar *system = hint && *prompt ? g_strconcat(prompt, "\n\n", hint, NULL) : g_strdup(hint ? hint : prompt);
+  if (context && *context)
+  {
+    g_autofree gchar *combined = *system ? g_strconcat(system, "\n\n", context, NULL) : g_strdup(context);
+    conversation_set_system(chat->conversation, combined);
+    return;
+  }
+  if (!*system)
+    return;
+  if (conversation_get_length(chat->conversation) > 0)
+    return;
+
+  conversation_set_system(chat->conversation, system);
+}
+
+/* A request for one chat, from submission to the scheduler until its
+ * result is handled. */
+typedef struct
+{
+  OpenaiAskPlugin *plugin;
+  guint64 chat_id;
+  gint64 conversation_id;
+  RequestTicket *ticket;
+  GCancellable *cancellable;
+  GPtrArray *attachments;
+  gchar *model; /* the chat model, picked when the question was sent */
+  gint64 sent_us; /* left the client, after any rate limit hold */
+  gboolean draft; /* asks the chat's draft_model, see on_draft_result() */
+  gboolean continuation; /* asks for the rest of a cut answer, see continue_answer() */
+  gboolean replaces; /* its exchange takes the place of the last one in the history */
+  /* Compaction only: the summarization request and what it replaces. */
+  Conversation *request;
+  guint64 before_seq;
+} OpenaiAskRequestCtx;
+
+static OpenaiAskRequestCtx *
+openai_ask_request_ctx_new(OpenaiAskPlugin *self, OpenaiAskChat *chat, GCancellable *cancellable)
+{
+  OpenaiAskRequestCtx *ctx = g_new0(OpenaiAskRequestCtx, 1);
+  ctx->plugin = g_object_ref(self);
+  ctx->chat_id = chat->id;
+  ctx->conversation_id = chat->conversation_id;
+  ctx->model = g_strdup(chat->model);
+  ctx->cancellable = g_object_ref(cancellable);
+  return ctx;
+}
+
+static void
+openai_ask_request_ctx_free(OpenaiAskRequestCtx *ctx)
+{
+  request_ticket_done(ctx->ticket);
+  g_clear_pointer(&ctx->attachments, g_ptr_array_unref);
+  g_clear_pointer(&ctx->request, conversation_free);
+  g_free(ctx->model);
+  g_clear_object(&ctx->cancellable);
+  g_object_unref(ctx->plugin);
+  g_free(ctx);
+}
+
+/* The chat @ctx was sent for, if it is still open and was not reset since. */
+static OpenaiAskChat *
+openai_ask_request_ctx_get_chat(OpenaiAskRequestCtx *ctx)
+{
+  OpenaiAskChat *chat = openai_ask_plugin_find_chat(ctx->plugin, ctx->chat_id);
+  return chat && chat->conversation_id == ctx->conversation_id ? chat : NULL;
+}
+
+static void
+openai_ask_plugin_on_compact_result(OpenaiClientResult *result, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+
+  if (chat)
+    chat->compact_in_flight = FALSE;
+  if (!result->ok)
+    openai_ask_log("compact failed http=%d err=%s", result->http_status, result->error_message ? result->error_message : "");
+  else if (!chat)
+    openai_ask_log("compact result for an ended conversation, dropped");
+  else
+  {
+    openai_ask_log("compact ok summary len=%zu", strlen(result->content));
+    conversation_summarize_before(chat->conversation, ctx->before_seq, result->content);
+  }
+  openai_ask_request_ctx_free(ctx);
+}
+
+static void
+openai_ask_plugin_start_compact(RequestTicket *ticket, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskPlugin *self = ctx->plugin;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+  ctx->ticket = ticket;
+  if (!ticket || !chat)
+  {
+    if (chat)
+      chat->compact_in_flight = FALSE;
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  if (self->settings.use_engine)
+  {
+    engine_client_send_chat_async(self->settings.endpoint,
+                                  self->settings.compact_model,
+                                  COMPACT_TEMPERATURE,
+                                  ctx->request,
+                                  ctx->cancellable,
+                                  openai_ask_plugin_on_compact_result,
+                                  ctx);
+    return;
+  }
+
+  g_autofree gchar *api_key = keyring_lookup_api_key(self->settings.endpoint);
+  if (!api_key || !*api_key)
+  {
+    chat->compact_in_flight = FALSE;
+    return openai_ask_request_ctx_free(ctx);
+  }
+  openai_client_send_chat_async(self->settings.endpoint,
+                                api_key,
+                                self->settings.compact_model,
+                                COMPACT_TEMPERATURE,
+                                ctx->request,
+                                NULL,
+                                ctx->cancellable,
+                                openai_ask_plugin_on_compact_result,
+                                ctx);
+}
+
+/* Once the ring is full, the next follow-up would drop the oldest turns.
+ * Summarize everything but the latest exchange with the cheap model while
+ * the user reads the answer, so the next request carries the summary. It
+ * is background work: questions in other tabs go first. */
+static void
+openai_ask_plugin_maybe_compact(OpenaiAskPlugin *self, OpenaiAskChat *chat)
+{
+  if (!self->settings.compact_model || !*self->settings.compact_model || chat->compact_in_flight)
+    return;
+  if (conversation_get_turn_count(chat->conversation) < FOLLOWUP_MAX_TURNS - 1)
+    return;
+
+  guint64 before_seq = conversation_get_next_seq(chat->conversation) - 2;
+  g_autofree gchar *transcript = conversation_format_transcript(chat->conversation, before_seq);
+  if (!transcript)
+    return;
+
+  g_clear_object(&chat->compact_cancellable);
+  chat->compact_cancellable = g_cancellable_new();
+  chat->compact_in_flight = TRUE;
+
+  OpenaiAskRequestCtx *ctx = openai_ask_request_ctx_new(self, chat, chat->compact_cancellable);
+  ctx->before_seq = before_seq;
+  ctx->request = conversation_new(1);
+  conversation_set_system(ctx->request, COMPACT_PROMPT);
+  conversation_append(ctx->request, CONVERSATION_ROLE_USER, transcript);
+
+  openai_ask_log("compact queued model=%s transcript len=%zu", self->settings.compact_model, strlen(transcript));
+  request_scheduler_submit(request_scheduler_get_default(),
+                           self->settings.endpoint,
+                           REQUEST_PRIORITY_BACKGROUND,
+                           chat->id,
+                           chat->compact_cancellable,
+                           openai_ask_plugin_start_compact,
+                           ctx);
+}
+
+/* Takes @chat's draft as the answer to its question and stops waiting for
+ * the real one. */
+static void
+openai_ask_plugin_keep_draft(OpenaiAskPlugin *self, OpenaiAskChat *chat)
+{
+  if (chat->cancellable)
+    g_cancellable_cancel(chat->cancellable);
+  g_free(chat->model);
+  chat->model = g_steal_pointer(&chat->draft_model);
+  chat->answer = g_steal_pointer(&chat->draft);
+  openai_ask_chat_drop_draft(chat);
+  openai_ask_plugin_set_request_state(self, chat, FALSE, FALSE);
+  if (chat == self->chat && !self->history_mode)
+    openai_ask_plugin_update_title(self);
+
+  const ConversationTurn *question = conversation_get_last(chat->conversation, CONVERSATION_ROLE_USER);
+  if (question)
+    history_append(self->history, chat->conversation_id, chat->model, question->content, chat->answer);
+  conversation_append(chat->conversation, CONVERSATION_ROLE_ASSISTANT, chat->answer);
+  openai_ask_plugin_maybe_compact(self, chat);
+}
+
+static void
+openai_ask_plugin_on_draft_result(OpenaiClientResult *result, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskPlugin *plugin = ctx->plugin;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+  if (!chat || g_cancellable_is_cancelled(ctx->cancellable))
+    return openai_ask_request_ctx_free(ctx);
+
+  chat->draft_in_flight = FALSE;
+  if (plugin->router && ctx->sent_us)
+    model_router_record(plugin->router, ctx->model, result->ok, g_get_monotonic_time() - ctx->sent_us);
+  if (!result->ok || !chat->in_flight)
+  {
+    openai_ask_log("draft %s, dropped", result->ok ? "came after the answer" : "failed");
+    g_clear_pointer(&chat->draft_model, g_free);
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  openai_ask_log("draft after %.1f ms model=%s", (g_get_monotonic_time() - chat->asked_us) / 1000.0, ctx->model);
+  chat->draft = g_strdup(result->content);
+  if (chat == plugin->chat && !plugin->history_mode)
+  {
+    openai_ask_plugin_update_title(plugin);
+    openai_ask_plugin_set_answer(plugin, chat->draft);
+  }
+  openai_ask_request_ctx_free(ctx);
+}
+
+static void
+openai_ask_plugin_on_client_result(OpenaiClientResult *result, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskPlugin *plugin = ctx->plugin;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+  if (!chat)
+  {
+    openai_ask_log("result for a closed conversation, dropped");
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  if (g_cancellable_is_cancelled(ctx->cancellable))
+  {
+    /* Ctrl+D kept the draft instead. */
+    openai_ask_log("cancelled result for chat=%" G_GUINT64_FORMAT ", dropped", chat->id);
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  gboolean shown = chat == plugin->chat && !plugin->history_mode;
+  if (plugin->router && ctx->sent_us)
+    model_router_record(plugin->router, ctx->model, result->ok, g_get_monotonic_time() - ctx->sent_us);
+  if (!result->ok && chat->draft)
+  {
+    openai_ask_log("request failed http=%d err=%s, keeping the draft",
+                   result->http_status,
+                   result->error_message ? result->error_message : "");
+    openai_ask_plugin_keep_draft(plugin, chat);
+    return openai_ask_request_ctx_free(ctx);
+  }
+  if (chat->draft_model)
+    openai_ask_log("answer after %.1f ms, %s",
+                   (g_get_monotonic_time() - chat->asked_us) / 1000.0,
+                   chat->draft ? "replacing the draft" : "before the draft");
+  openai_ask_chat_drop_draft(chat);
+  /* A continuation that failed can be asked for again. */
+  chat->truncated = result->ok ? result->truncated : ctx->continuation;
+  if (!result->ok && ctx->continuation)
+    conversation_drop_last(chat->conversation);
+  openai_ask_plugin_set_request_state(plugin, chat, FALSE, FALSE);
+  if (shown)
+    openai_ask_plugin_update_title(plugin);
+  if (!result->ok)
+  {
+    openai_ask_log("request failed http=%d err=%s",
+                   result->http_status,
+                   result->error_message ? result->error_message : "");
+    chat->error = g_strdup(result->error_message ? result->error_message : "Request failed.");
+    if (shown)
+      openai_ask_plugin_set_error(plugin, chat->error);
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  openai_ask_log("request ok chat=%" G_GUINT64_FORMAT " waited %.1f ms for a slot",
+                 chat->id,
+                 request_ticket_get_wait_us(ctx->ticket) / 1000.0);
+  if (result->truncated)
+    openai_ask_log("answer cut at the output budget after %" G_GINT64_FORMAT " tokens", result->completion_tokens);
+  gchar *answer = ctx->continuation && chat->answer ? g_strconcat(chat->answer, result->content, NULL)
+                                                    : g_strdup(result->content);
+  g_free(chat->answer);
+  chat->answer = answer;
+  if (ctx->continuation)
+  {
+    /* The prompt that asked for the rest and the part before it fold into
+     * one answer to the question, in the conversation and the history. */
+    conversation_drop_last(chat->conversation);
+    const ConversationTurn *last =
+      conversation_get_turn(chat->conversation, conversation_get_length(chat->conversation) - 1);
+    if (last && last->role == CONVERSATION_ROLE_ASSISTANT)
+      conversation_drop_last(chat->conversation);
+  }
+  const ConversationTurn *question = conversation_get_last(chat->conversation, CONVERSATION_ROLE_USER);
+  if (question && ctx->replaces)
+    history_replace_last(plugin->history, chat->conversation_id, ctx->model, question->content, chat->answer);
+  else if (question)
+    history_append(plugin->history, chat->conversation_id, ctx->model, question->content, chat->answer);
+  if (shown)
+    openai_ask_plugin_set_answer(plugin, chat->answer);
+  conversation_append(chat->conversation, CONVERSATION_ROLE_ASSISTANT, chat->answer);
+  openai_ask_plugin_maybe_compact(plugin, chat);
+  openai_ask_request_ctx_free(ctx);
+}
+
+static gboolean
 openai_ask_plugin_on_popup_focus_out(GtkWidget *widget, GdkEventFocus *event, gpointer user_data)
 {
   (void)widget;
@@ -541,82 +1558,819 @@ openai_ask_plugin_on_popup_focus_out(GtkWidget *widget, GdkEventFocus *event, gp
   return GDK_EVENT_PROPAGATE;
 }
 
-static gboolean
-openai_ask_plugin_on_popup_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
+static gboolean
+openai_ask_plugin_on_popup_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
+{
+  (void)widget;
+  OpenaiAskPlugin *self = user_data;
+  if (event->keyval == GDK_KEY_Escape)
+  {
+    openai_ask_plugin_popover_hide(self);
+    return GDK_EVENT_STOP;
+  }
+  return GDK_EVENT_PROPAGATE;
+}
+
+static void
+openai_ask_plugin_history_refresh(OpenaiAskPlugin *self)
+{
+  GList *rows = gtk_container_get_children(GTK_CONTAINER(self->history_list));
+  for (GList *l = rows; l; l = l->next)
+    gtk_widget_destroy(GTK_WIDGET(l->data));
+  g_list_free(rows);
+
+  HistoryHit hits[HISTORY_SEARCH_RESULTS];
+  const gchar *query = gtk_entry_get_text(GTK_ENTRY(self->entry));
+  gint64 t0 = g_get_monotonic_time();
+  guint n = history_search(self->history, query, hits, G_N_ELEMENTS(hits));
+  openai_ask_log("history search len=%zu hits=%u of %u in %.2f ms",
+                 strlen(query),
+                 n,
+                 history_get_count(self->history),
+                 (g_get_monotonic_time() - t0) / 1000.0);
+
+  const gchar *placeholder = "No matching questions.";
+  if (!self->history)
+    placeholder = "History is unavailable.";
+  else if (!history_is_loaded(self->history))
+    placeholder = "Loading history…";
+  gtk_label_set_text(GTK_LABEL(self->history_placeholder), placeholder);
+
+  for (guint i = 0; i < n; i++)
+  {
+    g_autoptr(GDateTime) when = g_date_time_new_from_unix_local(hits[i].timestamp);
+    g_autofree gchar *date = when ? g_date_time_format(when, "%Y-%m-%d %H:%M") : g_strdup("");
+    g_autofree gchar *markup = g_markup_printf_escaped("<small>%s</small>  %s", date, hits[i].preview);
+
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(label), markup);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+    gtk_widget_set_margin_start(label, 14);
+    gtk_widget_set_margin_end(label, 14);
+    gtk_widget_set_margin_top(label, 6);
+    gtk_widget_set_margin_bottom(label, 6);
+    gtk_list_box_insert(GTK_LIST_BOX(self->history_list), label, -1);
+
+    gint64 *conversation = g_new(gint64, 1);
+    *conversation = hits[i].conversation;
+    g_object_set_data_full(G_OBJECT(gtk_widget_get_parent(label)), "conversation", conversation, g_free);
+  }
+
+  gtk_widget_show_all(self->history_list);
+  gtk_list_box_select_row(GTK_LIST_BOX(self->history_list),
+                          gtk_list_box_get_row_at_index(GTK_LIST_BOX(self->history_list), 0));
+  openai_ask_plugin_request_relayout(self);
+}
+
+static void
+openai_ask_plugin_history_loaded(gpointer user_data)
+{
+  OpenaiAskPlugin *self = user_data;
+  if (self->history_mode)
+    openai_ask_plugin_history_refresh(self);
+}
+
+static void
+openai_ask_plugin_history_enter(OpenaiAskPlugin *self)
+{
+  if (self->history_mode)
+    return;
+
+  gboolean was_open = openai_ask_plugin_popover_is_open(self);
+  self->history_mode = TRUE;
+  self->history_prev_child = was_open ? gtk_stack_get_visible_child(GTK_STACK(self->popover_stack)) : NULL;
+
+  gtk_label_set_text(GTK_LABEL(self->popover_title), "History");
+  gtk_widget_set_tooltip_text(self->popover_title, NULL);
+  openai_ask_plugin_drop_pending_answer(self);
+  gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "history");
+  openai_ask_plugin_history_refresh(self);
+  if (!was_open)
+    openai_ask_plugin_popover_show(self);
+}
+
+/* Back to the conversation that was showing, or close if there was none.
+ * Its answer may have arrived meanwhile, so it is redrawn. */
+static void
+openai_ask_plugin_history_leave(OpenaiAskPlugin *self)
+{
+  if (!self->history_mode)
+    return;
+  self->history_mode = FALSE;
+  if (!self->history_prev_child)
+  {
+    openai_ask_plugin_popover_hide(self);
+    return;
+  }
+  openai_ask_plugin_show_chat(self, self->chat);
+}
+
+static void
+openai_ask_plugin_history_move(OpenaiAskPlugin *self, gint delta)
+{
+  GtkListBox *list = GTK_LIST_BOX(self->history_list);
+  GtkListBoxRow *row = gtk_list_box_get_selected_row(list);
+  GtkListBoxRow *next = gtk_list_box_get_row_at_index(list, (row ? gtk_list_box_row_get_index(row) : -1) + delta);
+  if (!next)
+    return;
+
+  gtk_list_box_select_row(list, next);
+  GtkAllocation alloc;
+  gtk_widget_get_allocation(GTK_WIDGET(next), &alloc);
+  gtk_adjustment_clamp_page(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(self->history_scrolled)),
+                            alloc.y,
+                            alloc.y + alloc.height);
+}
+
+/* Replaces the current conversation with a stored one, ready for follow-ups. */
+static void
+openai_ask_plugin_history_restore(OpenaiAskPlugin *self, GtkListBoxRow *row)
+{
+  const gint64 *conversation = row ? g_object_get_data(G_OBJECT(row), "conversation") : NULL;
+  if (!conversation)
+    return;
+
+  g_autoptr(GPtrArray) exchanges = history_get_conversation(self->history, *conversation);
+  if (exchanges->len == 0)
+    return;
+
+  /* A conversation still waiting for its answer keeps its tab. */
+  OpenaiAskChat *chat = self->chat->in_flight ? openai_ask_plugin_add_chat(self) : self->chat;
+  if (!chat)
+    return;
+  openai_ask_plugin_reset_chat(chat);
+  openai_ask_plugin_append_system_if_needed(self, chat, NULL);
+  for (guint i = 0; i < exchanges->len; i++)
+  {
+    HistoryExchange *ex = g_ptr_array_index(exchanges, i);
+    conversation_append(chat->conversation, CONVERSATION_ROLE_USER, ex->prompt);
+    conversation_append(chat->conversation, CONVERSATION_ROLE_ASSISTANT, ex->answer);
+  }
+  HistoryExchange *first = g_ptr_array_index(exchanges, 0);
+  HistoryExchange *last = g_ptr_array_index(exchanges, exchanges->len - 1);
+  chat->conversation_id = *conversation;
+  chat->title = g_strdelimit(g_strdup(first->prompt), "\n\t", ' ');
+  chat->answer = g_strdup(last->answer);
+  chat->model = g_strdup(last->model);
+  openai_ask_log("history restored exchanges=%u", exchanges->len);
+
+  gtk_entry_set_text(GTK_ENTRY(self->entry), "");
+  openai_ask_plugin_show_chat(self, chat);
+}
+
+static void
+openai_ask_plugin_on_history_row_activated(GtkListBox *list, GtkListBoxRow *row, gpointer user_data)
+{
+  (void)list;
+  openai_ask_plugin_history_restore(user_data, row);
+}
+
+static void
+openai_ask_plugin_on_entry_changed(GtkEditable *editable, gpointer user_data)
+{
+  (void)editable;
+  OpenaiAskPlugin *self = user_data;
+  if (self->history_mode)
+    openai_ask_plugin_history_refresh(self);
+  else if (self->attachments && self->attachments->len > 0)
+    openai_ask_plugin_update_attachments(self);
+}
+
+static void
+openai_ask_plugin_update_attachments(OpenaiAskPlugin *self)
+{
+  GtkEntry *entry = GTK_ENTRY(self->entry);
+  if (self->attachments->len == 0)
+  {
+    gtk_entry_set_icon_from_icon_name(entry, GTK_ENTRY_ICON_SECONDARY, NULL);
+    return;
+  }
+  /* The tooltip is the preview: what will be sent and roughly how many
+   * tokens the question will cost. */
+  g_autofree gchar *summary =
+    attachment_list_describe(self->attachments, strlen(gtk_entry_get_text(entry)));
+  g_autofree gchar *tooltip = g_strdup_printf("%s\nClick to remove", summary);
+  gtk_entry_set_icon_from_icon_name(entry, GTK_ENTRY_ICON_SECONDARY, "mail-attachment");
+  gtk_entry_set_icon_tooltip_text(entry, GTK_ENTRY_ICON_SECONDARY, tooltip);
+}
+
+static void
+openai_ask_plugin_attach(OpenaiAskPlugin *self, Attachment *attachment, const GError *open_error)
+{
+  g_autoptr(GError) error = NULL;
+  if (!attachment)
+    error = g_error_copy(open_error);
+  else if (attachment_add(self->attachments, attachment, &error))
+    openai_ask_log("attached %s", attachment_get_name(attachment));
+
+  if (error)
+  {
+    openai_ask_log("attach failed: %s", error->message);
+    openai_ask_plugin_set_error(self, error->message);
+    openai_ask_plugin_popover_show(self);
+  }
+  openai_ask_plugin_update_attachments(self);
+}
+
+static void
+openai_ask_plugin_on_entry_icon_press(GtkEntry *entry, GtkEntryIconPosition pos, GdkEvent *event, gpointer user_data)
+{
+  (void)entry;
+  (void)event;
+  OpenaiAskPlugin *self = user_data;
+  if (pos != GTK_ENTRY_ICON_SECONDARY)
+    return;
+  g_ptr_array_set_size(self->attachments, 0);
+  openai_ask_plugin_update_attachments(self);
+}
+
+static void
+openai_ask_plugin_on_entry_drag_data_received(GtkWidget *widget,
+                                              GdkDragContext *context,
+                                              gint x,
+                                              gint y,
+                                              GtkSelectionData *data,
+                                              guint info,
+                                              guint time,
+                                              gpointer user_data)
+{
+  (void)x;
+  (void)y;
+  (void)info;
+  OpenaiAskPlugin *self = user_data;
+  g_auto(GStrv) uris = gtk_selection_data_get_uris(data);
+  if (!uris)
+    return; /* plain text: let the entry insert it */
+  openai_ask_plugin_ensure_popup(self);
+
+  for (guint i = 0; uris[i]; i++)
+  {
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *path = g_filename_from_uri(uris[i], NULL, &error);
+    Attachment *attachment = path ? attachment_new_file(path, &error) : NULL;
+    openai_ask_plugin_attach(self, attachment, error);
+  }
+  g_signal_stop_emission_by_name(widget, "drag-data-received");
+  gtk_drag_finish(context, TRUE, FALSE, time);
+}
+
+static void
+openai_ask_plugin_on_primary_text(GtkClipboard *clipboard, const gchar *text, gpointer user_data)
+{
+  (void)clipboard;
+  OpenaiAskPlugin *self = user_data;
+  if (self->attachments && text && *text)
+    openai_ask_plugin_attach(self, attachment_new_text("selection", text, -1), NULL);
+  g_object_unref(self);
+}
+
+static void
+openai_ask_plugin_start_request(RequestTicket *ticket, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskPlugin *self = ctx->plugin;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+  ctx->ticket = ticket;
+  if (!ticket || !chat)
+    return openai_ask_request_ctx_free(ctx);
+  OpenaiClientCallback callback = openai_ask_plugin_on_client_result;
+  if (ctx->draft)
+    callback = openai_ask_plugin_on_draft_result;
+  else
+    openai_ask_plugin_set_request_state(self, chat, TRUE, FALSE);
+
+  gint max_tokens = 0;
+  OutputBudget budget;
+  if (self->settings.fit_answers && openai_ask_plugin_get_output_budget(self, &budget))
+    max_tokens = budget.max_tokens;
+
+  /* The engine's Ask call carries messages only, so requests with
+   * attachments or a token limit are sent from this process. */
+  if (self->settings.use_engine && !ctx->attachments && !max_tokens)
+  {
+    /* The engine has its own key cache and reports a missing key itself. */
+    openai_ask_log("sending request via engine endpoint=%s model=%s", self->settings.endpoint, ctx->model);
+    ctx->sent_us = g_get_monotonic_time();
+    engine_client_send_chat_async(self->settings.endpoint,
+                                  ctx->model,
+                                  self->settings.temperature,
+                                  chat->conversation,
+                                  ctx->cancellable,
+                                  callback,
+                                  ctx);
+    return;
+  }
+
+  g_autofree gchar *api_key = keyring_lookup_api_key(self->settings.endpoint);
+  if ((!api_key || !*api_key) && ctx->draft)
+  {
+    chat->draft_in_flight = FALSE; /* the answer's request reports it */
+    return openai_ask_request_ctx_free(ctx);
+  }
+  if (!api_key || !*api_key)
+  {
+    g_warning("XFCE Ask: no API key found for endpoint");
+    openai_ask_log("no api key for endpoint=%s", self->settings.endpoint ? self->settings.endpoint : "");
+    openai_ask_plugin_set_request_state(self, chat, FALSE, FALSE);
+    chat->error = g_strdup("No API key found for this endpoint.\n"
+                           "Right-click the plugin → Properties → save an API key.");
+    if (chat == self->chat && !self->history_mode)
+      openai_ask_plugin_set_error(self, chat->error);
+    return openai_ask_request_ctx_free(ctx);
+  }
+
+  openai_ask_log("sending request endpoint=%s model=%s temp=%.2f max_tokens=%d",
+                 self->settings.endpoint ? self->settings.endpoint : "",
+                 ctx->model,
+                 self->settings.temperature,
+                 max_tokens);
+  gint64 hold_us = openai_client_get_hold_us(self->settings.endpoint, api_key, chat->conversation, ctx->attachments);
+  if (hold_us > 0 && hold_us <= RATE_LIMITER_MAX_HOLD_US && !ctx->draft)
+    openai_ask_plugin_set_hold(self, chat, hold_us);
+  ctx->sent_us = g_get_monotonic_time() + MAX(hold_us, 0);
+  openai_client_send_chat_full_async(
+    self->settings.endpoint,
+    api_key,
+    ctx->model,
+    self->settings.temperature,
+    max_tokens,
+    chat->conversation,
+    ctx->attachments,
+    ctx->cancellable,
+    callback,
+    ctx);
+}
+
+/* Starts, reconfigures or drops document retrieval to match the settings.
+ * The embeddings endpoint's key is the chat endpoint's unless it has one
+ * of its own. */
+static void
+openai_ask_plugin_configure_retrieval(OpenaiAskPlugin *self)
+{
+  g_auto(GStrv) dirs = g_strsplit(self->settings.retrieval_dirs ? self->settings.retrieval_dirs : "", ";", -1);
+  g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+  for (guint i = 0; dirs[i]; i++)
+  {
+    g_strstrip(dirs[i]);
+    if (*dirs[i] == '~')
+      g_ptr_array_add(paths, g_build_filename(g_get_home_dir(), dirs[i] + 1, NULL));
+    else if (*dirs[i])
+      g_ptr_array_add(paths, g_strdup(dirs[i]));
+  }
+  if (paths->len == 0)
+  {
+    g_clear_pointer(&self->retrieval, retrieval_free);
+    return;
+  }
+  g_ptr_array_add(paths, NULL);
+
+  const gchar *endpoint = self->settings.embeddings_endpoint;
+  g_autofree gchar *derived = NULL;
+  if (!endpoint || !*endpoint)
+    endpoint = derived = openai_client_get_embeddings_url(self->settings.endpoint ? self->settings.endpoint : "");
+  if (!endpoint)
+  {
+    openai_ask_log("retrieval: no embeddings endpoint next to %s", self->settings.endpoint);
+    g_clear_pointer(&self->retrieval, retrieval_free);
+    return;
+  }
+  g_autofree gchar *api_key = keyring_lookup_api_key(endpoint);
+  if ((!api_key || !*api_key) && derived)
+  {
+    g_free(api_key);
+    api_key = keyring_lookup_api_key(self->settings.endpoint);
+  }
+
+  if (!self->retrieval)
+  {
+    g_autofree gchar *index_path = retrieval_default_path();
+    self->retrieval = retrieval_new(index_path);
+  }
+  retrieval_configure(self->retrieval,
+                      (const gchar *const *)paths->pdata,
+                      endpoint,
+                      api_key,
+                      self->settings.embeddings_model);
+}
+
+static void
+openai_ask_plugin_submit(OpenaiAskPlugin *self, OpenaiAskChat *chat, OpenaiAskRequestCtx *ctx)
+{
+  /* The draft is queued first: it is the one that should start at once. */
+  if (chat->draft_model && !chat->draft_in_flight)
+  {
+    OpenaiAskRequestCtx *draft = openai_ask_request_ctx_new(self, chat, chat->draft_cancellable);
+    g_free(draft->model);
+    draft->model = g_strdup(chat->draft_model);
+    draft->draft = TRUE;
+    if (ctx->attachments)
+      draft->attachments = g_ptr_array_ref(ctx->attachments);
+    chat->draft_in_flight = TRUE;
+    request_scheduler_submit(request_scheduler_get_default(),
+                             self->settings.endpoint,
+                             REQUEST_PRIORITY_INTERACTIVE,
+                             chat->id,
+                             chat->draft_cancellable,
+                             openai_ask_plugin_start_request,
+                             draft);
+  }
+  request_scheduler_submit(request_scheduler_get_default(),
+                           self->settings.endpoint,
+                           REQUEST_PRIORITY_INTERACTIVE,
+                           chat->id,
+                           chat->cancellable,
+                           openai_ask_plugin_start_request,
+                           ctx);
+}
+
+static void
+openai_ask_plugin_on_retrieved(const gchar *context, gpointer user_data)
+{
+  OpenaiAskRequestCtx *ctx = user_data;
+  OpenaiAskChat *chat = openai_ask_request_ctx_get_chat(ctx);
+  if (!chat || g_cancellable_is_cancelled(ctx->cancellable))
+    return openai_ask_request_ctx_free(ctx);
+
+  OpenaiAskPlugin *self = ctx->plugin;
+  chat->searching = FALSE;
+  if (chat == self->chat && !self->history_mode)
+    openai_ask_plugin_update_loading(self);
+  openai_ask_log("retrieval: %zu bytes of context for chat=%" G_GUINT64_FORMAT,
+                 context ? strlen(context) : 0,
+                 chat->id);
+  openai_ask_plugin_append_system_if_needed(self, chat, context);
+  openai_ask_plugin_submit(self, chat, ctx);
+}
+
+/* Returns FALSE if @prompt was not sent and should stay in the entry. */
+static gboolean
+openai_ask_plugin_send(OpenaiAskPlugin *self, const gchar *prompt)
+{
+  if (!prompt || !*prompt)
+    return FALSE;
+
+  /* Asking while the current answer is pending starts another conversation. */
+  gboolean open = openai_ask_plugin_popover_is_open(self);
+  gboolean new_chat = self->chat->in_flight;
+  if (new_chat && self->chats->len >= CHAT_MAX)
+  {
+    openai_ask_plugin_set_error(self, "Too many conversations are open; close one with Ctrl+W.");
+    return FALSE;
+  }
+
+  g_autoptr(GError) attach_error = NULL;
+  if (!attachment_add_references(self->attachments, prompt, &attach_error))
+  {
+    openai_ask_plugin_set_error(self, attach_error->message);
+    openai_ask_plugin_popover_show(self);
+    return FALSE;
+  }
+
+  /* Called straight from the Enter key handler; timed to the popup's first draw. */
+  if (!open)
+    self->show_key_press_us = g_get_monotonic_time();
+  if (!self->settings.endpoint || !*self->settings.endpoint)
+  {
+    g_warning("XFCE Ask: missing endpoint");
+    openai_ask_plugin_set_error(self, "No endpoint configured.");
+    openai_ask_plugin_popover_show(self);
+    return TRUE;
+  }
+  if (!self->settings.model || !*self->settings.model)
+  {
+    g_warning("XFCE Ask: missing model");
+    openai_ask_plugin_set_error(self, "No model configured.");
+    openai_ask_plugin_popover_show(self);
+    return TRUE;
+  }
+
+  OpenaiAskChat *chat = self->chat;
+  if (new_chat)
+  {
+    chat = openai_ask_plugin_add_chat(self);
+    openai_ask_plugin_show_chat(self, chat);
+  }
+  else if (!open)
+    openai_ask_plugin_reset_chat(chat);
+
+  openai_ask_plugin_append_system_if_needed(self, chat, NULL);
+  conversation_append(chat->conversation, CONVERSATION_ROLE_USER, prompt);
+  if (!chat->title)
+    chat->title = g_strdup(prompt);
+  g_clear_pointer(&chat->answer, g_free);
+  g_clear_pointer(&chat->error, g_free);
+  g_clear_pointer(&chat->attachments, g_ptr_array_unref);
+  chat->truncated = FALSE;
+  /* A follow-up is routed on its own text, but never to a smaller model
+   * than the conversation has, e.g. one Ctrl+B escalated to. */
+  g_autofree gchar *previous = g_steal_pointer(&chat->model);
+  chat->model =
+    g_strdup(self->router ? model_router_pick_at_least(self->router, prompt, previous) : self->settings.model);
+  openai_ask_chat_drop_draft(chat);
+  chat->asked_us = g_get_monotonic_time();
+  const gchar *draft_model = self->settings.draft_model;
+  if (draft_model && *draft_model && g_strcmp0(draft_model, chat->model) != 0)
+  {
+    chat->draft_model = g_strdup(draft_model);
+    chat->draft_cancellable = g_cancellable_new();
+  }
+  openai_ask_plugin_update_title(self);
+  openai_ask_log("send prompt len=%zu chat=%" G_GUINT64_FORMAT, (size_t)strlen(prompt), chat->id);
+
+  g_clear_object(&chat->cancellable);
+  chat->cancellable = g_cancellable_new();
+  OpenaiAskRequestCtx *ctx = openai_ask_request_ctx_new(self, chat, chat->cancellable);
+
+  openai_ask_plugin_set_request_state(self, chat, TRUE, TRUE);
+  openai_ask_plugin_popover_show(self);
+  openai_ask_plugin_request_relayout(self);
+
+  /* Attachments go with this question only; follow-ups see the answer. */
+  if (self->attachments->len > 0)
+  {
+    ctx->attachments = g_steal_pointer(&self->attachments);
+    chat->attachments = g_ptr_array_ref(ctx->attachments);
+    self->attachments = attachment_list_new();
+    openai_ask_plugin_update_attachments(self);
+    openai_ask_log("sending %u attachments, about %zu tokens",
+                   ctx->attachments->len,
+                   (size_t)attachment_estimate_tokens(strlen(prompt) + attachment_list_get_bytes(ctx->attachments)));
+  }
+
+  if (self->retrieval && retrieval_is_ready(self->retrieval))
+  {
+    chat->searching = TRUE;
+    openai_ask_plugin_update_loading(self);
+    retrieval_refresh(self->retrieval);
+    retrieval_search_async(self->retrieval, prompt, chat->cancellable, openai_ask_plugin_on_retrieved, ctx);
+    return TRUE;
+  }
+  openai_ask_plugin_submit(self, chat, ctx);
+  return TRUE;
+}
+
+static OpenaiAskChat *
+openai_ask_plugin_find_batch_chat(OpenaiAskPlugin *self, Batch *batch)
+{
+  for (guint i = 0; self->chats && i < self->chats->len; i++)
+  {
+    OpenaiAskChat *chat = g_ptr_array_index(self->chats, i);
+    if (chat->batch == batch)
+      return chat;
+  }
+  return NULL;
+}
+
+/* Running batches show on the entry's progress bar and tooltip, whether or
+ * not the popup is open. */
+static void
+openai_ask_plugin_update_batch_status(OpenaiAskPlugin *self)
 {
-  (void)widget;
-  OpenaiAskPlugin *self = user_data;
-  if (event->keyval == GDK_KEY_Escape)
+  guint written = 0;
+  guint total = 0;
+  g_autoptr(GString) tooltip = g_string_new(NULL);
+  for (guint i = 0; i < self->batches->len; i++)
   {
-    openai_ask_plugin_popover_hide(self);
-    return GDK_EVENT_STOP;
+    Batch *batch = g_ptr_array_index(self->batches, i);
+    const BatchProgress *progress = batch_get_progress(batch);
+    written += progress->written;
+    total += progress->total;
+    g_autofree gchar *name = g_path_get_basename(batch_get_output_path(batch));
+    g_autofree gchar *status = batch_progress_describe(progress);
+    g_string_append_printf(tooltip, "%sBatch to %s: %s", tooltip->len > 0 ? "\n" : "", name, status);
   }
-  return GDK_EVENT_PROPAGATE;
+  gtk_entry_set_progress_fraction(GTK_ENTRY(self->entry), total > 0 ? (gdouble)written / total : 0.0);
+  gtk_widget_set_tooltip_text(self->entry, tooltip->len > 0 ? tooltip->str : NULL);
 }
 
 static void
-openai_ask_plugin_send(OpenaiAskPlugin *self, const gchar *prompt)
+openai_ask_plugin_on_batch_progress(Batch *batch, const BatchProgress *progress, gpointer user_data)
 {
-  if (!prompt || !*prompt)
+  (void)progress;
+  OpenaiAskPlugin *self = user_data;
+  openai_ask_plugin_update_batch_status(self);
+  OpenaiAskChat *chat = openai_ask_plugin_find_batch_chat(self, batch);
+  if (chat && chat == self->chat && !self->history_mode)
+    openai_ask_plugin_update_loading(self);
+}
+
+static void
+openai_ask_plugin_on_batch_done(Batch *batch, const BatchProgress *progress, const GError *error, gpointer user_data)
+{
+  OpenaiAskPlugin *self = user_data;
+  OpenaiAskChat *chat = openai_ask_plugin_find_batch_chat(self, batch);
+  g_autofree gchar *path = g_filename_display_name(batch_get_output_path(batch));
+  g_ptr_array_remove(self->batches, batch);
+  openai_ask_plugin_update_batch_status(self);
+  if (!chat)
     return;
-  if (!self->endpoint || !*self->endpoint)
+  chat->batch = NULL;
+  if (error)
+    chat->error = g_strdup_printf("%s\n%u of %u lines are in %s; run the batch again to resume it.",
+                                  error->message,
+                                  progress->written,
+                                  progress->total,
+                                  path);
+  else
   {
-    g_warning("XFCE Ask: missing endpoint");
-    openai_ask_plugin_set_error(self, "No endpoint configured.");
-    openai_ask_plugin_popover_show(self);
-    return;
+    GString *answer = g_string_new(NULL);
+    g_string_append_printf(answer, "**Batch done:** %u lines in `%s`\n\n", progress->total, path);
+    if (progress->resumed > 0)
+      g_string_append_printf(answer, "- %u kept from an earlier run\n", progress->resumed);
+    if (progress->failed > 0)
+      g_string_append_printf(answer,
+                             "- %u failed and have an \"error\" in place of an \"answer\"; running the batch "
+                             "again asks them again\n",
+                             progress->failed);
+    g_string_append_printf(answer,
+                           "- %u requests in %.1f s, %.1f requests/s\n",
+                           progress->requests,
+                           progress->elapsed_us / 1e6,
+                           batch_progress_get_rate(progress));
+    chat->answer = g_string_free(answer, FALSE);
   }
-  if (!self->model || !*self->model)
-  {
-    g_warning("XFCE Ask: missing model");
-    openai_ask_plugin_set_error(self, "No model configured.");
-    openai_ask_plugin_popover_show(self);
+  openai_ask_plugin_set_request_state(self, chat, FALSE, FALSE);
+  if (chat != self->chat || self->history_mode)
     return;
-  }
-
-  if (!openai_ask_plugin_popover_is_open(self))
-    openai_ask_plugin_begin_new(self);
+  if (chat->error)
+    openai_ask_plugin_set_error(self, chat->error);
   else
-    gtk_label_set_text(GTK_LABEL(self->popover_title), "Follow-up");
-
-  openai_ask_plugin_append_system_if_needed(self);
-  g_ptr_array_add(self->messages, openai_chat_message_new("user", prompt));
-  openai_ask_plugin_trim_followup(self);
-  openai_ask_log("send prompt len=%zu", (size_t)strlen(prompt));
-
-  g_clear_object(&self->request_cancellable);
-  self->request_cancellable = g_cancellable_new();
-
-  openai_ask_plugin_set_request_state(self, TRUE);
-  openai_ask_plugin_popover_show(self);
-  openai_ask_plugin_request_relayout(self);
+    openai_ask_plugin_set_answer(self, chat->answer);
+}
 
-  g_autofree gchar *api_key = keyring_lookup_api_key(self->endpoint);
+/* Ctrl+Enter: asks the entry text, as a template ({} stands for the line),
+ * of every line of the file its first @/path word names, in a tab of its
+ * own. Answers go to a .answers.jsonl file next to it, and running the
+ * same batch again resumes it. Returns FALSE if nothing was started. */
+static gboolean
+openai_ask_plugin_run_batch(OpenaiAskPlugin *self, const gchar *text)
+{
+  g_autofree gchar *input = NULL;
+  g_autoptr(GString) template = g_string_new(NULL);
+  g_auto(GStrv) words = g_strsplit(text, " ", -1);
+  for (guint i = 0; words[i]; i++)
+  {
+    const gchar *word = words[i];
+    if (!input && word[0] == '@' && (word[1] == '/' || g_str_has_prefix(word + 1, "~/")))
+    {
+      input = word[1] == '~' ? g_build_filename(g_get_home_dir(), word + 3, NULL) : g_strdup(word + 1);
+      continue;
+    }
+    if (template->len > 0)
+      g_string_append_c(template, ' ');
+    g_string_append(template, word);
+  }
+  if (!input)
+  {
+    openai_ask_plugin_set_error(self,
+                                "Name the batch's input file with an @/path word; {} stands for each of its lines.");
+    return FALSE;
+  }
+  if (!self->settings.endpoint || !*self->settings.endpoint || !self->settings.model || !*self->settings.model)
+  {
+    openai_ask_plugin_set_error(self, "No endpoint or model configured.");
+    return FALSE;
+  }
+  /* Batches are always sent from this process, like attachments. */
+  g_autofree gchar *api_key = keyring_lookup_api_key(self->settings.endpoint);
   if (!api_key || !*api_key)
   {
-    g_warning("XFCE Ask: no API key found for endpoint");
-    openai_ask_log("no api key for endpoint=%s", self->endpoint ? self->endpoint : "");
-    openai_ask_plugin_set_request_state(self, FALSE);
     openai_ask_plugin_set_error(self,
                                 "No API key found for this endpoint.\n"
                                 "Right-click the plugin → Properties → save an API key.");
+    return FALSE;
+  }
+
+  /* The tab comes first: opening the batch already reads its output. */
+  OpenaiAskChat *chat = self->chat;
+  gboolean added = chat->in_flight || (openai_ask_plugin_popover_is_open(self) &&
+                                       (chat->title || conversation_get_length(chat->conversation) > 0));
+  if (added)
+    chat = openai_ask_plugin_add_chat(self);
+  if (!chat)
+  {
+    openai_ask_plugin_set_error(self, "Too many conversations are open; close one with Ctrl+W.");
+    return FALSE;
+  }
+  g_autofree gchar *output = batch_default_output_path(input);
+  g_autoptr(GError) error = NULL;
+  Batch *batch = batch_open(template->str, input, output, &error);
+  if (!batch)
+  {
+    if (added)
+    {
+      g_ptr_array_remove(self->chats, chat);
+      openai_ask_plugin_update_tabs(self);
+    }
+    openai_ask_plugin_set_error(self, error->message);
+    return FALSE;
+  }
+
+  openai_ask_plugin_reset_chat(chat);
+  g_ptr_array_add(self->batches, batch);
+  chat->batch = batch;
+  g_autofree gchar *name = g_path_get_basename(input);
+  chat->title = g_strdup_printf("Batch: %s", name);
+  openai_ask_plugin_set_request_state(self, chat, TRUE, FALSE);
+  openai_ask_plugin_show_chat(self, chat);
+  openai_ask_plugin_popover_show(self);
+  openai_ask_log("batch: %u lines of %s in chat=%" G_GUINT64_FORMAT,
+                 batch_get_progress(batch)->total,
+                 input,
+                 chat->id);
+
+  /* Background requests leave the endpoint's last slot for questions. */
+  BatchOptions options = {
+    .endpoint = self->settings.endpoint,
+    .api_key = api_key,
+    .model = self->settings.model,
+    .temperature = self->settings.temperature,
+    .system_prompt = self->settings.system_prompt,
+    .jobs = (guint)self->settings.max_requests,
+    .owner = chat->id,
+  };
+  batch_start(batch, &options, openai_ask_plugin_on_batch_progress, openai_ask_plugin_on_batch_done, self);
+  openai_ask_plugin_update_batch_status(self);
+  return TRUE;
+}
+
+/* While the draft is on screen: Ctrl+D keeps it as the answer, Ctrl+Shift+D
+ * drops it and waits for the real one. */
+static void
+openai_ask_plugin_drop_or_keep_draft(OpenaiAskPlugin *self, gboolean keep)
+{
+  OpenaiAskChat *chat = self->chat;
+  openai_ask_log("draft %s chat=%" G_GUINT64_FORMAT, keep ? "kept" : "dropped", chat->id);
+  if (keep)
+  {
+    openai_ask_plugin_keep_draft(self, chat);
     return;
   }
+  openai_ask_chat_drop_draft(chat);
+  openai_ask_plugin_update_title(self);
+  openai_ask_plugin_update_loading(self);
+}
 
-  openai_ask_log("sending request endpoint=%s model=%s temp=%.2f",
-                 self->endpoint ? self->endpoint : "",
-                 self->model ? self->model : "",
-                 self->temperature);
-  g_object_ref(self);
-  openai_client_send_chat_async(
-    self->endpoint,
-    api_key,
-    self->model,
-    self->temperature,
-    self->messages,
-    self->request_cancellable,
-    openai_ask_plugin_on_client_result,
-    self);
+/* Asks the last question of the conversation on screen again, of the next
+ * bigger model in the routing list, in place of the answer or error it
+ * got. The question keeps its attachments and retrieved excerpts. */
+static void
+openai_ask_plugin_escalate(OpenaiAskPlugin *self)
+{
+  OpenaiAskChat *chat = self->chat;
+  const gchar *bigger = self->router && chat->model ? model_router_get_bigger(self->router, chat->model) : NULL;
+  if (!bigger || chat->in_flight || chat->searching || (!chat->answer && !chat->error))
+    return;
+  const ConversationTurn *last =
+    conversation_get_turn(chat->conversation, conversation_get_length(chat->conversation) - 1);
+  if (last && last->role == CONVERSATION_ROLE_ASSISTANT)
+    conversation_drop_last(chat->conversation);
+  openai_ask_log("escalate chat=%" G_GUINT64_FORMAT " from %s to %s", chat->id, chat->model, bigger);
+  /* Only an answer, not an error, was written to the history. */
+  gboolean replaces = chat->answer != NULL;
+
+  g_free(chat->model);
+  chat->model = g_strdup(bigger);
+  chat->truncated = FALSE;
+  openai_ask_chat_drop_draft(chat);
+  g_clear_pointer(&chat->answer, g_free);
+  g_clear_pointer(&chat->error, g_free);
+  openai_ask_plugin_update_title(self);
+
+  g_clear_object(&chat->cancellable);
+  chat->cancellable = g_cancellable_new();
+  OpenaiAskRequestCtx *ctx = openai_ask_request_ctx_new(self, chat, chat->cancellable);
+  ctx->replaces = replaces;
+  if (chat->attachments)
+    ctx->attachments = g_ptr_array_ref(chat->attachments);
+  openai_ask_plugin_set_request_state(self, chat, TRUE, TRUE);
+  openai_ask_plugin_request_relayout(self);
+  openai_ask_plugin_submit(self, chat, ctx);
+}
+
+/* Asks for the rest of the answer on screen, which was cut at the output
+ * budget. The continuation is added to the answer when it comes. */
+static void
+openai_ask_plugin_continue_answer(OpenaiAskPlugin *self)
+{
+  OpenaiAskChat *chat = self->chat;
+  if (!chat->truncated || !chat->answer || chat->in_flight || chat->searching)
+    return;
+  openai_ask_log("continue chat=%" G_GUINT64_FORMAT " after %zu bytes", chat->id, strlen(chat->answer));
+  chat->truncated = FALSE;
+  g_clear_pointer(&chat->error, g_free);
+  conversation_append(chat->conversation, CONVERSATION_ROLE_USER, OUTPUT_BUDGET_CONTINUE_PROMPT);
+
+  g_clear_object(&chat->cancellable);
+  chat->cancellable = g_cancellable_new();
+  OpenaiAskRequestCtx *ctx = openai_ask_request_ctx_new(self, chat, chat->cancellable);
+  ctx->continuation = TRUE;
+  ctx->replaces = TRUE;
+  openai_ask_plugin_set_request_state(self, chat, TRUE, TRUE);
+  openai_ask_plugin_update_title(self);
+  openai_ask_plugin_request_relayout(self);
+  openai_ask_plugin_submit(self, chat, ctx);
 }
 
 typedef struct
@@ -635,6 +2389,7 @@ openai_ask_plugin_on_save_key_clicked(GtkButton *button, gpointer user_data)
   if (!endpoint || !*endpoint || !key || !*key)
     return;
   keyring_store_api_key(endpoint, key);
+  engine_client_forget_key(endpoint);
   gtk_entry_set_text(GTK_ENTRY(ctx->key_entry), "");
 }
 
@@ -647,39 +2402,195 @@ openai_ask_plugin_on_clear_key_clicked(GtkButton *button, gpointer user_data)
   if (!endpoint || !*endpoint)
     return;
   keyring_clear_api_key(endpoint);
+  engine_client_forget_key(endpoint);
+}
+
+/* The model box of the Properties dialog offers the models the endpoint's
+ * server listed: from the cache at once, then refreshed in the background
+ * if the cached list is older than MODEL_CACHE_TTL_S. */
+typedef struct
+{
+  GtkWidget *endpoint_entry;
+  GtkWidget *model_combo;
+  gchar *endpoint; /* whose models are shown */
+  GCancellable *cancellable;
+  guint refresh_id;
+} OpenaiAskModelsDialogCtx;
+
+static void
+openai_ask_plugin_set_models(GtkWidget *combo, const gchar *const *models)
+{
+  gtk_combo_box_text_remove_all(GTK_COMBO_BOX_TEXT(combo));
+  for (guint i = 0; models && models[i]; i++)
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), models[i]);
+}
+
+static void
+openai_ask_plugin_on_models_refreshed(GStrv models, const GError *error, gpointer user_data)
+{
+  /* The dialog may be gone by now; its context is only valid if the
+   * request was not cancelled. */
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+  OpenaiAskModelsDialogCtx *ctx = user_data;
+  if (models)
+    openai_ask_plugin_set_models(ctx->model_combo, (const gchar *const *)models);
+}
+
+static gboolean
+openai_ask_plugin_on_models_refresh(gpointer user_data)
+{
+  OpenaiAskModelsDialogCtx *ctx = user_data;
+  ctx->refresh_id = 0;
+  g_autofree gchar *api_key = keyring_lookup_api_key(ctx->endpoint);
+  model_cache_refresh_async(ctx->endpoint, api_key, ctx->cancellable, openai_ask_plugin_on_models_refreshed, ctx);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+openai_ask_plugin_load_models(OpenaiAskModelsDialogCtx *ctx)
+{
+  const gchar *endpoint = gtk_entry_get_text(GTK_ENTRY(ctx->endpoint_entry));
+  if (g_strcmp0(endpoint, ctx->endpoint) == 0)
+    return;
+  g_free(ctx->endpoint);
+  ctx->endpoint = g_strdup(endpoint);
+  g_clear_handle_id(&ctx->refresh_id, g_source_remove);
+  if (ctx->cancellable)
+    g_cancellable_cancel(ctx->cancellable);
+  g_clear_object(&ctx->cancellable);
+
+  gboolean fresh = FALSE;
+  g_auto(GStrv) models = model_cache_lookup(endpoint, &fresh);
+  openai_ask_plugin_set_models(ctx->model_combo, (const gchar *const *)models);
+  if (fresh || !*endpoint)
+    return;
+  /* After the dialog is up: the key lookup may have to ask the keyring. */
+  ctx->cancellable = g_cancellable_new();
+  ctx->refresh_id = g_idle_add(openai_ask_plugin_on_models_refresh, ctx);
+}
+
+static gboolean
+openai_ask_plugin_on_endpoint_focus_out(GtkWidget *widget, GdkEventFocus *event, gpointer user_data)
+{
+  (void)widget;
+  (void)event;
+  openai_ask_plugin_load_models(user_data);
+  return FALSE;
 }
 
 static void
 openai_ask_plugin_on_entry_activate(GtkEntry *entry, OpenaiAskPlugin *self)
 {
-  if (self->request_in_flight)
+  openai_ask_plugin_ensure_popup(self);
+  if (self->history_mode)
     return;
 
   const gchar *text = gtk_entry_get_text(entry);
   if (!text || !*text)
     return;
 
-  openai_ask_plugin_send(self, text);
-  gtk_entry_set_text(entry, "");
+  if (openai_ask_plugin_send(self, text))
+    gtk_entry_set_text(entry, "");
 }
 
 static gboolean
 openai_ask_plugin_on_entry_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
 {
   OpenaiAskPlugin *self = user_data;
+  openai_ask_plugin_ensure_popup(self);
+  if ((event->state & GDK_CONTROL_MASK) && (event->keyval == GDK_KEY_r || event->keyval == GDK_KEY_R))
+  {
+    if (self->history_mode)
+      openai_ask_plugin_history_leave(self);
+    else
+      openai_ask_plugin_history_enter(self);
+    return GDK_EVENT_STOP;
+  }
+  if ((event->state & GDK_CONTROL_MASK) && (event->state & GDK_SHIFT_MASK) &&
+      (event->keyval == GDK_KEY_v || event->keyval == GDK_KEY_V))
+  {
+    /* Attach the PRIMARY selection (whatever text is highlighted). */
+    GtkClipboard *primary = gtk_widget_get_clipboard(widget, GDK_SELECTION_PRIMARY);
+    gtk_clipboard_request_text(primary, openai_ask_plugin_on_primary_text, g_object_ref(self));
+    return GDK_EVENT_STOP;
+  }
+  if ((event->state & GDK_CONTROL_MASK) && openai_ask_plugin_popover_is_open(self) && !self->history_mode)
+  {
+    switch (event->keyval)
+    {
+    case GDK_KEY_t:
+    case GDK_KEY_T:
+    {
+      /* An untouched conversation is already a new one. */
+      OpenaiAskChat *chat = conversation_get_length(self->chat->conversation) > 0 || self->chat->in_flight
+                              ? openai_ask_plugin_add_chat(self)
+                              : self->chat;
+      if (chat)
+        openai_ask_plugin_show_chat(self, chat);
+      return GDK_EVENT_STOP;
+    }
+    case GDK_KEY_w:
+    case GDK_KEY_W:
+      openai_ask_plugin_close_chat(self, self->chat);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_Tab:
+    case GDK_KEY_Page_Down:
+      openai_ask_plugin_switch_chat(self, 1);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_ISO_Left_Tab:
+    case GDK_KEY_Page_Up:
+      openai_ask_plugin_switch_chat(self, -1);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_b:
+    case GDK_KEY_B:
+      openai_ask_plugin_escalate(self);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_m:
+    case GDK_KEY_M:
+      openai_ask_plugin_continue_answer(self);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_d:
+    case GDK_KEY_D:
+      if (self->chat->in_flight && self->chat->draft)
+        openai_ask_plugin_drop_or_keep_draft(self, (event->state & GDK_SHIFT_MASK) == 0);
+      return GDK_EVENT_STOP;
+    default:
+      break;
+    }
+  }
+  if (self->history_mode)
+  {
+    switch (event->keyval)
+    {
+    case GDK_KEY_Escape:
+      openai_ask_plugin_history_leave(self);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_Up:
+    case GDK_KEY_KP_Up:
+      openai_ask_plugin_history_move(self, -1);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_Down:
+    case GDK_KEY_KP_Down:
+      openai_ask_plugin_history_move(self, 1);
+      return GDK_EVENT_STOP;
+    case GDK_KEY_Return:
+    case GDK_KEY_KP_Enter:
+    case GDK_KEY_ISO_Enter:
+      openai_ask_plugin_history_restore(self, gtk_list_box_get_selected_row(GTK_LIST_BOX(self->history_list)));
+      return GDK_EVENT_STOP;
+    default:
+      break;
+    }
+  }
   if (event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter || event->keyval == GDK_KEY_ISO_Enter ||
       event->keyval == GDK_KEY_Linefeed)
   {
     openai_ask_log("enter key pressed");
-    if (!self->request_in_flight)
-    {
-      const gchar *text = gtk_entry_get_text(GTK_ENTRY(widget));
-      if (text && *text)
-      {
-        openai_ask_plugin_send(self, text);
-        gtk_entry_set_text(GTK_ENTRY(widget), "");
-      }
-    }
+    const gchar *text = gtk_entry_get_text(GTK_ENTRY(widget));
+    gboolean batch = (event->state & GDK_CONTROL_MASK) != 0;
+    if (text && *text && (batch ? openai_ask_plugin_run_batch(self, text) : openai_ask_plugin_send(self, text)))
+      gtk_entry_set_text(GTK_ENTRY(widget), "");
     return GDK_EVENT_STOP;
   }
   return GDK_EVENT_PROPAGATE;
@@ -695,85 +2606,39 @@ openai_ask_plugin_on_entry_button_press(GtkWidget *widget, GdkEventButton *event
   return GDK_EVENT_PROPAGATE;
 }
 
+/* Routing is on when route models are set; statistics survive changes
+ * to the list but not to the endpoint. */
 static void
-openai_ask_plugin_load_settings(OpenaiAskPlugin *self)
+openai_ask_plugin_configure_router(OpenaiAskPlugin *self)
 {
-  g_clear_pointer(&self->endpoint, g_free);
-  g_clear_pointer(&self->model, g_free);
-  g_clear_pointer(&self->system_prompt, g_free);
+  g_auto(GStrv) models = g_strsplit(self->settings.route_models ? self->settings.route_models : "", ";", -1);
+  for (guint i = 0; models[i]; i++)
+    g_strstrip(models[i]);
+  if (!self->router)
+    self->router = model_router_new();
+  model_router_configure(self->router, self->settings.endpoint, (const gchar *const *)models);
+  if (model_router_get_count(self->router) == 0)
+    g_clear_pointer(&self->router, model_router_free);
+}
 
-  self->endpoint = g_strdup("https://api.openai.com/v1/chat/completions");
-  self->model = g_strdup("gpt-4o-mini");
-  self->system_prompt = g_strdup("");
-  self->temperature = 0.7;
-  self->width_chars = 18;
-  self->reply_width_px = 0;
-  self->reply_opacity_pct = 100;
+static void
+openai_ask_plugin_load_settings(OpenaiAskPlugin *self)
+{
+  openai_ask_settings_clear(&self->settings);
+  openai_ask_settings_init(&self->settings);
 
   g_autofree gchar *rc = xfce_panel_plugin_save_location(XFCE_PANEL_PLUGIN(self), FALSE);
-  if (!rc)
-    return;
-
-  g_autoptr(GKeyFile) kf = g_key_file_new();
-  g_autoptr(GError) error = NULL;
-  if (!g_key_file_load_from_file(kf, rc, G_KEY_FILE_NONE, &error))
-    return;
-
-  g_autofree gchar *endpoint = g_key_file_get_string(kf, KF_GROUP, KF_ENDPOINT, NULL);
-  g_autofree gchar *model = g_key_file_get_string(kf, KF_GROUP, KF_MODEL, NULL);
-  g_autofree gchar *system_prompt = g_key_file_get_string(kf, KF_GROUP, KF_SYSTEM_PROMPT, NULL);
-  gdouble temperature = self->temperature;
-  if (g_key_file_has_key(kf, KF_GROUP, KF_TEMPERATURE, NULL))
-    temperature = g_key_file_get_double(kf, KF_GROUP, KF_TEMPERATURE, NULL);
-
-  if (endpoint && *endpoint)
-  {
-    g_free(self->endpoint);
-    self->endpoint = g_strdup(endpoint);
-  }
-  if (model && *model)
-  {
-    g_free(self->model);
-    self->model = g_strdup(model);
-  }
-  if (system_prompt)
-  {
-    g_free(self->system_prompt);
-    self->system_prompt = g_strdup(system_prompt);
-  }
-  self->temperature = temperature;
-
-  if (g_key_file_has_key(kf, KF_GROUP, KF_WIDTH_CHARS, NULL))
-    self->width_chars = g_key_file_get_integer(kf, KF_GROUP, KF_WIDTH_CHARS, NULL);
-
-  if (g_key_file_has_key(kf, KF_GROUP, KF_REPLY_WIDTH_PX, NULL))
-    self->reply_width_px = g_key_file_get_integer(kf, KF_GROUP, KF_REPLY_WIDTH_PX, NULL);
-
-  if (g_key_file_has_key(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, NULL))
-    self->reply_opacity_pct = g_key_file_get_integer(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, NULL);
+  openai_ask_settings_load(&self->settings, rc);
+  request_scheduler_set_limit(request_scheduler_get_default(), self->settings.endpoint, self->settings.max_requests);
+  openai_client_set_backend(self->settings.endpoint, openai_client_backend_from_name(self->settings.backend));
+  openai_ask_plugin_configure_router(self);
 }
 
 static void
 openai_ask_plugin_save_settings(OpenaiAskPlugin *self)
 {
   g_autofree gchar *rc = xfce_panel_plugin_save_location(XFCE_PANEL_PLUGIN(self), TRUE);
-  if (!rc)
-    return;
-
-  g_autoptr(GKeyFile) kf = g_key_file_new();
-  g_key_file_set_string(kf, KF_GROUP, KF_ENDPOINT, self->endpoint ? self->endpoint : "");
-  g_key_file_set_string(kf, KF_GROUP, KF_MODEL, self->model ? self->model : "");
-  g_key_file_set_string(kf, KF_GROUP, KF_SYSTEM_PROMPT, self->system_prompt ? self->system_prompt : "");
-  g_key_file_set_double(kf, KF_GROUP, KF_TEMPERATURE, self->temperature);
-  g_key_file_set_integer(kf, KF_GROUP, KF_WIDTH_CHARS, self->width_chars);
-  g_key_file_set_integer(kf, KF_GROUP, KF_REPLY_WIDTH_PX, self->reply_width_px);
-  g_key_file_set_integer(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, self->reply_opacity_pct);
-
-  gsize len = 0;
-  g_autofree gchar *data = g_key_file_to_data(kf, &len, NULL);
-  if (!data)
-    return;
-  g_file_set_contents(rc, data, (gssize)len, NULL);
+  openai_ask_settings_save(&self->settings, rc);
 }
 
 static void
@@ -801,20 +2666,40 @@ openai_ask_plugin_show_configure(XfcePanelPlugin *plugin, gpointer user_data)
   GtkWidget *endpoint_label = gtk_label_new("Endpoint");
   gtk_widget_set_halign(endpoint_label, GTK_ALIGN_END);
   GtkWidget *endpoint_entry = gtk_entry_new();
-  gtk_entry_set_text(GTK_ENTRY(endpoint_entry), self->endpoint ? self->endpoint : "");
+  gtk_entry_set_text(GTK_ENTRY(endpoint_entry), self->settings.endpoint ? self->settings.endpoint : "");
+  gtk_widget_set_tooltip_text(endpoint_entry, "URL, or unix:/path/to.sock:/v1/chat/completions for a local socket");
+  gtk_widget_set_hexpand(endpoint_entry, TRUE);
+  GtkWidget *backend_combo = gtk_combo_box_text_new();
+  for (guint i = 0; i < OPENAI_CLIENT_BACKEND_COUNT; i++)
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(backend_combo),
+                              openai_client_backend_get_name(i),
+                              openai_client_backend_get_label(i));
+  gtk_combo_box_set_active(GTK_COMBO_BOX(backend_combo), (gint)openai_client_backend_from_name(self->settings.backend));
+  gtk_widget_set_tooltip_text(backend_combo,
+                              "Ollama and llama.cpp keep the model loaded and reuse the cached prompt between "
+                              "follow-ups");
+  GtkWidget *endpoint_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+  gtk_box_pack_start(GTK_BOX(endpoint_box), endpoint_entry, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(endpoint_box), backend_combo, FALSE, FALSE, 0);
   gtk_grid_attach(GTK_GRID(grid), endpoint_label, 0, 0, 1, 1);
-  gtk_grid_attach(GTK_GRID(grid), endpoint_entry, 1, 0, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), endpoint_box, 1, 0, 1, 1);
 
   GtkWidget *model_label = gtk_label_new("Model");
   gtk_widget_set_halign(model_label, GTK_ALIGN_END);
-  GtkWidget *model_entry = gtk_entry_new();
-  gtk_entry_set_text(GTK_ENTRY(model_entry), self->model ? self->model : "");
+  GtkWidget *model_combo = gtk_combo_box_text_new_with_entry();
+  GtkWidget *model_entry = gtk_bin_get_child(GTK_BIN(model_combo));
+  gtk_entry_set_text(GTK_ENTRY(model_entry), self->settings.model ? self->settings.model : "");
+  GtkEntryCompletion *model_completion = gtk_entry_completion_new();
+  gtk_entry_completion_set_model(model_completion, gtk_combo_box_get_model(GTK_COMBO_BOX(model_combo)));
+  gtk_entry_completion_set_text_column(model_completion, 0);
+  gtk_entry_set_completion(GTK_ENTRY(model_entry), model_completion);
+  g_object_unref(model_completion);
   gtk_grid_attach(GTK_GRID(grid), model_label, 0, 1, 1, 1);
-  gtk_grid_attach(GTK_GRID(grid), model_entry, 1, 1, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), model_combo, 1, 1, 1, 1);
 
   GtkWidget *temp_label = gtk_label_new("Temperature");
   gtk_widget_set_halign(temp_label, GTK_ALIGN_END);
-  GtkAdjustment *temp_adj = gtk_adjustment_new(self->temperature, 0.0, 2.0, 0.1, 0.1, 0.0);
+  GtkAdjustment *temp_adj = gtk_adjustment_new(self->settings.temperature, 0.0, 2.0, 0.1, 0.1, 0.0);
   GtkWidget *temp_spin = gtk_spin_button_new(temp_adj, 0.1, 1);
   gtk_grid_attach(GTK_GRID(grid), temp_label, 0, 2, 1, 1);
   gtk_grid_attach(GTK_GRID(grid), temp_spin, 1, 2, 1, 1);
@@ -822,20 +2707,20 @@ openai_ask_plugin_show_configure(XfcePanelPlugin *plugin, gpointer user_data)
   GtkWidget *system_label = gtk_label_new("System prompt");
   gtk_widget_set_halign(system_label, GTK_ALIGN_END);
   GtkWidget *system_entry = gtk_entry_new();
-  gtk_entry_set_text(GTK_ENTRY(system_entry), self->system_prompt ? self->system_prompt : "");
+  gtk_entry_set_text(GTK_ENTRY(system_entry), self->settings.system_prompt ? self->settings.system_prompt : "");
   gtk_grid_attach(GTK_GRID(grid), system_label, 0, 3, 1, 1);
   gtk_grid_attach(GTK_GRID(grid), system_entry, 1, 3, 1, 1);
 
   GtkWidget *width_label = gtk_label_new("Width (chars)");
   gtk_widget_set_halign(width_label, GTK_ALIGN_END);
-  GtkAdjustment *width_adj = gtk_adjustment_new(self->width_chars, 6.0, 80.0, 1.0, 1.0, 0.0);
+  GtkAdjustment *width_adj = gtk_adjustment_new(self->settings.width_chars, 6.0, 80.0, 1.0, 1.0, 0.0);
   GtkWidget *width_spin = gtk_spin_button_new(width_adj, 1.0, 0);
   gtk_grid_attach(GTK_GRID(grid), width_label, 0, 4, 1, 1);
   gtk_grid_attach(GTK_GRID(grid), width_spin, 1, 4, 1, 1);
 
   GtkWidget *reply_width_label = gtk_label_new("Reply width (px)");
   gtk_widget_set_halign(reply_width_label, GTK_ALIGN_END);
-  GtkAdjustment *reply_width_adj = gtk_adjustment_new(self->reply_width_px, 0.0, 4000.0, 10.0, 50.0, 0.0);
+  GtkAdjustment *reply_width_adj = gtk_adjustment_new(self->settings.reply_width_px, 0.0, 4000.0, 10.0, 50.0, 0.0);
   GtkWidget *reply_width_spin = gtk_spin_button_new(reply_width_adj, 10.0, 0);
   gtk_widget_set_tooltip_text(reply_width_spin, "0 = match question box width");
   gtk_grid_attach(GTK_GRID(grid), reply_width_label, 0, 5, 1, 1);
@@ -843,7 +2728,7 @@ openai_ask_plugin_show_configure(XfcePanelPlugin *plugin, gpointer user_data)
 
   GtkWidget *opacity_label = gtk_label_new("Reply opacity (%)");
   gtk_widget_set_halign(opacity_label, GTK_ALIGN_END);
-  GtkAdjustment *opacity_adj = gtk_adjustment_new(self->reply_opacity_pct, 0.0, 100.0, 1.0, 5.0, 0.0);
+  GtkAdjustment *opacity_adj = gtk_adjustment_new(self->settings.reply_opacity_pct, 0.0, 100.0, 1.0, 5.0, 0.0);
   GtkWidget *opacity_scale = gtk_scale_new(GTK_ORIENTATION_HORIZONTAL, opacity_adj);
   gtk_scale_set_draw_value(GTK_SCALE(opacity_scale), TRUE);
   gtk_scale_set_value_pos(GTK_SCALE(opacity_scale), GTK_POS_RIGHT);
@@ -867,69 +2752,180 @@ openai_ask_plugin_show_configure(XfcePanelPlugin *plugin, gpointer user_data)
   gtk_grid_attach(GTK_GRID(grid), key_entry, 1, 7, 1, 1);
   gtk_grid_attach(GTK_GRID(grid), key_buttons, 1, 8, 1, 1);
 
+  GtkWidget *engine_check = gtk_check_button_new_with_label("Use shared engine (xfce-ask-engine)");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(engine_check), self->settings.use_engine);
+  gtk_widget_set_tooltip_text(engine_check,
+                              "Send requests from a separate process shared by all panel instances");
+  gtk_grid_attach(GTK_GRID(grid), engine_check, 1, 9, 1, 1);
+
+  GtkWidget *compact_label = gtk_label_new("Summary model");
+  gtk_widget_set_halign(compact_label, GTK_ALIGN_END);
+  GtkWidget *compact_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(compact_entry), self->settings.compact_model ? self->settings.compact_model : "");
+  gtk_entry_set_placeholder_text(GTK_ENTRY(compact_entry), "Off");
+  gtk_widget_set_tooltip_text(compact_entry,
+                              "Cheap model that summarizes older follow-up turns instead of dropping them");
+  gtk_grid_attach(GTK_GRID(grid), compact_label, 0, 10, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), compact_entry, 1, 10, 1, 1);
+
+  GtkWidget *route_label = gtk_label_new("Route models");
+  gtk_widget_set_halign(route_label, GTK_ALIGN_END);
+  GtkWidget *route_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(route_entry), self->settings.route_models ? self->settings.route_models : "");
+  gtk_entry_set_placeholder_text(GTK_ENTRY(route_entry), "Off");
+  gtk_widget_set_tooltip_text(route_entry,
+                              "Models on this endpoint, smallest first, separated by ';'. Each question goes to "
+                              "the fastest one likely to suffice instead of Model; Ctrl+B asks the next bigger one");
+  gtk_grid_attach(GTK_GRID(grid), route_label, 0, 11, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), route_entry, 1, 11, 1, 1);
+
+  GtkWidget *draft_label = gtk_label_new("Draft model");
+  gtk_widget_set_halign(draft_label, GTK_ALIGN_END);
+  GtkWidget *draft_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(draft_entry), self->settings.draft_model ? self->settings.draft_model : "");
+  gtk_entry_set_placeholder_text(GTK_ENTRY(draft_entry), "Off");
+  gtk_widget_set_tooltip_text(draft_entry,
+                              "Fast model asked at the same time; its answer is shown until the real one replaces "
+                              "it. Costs a second request per question");
+  gtk_grid_attach(GTK_GRID(grid), draft_label, 0, 12, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), draft_entry, 1, 12, 1, 1);
+
+  GtkWidget *max_requests_label = gtk_label_new("Parallel requests");
+  gtk_widget_set_halign(max_requests_label, GTK_ALIGN_END);
+  GtkAdjustment *max_requests_adj = gtk_adjustment_new(self->settings.max_requests, 1.0, 16.0, 1.0, 1.0, 0.0);
+  GtkWidget *max_requests_spin = gtk_spin_button_new(max_requests_adj, 1.0, 0);
+  gtk_widget_set_tooltip_text(max_requests_spin,
+                              "Requests to this endpoint at once; more wait in a queue, questions before summaries");
+  gtk_grid_attach(GTK_GRID(grid), max_requests_label, 0, 13, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), max_requests_spin, 1, 13, 1, 1);
+
+  GtkWidget *retrieval_label = gtk_label_new("Documents");
+  gtk_widget_set_halign(retrieval_label, GTK_ALIGN_END);
+  GtkWidget *retrieval_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(retrieval_entry), self->settings.retrieval_dirs ? self->settings.retrieval_dirs : "");
+  gtk_entry_set_placeholder_text(GTK_ENTRY(retrieval_entry), "Off");
+  gtk_widget_set_tooltip_text(retrieval_entry,
+                              "Directories of notes or runbooks, separated by ';'. Passages relevant to a "
+                              "question are sent along with it");
+  gtk_grid_attach(GTK_GRID(grid), retrieval_label, 0, 14, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), retrieval_entry, 1, 14, 1, 1);
+
+  GtkWidget *embeddings_label = gtk_label_new("Embeddings");
+  gtk_widget_set_halign(embeddings_label, GTK_ALIGN_END);
+  GtkWidget *embeddings_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+  GtkWidget *embeddings_model_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(embeddings_model_entry),
+                     self->settings.embeddings_model ? self->settings.embeddings_model : "");
+  gtk_widget_set_tooltip_text(embeddings_model_entry, "Embeddings model; changing it indexes the documents again");
+  GtkWidget *embeddings_endpoint_entry = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY(embeddings_endpoint_entry),
+                     self->settings.embeddings_endpoint ? self->settings.embeddings_endpoint : "");
+  gtk_entry_set_placeholder_text(GTK_ENTRY(embeddings_endpoint_entry), "Next to the endpoint");
+  gtk_widget_set_tooltip_text(embeddings_endpoint_entry,
+                              "Embeddings URL, e.g. a local server's /v1/embeddings; empty uses the chat "
+                              "endpoint's server and key");
+  gtk_widget_set_hexpand(embeddings_endpoint_entry, TRUE);
+  gtk_box_pack_start(GTK_BOX(embeddings_box), embeddings_model_entry, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(embeddings_box), embeddings_endpoint_entry, TRUE, TRUE, 0);
+  gtk_grid_attach(GTK_GRID(grid), embeddings_label, 0, 15, 1, 1);
+  gtk_grid_attach(GTK_GRID(grid), embeddings_box, 1, 15, 1, 1);
+
+  GtkWidget *fit_check = gtk_check_button_new_with_label("Fit answers to the popup");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(fit_check), self->settings.fit_answers);
+  gtk_widget_set_tooltip_text(fit_check,
+                              "Ask for answers about as long as the popup shows and limit their tokens to match; "
+                              "Ctrl+M fetches the rest of one that was cut");
+  gtk_grid_attach(GTK_GRID(grid), fit_check, 1, 16, 1, 1);
+
+  /* Since the panel started; requests sent by the shared engine are in
+   * its own file next to this process's. */
+  g_autofree gchar *summary = metrics_format_summary();
+  g_autofree gchar *stats_text = g_strdup_printf("%s\nExported to %s", summary, metrics_get_export_dir());
+  GtkWidget *stats_expander = gtk_expander_new("Statistics");
+  GtkWidget *stats_label = gtk_label_new(stats_text);
+  gtk_label_set_selectable(GTK_LABEL(stats_label), TRUE);
+  gtk_label_set_xalign(GTK_LABEL(stats_label), 0.0);
+  gtk_widget_set_margin_top(stats_label, 6);
+  gtk_container_add(GTK_CONTAINER(stats_expander), stats_label);
+  gtk_grid_attach(GTK_GRID(grid), stats_expander, 0, 17, 2, 1);
+
   OpenaiAskKeyDialogCtx key_ctx = {endpoint_entry, key_entry};
   g_signal_connect(btn_save_key, "clicked", G_CALLBACK(openai_ask_plugin_on_save_key_clicked), &key_ctx);
   g_signal_connect(btn_clear_key, "clicked", G_CALLBACK(openai_ask_plugin_on_clear_key_clicked), &key_ctx);
 
+  OpenaiAskModelsDialogCtx models_ctx = {endpoint_entry, model_combo, NULL, NULL, 0};
+  openai_ask_plugin_load_models(&models_ctx);
+  g_signal_connect(endpoint_entry, "focus-out-event", G_CALLBACK(openai_ask_plugin_on_endpoint_focus_out), &models_ctx);
+
   gtk_widget_show_all(dialog);
   gint resp = gtk_dialog_run(GTK_DIALOG(dialog));
+  g_signal_handlers_disconnect_by_data(endpoint_entry, &models_ctx);
+  g_clear_handle_id(&models_ctx.refresh_id, g_source_remove);
+  if (models_ctx.cancellable)
+    g_cancellable_cancel(models_ctx.cancellable);
+  g_clear_object(&models_ctx.cancellable);
+  g_free(models_ctx.endpoint);
   if (resp == GTK_RESPONSE_OK)
   {
-    g_free(self->endpoint);
-    g_free(self->model);
-    g_free(self->system_prompt);
-    self->endpoint = g_strdup(gtk_entry_get_text(GTK_ENTRY(endpoint_entry)));
-    self->model = g_strdup(gtk_entry_get_text(GTK_ENTRY(model_entry)));
-    self->system_prompt = g_strdup(gtk_entry_get_text(GTK_ENTRY(system_entry)));
-    self->temperature = gtk_spin_button_get_value(GTK_SPIN_BUTTON(temp_spin));
-    self->width_chars = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(width_spin));
-    self->reply_width_px = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(reply_width_spin));
-    self->reply_opacity_pct = (gint)gtk_range_get_value(GTK_RANGE(opacity_scale));
-    if (self->width_chars < 6)
-      self->width_chars = 6;
-    if (self->reply_width_px < 0)
-      self->reply_width_px = 0;
-    self->reply_opacity_pct = CLAMP(self->reply_opacity_pct, 0, 100);
+    g_free(self->settings.endpoint);
+    g_free(self->settings.model);
+    g_free(self->settings.backend);
+    g_free(self->settings.system_prompt);
+    g_free(self->settings.compact_model);
+    g_free(self->settings.route_models);
+    g_free(self->settings.draft_model);
+    g_free(self->settings.retrieval_dirs);
+    g_free(self->settings.embeddings_model);
+    g_free(self->settings.embeddings_endpoint);
+    self->settings.endpoint = g_strdup(gtk_entry_get_text(GTK_ENTRY(endpoint_entry)));
+    self->settings.model = g_strdup(gtk_entry_get_text(GTK_ENTRY(model_entry)));
+    self->settings.backend = g_strdup(gtk_combo_box_get_active_id(GTK_COMBO_BOX(backend_combo)));
+    self->settings.system_prompt = g_strdup(gtk_entry_get_text(GTK_ENTRY(system_entry)));
+    self->settings.compact_model = g_strdup(gtk_entry_get_text(GTK_ENTRY(compact_entry)));
+    self->settings.route_models = g_strdup(gtk_entry_get_text(GTK_ENTRY(route_entry)));
+    self->settings.draft_model = g_strdup(gtk_entry_get_text(GTK_ENTRY(draft_entry)));
+    self->settings.retrieval_dirs = g_strdup(gtk_entry_get_text(GTK_ENTRY(retrieval_entry)));
+    self->settings.embeddings_model = g_strdup(gtk_entry_get_text(GTK_ENTRY(embeddings_model_entry)));
+    self->settings.embeddings_endpoint = g_strdup(gtk_entry_get_text(GTK_ENTRY(embeddings_endpoint_entry)));
+    self->settings.temperature = gtk_spin_button_get_value(GTK_SPIN_BUTTON(temp_spin));
+    self->settings.width_chars = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(width_spin));
+    self->settings.reply_width_px = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(reply_width_spin));
+    self->settings.reply_opacity_pct = (gint)gtk_range_get_value(GTK_RANGE(opacity_scale));
+    self->settings.use_engine = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(engine_check));
+    self->settings.fit_answers = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(fit_check));
+    self->settings.max_requests = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(max_requests_spin));
+    if (self->settings.width_chars < 6)
+      self->settings.width_chars = 6;
+    if (self->settings.reply_width_px < 0)
+      self->settings.reply_width_px = 0;
+    self->settings.reply_opacity_pct = CLAMP(self->settings.reply_opacity_pct, 0, 100);
     if (self->entry)
-      gtk_entry_set_width_chars(GTK_ENTRY(self->entry), self->width_chars);
+      gtk_entry_set_width_chars(GTK_ENTRY(self->entry), self->settings.width_chars);
     openai_ask_plugin_update_frame_opacity(self);
+    request_scheduler_set_limit(request_scheduler_get_default(), self->settings.endpoint, self->settings.max_requests);
+    openai_client_set_backend(self->settings.endpoint, openai_client_backend_from_name(self->settings.backend));
+    openai_ask_plugin_configure_router(self);
+    if (self->popup)
+      openai_ask_plugin_configure_retrieval(self);
     openai_ask_plugin_save_settings(self);
   }
   gtk_widget_destroy(dialog);
 }
 
+/* The popup, its CSS, the conversations and the history index are only
+ * needed once the user gets near the entry: they are built on its first
+ * focus, or LAZY_INIT_DELAY_S after the panel started, whichever comes
+ * first. */
 static void
-openai_ask_plugin_construct(XfcePanelPlugin *plugin)
+openai_ask_plugin_ensure_popup(OpenaiAskPlugin *self)
 {
-  OpenaiAskPlugin *self = (OpenaiAskPlugin *)plugin;
-  openai_ask_log_init();
-  openai_ask_log("plugin construct");
-  openai_ask_plugin_apply_css(self);
-  openai_ask_plugin_load_settings(self);
-
-  /* Make sure the panel allocates visible space for the entry. */
-  xfce_panel_plugin_set_expand(plugin, TRUE);
-  xfce_panel_plugin_set_shrink(plugin, TRUE);
-  xfce_panel_plugin_set_small(plugin, FALSE);
-
-  xfce_panel_plugin_menu_show_configure(plugin);
-  g_signal_connect(plugin, "configure-plugin", G_CALLBACK(openai_ask_plugin_show_configure), NULL);
-
-  self->container = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-  gtk_container_add(GTK_CONTAINER(plugin), self->container);
-
-  self->entry = gtk_entry_new();
-  gtk_widget_set_can_focus(self->entry, TRUE);
-  gtk_entry_set_placeholder_text(GTK_ENTRY(self->entry), "Ask…");
-  gtk_entry_set_width_chars(GTK_ENTRY(self->entry), self->width_chars);
-  gtk_box_pack_start(GTK_BOX(self->container), self->entry, TRUE, TRUE, 0);
-  g_signal_connect(self->entry, "activate", G_CALLBACK(openai_ask_plugin_on_entry_activate), self);
-  gtk_widget_add_events(self->entry, GDK_KEY_PRESS_MASK);
-  g_signal_connect(self->entry, "key-press-event", G_CALLBACK(openai_ask_plugin_on_entry_key_press), self);
-  gtk_widget_add_events(self->entry, GDK_BUTTON_PRESS_MASK);
-  g_signal_connect(self->entry, "button-press-event", G_CALLBACK(openai_ask_plugin_on_entry_button_press), self);
-  xfce_panel_plugin_focus_widget(plugin, self->entry);
+  if (self->popup)
+    return;
+  g_clear_handle_id(&self->lazy_init_id, g_source_remove);
+  gint64 t0 = g_get_monotonic_time();
+  glong rss0_kb = openai_ask_plugin_rss_kb();
 
+  openai_ask_plugin_apply_css(self);
   self->popup = gtk_window_new(GTK_WINDOW_POPUP);
   gtk_widget_set_name(self->popup, "openai-ask-popup");
   openai_ask_plugin_enable_transparency(self->popup);
@@ -939,15 +2935,12 @@ openai_ask_plugin_construct(XfcePanelPlugin *plugin)
   gtk_window_set_skip_pager_hint(GTK_WINDOW(self->popup), TRUE);
   gtk_window_set_type_hint(GTK_WINDOW(self->popup), GDK_WINDOW_TYPE_HINT_DROPDOWN_MENU);
   gtk_window_set_accept_focus(GTK_WINDOW(self->popup), TRUE);
-  gtk_window_set_transient_for(GTK_WINDOW(self->popup), GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(plugin))));
+  gtk_window_set_transient_for(GTK_WINDOW(self->popup), GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(self))));
   gtk_window_set_default_size(GTK_WINDOW(self->popup), 520, 320);
   g_signal_connect(self->popup, "focus-out-event", G_CALLBACK(openai_ask_plugin_on_popup_focus_out), self);
   g_signal_connect(self->popup, "key-press-event", G_CALLBACK(openai_ask_plugin_on_popup_key_press), self);
   g_signal_connect(self->popup, "hide", G_CALLBACK(openai_ask_plugin_on_popover_hide), self);
-  g_signal_connect(plugin,
-                   "screen-position-changed",
-                   G_CALLBACK(openai_ask_plugin_on_screen_position_changed),
-                   self);
+  g_signal_connect(self->popup, "draw", G_CALLBACK(openai_ask_plugin_on_popup_draw), self);
 
   GtkWidget *outer = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   gtk_container_add(GTK_CONTAINER(self->popup), outer);
@@ -990,6 +2983,14 @@ openai_ask_plugin_construct(XfcePanelPlugin *plugin)
   gtk_box_pack_start(GTK_BOX(self->header), btn_close, FALSE, FALSE, 0);
   gtk_box_pack_start(GTK_BOX(popover_box), self->header, FALSE, FALSE, 0);
 
+  /* One button per conversation; hidden while there is only one. */
+  self->tab_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 2);
+  gtk_widget_set_name(self->tab_bar, "openai-ask-tabs");
+  gtk_widget_set_margin_start(self->tab_bar, 8);
+  gtk_widget_set_margin_end(self->tab_bar, 8);
+  gtk_widget_set_no_show_all(self->tab_bar, TRUE);
+  gtk_box_pack_start(GTK_BOX(popover_box), self->tab_bar, FALSE, FALSE, 0);
+
   self->popover_stack = gtk_stack_new();
   gtk_stack_set_transition_type(GTK_STACK(self->popover_stack), GTK_STACK_TRANSITION_TYPE_CROSSFADE);
   gtk_widget_set_hexpand(self->popover_stack, TRUE);
@@ -998,9 +2999,9 @@ openai_ask_plugin_construct(XfcePanelPlugin *plugin)
 
   GtkWidget *loading = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
   self->popover_spinner = gtk_spinner_new();
-  GtkWidget *loading_label = gtk_label_new("Thinking…");
+  self->loading_label = gtk_label_new("Thinking…");
   gtk_box_pack_start(GTK_BOX(loading), self->popover_spinner, FALSE, FALSE, 0);
-  gtk_box_pack_start(GTK_BOX(loading), loading_label, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(loading), self->loading_label, FALSE, FALSE, 0);
   gtk_stack_add_named(GTK_STACK(self->popover_stack), loading, "loading");
 
   self->scrolled = gtk_scrolled_window_new(NULL, NULL);
@@ -1021,13 +3022,134 @@ openai_ask_plugin_construct(XfcePanelPlugin *plugin)
   gtk_container_add(GTK_CONTAINER(self->scrolled), self->popover_label);
   gtk_stack_add_named(GTK_STACK(self->popover_stack), self->scrolled, "answer");
 
+  self->answer_scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->answer_scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_widget_set_hexpand(self->answer_scrolled, TRUE);
+  gtk_widget_set_vexpand(self->answer_scrolled, TRUE);
+  self->answer_view = answer_view_new();
+  gtk_container_add(GTK_CONTAINER(self->answer_scrolled), self->answer_view);
+  gtk_stack_add_named(GTK_STACK(self->popover_stack), self->answer_scrolled, "large");
+
+  self->history_scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->history_scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(self->history_scrolled), TRUE);
+  gtk_widget_set_hexpand(self->history_scrolled, TRUE);
+  gtk_widget_set_vexpand(self->history_scrolled, TRUE);
+  self->history_list = gtk_list_box_new();
+  gtk_list_box_set_selection_mode(GTK_LIST_BOX(self->history_list), GTK_SELECTION_BROWSE);
+  gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(self->history_list), TRUE);
+  self->history_placeholder = gtk_label_new(NULL);
+  gtk_widget_set_margin_top(self->history_placeholder, 14);
+  gtk_widget_set_margin_bottom(self->history_placeholder, 14);
+  gtk_widget_show(self->history_placeholder);
+  gtk_list_box_set_placeholder(GTK_LIST_BOX(self->history_list), self->history_placeholder);
+  g_signal_connect(self->history_list, "row-activated", G_CALLBACK(openai_ask_plugin_on_history_row_activated), self);
+  gtk_container_add(GTK_CONTAINER(self->history_scrolled), self->history_list);
+  gtk_stack_add_named(GTK_STACK(self->popover_stack), self->history_scrolled, "history");
+
   gtk_stack_set_visible_child_name(GTK_STACK(self->popover_stack), "answer");
 
-  self->messages = g_ptr_array_new_with_free_func((GDestroyNotify)openai_chat_message_free);
-  openai_ask_plugin_set_request_state(self, FALSE);
+  self->chats = g_ptr_array_new_with_free_func((GDestroyNotify)openai_ask_chat_free);
+  self->chat = openai_ask_plugin_add_chat(self);
+  openai_ask_plugin_update_tabs(self);
+
+  g_autofree gchar *history_path = history_default_path();
+  self->history = history_new(history_path, openai_ask_plugin_history_loaded, self);
+
+  self->prewarm_source_id =
+    g_idle_add_full(G_PRIORITY_LOW, openai_ask_plugin_prewarm_idle, g_object_ref(self), g_object_unref);
+
+  openai_ask_plugin_configure_retrieval(self);
+  metrics_start_export("plugin");
+  openai_ask_log("popup built in %.1f ms, RSS +%ld KB",
+                 (g_get_monotonic_time() - t0) / 1000.0,
+                 openai_ask_plugin_rss_kb() - rss0_kb);
+}
+
+static gboolean
+openai_ask_plugin_on_lazy_init(gpointer user_data)
+{
+  OpenaiAskPlugin *self = user_data;
+  self->lazy_init_id = 0;
+  openai_ask_plugin_ensure_popup(self);
+  return G_SOURCE_REMOVE;
+}
+
+/* A question is probably coming: local servers load the model meanwhile. */
+static void
+openai_ask_plugin_preload(OpenaiAskPlugin *self)
+{
+  if (openai_client_backend_from_name(self->settings.backend) == OPENAI_CLIENT_BACKEND_OPENAI)
+    return;
+  g_autofree gchar *api_key = keyring_lookup_api_key(self->settings.endpoint);
+  openai_client_preload(self->settings.endpoint, api_key, self->settings.model);
+}
+
+static gboolean
+openai_ask_plugin_on_entry_focus_in(GtkWidget *widget, GdkEventFocus *event, gpointer user_data)
+{
+  (void)widget;
+  (void)event;
+  openai_ask_plugin_ensure_popup(user_data);
+  openai_ask_plugin_preload(user_data);
+  return GDK_EVENT_PROPAGATE;
+}
+
+static void
+openai_ask_plugin_construct(XfcePanelPlugin *plugin)
+{
+  OpenaiAskPlugin *self = (OpenaiAskPlugin *)plugin;
+  gint64 t0 = g_get_monotonic_time();
+  glong rss0_kb = openai_ask_plugin_rss_kb();
+  openai_ask_log_init();
+  openai_ask_log("plugin construct");
+  openai_ask_plugin_load_settings(self);
+
+  /* Make sure the panel allocates visible space for the entry. */
+  xfce_panel_plugin_set_expand(plugin, TRUE);
+  xfce_panel_plugin_set_shrink(plugin, TRUE);
+  xfce_panel_plugin_set_small(plugin, FALSE);
+
+  xfce_panel_plugin_menu_show_configure(plugin);
+  g_signal_connect(plugin, "configure-plugin", G_CALLBACK(openai_ask_plugin_show_configure), NULL);
+
+  self->container = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_container_add(GTK_CONTAINER(plugin), self->container);
+
+  self->entry = gtk_entry_new();
+  gtk_widget_set_can_focus(self->entry, TRUE);
+  gtk_entry_set_placeholder_text(GTK_ENTRY(self->entry), "Ask…");
+  gtk_entry_set_width_chars(GTK_ENTRY(self->entry), self->settings.width_chars);
+  gtk_box_pack_start(GTK_BOX(self->container), self->entry, TRUE, TRUE, 0);
+  g_signal_connect(self->entry, "activate", G_CALLBACK(openai_ask_plugin_on_entry_activate), self);
+  g_signal_connect(self->entry, "changed", G_CALLBACK(openai_ask_plugin_on_entry_changed), self);
+  gtk_widget_add_events(self->entry, GDK_KEY_PRESS_MASK);
+  g_signal_connect(self->entry, "key-press-event", G_CALLBACK(openai_ask_plugin_on_entry_key_press), self);
+  gtk_widget_add_events(self->entry, GDK_BUTTON_PRESS_MASK);
+  g_signal_connect(self->entry, "button-press-event", G_CALLBACK(openai_ask_plugin_on_entry_button_press), self);
+  g_signal_connect(self->entry, "icon-press", G_CALLBACK(openai_ask_plugin_on_entry_icon_press), self);
+  /* Files dropped on the entry are attached; dropped text is still inserted. */
+  gtk_drag_dest_add_uri_targets(self->entry);
+  g_signal_connect(
+    self->entry, "drag-data-received", G_CALLBACK(openai_ask_plugin_on_entry_drag_data_received), self);
+  g_signal_connect(self->entry, "focus-in-event", G_CALLBACK(openai_ask_plugin_on_entry_focus_in), self);
+  xfce_panel_plugin_focus_widget(plugin, self->entry);
+  self->attachments = attachment_list_new();
+  self->batches = g_ptr_array_new_with_free_func((GDestroyNotify)batch_free);
+
+  g_signal_connect(plugin,
+                   "screen-position-changed",
+                   G_CALLBACK(openai_ask_plugin_on_screen_position_changed),
+                   self);
+  openai_ask_plugin_watch_geometry(self);
 
   /* XFCE does not always show child widgets automatically. */
   gtk_widget_show_all(GTK_WIDGET(plugin));
+
+  self->lazy_init_id = g_timeout_add_seconds(LAZY_INIT_DELAY_S, openai_ask_plugin_on_lazy_init, self);
+  openai_ask_log("plugin constructed in %.1f ms, RSS +%ld KB",
+                 (g_get_monotonic_time() - t0) / 1000.0,
+                 openai_ask_plugin_rss_kb() - rss0_kb);
 }
 
 static void
@@ -1035,11 +3157,29 @@ openai_ask_plugin_dispose(GObject *object)
 {
   OpenaiAskPlugin *self = (OpenaiAskPlugin *)object;
 
-  openai_ask_plugin_cancel_inflight(self);
-  g_clear_object(&self->request_cancellable);
+  /* Cancels every request and batch; their results find no chat and are
+   * dropped. */
+  self->chat = NULL;
+  g_clear_pointer(&self->chats, g_ptr_array_unref);
+  g_clear_pointer(&self->batches, g_ptr_array_unref);
+  g_clear_handle_id(&self->prewarm_source_id, g_source_remove);
+  g_clear_handle_id(&self->lazy_init_id, g_source_remove);
+  g_clear_handle_id(&self->hold_tick_id, g_source_remove);
+  if (self->geometry_toplevel)
+  {
+    g_signal_handler_disconnect(self->geometry_toplevel, self->geometry_configure_id);
+    g_object_remove_weak_pointer(G_OBJECT(self->geometry_toplevel), (gpointer *)&self->geometry_toplevel);
+    self->geometry_toplevel = NULL;
+  }
   g_clear_object(&self->frame_css);
 
-  g_clear_pointer(&self->messages, g_ptr_array_unref);
+  g_clear_pointer(&self->attachments, g_ptr_array_unref);
+  g_clear_pointer(&self->history, history_free);
+  g_clear_pointer(&self->retrieval, retrieval_free);
+  g_clear_pointer(&self->router, model_router_free);
+  openai_ask_plugin_drop_pending_answer(self);
+  openai_ask_plugin_drop_relayout_tick(self);
+  g_clear_handle_id(&self->relayout_source_id, g_source_remove);
 
   G_OBJECT_CLASS(openai_ask_plugin_parent_class)->dispose(object);
 }
@@ -1048,9 +3188,7 @@ static void
 openai_ask_plugin_finalize(GObject *object)
 {
   OpenaiAskPlugin *self = (OpenaiAskPlugin *)object;
-  g_clear_pointer(&self->endpoint, g_free);
-  g_clear_pointer(&self->model, g_free);
-  g_clear_pointer(&self->system_prompt, g_free);
+  openai_ask_settings_clear(&self->settings);
   G_OBJECT_CLASS(openai_ask_plugin_parent_class)->finalize(object);
 }
 
@@ -1068,8 +3206,5 @@ openai_ask_plugin_class_init(OpenaiAskPluginClass *klass)
 static void
 openai_ask_plugin_init(OpenaiAskPlugin *self)
 {
-  self->temperature = 0.7;
-  self->width_chars = 18;
-  self->reply_width_px = 0;
-  self->reply_opacity_pct = 100;
+  openai_ask_settings_init(&self->settings);
 }
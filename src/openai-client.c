@@ -1,29 +1,26 @@
 #include "openai-client.h"
 
+#include <gio/gunixsocketaddress.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
 #include <string.h>
 
+#include "attachment.h"
+#include "body-stream.h"
 #include "log.h"
+#include "metrics.h"
+#include "rate-limiter.h"
 
-OpenaiChatMessage *
-openai_chat_message_new(const gchar *role, const gchar *content)
-{
-  OpenaiChatMessage *msg = g_new0(OpenaiChatMessage, 1);
-  msg->role = g_strdup(role ? role : "user");
-  msg->content = g_strdup(content ? content : "");
-  return msg;
-}
+/* Stands in for the attachments in the last user message while the body
+ * is generated; the generator escapes it to "\u0001attachments\u0001". */
+#define OPENAI_CLIENT_ATTACHMENT_MARK "\001attachments\001"
+#define OPENAI_CLIENT_ATTACHMENT_MARK_JSON "\\u0001attachments\\u0001"
 
-void
-openai_chat_message_free(OpenaiChatMessage *msg)
-{
-  if (!msg)
-    return;
-  g_free(msg->role);
-  g_free(msg->content);
-  g_free(msg);
-}
+/* The request scheduler is what limits requests per endpoint; the pool only
+ * has to be large enough for any limit it is given (Parallel requests,
+ * xfce-ask-cli --jobs). Endpoints that negotiate HTTP/2 multiplex them over
+ * one connection instead. */
+#define OPENAI_CLIENT_MAX_CONNS_PER_HOST 32
 
 static OpenaiClientResult *
 openai_client_result_new_error(gint http_status, const gchar *message)
@@ -55,28 +52,95 @@ openai_client_result_free(OpenaiClientResult *r)
   g_free(r);
 }
 
+/* What the client knows about the server behind an endpoint. Entries live
+ * as long as the process. Main context only. */
+typedef struct
+{
+  gchar *endpoint;
+  OpenaiClientBackend backend;
+  gint64 preloaded_us; /* when openai_client_preload() last ran */
+  gboolean preloading;
+  /* llama.cpp: the conversation pinned to each slot and when the slot was
+   * last used; n_slots is 0 until /props has been read. */
+  guint n_slots;
+  guint *slot_keys;
+  gint64 *slot_used_us;
+} OpenaiClientServer;
+
+/* One chat request, as the backends see it. */
+typedef struct
+{
+  OpenaiClientServer *server;
+  const gchar *api_key;
+  const gchar *model;
+  gdouble temperature;
+  gint max_tokens; /* 0 = the server's default */
+  const Conversation *conversation;
+} OpenaiClientChat;
+
+/* The server-specific parts of a chat request. A new backend is a row in
+ * openai_client_backends[]. */
+typedef struct
+{
+  const gchar *name;
+  const gchar *label;
+  /* Where chat requests go, as openai_client_get_sibling_url() names it;
+   * NULL sends them to the endpoint itself. */
+  const gchar *chat_path;
+  /* Adds the sampling and server members to the request object. */
+  void (*add_members)(JsonBuilder *b, const OpenaiClientChat *chat);
+  /* Starts getting the server ready; NULL if there is nothing to do. */
+  void (*preload)(OpenaiClientServer *server, const gchar *api_key, const gchar *model);
+} OpenaiClientBackendOps;
+
+static const OpenaiClientBackendOps openai_client_backends[OPENAI_CLIENT_BACKEND_COUNT];
+
+static OpenaiClientServer *
+openai_client_get_server(const gchar *endpoint)
+{
+  static GHashTable *servers = NULL;
+  if (!servers)
+    servers = g_hash_table_new(g_str_hash, g_str_equal);
+  OpenaiClientServer *server = g_hash_table_lookup(servers, endpoint);
+  if (!server)
+  {
+    server = g_new0(OpenaiClientServer, 1);
+    server->endpoint = g_strdup(endpoint);
+    g_hash_table_insert(servers, server->endpoint, server);
+  }
+  return server;
+}
+
 static gchar *
-openai_client_build_body(const gchar *model, gdouble temperature, GPtrArray *messages)
+openai_client_build_body(const OpenaiClientChat *chat, gboolean mark_attachments)
 {
   g_autoptr(JsonBuilder) b = json_builder_new();
 
   json_builder_begin_object(b);
   json_builder_set_member_name(b, "model");
-  json_builder_add_string_value(b, model ? model : "");
+  json_builder_add_string_value(b, chat->model ? chat->model : "");
 
-  json_builder_set_member_name(b, "temperature");
-  json_builder_add_double_value(b, temperature);
+  openai_client_backends[chat->server->backend].add_members(b, chat);
 
   json_builder_set_member_name(b, "messages");
   json_builder_begin_array(b);
-  for (guint i = 0; i < messages->len; i++)
+  const Conversation *conversation = chat->conversation;
+  guint n_turns = conversation_get_length(conversation);
+  const ConversationTurn *question = conversation_get_last(conversation, CONVERSATION_ROLE_USER);
+  for (guint i = 0; i < n_turns; i++)
   {
-    OpenaiChatMessage *m = g_ptr_array_index(messages, i);
+    const ConversationTurn *turn = conversation_get_turn(conversation, i);
     json_builder_begin_object(b);
     json_builder_set_member_name(b, "role");
-    json_builder_add_string_value(b, m->role ? m->role : "user");
+    json_builder_add_string_value(b, conversation_role_to_string(turn->role));
     json_builder_set_member_name(b, "content");
-    json_builder_add_string_value(b, m->content ? m->content : "");
+    if (mark_attachments && turn == question)
+    {
+      g_autofree gchar *content = g_strconcat(turn->content, OPENAI_CLIENT_ATTACHMENT_MARK, NULL);
+      json_builder_add_string_value(b, content);
+    }
+    else
+      json_builder_add_string_value(b, turn->content);
     json_builder_end_object(b);
   }
   json_builder_end_array(b);
@@ -102,29 +166,26 @@ json_read_string_member(JsonObject *obj, const gchar *name)
 }
 
 static OpenaiClientResult *
-openai_client_parse_response(gint http_status, const gchar *body)
+openai_client_parse_object(gint http_status, JsonObject *obj)
 {
-  if (!body)
-    return openai_client_result_new_error(http_status, "Empty response body.");
-
-  g_autoptr(JsonParser) parser = json_parser_new();
-  g_autoptr(GError) error = NULL;
-  if (!json_parser_load_from_data(parser, body, -1, &error))
-    return openai_client_result_new_error(http_status, error ? error->message : "Invalid JSON response.");
-
-  JsonNode *root = json_parser_get_root(parser);
-  if (!root || json_node_get_node_type(root) != JSON_NODE_OBJECT)
-    return openai_client_result_new_error(http_status, "Unexpected JSON response.");
-
-  JsonObject *obj = json_node_get_object(root);
-
-  if (json_object_has_member(obj, "error"))
+  /* {"error": {"message": ...}}, or Ollama's {"error": "..."} */
+  JsonNode *err = json_object_get_member(obj, "error");
+  if (err)
   {
-    JsonObject *err_obj = json_object_get_object_member(obj, "error");
-    g_autofree gchar *msg = json_read_string_member(err_obj, "message");
+    g_autofree gchar *msg = JSON_NODE_HOLDS_OBJECT(err) ? json_read_string_member(json_node_get_object(err), "message")
+                            : json_read_string_member(obj, "error");
     return openai_client_result_new_error(http_status, msg ? msg : "Provider returned an error.");
   }
 
+  /* Ollama's /api/chat: {"message": {"role": ..., "content": ...}} */
+  JsonNode *message = json_object_get_member(obj, "message");
+  if (message && JSON_NODE_HOLDS_OBJECT(message))
+  {
+    g_autofree gchar *content = json_read_string_member(json_node_get_object(message), "content");
+    if (content)
+      return openai_client_result_new_ok(content);
+  }
+
   if (!json_object_has_member(obj, "choices"))
     return openai_client_result_new_error(http_status, "No choices in response.");
 
@@ -154,10 +215,558 @@ openai_client_parse_response(gint http_status, const gchar *body)
   return openai_client_result_new_error(http_status, "Unable to find message content in response.");
 }
 
+/* What local servers say about where the time went: llama.cpp's "timings"
+ * (cache_n prompt tokens came from the slot's cache) and Ollama's load and
+ * prompt durations in nanoseconds. */
+static void
+openai_client_log_server_timings(JsonObject *obj)
+{
+  JsonNode *timings = json_object_get_member(obj, "timings");
+  if (timings && JSON_NODE_HOLDS_OBJECT(timings))
+  {
+    JsonObject *t = json_node_get_object(timings);
+    openai_ask_log("llama.cpp timings prompt_n=%" G_GINT64_FORMAT " cache_n=%" G_GINT64_FORMAT " prompt_ms=%.1f predicted_ms=%.1f",
+                   json_object_get_int_member_with_default(t, "prompt_n", -1),
+                   json_object_get_int_member_with_default(t, "cache_n", -1),
+                   json_object_get_double_member_with_default(t, "prompt_ms", -1.0),
+                   json_object_get_double_member_with_default(t, "predicted_ms", -1.0));
+  }
+  if (json_object_has_member(obj, "load_duration"))
+    openai_ask_log("ollama timings load_ms=%.1f prompt_eval_count=%" G_GINT64_FORMAT " prompt_ms=%.1f eval_ms=%.1f",
+                   json_object_get_int_member_with_default(obj, "load_duration", 0) / 1e6,
+                   json_object_get_int_member_with_default(obj, "prompt_eval_count", 0),
+                   json_object_get_int_member_with_default(obj, "prompt_eval_duration", 0) / 1e6,
+                   json_object_get_int_member_with_default(obj, "eval_duration", 0) / 1e6);
+}
+
+/* The answer stopped at max_tokens: choices[0].finish_reason, or Ollama's
+ * done_reason, is "length". */
+static gboolean
+openai_client_is_truncated(JsonObject *obj)
+{
+  JsonNode *choices = json_object_get_member(obj, "choices");
+  if (choices && JSON_NODE_HOLDS_ARRAY(choices) && json_array_get_length(json_node_get_array(choices)) > 0)
+  {
+    JsonObject *choice0 = json_array_get_object_element(json_node_get_array(choices), 0);
+    g_autofree gchar *reason = json_read_string_member(choice0, "finish_reason");
+    return g_strcmp0(reason, "length") == 0;
+  }
+  g_autofree gchar *reason = json_read_string_member(obj, "done_reason");
+  return g_strcmp0(reason, "length") == 0;
+}
+
+static OpenaiClientResult *
+openai_client_parse_response(gint http_status, const gchar *body)
+{
+  if (!body)
+    return openai_client_result_new_error(http_status, "Empty response body.");
+
+  g_autoptr(JsonParser) parser = json_parser_new();
+  g_autoptr(GError) error = NULL;
+  if (!json_parser_load_from_data(parser, body, -1, &error))
+    return openai_client_result_new_error(http_status, error ? error->message : "Invalid JSON response.");
+
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || json_node_get_node_type(root) != JSON_NODE_OBJECT)
+    return openai_client_result_new_error(http_status, "Unexpected JSON response.");
+
+  JsonObject *obj = json_node_get_object(root);
+  OpenaiClientResult *r = openai_client_parse_object(http_status, obj);
+  r->truncated = r->ok && openai_client_is_truncated(obj);
+  JsonNode *usage = json_object_get_member(obj, "usage");
+  if (usage && JSON_NODE_HOLDS_OBJECT(usage))
+  {
+    JsonObject *u = json_node_get_object(usage);
+    r->prompt_tokens = json_object_get_int_member_with_default(u, "prompt_tokens", 0);
+    r->completion_tokens = json_object_get_int_member_with_default(u, "completion_tokens", 0);
+  }
+  else if (json_object_has_member(obj, "prompt_eval_count") || json_object_has_member(obj, "eval_count"))
+  {
+    r->prompt_tokens = json_object_get_int_member_with_default(obj, "prompt_eval_count", 0);
+    r->completion_tokens = json_object_get_int_member_with_default(obj, "eval_count", 0);
+  }
+  openai_client_log_server_timings(obj);
+  return r;
+}
+
+/* One session for the whole process so keep-alive connections (and TLS
+ * sessions) are reused between requests instead of re-handshaking each
+ * time. Unix socket endpoints get a session per socket, since a session's
+ * remote-connectable applies to every request it sends. Only used from the
+ * main context. */
+static SoupSession *
+openai_client_new_session(const gchar *socket_path)
+{
+  if (!socket_path)
+    return soup_session_new_with_options("max-conns-per-host", OPENAI_CLIENT_MAX_CONNS_PER_HOST, NULL);
+  g_autoptr(GSocketAddress) address = g_unix_socket_address_new(socket_path);
+  return soup_session_new_with_options("remote-connectable",
+                                       address,
+                                       "max-conns-per-host",
+                                       OPENAI_CLIENT_MAX_CONNS_PER_HOST,
+                                       NULL);
+}
+
+static SoupSession *
+openai_client_get_session(const gchar *socket_path)
+{
+  static SoupSession *session = NULL;
+  static GHashTable *unix_sessions = NULL;
+
+  if (!socket_path)
+  {
+    if (!session)
+      session = openai_client_new_session(NULL);
+    return session;
+  }
+
+  if (!unix_sessions)
+    unix_sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+  SoupSession *unix_session = g_hash_table_lookup(unix_sessions, socket_path);
+  if (!unix_session)
+  {
+    unix_session = openai_client_new_session(socket_path);
+    g_hash_table_insert(unix_sessions, g_strdup(socket_path), unix_session);
+  }
+  return unix_session;
+}
+
+/* Blocking requests from worker threads cannot use the main context's
+ * sessions; each thread keeps its own, per socket ("" for TCP), for as long
+ * as it lives. */
+static SoupSession *
+openai_client_get_thread_session(const gchar *socket_path)
+{
+  static GPrivate sessions_key = G_PRIVATE_INIT((GDestroyNotify)g_hash_table_unref);
+  GHashTable *sessions = g_private_get(&sessions_key);
+  if (!sessions)
+  {
+    sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+    g_private_set(&sessions_key, sessions);
+  }
+  SoupSession *session = g_hash_table_lookup(sessions, socket_path ? socket_path : "");
+  if (!session)
+  {
+    session = openai_client_new_session(socket_path);
+    g_hash_table_insert(sessions, g_strdup(socket_path ? socket_path : ""), session);
+  }
+  return session;
+}
+
+/* "unix:/run/user/1000/llm.sock:/v1/chat/completions" names a socket and
+ * the HTTP path to request over it. Returns FALSE for ordinary URLs; for a
+ * unix endpoint without a path, @uri is NULL. */
+static gboolean
+openai_client_split_unix_endpoint(const gchar *endpoint, gchar **socket_path, gchar **uri)
+{
+  *socket_path = NULL;
+  *uri = NULL;
+  if (!g_str_has_prefix(endpoint, "unix:"))
+    return FALSE;
+
+  const gchar *path = endpoint + strlen("unix:");
+  const gchar *sep = g_strrstr(path, ":/");
+  if (!sep || sep == path)
+  {
+    *socket_path = g_strdup(path);
+    return TRUE;
+  }
+  *socket_path = g_strndup(path, (gsize)(sep - path));
+  /* The host is never resolved; it only fills in the Host header. */
+  *uri = g_strconcat("http://localhost", sep + 1, NULL);
+  return TRUE;
+}
+
+/* The URL of @name (e.g. "models") next to a chat endpoint's completions
+ * path, keeping a unix socket endpoint's socket. A @name starting with '/'
+ * is relative to the server's root instead, past any "/v1". Ollama's
+ * native ".../api/chat" counts as a completions path, with "/v1" for the
+ * OpenAI-compatible names. */
+static gchar *
+openai_client_get_sibling_url(const gchar *endpoint, const gchar *name)
+{
+  g_return_val_if_fail(endpoint != NULL, NULL);
+
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *unix_uri = NULL;
+  gboolean is_unix = openai_client_split_unix_endpoint(endpoint, &socket_path, &unix_uri);
+  const gchar *uri = is_unix ? unix_uri : endpoint;
+  if (!uri)
+    return NULL;
+
+  g_autoptr(GUri) parsed = g_uri_parse(uri, G_URI_FLAGS_NONE, NULL);
+  if (!parsed)
+    return NULL;
+  const gchar *path = g_uri_get_path(parsed);
+  gboolean native = g_str_has_suffix(path, "/api/chat");
+  const gchar *suffix = g_str_has_suffix(path, "/chat/completions") ? "/chat/completions"
+                        : g_str_has_suffix(path, "/completions")    ? "/completions"
+                        : native                                    ? "/api/chat"
+                                                                    : NULL;
+  if (!suffix)
+    return NULL;
+  g_autofree gchar *base = g_strndup(path, strlen(path) - strlen(suffix));
+  g_autofree gchar *sibling_path = NULL;
+  if (*name == '/')
+  {
+    if (!native && g_str_has_suffix(base, "/v1"))
+      base[strlen(base) - strlen("/v1")] = '\0';
+    sibling_path = g_strconcat(base, name, NULL);
+  }
+  else
+    sibling_path = g_strconcat(base, native ? "/v1/" : "/", name, NULL);
+  if (is_unix)
+    return g_strconcat("unix:", socket_path, ":", sibling_path, NULL);
+
+  g_autoptr(GUri) sibling = g_uri_build(G_URI_FLAGS_NONE,
+                                        g_uri_get_scheme(parsed),
+                                        g_uri_get_userinfo(parsed),
+                                        g_uri_get_host(parsed),
+                                        g_uri_get_port(parsed),
+                                        sibling_path,
+                                        NULL,
+                                        NULL);
+  return g_uri_to_string(sibling);
+}
+
+/* Identifies a conversation across follow-ups by its system prompt,
+ * summary and oldest turn. Once that turn falls out of the ring the prompt
+ * prefix changes anyway, so moving to another slot then costs nothing. */
+static guint
+openai_client_conversation_key(const Conversation *conversation)
+{
+  guint n_turns = conversation_get_length(conversation);
+  guint oldest = n_turns - conversation_get_turn_count(conversation);
+  guint key = 5381;
+  for (guint i = 0; i <= oldest && i < n_turns; i++)
+    key = key * 33 + g_str_hash(conversation_get_turn(conversation, i)->content);
+  return key ? key : 1;
+}
+
+/* The slot pinned to @key, or else the least recently used one, which @key
+ * then takes over. -1 while the slot count is not known. */
+static gint
+openai_client_pick_slot(OpenaiClientServer *server, guint key)
+{
+  if (server->n_slots == 0)
+    return -1;
+  guint pick = 0;
+  for (guint i = 0; i < server->n_slots; i++)
+  {
+    if (server->slot_keys[i] == key)
+    {
+      pick = i;
+      break;
+    }
+    if (server->slot_used_us[i] < server->slot_used_us[pick])
+      pick = i;
+  }
+  server->slot_keys[pick] = key;
+  server->slot_used_us[pick] = g_get_monotonic_time();
+  return (gint)pick;
+}
+
 typedef struct
 {
+  OpenaiClientServer *server;
   SoupSession *session;
   SoupMessage *msg;
+  gint64 sent_us;
+  void (*done)(OpenaiClientServer *server, GBytes *bytes);
+} OpenaiClientPreloadCtx;
+
+static void
+openai_client_on_preload_finish(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  (void)source;
+  OpenaiClientPreloadCtx *ctx = user_data;
+
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GBytes) bytes = soup_session_send_and_read_finish(ctx->session, res, &error);
+  gint status = soup_message_get_status(ctx->msg);
+  openai_ask_log("preload %s status=%d in %.1f ms%s%s",
+                 openai_client_backends[ctx->server->backend].name,
+                 status,
+                 (g_get_monotonic_time() - ctx->sent_us) / 1000.0,
+                 error ? " error=" : "",
+                 error ? error->message : "");
+  ctx->server->preloading = FALSE;
+  if (bytes && status >= 200 && status < 300 && ctx->done)
+    ctx->done(ctx->server, bytes);
+
+  g_clear_object(&ctx->msg);
+  g_clear_object(&ctx->session);
+  g_free(ctx);
+}
+
+/* Sends a request that only warms the server up. Nobody waits for it, so
+ * it is neither rate limited nor queued, and failures are only logged. */
+static void
+openai_client_send_preload(OpenaiClientServer *server,
+                           const gchar *method,
+                           const gchar *name,
+                           const gchar *api_key,
+                           const gchar *body,
+                           void (*done)(OpenaiClientServer *server, GBytes *bytes))
+{
+  g_autofree gchar *url = openai_client_get_sibling_url(server->endpoint, name);
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *unix_uri = NULL;
+  gboolean is_unix = url && openai_client_split_unix_endpoint(url, &socket_path, &unix_uri);
+  SoupMessage *msg = url && (!is_unix || unix_uri) ? soup_message_new(method, is_unix ? unix_uri : url) : NULL;
+  server->preloaded_us = g_get_monotonic_time();
+  if (!msg)
+  {
+    openai_ask_log("preload: no %s next to %s", name, server->endpoint);
+    return;
+  }
+
+  SoupMessageHeaders *hdrs = soup_message_get_request_headers(msg);
+  soup_message_headers_append(hdrs, "Accept", "application/json");
+  if (api_key && *api_key)
+  {
+    g_autofree gchar *auth = g_strdup_printf("Bearer %s", api_key);
+    soup_message_headers_append(hdrs, "Authorization", auth);
+  }
+  if (body)
+  {
+    g_autoptr(GBytes) body_bytes = g_bytes_new(body, strlen(body));
+    soup_message_set_request_body_from_bytes(msg, "application/json", body_bytes);
+  }
+
+  OpenaiClientPreloadCtx *ctx = g_new0(OpenaiClientPreloadCtx, 1);
+  ctx->server = server;
+  ctx->session = g_object_ref(openai_client_get_session(socket_path));
+  ctx->msg = msg;
+  ctx->sent_us = server->preloaded_us;
+  ctx->done = done;
+  server->preloading = TRUE;
+  openai_ask_log("preload %s %s %s", openai_client_backends[server->backend].name, method, url);
+  soup_session_send_and_read_async(ctx->session,
+                                   msg,
+                                   G_PRIORITY_LOW,
+                                   NULL,
+                                   openai_client_on_preload_finish,
+                                   ctx);
+}
+
+static void
+openai_client_openai_add_members(JsonBuilder *b, const OpenaiClientChat *chat)
+{
+  json_builder_set_member_name(b, "temperature");
+  json_builder_add_double_value(b, chat->temperature);
+  if (chat->max_tokens > 0)
+  {
+    json_builder_set_member_name(b, "max_tokens");
+    json_builder_add_int_value(b, chat->max_tokens);
+  }
+}
+
+/* Without keep_alive Ollama unloads the model after five idle minutes, and
+ * the next question waits for it to load again. */
+static void
+openai_client_ollama_add_members(JsonBuilder *b, const OpenaiClientChat *chat)
+{
+  json_builder_set_member_name(b, "stream");
+  json_builder_add_boolean_value(b, FALSE);
+  json_builder_set_member_name(b, "keep_alive");
+  json_builder_add_string_value(b, OPENAI_CLIENT_OLLAMA_KEEP_ALIVE);
+  json_builder_set_member_name(b, "options");
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "temperature");
+  json_builder_add_double_value(b, chat->temperature);
+  if (chat->max_tokens > 0)
+  {
+    json_builder_set_member_name(b, "num_predict");
+    json_builder_add_int_value(b, chat->max_tokens);
+  }
+  json_builder_end_object(b);
+}
+
+/* An empty chat loads the model and keeps it for keep_alive. */
+static void
+openai_client_ollama_preload(OpenaiClientServer *server, const gchar *api_key, const gchar *model)
+{
+  if (!model || !*model)
+    return;
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "model");
+  json_builder_add_string_value(b, model);
+  json_builder_set_member_name(b, "messages");
+  json_builder_begin_array(b);
+  json_builder_end_array(b);
+  json_builder_set_member_name(b, "keep_alive");
+  json_builder_add_string_value(b, OPENAI_CLIENT_OLLAMA_KEEP_ALIVE);
+  json_builder_end_object(b);
+
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  g_autofree gchar *body = json_generator_to_data(gen, NULL);
+  openai_client_send_preload(server, "POST", openai_client_backends[server->backend].chat_path, api_key, body, NULL);
+}
+
+/* {"total_slots": N, ...} from /props. */
+static void
+openai_client_llama_cpp_on_props(OpenaiClientServer *server, GBytes *bytes)
+{
+  gsize size = 0;
+  const gchar *data = g_bytes_get_data(bytes, &size);
+  g_autoptr(JsonParser) parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, data, (gssize)size, NULL))
+    return;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return;
+  gint64 n_slots = json_object_get_int_member_with_default(json_node_get_object(root), "total_slots", 0);
+  if (n_slots <= 0 || n_slots > G_MAXUINT16 || (guint)n_slots == server->n_slots)
+    return;
+
+  openai_ask_log("llama.cpp %s has %" G_GINT64_FORMAT " slots", server->endpoint, n_slots);
+  server->n_slots = (guint)n_slots;
+  server->slot_keys = g_renew(guint, server->slot_keys, server->n_slots);
+  server->slot_used_us = g_renew(gint64, server->slot_used_us, server->n_slots);
+  memset(server->slot_keys, 0, server->n_slots * sizeof(guint));
+  memset(server->slot_used_us, 0, server->n_slots * sizeof(gint64));
+}
+
+static void
+openai_client_llama_cpp_preload(OpenaiClientServer *server, const gchar *api_key, const gchar *model)
+{
+  (void)model;
+  openai_client_send_preload(server, "GET", "/props", api_key, NULL, openai_client_llama_cpp_on_props);
+}
+
+/* cache_prompt keeps the slot's KV cache for the next request, and id_slot
+ * sends that next request (the follow-up) to the same slot, so only the
+ * new turns are processed. */
+static void
+openai_client_llama_cpp_add_members(JsonBuilder *b, const OpenaiClientChat *chat)
+{
+  json_builder_set_member_name(b, "temperature");
+  json_builder_add_double_value(b, chat->temperature);
+  if (chat->max_tokens > 0)
+  {
+    json_builder_set_member_name(b, "max_tokens");
+    json_builder_add_int_value(b, chat->max_tokens);
+  }
+  json_builder_set_member_name(b, "cache_prompt");
+  json_builder_add_boolean_value(b, TRUE);
+  gint slot = openai_client_pick_slot(chat->server, openai_client_conversation_key(chat->conversation));
+  if (slot < 0)
+  {
+    /* Unpinned until /props has said how many slots there are. */
+    openai_client_preload(chat->server->endpoint, chat->api_key, chat->model);
+    return;
+  }
+  json_builder_set_member_name(b, "id_slot");
+  json_builder_add_int_value(b, slot);
+}
+
+static const OpenaiClientBackendOps openai_client_backends[OPENAI_CLIENT_BACKEND_COUNT] = {
+  [OPENAI_CLIENT_BACKEND_OPENAI] = {"openai", "OpenAI-compatible", NULL, openai_client_openai_add_members, NULL},
+  [OPENAI_CLIENT_BACKEND_OLLAMA] = {"ollama",
+                                    "Ollama",
+                                    "/api/chat",
+                                    openai_client_ollama_add_members,
+                                    openai_client_ollama_preload},
+  [OPENAI_CLIENT_BACKEND_LLAMA_CPP] = {"llama.cpp",
+                                       "llama.cpp server",
+                                       NULL,
+                                       openai_client_llama_cpp_add_members,
+                                       openai_client_llama_cpp_preload},
+};
+
+const gchar *
+openai_client_backend_get_name(OpenaiClientBackend backend)
+{
+  g_return_val_if_fail(backend < OPENAI_CLIENT_BACKEND_COUNT, NULL);
+  return openai_client_backends[backend].name;
+}
+
+const gchar *
+openai_client_backend_get_label(OpenaiClientBackend backend)
+{
+  g_return_val_if_fail(backend < OPENAI_CLIENT_BACKEND_COUNT, NULL);
+  return openai_client_backends[backend].label;
+}
+
+OpenaiClientBackend
+openai_client_backend_from_name(const gchar *name)
+{
+  for (guint i = 0; name && i < OPENAI_CLIENT_BACKEND_COUNT; i++)
+    if (g_strcmp0(name, openai_client_backends[i].name) == 0)
+      return (OpenaiClientBackend)i;
+  return OPENAI_CLIENT_BACKEND_OPENAI;
+}
+
+void
+openai_client_set_backend(const gchar *endpoint, OpenaiClientBackend backend)
+{
+  g_return_if_fail(endpoint != NULL);
+  g_return_if_fail(backend < OPENAI_CLIENT_BACKEND_COUNT);
+
+  OpenaiClientServer *server = openai_client_get_server(endpoint);
+  if (server->backend == backend)
+    return;
+  server->backend = backend;
+  server->preloaded_us = 0;
+  server->n_slots = 0;
+}
+
+void
+openai_client_preload(const gchar *endpoint, const gchar *api_key, const gchar *model)
+{
+  g_return_if_fail(endpoint != NULL);
+
+  OpenaiClientServer *server = openai_client_get_server(endpoint);
+  const OpenaiClientBackendOps *ops = &openai_client_backends[server->backend];
+  if (!ops->preload || server->preloading)
+    return;
+  if (server->preloaded_us && g_get_monotonic_time() - server->preloaded_us < OPENAI_CLIENT_PRELOAD_INTERVAL_US)
+    return;
+  ops->preload(server, api_key, model);
+}
+
+/* Rough token count of the request, for the token bucket. */
+static guint64
+openai_client_estimate_tokens(const Conversation *conversation, GPtrArray *attachments)
+{
+  gsize bytes = attachments ? attachment_list_get_bytes(attachments) : 0;
+  guint n_turns = conversation_get_length(conversation);
+  for (guint i = 0; i < n_turns; i++)
+    bytes += conversation_get_turn(conversation, i)->len;
+  return attachment_estimate_tokens(bytes);
+}
+
+gint64
+openai_client_get_hold_us(const gchar *endpoint,
+                          const gchar *api_key,
+                          const Conversation *conversation,
+                          GPtrArray *attachments)
+{
+  return rate_limiter_peek(rate_limiter_get_default(),
+                           endpoint,
+                           api_key,
+                           openai_client_estimate_tokens(conversation, attachments));
+}
+
+typedef struct
+{
+  SoupSession *session;
+  SoupMessage *msg;
+  GCancellable *cancellable;
+  OpenaiClientServer *server;
+  gchar *endpoint;
+  gchar *api_key;
+  guint64 tokens;
+  gint64 wait_us;
+  gsize bytes_out;
+  gint64 sent_us;
+  gint64 first_byte_us;
+  guint hold_id;
+  gulong cancelled_id;
   OpenaiClientCallback callback;
   gpointer user_data;
 } OpenaiClientCtx;
@@ -169,11 +778,80 @@ openai_client_finish(OpenaiClientCtx *ctx, OpenaiClientResult *result)
     ctx->callback(result, ctx->user_data);
   openai_client_result_free(result);
 
+  if (ctx->hold_id)
+    g_source_remove(ctx->hold_id);
+  if (ctx->cancelled_id)
+    g_cancellable_disconnect(ctx->cancellable, ctx->cancelled_id);
+  g_clear_object(&ctx->cancellable);
   g_clear_object(&ctx->msg);
   g_clear_object(&ctx->session);
+  g_free(ctx->endpoint);
+  g_free(ctx->api_key);
   g_free(ctx);
 }
 
+static gboolean
+openai_client_on_invalid_endpoint(gpointer user_data)
+{
+  metrics_record_request(METRICS_OUTCOME_TRANSPORT_ERROR, -1, 0, 0);
+  openai_client_finish(user_data, openai_client_result_new_error(0, "Invalid endpoint URL."));
+  return G_SOURCE_REMOVE;
+}
+
+/* Splits the generated body at the attachment mark and streams the
+ * attachments in its place. The mark is in the last user message and
+ * nothing user-supplied follows it, so the last occurrence is the one. */
+static gboolean
+openai_client_set_streamed_body(SoupMessage *msg, gchar *body, GPtrArray *attachments, gsize *bytes_out)
+{
+  gchar *mark = g_strrstr(body, OPENAI_CLIENT_ATTACHMENT_MARK_JSON);
+  if (!mark)
+    return FALSE;
+  *mark = '\0';
+  const gchar *suffix = mark + strlen(OPENAI_CLIENT_ATTACHMENT_MARK_JSON);
+  g_autoptr(GInputStream) stream = openai_body_stream_new(body, attachments, suffix);
+  goffset size = openai_body_stream_get_size(OPENAI_BODY_STREAM(stream));
+  openai_ask_log("streaming body bytes=%" G_GOFFSET_FORMAT " attachments=%u", size, attachments->len);
+  soup_message_set_request_body(msg, "application/json", stream, (gssize)size);
+  *bytes_out = (gsize)size;
+  return TRUE;
+}
+
+static gint64
+openai_client_header_int(SoupMessageHeaders *hdrs, const gchar *name)
+{
+  const gchar *value = soup_message_headers_get_one(hdrs, name);
+  gchar *end = NULL;
+  gint64 n = value ? g_ascii_strtoll(value, &end, 10) : -1;
+  return value && end != value && n >= 0 ? n : -1;
+}
+
+/* Ends the request's rate limiter reservation with what the x-ratelimit-*
+ * headers (and Retry-After of a 429) said. */
+static void
+openai_client_finish_rate_limit(OpenaiClientCtx *ctx, gint status)
+{
+  if (status == 0)
+    return rate_limiter_finish(rate_limiter_get_default(), ctx->endpoint, ctx->api_key, ctx->tokens, NULL);
+
+  SoupMessageHeaders *hdrs = soup_message_get_response_headers(ctx->msg);
+  RateLimitInfo info;
+  rate_limit_info_init(&info);
+  info.limit_requests = openai_client_header_int(hdrs, "x-ratelimit-limit-requests");
+  info.remaining_requests = openai_client_header_int(hdrs, "x-ratelimit-remaining-requests");
+  info.reset_requests_us = rate_limiter_parse_duration(soup_message_headers_get_one(hdrs, "x-ratelimit-reset-requests"));
+  info.limit_tokens = openai_client_header_int(hdrs, "x-ratelimit-limit-tokens");
+  info.remaining_tokens = openai_client_header_int(hdrs, "x-ratelimit-remaining-tokens");
+  info.reset_tokens_us = rate_limiter_parse_duration(soup_message_headers_get_one(hdrs, "x-ratelimit-reset-tokens"));
+  if (status == 429)
+  {
+    info.retry_after_us = rate_limiter_parse_duration(soup_message_headers_get_one(hdrs, "Retry-After"));
+    if (info.retry_after_us < 0)
+      info.retry_after_us = MAX(info.reset_requests_us, info.reset_tokens_us);
+  }
+  rate_limiter_finish(rate_limiter_get_default(), ctx->endpoint, ctx->api_key, ctx->tokens, &info);
+}
+
 static void
 openai_client_on_send_finish(GObject *source, GAsyncResult *res, gpointer user_data)
 {
@@ -184,20 +862,35 @@ openai_client_on_send_finish(GObject *source, GAsyncResult *res, gpointer user_d
   g_autoptr(GBytes) bytes = soup_session_send_and_read_finish(ctx->session, res, &error);
 
   gint status = soup_message_get_status(ctx->msg);
+  openai_client_finish_rate_limit(ctx, bytes ? status : 0);
   if (!bytes)
   {
     openai_ask_log("http error status=%d msg=%s", status, error ? error->message : "request failed");
+    gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    metrics_record_request(cancelled ? METRICS_OUTCOME_CANCELLED : METRICS_OUTCOME_TRANSPORT_ERROR,
+                           status,
+                           ctx->bytes_out,
+                           0);
     return openai_client_finish(ctx, openai_client_result_new_error(status, error ? error->message : "Request failed."));
   }
 
   gsize size = 0;
   const gchar *data = g_bytes_get_data(bytes, &size);
   g_autofree gchar *body = g_strndup(data ? data : "", size);
+  gint64 now = g_get_monotonic_time();
+  metrics_record_latency(METRICS_HISTOGRAM_FIRST_BYTE, (ctx->first_byte_us ? ctx->first_byte_us : now) - ctx->sent_us);
+  metrics_record_latency(METRICS_HISTOGRAM_TOTAL, now - ctx->sent_us);
 
   if (status < 200 || status >= 300)
   {
     g_autofree gchar *snippet = g_strndup(body, 800);
     openai_ask_log("http non-2xx status=%d body=%s", status, snippet ? snippet : "");
+    /* The server may have restarted with fewer slots; ask again. */
+    if (ctx->server->backend == OPENAI_CLIENT_BACKEND_LLAMA_CPP && status != 429)
+    {
+      ctx->server->n_slots = 0;
+      ctx->server->preloaded_us = 0;
+    }
     OpenaiClientResult *r = openai_client_parse_response(status, body);
     if (r->ok)
     {
@@ -213,11 +906,112 @@ openai_client_on_send_finish(GObject *source, GAsyncResult *res, gpointer user_d
       g_free(r->error_message);
       r->error_message = g_strdup_printf("HTTP %d from provider.", status);
     }
+    metrics_record_request(METRICS_OUTCOME_HTTP_ERROR, status, ctx->bytes_out, size);
     return openai_client_finish(ctx, r);
   }
 
   openai_ask_log("http ok status=%d bytes=%zu", status, (size_t)size);
-  return openai_client_finish(ctx, openai_client_parse_response(status, body));
+  OpenaiClientResult *r = openai_client_parse_response(status, body);
+  metrics_record_request(r->ok ? METRICS_OUTCOME_OK : METRICS_OUTCOME_BAD_RESPONSE, status, ctx->bytes_out, size);
+  metrics_record_usage(r->prompt_tokens, r->completion_tokens);
+  return openai_client_finish(ctx, r);
+}
+
+static void openai_client_dispatch(OpenaiClientCtx *ctx);
+
+static void
+openai_client_on_got_headers(SoupMessage *msg, gpointer user_data)
+{
+  (void)msg;
+  OpenaiClientCtx *ctx = user_data;
+  if (!ctx->first_byte_us)
+    ctx->first_byte_us = g_get_monotonic_time();
+}
+
+static gboolean
+openai_client_on_hold_cancelled(gpointer user_data)
+{
+  metrics_record_request(METRICS_OUTCOME_CANCELLED, -1, 0, 0);
+  openai_client_finish(user_data, openai_client_result_new_error(0, "Request cancelled."));
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs from g_cancellable_cancel(); finishing is deferred so the caller
+ * never gets its callback while still inside the cancel. */
+static void
+openai_client_on_cancelled(GCancellable *cancellable, gpointer user_data)
+{
+  (void)cancellable;
+  OpenaiClientCtx *ctx = user_data;
+  if (ctx->hold_id)
+  {
+    g_source_remove(ctx->hold_id);
+    ctx->hold_id = 0;
+  }
+  g_idle_add(openai_client_on_hold_cancelled, ctx);
+}
+
+static gboolean
+openai_client_on_rate_limited(gpointer user_data)
+{
+  OpenaiClientCtx *ctx = user_data;
+  ctx->hold_id = 0;
+  metrics_record_request(METRICS_OUTCOME_RATE_LIMITED, -1, 0, 0);
+  g_autofree gchar *message = g_strdup_printf("Rate limit reached for this endpoint; it resets in %" G_GINT64_FORMAT " s.",
+                                              (ctx->wait_us + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC);
+  openai_client_finish(ctx, openai_client_result_new_error(429, message));
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+openai_client_on_hold_done(gpointer user_data)
+{
+  OpenaiClientCtx *ctx = user_data;
+  ctx->hold_id = 0;
+  openai_client_dispatch(ctx);
+  return G_SOURCE_REMOVE;
+}
+
+/* Sends the request once the rate limiter has room for it. Short waits are
+ * held here; a wait beyond RATE_LIMITER_MAX_HOLD_US fails at once, since
+ * the provider would only answer 429. */
+static void
+openai_client_dispatch(OpenaiClientCtx *ctx)
+{
+  gint64 wait = rate_limiter_reserve(rate_limiter_get_default(), ctx->endpoint, ctx->api_key, ctx->tokens);
+  ctx->wait_us = wait;
+  if (wait > RATE_LIMITER_MAX_HOLD_US)
+  {
+    openai_ask_log("ratelimit: refusing, reset in %" G_GINT64_FORMAT " ms", wait / 1000);
+    ctx->hold_id = g_idle_add(openai_client_on_rate_limited, ctx);
+    return;
+  }
+  if (wait > 0)
+  {
+    openai_ask_log("ratelimit: holding %" G_GINT64_FORMAT " ms", wait / 1000);
+    ctx->hold_id = g_timeout_add((guint)((wait + 999) / 1000), openai_client_on_hold_done, ctx);
+  }
+  if (ctx->hold_id)
+  {
+    if (ctx->cancellable && !ctx->cancelled_id)
+      ctx->cancelled_id = g_cancellable_connect(ctx->cancellable, G_CALLBACK(openai_client_on_cancelled), ctx, NULL);
+    return;
+  }
+
+  /* From here on libsoup watches the cancellable. */
+  if (ctx->cancelled_id)
+  {
+    g_cancellable_disconnect(ctx->cancellable, ctx->cancelled_id);
+    ctx->cancelled_id = 0;
+  }
+  ctx->sent_us = g_get_monotonic_time();
+  soup_session_send_and_read_async(
+    ctx->session,
+    ctx->msg,
+    G_PRIORITY_DEFAULT,
+    ctx->cancellable,
+    openai_client_on_send_finish,
+    ctx);
 }
 
 void
@@ -225,23 +1019,65 @@ openai_client_send_chat_async(const gchar *endpoint,
                               const gchar *api_key,
                               const gchar *model,
                               gdouble temperature,
-                              GPtrArray *messages,
+                              const Conversation *conversation,
+                              GPtrArray *attachments,
                               GCancellable *cancellable,
                               OpenaiClientCallback callback,
                               gpointer user_data)
+{
+  openai_client_send_chat_full_async(endpoint,
+                                     api_key,
+                                     model,
+                                     temperature,
+                                     0,
+                                     conversation,
+                                     attachments,
+                                     cancellable,
+                                     callback,
+                                     user_data);
+}
+
+void
+openai_client_send_chat_full_async(const gchar *endpoint,
+                                   const gchar *api_key,
+                                   const gchar *model,
+                                   gdouble temperature,
+                                   gint max_tokens,
+                                   const Conversation *conversation,
+                                   GPtrArray *attachments,
+                                   GCancellable *cancellable,
+                                   OpenaiClientCallback callback,
+                                   gpointer user_data)
 {
   g_return_if_fail(endpoint && *endpoint);
   g_return_if_fail(model && *model);
-  g_return_if_fail(messages != NULL);
+  g_return_if_fail(conversation != NULL);
+
+  OpenaiClientServer *server = openai_client_get_server(endpoint);
+  const OpenaiClientBackendOps *ops = &openai_client_backends[server->backend];
+  OpenaiClientChat chat = {server, api_key, model, temperature, max_tokens, conversation};
+  gboolean attach = attachments && attachments->len > 0;
+  g_autofree gchar *body = openai_client_build_body(&chat, attach);
 
-  g_autofree gchar *body = openai_client_build_body(model, temperature, messages);
-  g_autoptr(GBytes) body_bytes = g_bytes_new(body ? body : "{}", body ? strlen(body) : 2);
+  g_autofree gchar *chat_url = ops->chat_path ? openai_client_get_sibling_url(endpoint, ops->chat_path) : NULL;
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *unix_uri = NULL;
+  const gchar *url = chat_url ? chat_url : endpoint;
+  gboolean is_unix = openai_client_split_unix_endpoint(url, &socket_path, &unix_uri);
 
   OpenaiClientCtx *ctx = g_new0(OpenaiClientCtx, 1);
-  ctx->session = soup_session_new();
-  ctx->msg = soup_message_new("POST", endpoint);
   ctx->callback = callback;
   ctx->user_data = user_data;
+  if (!is_unix || unix_uri)
+    ctx->msg = soup_message_new("POST", is_unix ? unix_uri : url);
+  if (!ctx->msg)
+  {
+    openai_ask_log("invalid endpoint=%s", url);
+    g_idle_add(openai_client_on_invalid_endpoint, ctx);
+    return;
+  }
+  ctx->session = g_object_ref(openai_client_get_session(socket_path));
+  g_signal_connect(ctx->msg, "got-headers", G_CALLBACK(openai_client_on_got_headers), ctx);
 
   SoupMessageHeaders *hdrs = soup_message_get_request_headers(ctx->msg);
   soup_message_headers_append(hdrs, "Content-Type", "application/json");
@@ -252,13 +1088,350 @@ openai_client_send_chat_async(const gchar *endpoint,
     soup_message_headers_append(hdrs, "Authorization", auth);
   }
 
-  soup_message_set_request_body_from_bytes(ctx->msg, "application/json", body_bytes);
+  if (!attach || !openai_client_set_streamed_body(ctx->msg, body, attachments, &ctx->bytes_out))
+  {
+    g_autoptr(GBytes) body_bytes = g_bytes_new(body ? body : "{}", body ? strlen(body) : 2);
+    soup_message_set_request_body_from_bytes(ctx->msg, "application/json", body_bytes);
+    ctx->bytes_out = g_bytes_get_size(body_bytes);
+  }
 
-  soup_session_send_and_read_async(
-    ctx->session,
-    ctx->msg,
-    G_PRIORITY_DEFAULT,
-    cancellable,
-    openai_client_on_send_finish,
-    ctx);
+  ctx->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+  ctx->server = server;
+  ctx->endpoint = g_strdup(endpoint);
+  ctx->api_key = g_strdup(api_key);
+  ctx->tokens = openai_client_estimate_tokens(conversation, attachments);
+  openai_client_dispatch(ctx);
+}
+
+gchar *
+openai_client_get_models_url(const gchar *endpoint)
+{
+  return openai_client_get_sibling_url(endpoint, "models");
+}
+
+gchar *
+openai_client_get_embeddings_url(const gchar *endpoint)
+{
+  return openai_client_get_sibling_url(endpoint, "embeddings");
+}
+
+/* {"data": [{"id": "..."}, ...]}, as OpenAI, Ollama, llama.cpp and vLLM
+ * answer. Returns the ids sorted, or NULL. */
+static GStrv
+openai_client_parse_models(const gchar *body, gsize size)
+{
+  g_autoptr(JsonParser) parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, body, (gssize)size, NULL))
+    return NULL;
+  JsonNode *root = json_parser_get_root(parser);
+  if (!root || !JSON_NODE_HOLDS_OBJECT(root))
+    return NULL;
+  JsonNode *data = json_object_get_member(json_node_get_object(root), "data");
+  if (!data || !JSON_NODE_HOLDS_ARRAY(data))
+    return NULL;
+
+  JsonArray *array = json_node_get_array(data);
+  g_autoptr(GPtrArray) ids = g_ptr_array_new();
+  for (guint i = 0; i < json_array_get_length(array); i++)
+  {
+    JsonNode *node = json_array_get_element(array, i);
+    gchar *id = JSON_NODE_HOLDS_OBJECT(node) ? json_read_string_member(json_node_get_object(node), "id") : NULL;
+    if (id && *id)
+      g_ptr_array_add(ids, id);
+    else
+      g_free(id);
+  }
+  g_ptr_array_sort(ids, (GCompareFunc)g_strcmp0);
+  g_ptr_array_add(ids, NULL);
+  return (GStrv)g_ptr_array_free(g_steal_pointer(&ids), FALSE);
+}
+
+typedef struct
+{
+  SoupSession *session;
+  SoupMessage *msg;
+  OpenaiClientModelsCallback callback;
+  gpointer user_data;
+} OpenaiClientModelsCtx;
+
+static void
+openai_client_models_finish(OpenaiClientModelsCtx *ctx, GStrv models, const GError *error)
+{
+  ctx->callback(models, error, ctx->user_data);
+  g_strfreev(models);
+  g_clear_object(&ctx->msg);
+  g_clear_object(&ctx->session);
+  g_free(ctx);
+}
+
+static void
+openai_client_on_models_finish(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  (void)source;
+  OpenaiClientModelsCtx *ctx = user_data;
+
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GBytes) bytes = soup_session_send_and_read_finish(ctx->session, res, &error);
+  if (!bytes)
+    return openai_client_models_finish(ctx, NULL, error);
+
+  gint status = soup_message_get_status(ctx->msg);
+  gsize size = 0;
+  const gchar *data = g_bytes_get_data(bytes, &size);
+  GStrv models = status >= 200 && status < 300 ? openai_client_parse_models(data, size) : NULL;
+  openai_ask_log("models status=%d bytes=%zu count=%u", status, (size_t)size, models ? g_strv_length(models) : 0);
+  if (!models)
+  {
+    g_autoptr(GError) bad = g_error_new(G_IO_ERROR,
+                                        G_IO_ERROR_FAILED,
+                                        status >= 200 && status < 300 ? "No model list in response." : "HTTP %d from provider.",
+                                        status);
+    return openai_client_models_finish(ctx, NULL, bad);
+  }
+  openai_client_models_finish(ctx, models, NULL);
+}
+
+static gboolean
+openai_client_on_models_invalid(gpointer user_data)
+{
+  g_autoptr(GError) error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "No models URL for this endpoint.");
+  openai_client_models_finish(user_data, NULL, error);
+  return G_SOURCE_REMOVE;
+}
+
+void
+openai_client_list_models_async(const gchar *endpoint,
+                                const gchar *api_key,
+                                GCancellable *cancellable,
+                                OpenaiClientModelsCallback callback,
+                                gpointer user_data)
+{
+  g_return_if_fail(endpoint != NULL);
+  g_return_if_fail(callback != NULL);
+
+  OpenaiClientModelsCtx *ctx = g_new0(OpenaiClientModelsCtx, 1);
+  ctx->callback = callback;
+  ctx->user_data = user_data;
+
+  g_autofree gchar *url = openai_client_get_models_url(endpoint);
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *unix_uri = NULL;
+  gboolean is_unix = url && openai_client_split_unix_endpoint(url, &socket_path, &unix_uri);
+  if (url)
+    ctx->msg = soup_message_new("GET", is_unix ? unix_uri : url);
+  if (!ctx->msg)
+  {
+    g_idle_add(openai_client_on_models_invalid, ctx);
+    return;
+  }
+  ctx->session = g_object_ref(openai_client_get_session(socket_path));
+
+  SoupMessageHeaders *hdrs = soup_message_get_request_headers(ctx->msg);
+  soup_message_headers_append(hdrs, "Accept", "application/json");
+  if (api_key && *api_key)
+  {
+    g_autofree gchar *auth = g_strdup_printf("Bearer %s", api_key);
+    soup_message_headers_append(hdrs, "Authorization", auth);
+  }
+  openai_ask_log("models GET %s", url);
+  soup_session_send_and_read_async(ctx->session,
+                                   ctx->msg,
+                                   G_PRIORITY_LOW,
+                                   cancellable,
+                                   openai_client_on_models_finish,
+                                   ctx);
+}
+
+/* {"model": ..., "input": [...]} to @url, which may be a unix endpoint. */
+static SoupMessage *
+openai_client_new_embed_message(const gchar *url,
+                                const gchar *api_key,
+                                const gchar *model,
+                                const gchar *const *inputs,
+                                gchar **socket_path)
+{
+  g_autofree gchar *unix_uri = NULL;
+  gboolean is_unix = openai_client_split_unix_endpoint(url, socket_path, &unix_uri);
+  if (is_unix && !unix_uri)
+    return NULL;
+  SoupMessage *msg = soup_message_new("POST", is_unix ? unix_uri : url);
+  if (!msg)
+    return NULL;
+
+  g_autoptr(JsonBuilder) b = json_builder_new();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "model");
+  json_builder_add_string_value(b, model ? model : "");
+  json_builder_set_member_name(b, "input");
+  json_builder_begin_array(b);
+  for (guint i = 0; inputs[i]; i++)
+    json_builder_add_string_value(b, inputs[i]);
+  json_builder_end_array(b);
+  json_builder_end_object(b);
+  g_autoptr(JsonGenerator) gen = json_generator_new();
+  g_autoptr(JsonNode) root = json_builder_get_root(b);
+  json_generator_set_root(gen, root);
+  gsize len = 0;
+  gchar *body = json_generator_to_data(gen, &len);
+  g_autoptr(GBytes) body_bytes = g_bytes_new_take(body, len);
+  soup_message_set_request_body_from_bytes(msg, "application/json", body_bytes);
+
+  SoupMessageHeaders *hdrs = soup_message_get_request_headers(msg);
+  soup_message_headers_append(hdrs, "Accept", "application/json");
+  if (api_key && *api_key)
+  {
+    g_autofree gchar *auth = g_strdup_printf("Bearer %s", api_key);
+    soup_message_headers_append(hdrs, "Authorization", auth);
+  }
+  return msg;
+}
+
+/* {"data": [{"index": i, "embedding": [...]}, ...]} into @n_inputs rows of
+ * *@dim floats, in input order. */
+static gfloat *
+openai_client_parse_embeddings(gint status, GBytes *bytes, guint n_inputs, guint *dim, GError **error)
+{
+  gsize size = 0;
+  const gchar *data = g_bytes_get_data(bytes, &size);
+  g_autoptr(JsonParser) parser = json_parser_new();
+  if (status < 200 || status >= 300 || !json_parser_load_from_data(parser, data ? data : "", (gssize)size, NULL))
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "HTTP %d from the embeddings endpoint.", status);
+    return NULL;
+  }
+  JsonNode *root = json_parser_get_root(parser);
+  JsonNode *list = root && JSON_NODE_HOLDS_OBJECT(root) ? json_object_get_member(json_node_get_object(root), "data") : NULL;
+  JsonArray *items = list && JSON_NODE_HOLDS_ARRAY(list) ? json_node_get_array(list) : NULL;
+  if (!items || json_array_get_length(items) != n_inputs)
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "No embeddings in response.");
+    return NULL;
+  }
+
+  g_autofree gfloat *vectors = NULL;
+  *dim = 0;
+  for (guint i = 0; i < n_inputs; i++)
+  {
+    JsonNode *node = json_array_get_element(items, i);
+    JsonObject *item = JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node) : NULL;
+    JsonNode *embedding = item ? json_object_get_member(item, "embedding") : NULL;
+    gint64 index = item ? json_object_get_int_member_with_default(item, "index", i) : -1;
+    if (!embedding || !JSON_NODE_HOLDS_ARRAY(embedding) || index < 0 || index >= n_inputs)
+    {
+      g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Malformed embedding in response.");
+      return NULL;
+    }
+    JsonArray *values = json_node_get_array(embedding);
+    guint n = json_array_get_length(values);
+    if (!vectors)
+    {
+      *dim = n;
+      vectors = g_new0(gfloat, (gsize)n_inputs * n);
+    }
+    if (n == 0 || n != *dim)
+    {
+      g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Embeddings of different sizes in response.");
+      return NULL;
+    }
+    gfloat *row = vectors + (gsize)index * n;
+    for (guint j = 0; j < n; j++)
+      row[j] = (gfloat)json_array_get_double_element(values, j);
+  }
+  return g_steal_pointer(&vectors);
+}
+
+gfloat *
+openai_client_embed_sync(const gchar *url,
+                         const gchar *api_key,
+                         const gchar *model,
+                         const gchar *const *inputs,
+                         guint *dim,
+                         GCancellable *cancellable,
+                         GError **error)
+{
+  g_return_val_if_fail(url != NULL && inputs != NULL && dim != NULL, NULL);
+
+  g_autofree gchar *socket_path = NULL;
+  g_autoptr(SoupMessage) msg = openai_client_new_embed_message(url, api_key, model, inputs, &socket_path);
+  if (!msg)
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid embeddings endpoint URL.");
+    return NULL;
+  }
+  SoupSession *session = openai_client_get_thread_session(socket_path);
+  g_autoptr(GBytes) bytes = soup_session_send_and_read(session, msg, cancellable, error);
+  if (!bytes)
+    return NULL;
+  return openai_client_parse_embeddings(soup_message_get_status(msg), bytes, g_strv_length((gchar **)inputs), dim, error);
+}
+
+typedef struct
+{
+  SoupSession *session;
+  SoupMessage *msg;
+  guint n_inputs;
+  OpenaiClientEmbedCallback callback;
+  gpointer user_data;
+} OpenaiClientEmbedCtx;
+
+static void
+openai_client_embed_finish(OpenaiClientEmbedCtx *ctx, gfloat *vectors, guint dim, const GError *error)
+{
+  ctx->callback(vectors, dim, error, ctx->user_data);
+  g_free(vectors);
+  g_clear_object(&ctx->msg);
+  g_clear_object(&ctx->session);
+  g_free(ctx);
+}
+
+static void
+openai_client_on_embed_finish(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  (void)source;
+  OpenaiClientEmbedCtx *ctx = user_data;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GBytes) bytes = soup_session_send_and_read_finish(ctx->session, res, &error);
+  guint dim = 0;
+  gfloat *vectors = bytes ? openai_client_parse_embeddings(soup_message_get_status(ctx->msg), bytes, ctx->n_inputs, &dim, &error)
+                          : NULL;
+  openai_client_embed_finish(ctx, vectors, dim, error);
+}
+
+static gboolean
+openai_client_on_embed_invalid(gpointer user_data)
+{
+  g_autoptr(GError) error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid embeddings endpoint URL.");
+  openai_client_embed_finish(user_data, NULL, 0, error);
+  return G_SOURCE_REMOVE;
+}
+
+void
+openai_client_embed_async(const gchar *url,
+                          const gchar *api_key,
+                          const gchar *model,
+                          const gchar *const *inputs,
+                          GCancellable *cancellable,
+                          OpenaiClientEmbedCallback callback,
+                          gpointer user_data)
+{
+  g_return_if_fail(url != NULL && inputs != NULL && callback != NULL);
+
+  OpenaiClientEmbedCtx *ctx = g_new0(OpenaiClientEmbedCtx, 1);
+  ctx->n_inputs = g_strv_length((gchar **)inputs);
+  ctx->callback = callback;
+  ctx->user_data = user_data;
+  g_autofree gchar *socket_path = NULL;
+  ctx->msg = openai_client_new_embed_message(url, api_key, model, inputs, &socket_path);
+  if (!ctx->msg)
+  {
+    g_idle_add(openai_client_on_embed_invalid, ctx);
+    return;
+  }
+  ctx->session = g_object_ref(openai_client_get_session(socket_path));
+  soup_session_send_and_read_async(ctx->session,
+                                   ctx->msg,
+                                   G_PRIORITY_DEFAULT,
+                                   cancellable,
+                                   openai_client_on_embed_finish,
+                                   ctx);
 }
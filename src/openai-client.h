@@ -3,14 +3,7 @@
 #include <glib.h>
 #include <gio/gio.h>
 
-typedef struct
-{
-  gchar *role;
-  gchar *content;
-} OpenaiChatMessage;
-
-OpenaiChatMessage *openai_chat_message_new(const gchar *role, const gchar *content);
-void openai_chat_message_free(OpenaiChatMessage *msg);
+#include "conversation.h"
 
 typedef struct
 {
@@ -18,15 +11,119 @@ typedef struct
   gint http_status;
   gchar *content;
   gchar *error_message;
+  gint64 prompt_tokens; /* from "usage"; 0 if not reported */
+  gint64 completion_tokens;
+  gboolean truncated; /* the server stopped at max_tokens */
 } OpenaiClientResult;
 
 typedef void (*OpenaiClientCallback)(OpenaiClientResult *result, gpointer user_data);
 
+/* What kind of server an endpoint is. Every backend takes the same
+ * OpenAI-style endpoint URL; the native ones send to their own paths next
+ * to it and add what keeps a local model warm. */
+typedef enum
+{
+  OPENAI_CLIENT_BACKEND_OPENAI, /* any OpenAI-compatible server */
+  OPENAI_CLIENT_BACKEND_OLLAMA, /* Ollama's /api/chat, with keep_alive */
+  OPENAI_CLIENT_BACKEND_LLAMA_CPP, /* llama.cpp's server, with cache_prompt and id_slot */
+  OPENAI_CLIENT_BACKEND_COUNT,
+} OpenaiClientBackend;
+
+/* Ollama keeps the model loaded this long after each request. */
+#define OPENAI_CLIENT_OLLAMA_KEEP_ALIVE "30m"
+/* openai_client_preload() does nothing more often than this per endpoint. */
+#define OPENAI_CLIENT_PRELOAD_INTERVAL_US (60 * G_USEC_PER_SEC)
+
+/* As stored in the settings: "openai", "ollama", "llama.cpp". */
+const gchar *openai_client_backend_get_name(OpenaiClientBackend backend);
+const gchar *openai_client_backend_get_label(OpenaiClientBackend backend);
+/* OPENAI_CLIENT_BACKEND_OPENAI for NULL or unknown names. */
+OpenaiClientBackend openai_client_backend_from_name(const gchar *name);
+
+/* Requests to @endpoint go through @backend from now on; the default is
+ * OPENAI_CLIENT_BACKEND_OPENAI. Main thread only. */
+void openai_client_set_backend(const gchar *endpoint, OpenaiClientBackend backend);
+
+/* Gets @endpoint's server ready for a question that is probably coming,
+ * e.g. when the entry takes focus: Ollama loads @model, llama.cpp reports
+ * its slots. Does nothing for other servers, or if it ran in the last
+ * OPENAI_CLIENT_PRELOAD_INTERVAL_US. */
+void openai_client_preload(const gchar *endpoint, const gchar *api_key, const gchar *model);
+
+/* @attachments (element-type Attachment, may be NULL) are appended to the
+ * last user message and streamed from their mappings; the request keeps a
+ * reference to the array until the body has been sent. With the llama.cpp
+ * backend, follow-ups of a conversation (known by its system prompt and
+ * oldest turn) are pinned to one server slot so its cached prompt is
+ * reused. */
 void openai_client_send_chat_async(const gchar *endpoint,
                                    const gchar *api_key,
                                    const gchar *model,
                                    gdouble temperature,
-                                   GPtrArray *messages, /* element-type OpenaiChatMessage* */
+                                   const Conversation *conversation,
+                                   GPtrArray *attachments,
                                    GCancellable *cancellable,
                                    OpenaiClientCallback callback,
                                    gpointer user_data);
+
+/* The same, with the answer limited to @max_tokens (0 = the server's
+ * default); result->truncated says whether it was cut there. */
+void openai_client_send_chat_full_async(const gchar *endpoint,
+                                        const gchar *api_key,
+                                        const gchar *model,
+                                        gdouble temperature,
+                                        gint max_tokens,
+                                        const Conversation *conversation,
+                                        GPtrArray *attachments,
+                                        GCancellable *cancellable,
+                                        OpenaiClientCallback callback,
+                                        gpointer user_data);
+
+/* How long a request for this conversation would be held by the client-side
+ * rate limiter if sent now; 0 if it would go out at once. */
+gint64 openai_client_get_hold_us(const gchar *endpoint,
+                                 const gchar *api_key,
+                                 const Conversation *conversation,
+                                 GPtrArray *attachments);
+
+/* @models (sorted, NULL-terminated) is only valid during the call; on
+ * failure it is NULL and @error says why. */
+typedef void (*OpenaiClientModelsCallback)(GStrv models, const GError *error, gpointer user_data);
+
+/* The models list next to a chat endpoint: ".../v1/chat/completions"
+ * becomes ".../v1/models", for unix socket endpoints too. NULL if the
+ * endpoint does not end in a completions path. */
+gchar *openai_client_get_models_url(const gchar *endpoint);
+
+/* GET the models list of @endpoint's server. Not rate limited or queued:
+ * it is one small request from the Properties dialog. */
+void openai_client_list_models_async(const gchar *endpoint,
+                                     const gchar *api_key,
+                                     GCancellable *cancellable,
+                                     OpenaiClientModelsCallback callback,
+                                     gpointer user_data);
+
+/* The embeddings endpoint next to a chat endpoint, as for models. */
+gchar *openai_client_get_embeddings_url(const gchar *endpoint);
+
+/* @vectors holds one row of @dim floats per input, in input order, and is
+ * only valid during the call; on failure it is NULL and @error says why. */
+typedef void (*OpenaiClientEmbedCallback)(const gfloat *vectors, guint dim, const GError *error, gpointer user_data);
+
+/* POST the NULL-terminated @inputs to the embeddings endpoint @url. */
+void openai_client_embed_async(const gchar *url,
+                               const gchar *api_key,
+                               const gchar *model,
+                               const gchar *const *inputs,
+                               GCancellable *cancellable,
+                               OpenaiClientEmbedCallback callback,
+                               gpointer user_data);
+/* The same, blocking, for worker threads. Returns the rows (g_free()) and
+ * sets @dim, or NULL. */
+gfloat *openai_client_embed_sync(const gchar *url,
+                                 const gchar *api_key,
+                                 const gchar *model,
+                                 const gchar *const *inputs,
+                                 guint *dim,
+                                 GCancellable *cancellable,
+                                 GError **error);
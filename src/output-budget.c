@@ -0,0 +1,30 @@
+#include "output-budget.h"
+
+#include "attachment.h"
+
+gboolean
+output_budget_compute(OutputBudget *budget,
+                      gint width_px,
+                      gint height_px,
+                      gdouble char_width_px,
+                      gdouble line_height_px)
+{
+  if (width_px <= 0 || height_px <= 0 || char_width_px <= 0.0 || line_height_px <= 0.0)
+    return FALSE;
+
+  budget->lines = MAX(1, (guint)(height_px / line_height_px));
+  budget->chars_per_line = MAX(1, (guint)(width_px / char_width_px));
+  gsize bytes = (gsize)(budget->lines * budget->chars_per_line * OUTPUT_BUDGET_LINE_FILL * OUTPUT_BUDGET_SCREENS);
+  budget->max_tokens = MAX(OUTPUT_BUDGET_MIN_TOKENS, (gint)attachment_estimate_tokens(bytes));
+  return TRUE;
+}
+
+gchar *
+output_budget_get_hint(const OutputBudget *budget)
+{
+  return g_strdup_printf("Your answer is shown in a small popup of about %u lines of %u characters. "
+                         "Answer directly and keep it short enough to fit: no preamble, no recap. "
+                         "If the question needs more, stop at a natural break; the user can ask you to continue.",
+                         budget->lines,
+                         budget->chars_per_line);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glib.h>
+
+/* A budgeted answer may run to this many popups before it is cut. */
+#define OUTPUT_BUDGET_SCREENS 2
+/* How full an answer's lines are on average: markdown has short list
+ * items, headings and blank lines between paragraphs. */
+#define OUTPUT_BUDGET_LINE_FILL 0.6
+#define OUTPUT_BUDGET_MIN_TOKENS 128
+/* Asks for the rest of an answer that was cut at the budget. */
+#define OUTPUT_BUDGET_CONTINUE_PROMPT "Continue exactly where you stopped, without repeating anything."
+
+/* Viewport-aware output budgeting: how much answer fits where it is shown,
+ * turned into a max_tokens for the request and a hint that asks the model
+ * to be brief. */
+typedef struct
+{
+  guint lines; /* of text the popup shows at its tallest */
+  guint chars_per_line;
+  gint max_tokens;
+} OutputBudget;
+
+/* From the text area in pixels and the font's average character width and
+ * line height. FALSE, leaving @budget unset, if any of them is not
+ * positive. */
+gboolean output_budget_compute(OutputBudget *budget,
+                               gint width_px,
+                               gint height_px,
+                               gdouble char_width_px,
+                               gdouble line_height_px);
+
+/* The brevity hint, for the end of the system prompt. */
+gchar *output_budget_get_hint(const OutputBudget *budget);
@@ -0,0 +1,264 @@
+#include "rate-limiter.h"
+
+#include "log.h"
+
+/* With nothing left and no reset time given, try again after this. */
+#define RATE_LIMITER_UNKNOWN_RESET_US G_USEC_PER_SEC
+
+typedef struct
+{
+  gdouble capacity; /* the provider's limit; 0 = not known */
+  gdouble available; /* at @stamp */
+  gdouble rate; /* refill per microsecond */
+  gint64 stamp;
+  gint64 reset_at; /* full again from here on; 0 = no reset known */
+} RateBucket;
+
+typedef struct
+{
+  RateBucket requests;
+  RateBucket tokens;
+  /* Reserved but not answered yet. The provider's figures do not count
+   * them, so they are taken off what it reports. */
+  guint outstanding;
+  guint64 outstanding_tokens;
+} RateLimit;
+
+struct _RateLimiter
+{
+  GHashTable *limits; /* hash of endpoint and key -> RateLimit */
+};
+
+static gdouble
+rate_bucket_level(const RateBucket *bucket, gint64 now)
+{
+  if (bucket->reset_at && now >= bucket->reset_at)
+    return bucket->capacity > 0 ? bucket->capacity : G_MAXDOUBLE;
+  gdouble level = bucket->available + bucket->rate * (gdouble)(now - bucket->stamp);
+  return bucket->capacity > 0 ? MIN(level, bucket->capacity) : level;
+}
+
+/* Microseconds until @bucket holds @cost, 0 if it does now. */
+static gint64
+rate_bucket_wait(const RateBucket *bucket, gdouble cost, gint64 now)
+{
+  if (!bucket->stamp)
+    return 0;
+  if (bucket->capacity > 0)
+    cost = MIN(cost, bucket->capacity); /* a request larger than the bucket waits for a full one */
+  gdouble level = rate_bucket_level(bucket, now);
+  if (level >= cost)
+    return 0;
+
+  gint64 until_reset = bucket->reset_at > now ? bucket->reset_at - now : G_MAXINT64;
+  if (bucket->rate > 0)
+    return MIN(until_reset, (gint64)((cost - level) / bucket->rate) + 1);
+  if (!bucket->reset_at)
+    return MAX(1, bucket->stamp + RATE_LIMITER_UNKNOWN_RESET_US - now);
+  return until_reset;
+}
+
+static void
+rate_bucket_take(RateBucket *bucket, gdouble cost, gint64 now)
+{
+  if (!bucket->stamp)
+    return;
+  gdouble level = rate_bucket_level(bucket, now);
+  if (level >= G_MAXDOUBLE)
+    return;
+  if (bucket->reset_at && now >= bucket->reset_at)
+    bucket->reset_at = 0; /* full again; draw it down from here */
+  bucket->available = level - cost;
+  bucket->stamp = now;
+}
+
+/* The provider's figures, less what is still in flight, replace whatever
+ * was counted locally. The bucket refills linearly from @remaining to
+ * @limit over @reset_us. */
+static void
+rate_bucket_update(RateBucket *bucket, gint64 limit, gint64 remaining, guint64 outstanding, gint64 reset_us, gint64 now)
+{
+  if (remaining < 0)
+    return;
+  bucket->capacity = limit > 0 ? (gdouble)limit : 0;
+  bucket->available = (gdouble)remaining - (gdouble)outstanding;
+  bucket->stamp = now;
+  bucket->reset_at = reset_us >= 0 ? now + reset_us : 0;
+  bucket->rate = limit > remaining && reset_us > 0 ? (gdouble)(limit - remaining) / (gdouble)reset_us : 0;
+}
+
+static void
+rate_bucket_exhaust(RateBucket *bucket, gint64 retry_after_us, gint64 now)
+{
+  bucket->available = 0;
+  bucket->rate = 0;
+  bucket->stamp = now;
+  bucket->reset_at = now + retry_after_us;
+}
+
+static gchar *
+rate_limiter_key(const gchar *endpoint, const gchar *api_key)
+{
+  g_autofree gchar *input = g_strconcat(endpoint, "\n", api_key ? api_key : "", NULL);
+  return g_compute_checksum_for_string(G_CHECKSUM_SHA256, input, -1);
+}
+
+RateLimiter *
+rate_limiter_new(void)
+{
+  RateLimiter *limiter = g_new0(RateLimiter, 1);
+  limiter->limits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  return limiter;
+}
+
+void
+rate_limiter_free(RateLimiter *limiter)
+{
+  if (!limiter)
+    return;
+  g_hash_table_destroy(limiter->limits);
+  g_free(limiter);
+}
+
+RateLimiter *
+rate_limiter_get_default(void)
+{
+  static RateLimiter *limiter = NULL;
+  if (!limiter)
+    limiter = rate_limiter_new();
+  return limiter;
+}
+
+void
+rate_limit_info_init(RateLimitInfo *info)
+{
+  info->limit_requests = -1;
+  info->remaining_requests = -1;
+  info->reset_requests_us = -1;
+  info->limit_tokens = -1;
+  info->remaining_tokens = -1;
+  info->reset_tokens_us = -1;
+  info->retry_after_us = -1;
+}
+
+gint64
+rate_limiter_parse_duration(const gchar *value)
+{
+  if (!value || !*value)
+    return -1;
+
+  const gchar *p = value;
+  gdouble total_s = 0;
+  while (*p)
+  {
+    gchar *end = NULL;
+    gdouble n = g_ascii_strtod(p, &end);
+    if (end == p || n < 0)
+      return -1;
+    p = end;
+    if (g_str_has_prefix(p, "ms"))
+    {
+      total_s += n / 1000.0;
+      p += 2;
+    }
+    else if (*p == 'h' || *p == 'm' || *p == 's')
+    {
+      total_s += n * (*p == 'h' ? 3600.0 : *p == 'm' ? 60.0 : 1.0);
+      p++;
+    }
+    else if (*p == '\0')
+      total_s += n; /* bare number: seconds, as in Retry-After */
+    else
+      return -1;
+  }
+  return (gint64)(total_s * G_USEC_PER_SEC);
+}
+
+static RateLimit *
+rate_limiter_lookup(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, gboolean create)
+{
+  gchar *key = rate_limiter_key(endpoint, api_key);
+  RateLimit *limit = g_hash_table_lookup(limiter->limits, key);
+  if (!limit && create)
+  {
+    limit = g_new0(RateLimit, 1);
+    g_hash_table_insert(limiter->limits, key, limit);
+  }
+  else
+    g_free(key);
+  return limit;
+}
+
+void
+rate_limiter_finish(RateLimiter *limiter,
+                    const gchar *endpoint,
+                    const gchar *api_key,
+                    guint64 tokens,
+                    const RateLimitInfo *info)
+{
+  RateLimit *limit = rate_limiter_lookup(limiter, endpoint, api_key, FALSE);
+  if (!limit)
+    return;
+  limit->outstanding -= MIN(limit->outstanding, 1);
+  limit->outstanding_tokens -= MIN(limit->outstanding_tokens, tokens);
+  if (!info || (info->remaining_requests < 0 && info->remaining_tokens < 0 && info->retry_after_us < 0))
+    return;
+
+  gint64 now = g_get_monotonic_time();
+  rate_bucket_update(&limit->requests,
+                     info->limit_requests,
+                     info->remaining_requests,
+                     limit->outstanding,
+                     info->reset_requests_us,
+                     now);
+  rate_bucket_update(&limit->tokens,
+                     info->limit_tokens,
+                     info->remaining_tokens,
+                     limit->outstanding_tokens,
+                     info->reset_tokens_us,
+                     now);
+  if (info->retry_after_us >= 0)
+    rate_bucket_exhaust(&limit->requests, info->retry_after_us, now);
+  openai_ask_log("ratelimit: %s requests %" G_GINT64_FORMAT "/%" G_GINT64_FORMAT
+                 " tokens %" G_GINT64_FORMAT "/%" G_GINT64_FORMAT " in flight %u retry-after %" G_GINT64_FORMAT " ms",
+                 endpoint,
+                 info->remaining_requests,
+                 info->limit_requests,
+                 info->remaining_tokens,
+                 info->limit_tokens,
+                 limit->outstanding,
+                 info->retry_after_us >= 0 ? info->retry_after_us / 1000 : -1);
+}
+
+static gint64
+rate_limiter_check(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, guint64 tokens, gboolean take)
+{
+  /* Reserving starts tracking the endpoint, so requests sent before its
+   * first response are counted as in flight. */
+  RateLimit *limit = rate_limiter_lookup(limiter, endpoint, api_key, take);
+  if (!limit)
+    return 0;
+
+  gint64 now = g_get_monotonic_time();
+  gint64 wait = MAX(rate_bucket_wait(&limit->requests, 1, now), rate_bucket_wait(&limit->tokens, (gdouble)tokens, now));
+  if (wait == 0 && take)
+  {
+    rate_bucket_take(&limit->requests, 1, now);
+    rate_bucket_take(&limit->tokens, (gdouble)tokens, now);
+    limit->outstanding++;
+    limit->outstanding_tokens += tokens;
+  }
+  return wait;
+}
+
+gint64
+rate_limiter_reserve(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, guint64 tokens)
+{
+  return rate_limiter_check(limiter, endpoint, api_key, tokens, TRUE);
+}
+
+gint64
+rate_limiter_peek(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, guint64 tokens)
+{
+  return rate_limiter_check(limiter, endpoint, api_key, tokens, FALSE);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glib.h>
+
+/* Requests are held at most this long for the quota to refill; beyond it
+ * they fail at once with the time until the reset. */
+#define RATE_LIMITER_MAX_HOLD_US (60 * G_USEC_PER_SEC)
+
+/* What a provider said about the quota in one response. Missing headers
+ * are -1. */
+typedef struct
+{
+  gint64 limit_requests;
+  gint64 remaining_requests;
+  gint64 reset_requests_us;
+  gint64 limit_tokens;
+  gint64 remaining_tokens;
+  gint64 reset_tokens_us;
+  gint64 retry_after_us; /* from a 429 */
+} RateLimitInfo;
+
+/* Token buckets for requests and tokens per endpoint and API key, kept in
+ * step with the x-ratelimit-* headers of every response and drawn down
+ * locally between them, so a burst of requests is held back before the
+ * provider would answer 429. API keys are only used hashed. Main thread
+ * only. */
+typedef struct _RateLimiter RateLimiter;
+
+RateLimiter *rate_limiter_new(void);
+void rate_limiter_free(RateLimiter *limiter);
+RateLimiter *rate_limiter_get_default(void);
+
+void rate_limit_info_init(RateLimitInfo *info);
+/* "1s", "6m0s", "20ms", "1h2m3.5s" or plain seconds; -1 if unparseable. */
+gint64 rate_limiter_parse_duration(const gchar *value);
+
+/* Takes one request and about @tokens tokens from the buckets and returns
+ * 0, or returns how long until they would be there and takes nothing. A
+ * successful reservation must be followed by rate_limiter_finish(). */
+gint64 rate_limiter_reserve(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, guint64 tokens);
+/* Ends a reservation of @tokens when its response (or error) arrives.
+ * @info holds what the response said about the quota, or is NULL. */
+void rate_limiter_finish(RateLimiter *limiter,
+                         const gchar *endpoint,
+                         const gchar *api_key,
+                         guint64 tokens,
+                         const RateLimitInfo *info);
+/* Same answer as rate_limiter_reserve(), without taking anything. */
+gint64 rate_limiter_peek(RateLimiter *limiter, const gchar *endpoint, const gchar *api_key, guint64 tokens);
@@ -0,0 +1,373 @@
+#include "request-scheduler.h"
+
+#include "log.h"
+#include "metrics.h"
+
+typedef struct
+{
+  gchar *endpoint;
+  guint limit; /* 0 = the scheduler's default */
+  GQueue queued[REQUEST_PRIORITY_COUNT];
+  GQueue running;
+  RequestSchedulerMetrics metrics; /* counters only; depths are filled in on read */
+} RequestEndpoint;
+
+struct _RequestScheduler
+{
+  GHashTable *endpoints; /* endpoint -> RequestEndpoint */
+  guint default_limit;
+  guint dispatch_id;
+};
+
+struct _RequestTicket
+{
+  RequestScheduler *scheduler;
+  RequestEndpoint *ep;
+  RequestPriority priority;
+  guint64 owner;
+  GCancellable *cancellable;
+  gulong cancelled_id;
+  RequestStartFunc start;
+  gpointer user_data;
+  gint64 queued_us;
+  gint64 started_us;
+};
+
+static const gchar *const priority_names[REQUEST_PRIORITY_COUNT] = {"interactive", "background"};
+
+static void
+request_ticket_free(RequestTicket *ticket)
+{
+  if (ticket->cancelled_id)
+    g_signal_handler_disconnect(ticket->cancellable, ticket->cancelled_id);
+  g_clear_object(&ticket->cancellable);
+  g_free(ticket);
+}
+
+static void
+request_endpoint_free(RequestEndpoint *ep)
+{
+  for (guint p = 0; p < REQUEST_PRIORITY_COUNT; p++)
+    g_queue_clear_full(&ep->queued[p], (GDestroyNotify)request_ticket_free);
+  g_queue_clear_full(&ep->running, (GDestroyNotify)request_ticket_free);
+  g_free(ep->endpoint);
+  g_free(ep);
+}
+
+static RequestEndpoint *
+request_scheduler_get_endpoint(RequestScheduler *scheduler, const gchar *endpoint)
+{
+  RequestEndpoint *ep = g_hash_table_lookup(scheduler->endpoints, endpoint);
+  if (!ep)
+  {
+    ep = g_new0(RequestEndpoint, 1);
+    ep->endpoint = g_strdup(endpoint);
+    for (guint p = 0; p < REQUEST_PRIORITY_COUNT; p++)
+      g_queue_init(&ep->queued[p]);
+    g_queue_init(&ep->running);
+    g_hash_table_insert(scheduler->endpoints, ep->endpoint, ep);
+  }
+  return ep;
+}
+
+static guint
+request_endpoint_get_limit(RequestScheduler *scheduler, RequestEndpoint *ep)
+{
+  return MAX(1, ep->limit ? ep->limit : scheduler->default_limit);
+}
+
+static guint
+request_endpoint_count_running(RequestEndpoint *ep, guint64 owner)
+{
+  guint n = 0;
+  for (GList *l = ep->running.head; l; l = l->next)
+    n += ((RequestTicket *)l->data)->owner == owner;
+  return n;
+}
+
+/* Takes the next ticket that may start now off its queue, or NULL. */
+static RequestTicket *
+request_endpoint_pick(RequestScheduler *scheduler, RequestEndpoint *ep, gint64 now)
+{
+  guint limit = request_endpoint_get_limit(scheduler, ep);
+  if (ep->running.length >= limit)
+    return NULL;
+
+  GQueue *background = &ep->queued[REQUEST_PRIORITY_BACKGROUND];
+  while (background->head && now - ((RequestTicket *)background->head->data)->queued_us >= REQUEST_SCHEDULER_AGING_US)
+  {
+    RequestTicket *aged = g_queue_pop_head(background);
+    aged->priority = REQUEST_PRIORITY_INTERACTIVE;
+    g_queue_push_tail(&ep->queued[REQUEST_PRIORITY_INTERACTIVE], aged);
+    openai_ask_log("scheduler: %s background request aged into interactive", ep->endpoint);
+  }
+
+  for (guint p = 0; p < REQUEST_PRIORITY_COUNT; p++)
+  {
+    /* Keep the last free slot for whoever the user is waiting on. */
+    if (p == REQUEST_PRIORITY_BACKGROUND && ep->running.length > 0 && ep->running.length + 1 >= limit)
+      break;
+
+    GList *best = NULL;
+    guint best_load = G_MAXUINT;
+    for (GList *l = ep->queued[p].head; l && best_load > 0; l = l->next)
+    {
+      guint load = request_endpoint_count_running(ep, ((RequestTicket *)l->data)->owner);
+      if (load < best_load)
+      {
+        best = l;
+        best_load = load;
+      }
+    }
+    if (best)
+    {
+      RequestTicket *ticket = best->data;
+      g_queue_delete_link(&ep->queued[p], best);
+      return ticket;
+    }
+  }
+  return NULL;
+}
+
+static gboolean
+request_scheduler_dispatch(gpointer user_data)
+{
+  RequestScheduler *scheduler = user_data;
+  scheduler->dispatch_id = 0;
+
+  /* Collect first: start functions may submit or finish requests. */
+  GQueue ready = G_QUEUE_INIT;
+  gint64 now = g_get_monotonic_time();
+  GHashTableIter iter;
+  RequestEndpoint *ep = NULL;
+  g_hash_table_iter_init(&iter, scheduler->endpoints);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&ep))
+  {
+    for (guint p = 0; p < REQUEST_PRIORITY_COUNT; p++)
+    {
+      for (GList *l = ep->queued[p].head, *next = NULL; l; l = next)
+      {
+        next = l->next;
+        RequestTicket *ticket = l->data;
+        if (!ticket->cancellable || !g_cancellable_is_cancelled(ticket->cancellable))
+          continue;
+        g_queue_delete_link(&ep->queued[p], l);
+        ep->metrics.cancelled_queued++;
+        g_queue_push_tail(&ready, ticket);
+      }
+    }
+
+    RequestTicket *ticket = NULL;
+    while ((ticket = request_endpoint_pick(scheduler, ep, now)))
+    {
+      ticket->started_us = now;
+      g_queue_push_tail(&ep->running, ticket);
+      gint64 wait = now - ticket->queued_us;
+      ep->metrics.started++;
+      ep->metrics.wait_total_us += wait;
+      ep->metrics.wait_max_us = MAX(ep->metrics.wait_max_us, wait);
+      ep->metrics.wait_last_us = wait;
+      metrics_record_latency(METRICS_HISTOGRAM_QUEUE_WAIT, wait);
+      openai_ask_log("scheduler: start %s %s after %.1f ms, %u queued, %u/%u running",
+                     ep->endpoint,
+                     priority_names[ticket->priority],
+                     wait / 1000.0,
+                     ep->queued[0].length + ep->queued[1].length,
+                     ep->running.length,
+                     request_endpoint_get_limit(scheduler, ep));
+      g_queue_push_tail(&ready, ticket);
+    }
+  }
+
+  RequestTicket *ticket = NULL;
+  while ((ticket = g_queue_pop_head(&ready)))
+  {
+    if (ticket->cancelled_id)
+    {
+      g_signal_handler_disconnect(ticket->cancellable, ticket->cancelled_id);
+      ticket->cancelled_id = 0;
+    }
+    if (ticket->started_us)
+      ticket->start(ticket, ticket->user_data);
+    else
+    {
+      ticket->start(NULL, ticket->user_data);
+      request_ticket_free(ticket);
+    }
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* Dispatches ahead of redraws, so a request that can start right away never
+ * shows as queued. */
+static void
+request_scheduler_queue_dispatch(RequestScheduler *scheduler)
+{
+  if (!scheduler->dispatch_id)
+    scheduler->dispatch_id = g_idle_add_full(G_PRIORITY_DEFAULT, request_scheduler_dispatch, scheduler, NULL);
+}
+
+static void
+request_scheduler_on_cancelled(GCancellable *cancellable, gpointer user_data)
+{
+  (void)cancellable;
+  request_scheduler_queue_dispatch(user_data);
+}
+
+RequestScheduler *
+request_scheduler_new(void)
+{
+  RequestScheduler *scheduler = g_new0(RequestScheduler, 1);
+  scheduler->endpoints = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)request_endpoint_free);
+  scheduler->default_limit = REQUEST_SCHEDULER_DEFAULT_LIMIT;
+  return scheduler;
+}
+
+void
+request_scheduler_free(RequestScheduler *scheduler)
+{
+  if (!scheduler)
+    return;
+  g_clear_handle_id(&scheduler->dispatch_id, g_source_remove);
+  g_hash_table_destroy(scheduler->endpoints);
+  g_free(scheduler);
+}
+
+RequestScheduler *
+request_scheduler_get_default(void)
+{
+  static RequestScheduler *scheduler = NULL;
+  if (!scheduler)
+    scheduler = request_scheduler_new();
+  return scheduler;
+}
+
+guint64
+request_scheduler_new_owner(void)
+{
+  static guint64 next_owner = 0;
+  return ++next_owner;
+}
+
+void
+request_scheduler_set_limit(RequestScheduler *scheduler, const gchar *endpoint, guint limit)
+{
+  if (endpoint)
+    request_scheduler_get_endpoint(scheduler, endpoint)->limit = limit;
+  else
+    scheduler->default_limit = MAX(1, limit);
+  request_scheduler_queue_dispatch(scheduler);
+}
+
+void
+request_scheduler_submit(RequestScheduler *scheduler,
+                         const gchar *endpoint,
+                         RequestPriority priority,
+                         guint64 owner,
+                         GCancellable *cancellable,
+                         RequestStartFunc start,
+                         gpointer user_data)
+{
+  g_return_if_fail(endpoint != NULL);
+  g_return_if_fail(priority < REQUEST_PRIORITY_COUNT);
+
+  RequestTicket *ticket = g_new0(RequestTicket, 1);
+  ticket->scheduler = scheduler;
+  ticket->ep = request_scheduler_get_endpoint(scheduler, endpoint);
+  ticket->priority = priority;
+  ticket->owner = owner;
+  ticket->start = start;
+  ticket->user_data = user_data;
+  ticket->queued_us = g_get_monotonic_time();
+  if (cancellable)
+  {
+    ticket->cancellable = g_object_ref(cancellable);
+    ticket->cancelled_id =
+      g_signal_connect(cancellable, "cancelled", G_CALLBACK(request_scheduler_on_cancelled), scheduler);
+  }
+  g_queue_push_tail(&ticket->ep->queued[priority], ticket);
+  request_scheduler_queue_dispatch(scheduler);
+}
+
+guint
+request_scheduler_get_ahead(RequestScheduler *scheduler, const gchar *endpoint, RequestPriority priority)
+{
+  RequestEndpoint *ep = g_hash_table_lookup(scheduler->endpoints, endpoint);
+  if (!ep)
+    return 0;
+  guint ahead = 0;
+  for (guint p = 0; p <= priority && p < REQUEST_PRIORITY_COUNT; p++)
+    ahead += ep->queued[p].length;
+  return ahead;
+}
+
+gint64
+request_ticket_get_wait_us(const RequestTicket *ticket)
+{
+  return ticket->started_us - ticket->queued_us;
+}
+
+static void
+request_scheduler_append_metrics(RequestScheduler *scheduler, const gchar *endpoint, GString *out)
+{
+  RequestSchedulerMetrics m;
+  request_scheduler_get_metrics(scheduler, endpoint, &m);
+  g_string_append_printf(out,
+                         "%s: queued %u interactive, %u background; running %u/%u; "
+                         "started %" G_GUINT64_FORMAT ", cancelled while queued %" G_GUINT64_FORMAT "; "
+                         "wait mean %.1f ms, max %.1f ms",
+                         endpoint,
+                         m.queued[REQUEST_PRIORITY_INTERACTIVE],
+                         m.queued[REQUEST_PRIORITY_BACKGROUND],
+                         m.running,
+                         m.limit,
+                         m.started,
+                         m.cancelled_queued,
+                         m.started > 0 ? m.wait_total_us / 1000.0 / m.started : 0.0,
+                         m.wait_max_us / 1000.0);
+}
+
+void
+request_ticket_done(RequestTicket *ticket)
+{
+  if (!ticket)
+    return;
+  g_queue_remove(&ticket->ep->running, ticket);
+  g_autoptr(GString) metrics = g_string_new(NULL);
+  request_scheduler_append_metrics(ticket->scheduler, ticket->ep->endpoint, metrics);
+  openai_ask_log("scheduler: done after %.1f ms; %s",
+                 (g_get_monotonic_time() - ticket->started_us) / 1000.0,
+                 metrics->str);
+  request_scheduler_queue_dispatch(ticket->scheduler);
+  request_ticket_free(ticket);
+}
+
+gboolean
+request_scheduler_get_metrics(RequestScheduler *scheduler, const gchar *endpoint, RequestSchedulerMetrics *metrics)
+{
+  RequestEndpoint *ep = g_hash_table_lookup(scheduler->endpoints, endpoint);
+  if (!ep)
+    return FALSE;
+  *metrics = ep->metrics;
+  for (guint p = 0; p < REQUEST_PRIORITY_COUNT; p++)
+    metrics->queued[p] = ep->queued[p].length;
+  metrics->running = ep->running.length;
+  metrics->limit = request_endpoint_get_limit(scheduler, ep);
+  return TRUE;
+}
+
+gchar *
+request_scheduler_format_metrics(RequestScheduler *scheduler)
+{
+  GString *out = g_string_new(NULL);
+  GHashTableIter iter;
+  const gchar *endpoint = NULL;
+  g_hash_table_iter_init(&iter, scheduler->endpoints);
+  while (g_hash_table_iter_next(&iter, (gpointer *)&endpoint, NULL))
+  {
+    if (out->len > 0)
+      g_string_append_c(out, '\n');
+    request_scheduler_append_metrics(scheduler, endpoint, out);
+  }
+  return g_string_free(out, FALSE);
+}
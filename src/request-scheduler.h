@@ -0,0 +1,80 @@
+#pragma once
+
+#include <gio/gio.h>
+
+/* Requests in flight per endpoint unless set otherwise. */
+#define REQUEST_SCHEDULER_DEFAULT_LIMIT 2
+/* Background requests queued this long are ordered as interactive ones,
+ * so a busy user cannot starve compaction forever. */
+#define REQUEST_SCHEDULER_AGING_US (30 * G_USEC_PER_SEC)
+
+typedef enum
+{
+  REQUEST_PRIORITY_INTERACTIVE, /* someone is watching a spinner */
+  REQUEST_PRIORITY_BACKGROUND, /* compaction, prefetch, batch jobs */
+  REQUEST_PRIORITY_COUNT,
+} RequestPriority;
+
+/* Queues requests per endpoint and starts them when the endpoint has a free
+ * slot: interactive before background, and within a priority the oldest
+ * request of the owner (e.g. conversation) with the fewest requests already
+ * running, so one busy conversation cannot hold every slot. Background work
+ * never takes the last slot. Main thread only. */
+typedef struct _RequestScheduler RequestScheduler;
+typedef struct _RequestTicket RequestTicket;
+
+/* Called from the main loop once the request may start. The request must
+ * end with request_ticket_done(), whatever its outcome. @ticket is NULL if
+ * the request's cancellable fired while it was still queued. */
+typedef void (*RequestStartFunc)(RequestTicket *ticket, gpointer user_data);
+
+typedef struct
+{
+  guint queued[REQUEST_PRIORITY_COUNT];
+  guint running;
+  guint limit;
+  guint64 started;
+  guint64 cancelled_queued;
+  gint64 wait_total_us;
+  gint64 wait_max_us;
+  gint64 wait_last_us;
+} RequestSchedulerMetrics;
+
+RequestScheduler *request_scheduler_new(void);
+void request_scheduler_free(RequestScheduler *scheduler);
+
+/* The process-wide scheduler shared by every panel instance in it. */
+RequestScheduler *request_scheduler_get_default(void);
+
+/* A new owner id for request_scheduler_submit(). Ids come from one
+ * process-wide counter, so owners of different panel instances never
+ * share one. */
+guint64 request_scheduler_new_owner(void);
+
+/* Sets the limit for @endpoint, or the default for endpoints without their
+ * own when @endpoint is NULL. Raising a limit starts queued requests. */
+void request_scheduler_set_limit(RequestScheduler *scheduler, const gchar *endpoint, guint limit);
+
+void request_scheduler_submit(RequestScheduler *scheduler,
+                              const gchar *endpoint,
+                              RequestPriority priority,
+                              guint64 owner,
+                              GCancellable *cancellable,
+                              RequestStartFunc start,
+                              gpointer user_data);
+
+/* Number of requests for @endpoint that start before one of @priority
+ * submitted now would. */
+guint request_scheduler_get_ahead(RequestScheduler *scheduler, const gchar *endpoint, RequestPriority priority);
+
+/* Time the request spent queued. */
+gint64 request_ticket_get_wait_us(const RequestTicket *ticket);
+/* Frees the slot and @ticket. */
+void request_ticket_done(RequestTicket *ticket);
+
+/* FALSE if nothing was ever submitted for @endpoint. */
+gboolean request_scheduler_get_metrics(RequestScheduler *scheduler,
+                                       const gchar *endpoint,
+                                       RequestSchedulerMetrics *metrics);
+/* One line per endpoint: queue depth, running/limit and wait times. */
+gchar *request_scheduler_format_metrics(RequestScheduler *scheduler);
@@ -0,0 +1,506 @@
+#include "retrieval.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "openai-client.h"
+#include "vector-index.h"
+
+#define RETRIEVAL_EMBED_BATCH 32
+#define RETRIEVAL_MAX_FILE_BYTES (2 * 1024 * 1024)
+#define RETRIEVAL_MAX_DEPTH 16
+
+static const gchar retrieval_context_header[] =
+  "These excerpts from the user's local documents may be relevant. Use them if they help, and say "
+  "which file an answer comes from.";
+
+static const gchar *const retrieval_extensions[] = {".md", ".markdown", ".txt", ".rst", ".adoc", ".org"};
+
+struct _Retrieval
+{
+  gchar *path;
+  VectorIndex *index; /* NULL until a pass has written one */
+  gchar **dirs;
+  gchar *url;
+  gchar *api_key;
+  gchar *model;
+  GCancellable *cancellable; /* of the running pass */
+  gboolean rerun; /* configured again while a pass ran */
+  gint64 last_pass_us;
+};
+
+/* What a pass works from, copied so the worker shares nothing. */
+typedef struct
+{
+  gchar *path;
+  gchar **dirs;
+  gchar *url;
+  gchar *api_key;
+  gchar *model;
+} RetrievalPass;
+
+static void
+retrieval_pass_free(gpointer data)
+{
+  RetrievalPass *pass = data;
+  g_free(pass->path);
+  g_strfreev(pass->dirs);
+  g_free(pass->url);
+  g_free(pass->api_key);
+  g_free(pass->model);
+  g_free(pass);
+}
+
+gchar *
+retrieval_default_path(void)
+{
+  const gchar *cache = g_get_user_cache_dir();
+  if (!cache || !*cache)
+    cache = g_get_home_dir();
+  g_autofree gchar *dir = g_build_filename(cache, "openai-ask", NULL);
+  g_mkdir_with_parents(dir, 0700);
+  return g_build_filename(dir, "retrieval.idx", NULL);
+}
+
+/* Appends @text to @chunks in pieces of at most RETRIEVAL_CHUNK_BYTES,
+ * broken at the last newline or space that keeps a piece over half full. */
+static void
+retrieval_split_long(const gchar *text, GPtrArray *chunks)
+{
+  const gchar *p = text;
+  gsize left = strlen(text);
+  while (left > RETRIEVAL_CHUNK_BYTES)
+  {
+    const gchar *limit = p + RETRIEVAL_CHUNK_BYTES;
+    const gchar *cut = NULL;
+    for (const gchar *q = limit; q > p + RETRIEVAL_CHUNK_BYTES / 2 && !cut; q--)
+    {
+      if (*q == '\n')
+        cut = q;
+    }
+    for (const gchar *q = limit; q > p + RETRIEVAL_CHUNK_BYTES / 2 && !cut; q--)
+    {
+      if (*q == ' ')
+        cut = q;
+    }
+    if (!cut)
+      cut = g_utf8_find_prev_char(p, limit + 1);
+    g_ptr_array_add(chunks, g_strndup(p, (gsize)(cut - p)));
+    left -= (gsize)(cut - p);
+    p = cut;
+    while (left > 0 && g_ascii_isspace(*p))
+    {
+      p++;
+      left--;
+    }
+  }
+  if (left > 0)
+    g_ptr_array_add(chunks, g_strdup(p));
+}
+
+GPtrArray *
+retrieval_chunk_text(const gchar *text)
+{
+  GPtrArray *chunks = g_ptr_array_new_with_free_func(g_free);
+  g_auto(GStrv) paragraphs = g_strsplit(text, "\n\n", -1);
+  g_autoptr(GString) current = g_string_new(NULL);
+  for (guint i = 0; paragraphs[i]; i++)
+  {
+    gchar *para = g_strstrip(paragraphs[i]);
+    gsize len = strlen(para);
+    if (len == 0)
+      continue;
+    if (current->len > 0 && current->len + 2 + len > RETRIEVAL_CHUNK_BYTES)
+    {
+      g_ptr_array_add(chunks, g_strdup(current->str));
+      g_string_truncate(current, 0);
+    }
+    if (len > RETRIEVAL_CHUNK_BYTES)
+    {
+      retrieval_split_long(para, chunks);
+      continue;
+    }
+    if (current->len > 0)
+      g_string_append(current, "\n\n");
+    g_string_append_len(current, para, (gssize)len);
+  }
+  if (current->len > 0)
+    g_ptr_array_add(chunks, g_strdup(current->str));
+  return chunks;
+}
+
+static gboolean
+retrieval_is_document(const gchar *name)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(retrieval_extensions); i++)
+  {
+    if (g_str_has_suffix(name, retrieval_extensions[i]))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Hidden entries and symlinked directories are skipped. */
+static void
+retrieval_collect(const gchar *dir, guint depth, GPtrArray *paths)
+{
+  g_autoptr(GDir) d = depth < RETRIEVAL_MAX_DEPTH ? g_dir_open(dir, 0, NULL) : NULL;
+  if (!d)
+    return;
+  const gchar *name = NULL;
+  while ((name = g_dir_read_name(d)))
+  {
+    if (name[0] == '.')
+      continue;
+    g_autofree gchar *path = g_build_filename(dir, name, NULL);
+    if (g_file_test(path, G_FILE_TEST_IS_SYMLINK) && g_file_test(path, G_FILE_TEST_IS_DIR))
+      continue;
+    if (g_file_test(path, G_FILE_TEST_IS_DIR))
+      retrieval_collect(path, depth + 1, paths);
+    else if (retrieval_is_document(name) && g_file_test(path, G_FILE_TEST_IS_REGULAR))
+      g_ptr_array_add(paths, g_steal_pointer(&path));
+  }
+}
+
+static gint
+retrieval_cmp_path(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+/* Embeds @chunks of @path in batches; NULL on error. The file name goes in
+ * front of each chunk, so a question naming a runbook finds it. */
+static gfloat *
+retrieval_embed_chunks(const RetrievalPass *pass,
+                       const gchar *path,
+                       GPtrArray *chunks,
+                       guint *dim,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+  g_autofree gchar *name = g_path_get_basename(path);
+  g_autofree gfloat *vectors = NULL;
+  for (guint start = 0; start < chunks->len; start += RETRIEVAL_EMBED_BATCH)
+  {
+    guint n = MIN(RETRIEVAL_EMBED_BATCH, chunks->len - start);
+    g_auto(GStrv) inputs = g_new0(gchar *, n + 1);
+    for (guint i = 0; i < n; i++)
+      inputs[i] = g_strconcat(name, "\n\n", (const gchar *)g_ptr_array_index(chunks, start + i), NULL);
+
+    guint batch_dim = 0;
+    g_autofree gfloat *batch = openai_client_embed_sync(pass->url,
+                                                        pass->api_key,
+                                                        pass->model,
+                                                        (const gchar *const *)inputs,
+                                                        &batch_dim,
+                                                        cancellable,
+                                                        error);
+    if (!batch)
+      return NULL;
+    if (!vectors)
+    {
+      *dim = batch_dim;
+      vectors = g_new(gfloat, (gsize)chunks->len * batch_dim);
+    }
+    else if (batch_dim != *dim)
+    {
+      g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Embeddings changed size between requests.");
+      return NULL;
+    }
+    memcpy(vectors + (gsize)start * *dim, batch, (gsize)n * *dim * sizeof(gfloat));
+  }
+  return g_steal_pointer(&vectors);
+}
+
+/* Returns TRUE from the task if the index file was rewritten or removed.
+ * Files that kept their mtime and size reuse the chunks and vectors of the
+ * old index; a failed request stops the pass and keeps the old index. */
+static void
+retrieval_pass_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+  (void)source_object;
+  RetrievalPass *pass = task_data;
+  gint64 t0 = g_get_monotonic_time();
+
+  g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+  for (guint i = 0; pass->dirs[i]; i++)
+    retrieval_collect(pass->dirs[i], 0, paths);
+  g_ptr_array_sort(paths, retrieval_cmp_path);
+
+  VectorIndex *old = vector_index_open(pass->path, NULL);
+  if (old && g_strcmp0(vector_index_get_model(old), pass->model) != 0)
+    g_clear_pointer(&old, vector_index_unref);
+
+  guint index_dim = old ? vector_index_get_dim(old) : 0;
+  VectorIndexWriter *writer = old ? vector_index_writer_new(index_dim, pass->model) : NULL;
+  guint reused = 0, embedded = 0;
+  g_autoptr(GError) error = NULL;
+  const gchar *prev = NULL;
+  for (guint i = 0; i < paths->len && !error; i++)
+  {
+    const gchar *path = g_ptr_array_index(paths, i);
+    if (g_strcmp0(path, prev) == 0)
+      continue; /* overlapping directories */
+    prev = path;
+    if (g_cancellable_set_error_if_cancelled(cancellable, &error))
+      break;
+
+    GStatBuf st;
+    if (g_stat(path, &st) != 0 || st.st_size > RETRIEVAL_MAX_FILE_BYTES)
+      continue;
+    guint first = 0, n = 0;
+    if (old && vector_index_lookup_file(old, path, (gint64)st.st_mtime, (guint64)st.st_size, &first, &n))
+    {
+      vector_index_writer_add_file(writer, path, (gint64)st.st_mtime, (guint64)st.st_size);
+      for (guint c = first; c < first + n; c++)
+        vector_index_writer_add_chunk(writer, vector_index_get_text(old, c), vector_index_get_vector(old, c));
+      reused++;
+      continue;
+    }
+
+    g_autofree gchar *text = NULL;
+    gsize len = 0;
+    if (!g_file_get_contents(path, &text, &len, NULL) || !g_utf8_validate(text, (gssize)len, NULL))
+      continue;
+    g_autoptr(GPtrArray) chunks = retrieval_chunk_text(text);
+    if (chunks->len == 0)
+      continue;
+    guint dim = 0;
+    g_autofree gfloat *vectors = retrieval_embed_chunks(pass, path, chunks, &dim, cancellable, &error);
+    if (!vectors)
+      break;
+    if (!writer)
+    {
+      index_dim = dim;
+      writer = vector_index_writer_new(dim, pass->model);
+    }
+    if (dim != index_dim)
+    {
+      g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Embeddings changed size; clear the index.");
+      break;
+    }
+    vector_index_writer_add_file(writer, path, (gint64)st.st_mtime, (guint64)st.st_size);
+    for (guint c = 0; c < chunks->len; c++)
+      vector_index_writer_add_chunk(writer, g_ptr_array_index(chunks, c), vectors + (gsize)c * dim);
+    embedded++;
+  }
+
+  gboolean changed = FALSE;
+  guint old_files = old ? vector_index_get_file_count(old) : 0;
+  if (error)
+    openai_ask_log("retrieval: pass stopped: %s", error->message);
+  else if (embedded > 0 || reused != old_files)
+  {
+    g_autoptr(GError) save_error = NULL;
+    if (writer && vector_index_writer_get_count(writer) > 0)
+      changed = vector_index_writer_save(writer, pass->path, &save_error);
+    else
+      changed = g_unlink(pass->path) == 0;
+    if (save_error)
+      openai_ask_log("retrieval: %s", save_error->message);
+  }
+  openai_ask_log("retrieval: %u files, %u embedded, %u unchanged, %u chunks in %.1f ms",
+                 paths->len,
+                 embedded,
+                 reused,
+                 writer ? vector_index_writer_get_count(writer) : 0,
+                 (g_get_monotonic_time() - t0) / 1000.0);
+  vector_index_writer_free(writer);
+  vector_index_unref(old);
+  g_task_return_boolean(task, changed);
+}
+
+static void retrieval_start_pass(Retrieval *retrieval);
+
+static void
+retrieval_on_pass_done(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  (void)source_object;
+  if (g_cancellable_is_cancelled(g_task_get_cancellable(G_TASK(res))))
+    return; /* @user_data is gone */
+
+  Retrieval *retrieval = user_data;
+  g_clear_object(&retrieval->cancellable);
+  if (g_task_propagate_boolean(G_TASK(res), NULL))
+  {
+    g_clear_pointer(&retrieval->index, vector_index_unref);
+    retrieval->index = vector_index_open(retrieval->path, NULL);
+  }
+  if (retrieval->rerun)
+    retrieval_start_pass(retrieval);
+}
+
+static void
+retrieval_start_pass(Retrieval *retrieval)
+{
+  retrieval->rerun = FALSE;
+  if (retrieval->cancellable)
+  {
+    retrieval->rerun = TRUE;
+    return;
+  }
+  if (!retrieval->dirs || !retrieval->dirs[0] || !retrieval->url)
+    return;
+
+  RetrievalPass *pass = g_new0(RetrievalPass, 1);
+  pass->path = g_strdup(retrieval->path);
+  pass->dirs = g_strdupv(retrieval->dirs);
+  pass->url = g_strdup(retrieval->url);
+  pass->api_key = g_strdup(retrieval->api_key);
+  pass->model = g_strdup(retrieval->model);
+  retrieval->last_pass_us = g_get_monotonic_time();
+  retrieval->cancellable = g_cancellable_new();
+
+  GTask *task = g_task_new(NULL, retrieval->cancellable, retrieval_on_pass_done, retrieval);
+  g_task_set_task_data(task, pass, retrieval_pass_free);
+  g_task_run_in_thread(task, retrieval_pass_thread);
+  g_object_unref(task);
+}
+
+Retrieval *
+retrieval_new(const gchar *index_path)
+{
+  Retrieval *retrieval = g_new0(Retrieval, 1);
+  retrieval->path = g_strdup(index_path);
+  retrieval->index = vector_index_open(index_path, NULL);
+  return retrieval;
+}
+
+void
+retrieval_free(Retrieval *retrieval)
+{
+  if (!retrieval)
+    return;
+  if (retrieval->cancellable)
+    g_cancellable_cancel(retrieval->cancellable);
+  g_clear_object(&retrieval->cancellable);
+  vector_index_unref(retrieval->index);
+  g_free(retrieval->path);
+  g_strfreev(retrieval->dirs);
+  g_free(retrieval->url);
+  g_free(retrieval->api_key);
+  g_free(retrieval->model);
+  g_free(retrieval);
+}
+
+void
+retrieval_configure(Retrieval *retrieval,
+                    const gchar *const *dirs,
+                    const gchar *url,
+                    const gchar *api_key,
+                    const gchar *model)
+{
+  if (retrieval->dirs && g_strv_equal((const gchar *const *)retrieval->dirs, dirs) &&
+      g_strcmp0(retrieval->url, url) == 0 && g_strcmp0(retrieval->api_key, api_key) == 0 &&
+      g_strcmp0(retrieval->model, model) == 0)
+    return;
+
+  g_strfreev(retrieval->dirs);
+  retrieval->dirs = g_strdupv((gchar **)dirs);
+  g_free(retrieval->url);
+  retrieval->url = g_strdup(url);
+  g_free(retrieval->api_key);
+  retrieval->api_key = g_strdup(api_key);
+  g_free(retrieval->model);
+  retrieval->model = g_strdup(model);
+  retrieval_start_pass(retrieval);
+}
+
+void
+retrieval_refresh(Retrieval *retrieval)
+{
+  if (g_get_monotonic_time() - retrieval->last_pass_us >= RETRIEVAL_RESCAN_S * G_USEC_PER_SEC)
+    retrieval_start_pass(retrieval);
+}
+
+gboolean
+retrieval_is_ready(Retrieval *retrieval)
+{
+  return retrieval->index && vector_index_get_count(retrieval->index) > 0 &&
+         g_strcmp0(vector_index_get_model(retrieval->index), retrieval->model) == 0;
+}
+
+typedef struct
+{
+  VectorIndex *index;
+  GCancellable *cancellable;
+  RetrievalCallback callback;
+  gpointer user_data;
+} RetrievalSearch;
+
+/* The hits as "[~/docs/db.md]\n<chunk>" paragraphs under a short header. */
+static gchar *
+retrieval_format_context(VectorIndex *index, const VectorIndexHit *hits, guint n)
+{
+  const gchar *home = g_get_home_dir();
+  g_autoptr(GString) context = g_string_new(retrieval_context_header);
+  guint used = 0;
+  for (guint i = 0; i < n && hits[i].score >= RETRIEVAL_MIN_SCORE; i++)
+  {
+    const gchar *path = vector_index_get_path(index, hits[i].chunk);
+    gboolean in_home = home && g_str_has_prefix(path, home) && path[strlen(home)] == G_DIR_SEPARATOR;
+    g_string_append_printf(context,
+                           "\n\n[%s%s]\n%s",
+                           in_home ? "~" : "",
+                           in_home ? path + strlen(home) : path,
+                           vector_index_get_text(index, hits[i].chunk));
+    used++;
+  }
+  if (used == 0)
+    return NULL;
+  return g_string_free(g_steal_pointer(&context), FALSE);
+}
+
+static void
+retrieval_on_query_embedded(const gfloat *vectors, guint dim, const GError *error, gpointer user_data)
+{
+  RetrievalSearch *search = user_data;
+  g_autofree gchar *context = NULL;
+  if (!vectors)
+    openai_ask_log("retrieval: query not embedded: %s", error ? error->message : "unknown error");
+  else if (dim != vector_index_get_dim(search->index))
+    openai_ask_log("retrieval: query has %u dimensions, the index %u", dim, vector_index_get_dim(search->index));
+  else if (!g_cancellable_is_cancelled(search->cancellable))
+  {
+    gint64 t0 = g_get_monotonic_time();
+    g_autofree gfloat *query = g_memdup2(vectors, (gsize)dim * sizeof(gfloat));
+    vector_index_normalize(query, dim);
+    VectorIndexHit hits[RETRIEVAL_TOP_K];
+    guint n = vector_index_search(search->index, query, hits, RETRIEVAL_TOP_K);
+    context = retrieval_format_context(search->index, hits, n);
+    openai_ask_log("retrieval: searched %u chunks in %.2f ms, best %.3f",
+                   vector_index_get_count(search->index),
+                   (g_get_monotonic_time() - t0) / 1000.0,
+                   n > 0 ? hits[0].score : 0.0f);
+  }
+
+  search->callback(context, search->user_data);
+  vector_index_unref(search->index);
+  g_clear_object(&search->cancellable);
+  g_free(search);
+}
+
+void
+retrieval_search_async(Retrieval *retrieval,
+                       const gchar *query,
+                       GCancellable *cancellable,
+                       RetrievalCallback callback,
+                       gpointer user_data)
+{
+  g_return_if_fail(retrieval_is_ready(retrieval));
+
+  RetrievalSearch *search = g_new0(RetrievalSearch, 1);
+  search->index = vector_index_ref(retrieval->index);
+  search->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+  search->callback = callback;
+  search->user_data = user_data;
+  const gchar *inputs[] = {query, NULL};
+  openai_client_embed_async(retrieval->url,
+                            retrieval->api_key,
+                            retrieval->model,
+                            inputs,
+                            cancellable,
+                            retrieval_on_query_embedded,
+                            search);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/* Chunks of about this many bytes are embedded and retrieved. */
+#define RETRIEVAL_CHUNK_BYTES 1500
+/* Chunks added to a question at most, and how similar they must be. */
+#define RETRIEVAL_TOP_K 4
+#define RETRIEVAL_MIN_SCORE 0.25f
+/* Directories are scanned again when asked after this long. */
+#define RETRIEVAL_RESCAN_S (10 * 60)
+
+/* Text files (.md, .txt, .rst, .adoc, .org) under the configured
+ * directories, chunked and embedded through an OpenAI-compatible
+ * embeddings endpoint into a VectorIndex. A pass over the directories runs
+ * on a worker thread and only embeds files whose mtime or size changed.
+ * Main thread only. */
+typedef struct _Retrieval Retrieval;
+
+/* Maps the index at @index_path if there is one; nothing is scanned until
+ * retrieval_configure(). */
+Retrieval *retrieval_new(const gchar *index_path);
+void retrieval_free(Retrieval *retrieval);
+
+/* @url is the embeddings endpoint itself. A change to any of these starts
+ * a pass; a different @model re-embeds everything. */
+void retrieval_configure(Retrieval *retrieval,
+                         const gchar *const *dirs,
+                         const gchar *url,
+                         const gchar *api_key,
+                         const gchar *model);
+/* Starts a pass if the last one is older than RETRIEVAL_RESCAN_S. */
+void retrieval_refresh(Retrieval *retrieval);
+/* Whether there is an index, made with the configured model, to search. */
+gboolean retrieval_is_ready(Retrieval *retrieval);
+
+/* @context is the best matching chunks formatted for a system prompt, or
+ * NULL if none is similar enough or the query could not be embedded. */
+typedef void (*RetrievalCallback)(const gchar *context, gpointer user_data);
+/* Embeds @query and searches the index. @callback is always called, also
+ * when @cancellable is cancelled. */
+void retrieval_search_async(Retrieval *retrieval,
+                            const gchar *query,
+                            GCancellable *cancellable,
+                            RetrievalCallback callback,
+                            gpointer user_data);
+
+/* Splits @text into chunks of about RETRIEVAL_CHUNK_BYTES at paragraph,
+ * then line or word boundaries (element-type utf8). */
+GPtrArray *retrieval_chunk_text(const gchar *text);
+
+/* $XDG_CACHE_HOME/openai-ask/retrieval.idx */
+gchar *retrieval_default_path(void);
@@ -0,0 +1,221 @@
+#include "settings.h"
+
+#include <string.h>
+
+#include "request-scheduler.h"
+
+static const gchar *KF_GROUP = "config";
+static const gchar *KF_ENDPOINT = "endpoint";
+static const gchar *KF_MODEL = "model";
+static const gchar *KF_BACKEND = "backend";
+static const gchar *KF_SYSTEM_PROMPT = "system_prompt";
+static const gchar *KF_COMPACT_MODEL = "compact_model";
+static const gchar *KF_ROUTE_MODELS = "route_models";
+static const gchar *KF_DRAFT_MODEL = "draft_model";
+static const gchar *KF_TEMPERATURE = "temperature";
+static const gchar *KF_WIDTH_CHARS = "width_chars";
+static const gchar *KF_REPLY_WIDTH_PX = "reply_width_px";
+static const gchar *KF_REPLY_OPACITY_PCT = "reply_opacity_pct";
+static const gchar *KF_FIT_ANSWERS = "fit_answers";
+static const gchar *KF_USE_ENGINE = "use_engine";
+static const gchar *KF_MAX_REQUESTS = "max_requests";
+static const gchar *KF_RETRIEVAL_DIRS = "retrieval_dirs";
+static const gchar *KF_EMBEDDINGS_ENDPOINT = "embeddings_endpoint";
+static const gchar *KF_EMBEDDINGS_MODEL = "embeddings_model";
+
+void
+openai_ask_settings_init(OpenaiAskSettings *settings)
+{
+  settings->endpoint = g_strdup("https://api.openai.com/v1/chat/completions");
+  settings->model = g_strdup("gpt-4o-mini");
+  settings->backend = g_strdup("openai");
+  settings->system_prompt = g_strdup("");
+  settings->compact_model = g_strdup("");
+  settings->route_models = g_strdup("");
+  settings->draft_model = g_strdup("");
+  settings->temperature = 0.7;
+  settings->width_chars = 18;
+  settings->reply_width_px = 0;
+  settings->reply_opacity_pct = 100;
+  settings->fit_answers = FALSE;
+  settings->use_engine = FALSE;
+  settings->max_requests = REQUEST_SCHEDULER_DEFAULT_LIMIT;
+  settings->retrieval_dirs = g_strdup("");
+  settings->embeddings_endpoint = g_strdup("");
+  settings->embeddings_model = g_strdup("text-embedding-3-small");
+}
+
+void
+openai_ask_settings_clear(OpenaiAskSettings *settings)
+{
+  g_clear_pointer(&settings->endpoint, g_free);
+  g_clear_pointer(&settings->model, g_free);
+  g_clear_pointer(&settings->backend, g_free);
+  g_clear_pointer(&settings->system_prompt, g_free);
+  g_clear_pointer(&settings->compact_model, g_free);
+  g_clear_pointer(&settings->route_models, g_free);
+  g_clear_pointer(&settings->draft_model, g_free);
+  g_clear_pointer(&settings->retrieval_dirs, g_free);
+  g_clear_pointer(&settings->embeddings_endpoint, g_free);
+  g_clear_pointer(&settings->embeddings_model, g_free);
+}
+
+gboolean
+openai_ask_settings_load(OpenaiAskSettings *settings, const gchar *path)
+{
+  if (!path)
+    return FALSE;
+
+  g_autoptr(GKeyFile) kf = g_key_file_new();
+  g_autoptr(GError) error = NULL;
+  if (!g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, &error))
+    return FALSE;
+
+  g_autofree gchar *endpoint = g_key_file_get_string(kf, KF_GROUP, KF_ENDPOINT, NULL);
+  g_autofree gchar *model = g_key_file_get_string(kf, KF_GROUP, KF_MODEL, NULL);
+  g_autofree gchar *backend = g_key_file_get_string(kf, KF_GROUP, KF_BACKEND, NULL);
+  g_autofree gchar *system_prompt = g_key_file_get_string(kf, KF_GROUP, KF_SYSTEM_PROMPT, NULL);
+  g_autofree gchar *compact_model = g_key_file_get_string(kf, KF_GROUP, KF_COMPACT_MODEL, NULL);
+  g_autofree gchar *route_models = g_key_file_get_string(kf, KF_GROUP, KF_ROUTE_MODELS, NULL);
+  g_autofree gchar *draft_model = g_key_file_get_string(kf, KF_GROUP, KF_DRAFT_MODEL, NULL);
+  g_autofree gchar *retrieval_dirs = g_key_file_get_string(kf, KF_GROUP, KF_RETRIEVAL_DIRS, NULL);
+  g_autofree gchar *embeddings_endpoint = g_key_file_get_string(kf, KF_GROUP, KF_EMBEDDINGS_ENDPOINT, NULL);
+  g_autofree gchar *embeddings_model = g_key_file_get_string(kf, KF_GROUP, KF_EMBEDDINGS_MODEL, NULL);
+
+  if (endpoint && *endpoint)
+  {
+    g_free(settings->endpoint);
+    settings->endpoint = g_steal_pointer(&endpoint);
+  }
+  if (model && *model)
+  {
+    g_free(settings->model);
+    settings->model = g_steal_pointer(&model);
+  }
+  if (backend && *backend)
+  {
+    g_free(settings->backend);
+    settings->backend = g_steal_pointer(&backend);
+  }
+  if (system_prompt)
+  {
+    g_free(settings->system_prompt);
+    settings->system_prompt = g_steal_pointer(&system_prompt);
+  }
+  if (compact_model)
+  {
+    g_free(settings->compact_model);
+    settings->compact_model = g_steal_pointer(&compact_model);
+  }
+  if (route_models)
+  {
+    g_free(settings->route_models);
+    settings->route_models = g_steal_pointer(&route_models);
+  }
+  if (draft_model)
+  {
+    g_free(settings->draft_model);
+    settings->draft_model = g_steal_pointer(&draft_model);
+  }
+  if (retrieval_dirs)
+  {
+    g_free(settings->retrieval_dirs);
+    settings->retrieval_dirs = g_steal_pointer(&retrieval_dirs);
+  }
+  if (embeddings_endpoint)
+  {
+    g_free(settings->embeddings_endpoint);
+    settings->embeddings_endpoint = g_steal_pointer(&embeddings_endpoint);
+  }
+  if (embeddings_model && *embeddings_model)
+  {
+    g_free(settings->embeddings_model);
+    settings->embeddings_model = g_steal_pointer(&embeddings_model);
+  }
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_TEMPERATURE, NULL))
+    settings->temperature = g_key_file_get_double(kf, KF_GROUP, KF_TEMPERATURE, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_WIDTH_CHARS, NULL))
+    settings->width_chars = g_key_file_get_integer(kf, KF_GROUP, KF_WIDTH_CHARS, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_REPLY_WIDTH_PX, NULL))
+    settings->reply_width_px = g_key_file_get_integer(kf, KF_GROUP, KF_REPLY_WIDTH_PX, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, NULL))
+    settings->reply_opacity_pct = g_key_file_get_integer(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_FIT_ANSWERS, NULL))
+    settings->fit_answers = g_key_file_get_boolean(kf, KF_GROUP, KF_FIT_ANSWERS, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_USE_ENGINE, NULL))
+    settings->use_engine = g_key_file_get_boolean(kf, KF_GROUP, KF_USE_ENGINE, NULL);
+
+  if (g_key_file_has_key(kf, KF_GROUP, KF_MAX_REQUESTS, NULL))
+    settings->max_requests = MAX(1, g_key_file_get_integer(kf, KF_GROUP, KF_MAX_REQUESTS, NULL));
+  return TRUE;
+}
+
+gboolean
+openai_ask_settings_save(const OpenaiAskSettings *settings, const gchar *path)
+{
+  if (!path)
+    return FALSE;
+
+  g_autoptr(GKeyFile) kf = g_key_file_new();
+  g_key_file_set_string(kf, KF_GROUP, KF_ENDPOINT, settings->endpoint ? settings->endpoint : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_MODEL, settings->model ? settings->model : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_BACKEND, settings->backend ? settings->backend : "openai");
+  g_key_file_set_string(kf, KF_GROUP, KF_SYSTEM_PROMPT, settings->system_prompt ? settings->system_prompt : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_COMPACT_MODEL, settings->compact_model ? settings->compact_model : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_ROUTE_MODELS, settings->route_models ? settings->route_models : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_DRAFT_MODEL, settings->draft_model ? settings->draft_model : "");
+  g_key_file_set_double(kf, KF_GROUP, KF_TEMPERATURE, settings->temperature);
+  g_key_file_set_integer(kf, KF_GROUP, KF_WIDTH_CHARS, settings->width_chars);
+  g_key_file_set_integer(kf, KF_GROUP, KF_REPLY_WIDTH_PX, settings->reply_width_px);
+  g_key_file_set_integer(kf, KF_GROUP, KF_REPLY_OPACITY_PCT, settings->reply_opacity_pct);
+  g_key_file_set_boolean(kf, KF_GROUP, KF_FIT_ANSWERS, settings->fit_answers);
+  g_key_file_set_boolean(kf, KF_GROUP, KF_USE_ENGINE, settings->use_engine);
+  g_key_file_set_integer(kf, KF_GROUP, KF_MAX_REQUESTS, settings->max_requests);
+  g_key_file_set_string(kf, KF_GROUP, KF_RETRIEVAL_DIRS, settings->retrieval_dirs ? settings->retrieval_dirs : "");
+  g_key_file_set_string(kf,
+                        KF_GROUP,
+                        KF_EMBEDDINGS_ENDPOINT,
+                        settings->embeddings_endpoint ? settings->embeddings_endpoint : "");
+  g_key_file_set_string(kf, KF_GROUP, KF_EMBEDDINGS_MODEL, settings->embeddings_model ? settings->embeddings_model : "");
+
+  gsize len = 0;
+  g_autofree gchar *data = g_key_file_to_data(kf, &len, NULL);
+  if (!data)
+    return FALSE;
+  return g_file_set_contents(path, data, (gssize)len, NULL);
+}
+
+static gint
+openai_ask_settings_cmp_path(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+gchar *
+openai_ask_settings_find_panel_rc(void)
+{
+  /* xfce_panel_plugin_save_location() uses xfce4/panel/<name>-<id>.rc. */
+  g_autofree gchar *dir = g_build_filename(g_get_user_config_dir(), "xfce4", "panel", NULL);
+  g_autoptr(GDir) d = g_dir_open(dir, 0, NULL);
+  if (!d)
+    return NULL;
+
+  g_autoptr(GPtrArray) found = g_ptr_array_new_with_free_func(g_free);
+  const gchar *name = NULL;
+  while ((name = g_dir_read_name(d)))
+  {
+    if (g_str_has_prefix(name, "openai-ask-") && g_str_has_suffix(name, ".rc"))
+      g_ptr_array_add(found, g_build_filename(dir, name, NULL));
+  }
+  if (found->len == 0)
+    return NULL;
+
+  g_ptr_array_sort(found, openai_ask_settings_cmp_path);
+  return g_strdup(g_ptr_array_index(found, 0));
+}
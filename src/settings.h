@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glib.h>
+
+/* Configuration shared by the panel plugin and xfce-ask-cli. Stored as a
+ * key file in the panel's per-plugin rc file. */
+typedef struct
+{
+  gchar *endpoint;
+  gchar *model;
+  gchar *backend; /* openai_client_backend_get_name(): "openai", "ollama", "llama.cpp" */
+  gchar *system_prompt;
+  gchar *compact_model; /* summarizes older follow-up turns; "" = just drop them */
+  gchar *route_models; /* ';'-separated, smallest first, picked per question; "" = always model */
+  gchar *draft_model; /* fast model asked alongside, shown until the answer arrives; "" = off */
+  gdouble temperature;
+  gint width_chars;
+  gint reply_width_px; /* 0 = match anchor width */
+  gint reply_opacity_pct; /* 0..100, affects background only */
+  gboolean fit_answers; /* limit answers to what the popup shows, see output-budget.h */
+  gboolean use_engine; /* send through the shared xfce-ask-engine daemon */
+  gint max_requests; /* in flight per endpoint; the rest queue */
+  gchar *retrieval_dirs; /* ';'-separated directories to answer from; "" = off */
+  gchar *embeddings_endpoint; /* "" = next to the chat endpoint */
+  gchar *embeddings_model;
+} OpenaiAskSettings;
+
+/* Fills in the defaults; strings are owned by @settings. */
+void openai_ask_settings_init(OpenaiAskSettings *settings);
+void openai_ask_settings_clear(OpenaiAskSettings *settings);
+
+/* Overrides defaults with whatever @path sets. Returns FALSE if the file
+ * could not be read, leaving @settings unchanged. */
+gboolean openai_ask_settings_load(OpenaiAskSettings *settings, const gchar *path);
+gboolean openai_ask_settings_save(const OpenaiAskSettings *settings, const gchar *path);
+
+/* The rc file of the first panel plugin instance that has one, or NULL. */
+gchar *openai_ask_settings_find_panel_rc(void);
@@ -0,0 +1,542 @@
+#include "syntax-highlight.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Small table-driven lexers for the languages models most often fence.
+ * They are deliberately shallow: one linear pass, no nesting, no state
+ * beyond "inside a comment/string" (SyntaxState). Good enough for
+ * colouring. */
+
+#define SYNTAX_CHECK_EVERY 1024 /* bytes between deadline checks */
+#define SYNTAX_MAX_WORD 32
+
+enum
+{
+  SYNTAX_PREPROC = 1 << 0,         /* '#' at line start is a directive (C) */
+  SYNTAX_VARIABLES = 1 << 1,       /* $name, ${name}, $1 (shell) */
+  SYNTAX_KEYS = 1 << 2,            /* word or string followed by ':' is a key */
+  SYNTAX_CASELESS = 1 << 3,        /* keywords match case-insensitively (SQL) */
+  SYNTAX_TRIPLE_QUOTES = 1 << 4,   /* """...""" and '''...''' (Python) */
+  SYNTAX_COMMENT_AT_WORD = 1 << 5, /* line comment only after whitespace (shell, YAML) */
+};
+
+typedef enum
+{
+  SYNTAX_TOKEN_COMMENT,
+  SYNTAX_TOKEN_STRING,
+  SYNTAX_TOKEN_NUMBER,
+  SYNTAX_TOKEN_KEYWORD,
+  SYNTAX_TOKEN_LITERAL,
+  SYNTAX_TOKEN_VARIABLE,
+  SYNTAX_TOKEN_KEY,
+  SYNTAX_TOKEN_PREPROC,
+} SyntaxToken;
+
+/* Readable on both the default grey and typical theme selection colours. */
+static const gchar *const syntax_token_open[] = {
+  [SYNTAX_TOKEN_COMMENT] = "<span fgalpha=\"65%\" style=\"italic\">",
+  [SYNTAX_TOKEN_STRING] = "<span foreground=\"#c3e88d\">",
+  [SYNTAX_TOKEN_NUMBER] = "<span foreground=\"#f78c6c\">",
+  [SYNTAX_TOKEN_KEYWORD] = "<span weight=\"bold\">",
+  [SYNTAX_TOKEN_LITERAL] = "<span foreground=\"#f78c6c\">",
+  [SYNTAX_TOKEN_VARIABLE] = "<span foreground=\"#ffcb6b\">",
+  [SYNTAX_TOKEN_KEY] = "<span foreground=\"#ffcb6b\">",
+  [SYNTAX_TOKEN_PREPROC] = "<span foreground=\"#c792ea\">",
+};
+
+typedef struct
+{
+  const gchar *const *words; /* sorted by strcmp() */
+  guint n_words;
+} SyntaxWords;
+
+#define SYNTAX_WORDS(arr) {arr, G_N_ELEMENTS(arr)}
+#define SYNTAX_NO_WORDS {NULL, 0}
+
+typedef struct
+{
+  const gchar *names; /* fence names, space separated */
+  SyntaxWords keywords;
+  SyntaxWords literals;
+  const gchar *line_comment;
+  const gchar *block_open;
+  const gchar *block_close;
+  const gchar *quotes;
+  const gchar *word_extra; /* identifier characters allowed after the first */
+  guint flags;
+} SyntaxLexer;
+
+static const gchar *const c_keywords[] = {
+  "auto", "bool", "break", "case", "catch", "char", "class", "const", "const_cast", "constexpr",
+  "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+  "explicit", "extern", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable",
+  "namespace", "new", "noexcept", "operator", "override", "private", "protected", "public",
+  "register", "reinterpret_cast", "restrict", "return", "short", "signed", "sizeof", "static",
+  "static_cast", "struct", "switch", "template", "this", "throw", "try", "typedef", "typename",
+  "union", "unsigned", "using", "virtual", "void", "volatile", "while",
+};
+static const gchar *const c_literals[] = {"NULL", "false", "nullptr", "true"};
+
+static const gchar *const sh_keywords[] = {
+  "alias", "break", "case", "cd", "continue", "declare", "do", "done", "echo", "elif", "else",
+  "esac", "eval", "exec", "exit", "export", "fi", "for", "function", "if", "in", "local", "printf",
+  "read", "readonly", "return", "select", "set", "shift", "source", "test", "then", "trap",
+  "unset", "until", "while",
+};
+static const gchar *const sh_literals[] = {"false", "true"};
+
+static const gchar *const py_keywords[] = {
+  "and", "as", "assert", "async", "await", "break", "case", "class", "continue", "def", "del",
+  "elif", "else", "except", "finally", "for", "from", "global", "if", "import", "in", "is",
+  "lambda", "match", "nonlocal", "not", "or", "pass", "raise", "return", "try", "while", "with",
+  "yield",
+};
+static const gchar *const py_literals[] = {"False", "None", "True"};
+
+static const gchar *const json_literals[] = {"false", "null", "true"};
+
+static const gchar *const yaml_literals[] = {
+  "False", "Null", "True", "false", "no", "null", "off", "on", "true", "yes",
+};
+
+static const gchar *const sql_keywords[] = {
+  "add", "all", "alter", "and", "as", "asc", "begin", "between", "by", "cascade", "case", "check",
+  "column", "commit", "constraint", "create", "cross", "database", "default", "delete", "desc",
+  "distinct", "drop", "else", "end", "exists", "foreign", "from", "full", "grant", "group",
+  "having", "if", "ilike", "in", "index", "inner", "insert", "into", "is", "join", "key", "left",
+  "like", "limit", "not", "null", "offset", "on", "or", "order", "outer", "primary", "references",
+  "replace", "returning", "revoke", "right", "rollback", "schema", "select", "set", "table",
+  "then", "transaction", "union", "unique", "update", "values", "view", "when", "where", "with",
+};
+static const gchar *const sql_literals[] = {"false", "true"};
+
+static const SyntaxLexer syntax_lexers[] = {
+  {
+    "c h cpp c++ cc cxx hpp objc",
+    SYNTAX_WORDS(c_keywords),
+    SYNTAX_WORDS(c_literals),
+    "//", "/*", "*/", "\"'", "",
+    SYNTAX_PREPROC,
+  },
+  {
+    "sh bash shell zsh console shellsession",
+    SYNTAX_WORDS(sh_keywords),
+    SYNTAX_WORDS(sh_literals),
+    "#", NULL, NULL, "\"'`", "-./",
+    SYNTAX_VARIABLES | SYNTAX_COMMENT_AT_WORD,
+  },
+  {
+    "python py python3",
+    SYNTAX_WORDS(py_keywords),
+    SYNTAX_WORDS(py_literals),
+    "#", NULL, NULL, "\"'", "",
+    SYNTAX_TRIPLE_QUOTES,
+  },
+  {
+    "json jsonc json5",
+    SYNTAX_NO_WORDS,
+    SYNTAX_WORDS(json_literals),
+    "//", "/*", "*/", "\"", "",
+    SYNTAX_KEYS,
+  },
+  {
+    "yaml yml",
+    SYNTAX_NO_WORDS,
+    SYNTAX_WORDS(yaml_literals),
+    "#", NULL, NULL, "\"'", "-.",
+    SYNTAX_KEYS | SYNTAX_COMMENT_AT_WORD,
+  },
+  {
+    "sql psql mysql sqlite postgresql",
+    SYNTAX_WORDS(sql_keywords),
+    SYNTAX_WORDS(sql_literals),
+    "--", "/*", "*/", "'\"", "",
+    SYNTAX_CASELESS,
+  },
+};
+
+static const SyntaxLexer *
+syntax_lexer_for(const gchar *lang)
+{
+  if (!lang || !*lang)
+    return NULL;
+
+  gsize lang_len = strlen(lang);
+  for (guint i = 0; i < G_N_ELEMENTS(syntax_lexers); i++)
+  {
+    const gchar *p = syntax_lexers[i].names;
+    while (*p)
+    {
+      const gchar *sp = strchr(p, ' ');
+      gsize n = sp ? (gsize)(sp - p) : strlen(p);
+      if (n == lang_len && g_ascii_strncasecmp(p, lang, n) == 0)
+        return &syntax_lexers[i];
+      p += n;
+      while (*p == ' ')
+        p++;
+    }
+  }
+  return NULL;
+}
+
+gboolean
+syntax_highlight_supported(const gchar *lang)
+{
+  return syntax_lexer_for(lang) != NULL;
+}
+
+static void
+syntax_append_escaped(GString *out, const gchar *p, gsize len)
+{
+  const gchar *end = p + len;
+  const gchar *run = p;
+  for (; p < end; p++)
+  {
+    const gchar *rep = NULL;
+    switch (*p)
+    {
+      case '&':
+        rep = "&amp;";
+        break;
+      case '<':
+        rep = "&lt;";
+        break;
+      case '>':
+        rep = "&gt;";
+        break;
+      case '"':
+        rep = "&quot;";
+        break;
+      case '\'':
+        rep = "&#39;";
+        break;
+      default:
+        if ((guchar)*p < 0x20 && *p != '\n' && *p != '\t' && *p != '\r')
+          rep = "";
+        break;
+    }
+    if (!rep)
+      continue;
+    g_string_append_len(out, run, p - run);
+    g_string_append(out, rep);
+    run = p + 1;
+  }
+  g_string_append_len(out, run, end - run);
+}
+
+static void
+syntax_append_token(GString *out, SyntaxToken token, const gchar *p, gsize len)
+{
+  g_string_append(out, syntax_token_open[token]);
+  syntax_append_escaped(out, p, len);
+  g_string_append(out, "</span>");
+}
+
+static int
+syntax_word_cmp(const void *key, const void *elem)
+{
+  return strcmp(key, *(const gchar *const *)elem);
+}
+
+static gboolean
+syntax_words_contain(const SyntaxWords *words, const gchar *word, gsize len, gboolean caseless)
+{
+  if (words->n_words == 0 || len >= SYNTAX_MAX_WORD)
+    return FALSE;
+
+  gchar buf[SYNTAX_MAX_WORD];
+  for (gsize i = 0; i < len; i++)
+    buf[i] = caseless ? g_ascii_tolower(word[i]) : word[i];
+  buf[len] = '\0';
+  return bsearch(buf, words->words, words->n_words, sizeof(words->words[0]), syntax_word_cmp) != NULL;
+}
+
+static const gchar *
+syntax_find(const gchar *p, const gchar *end, const gchar *needle)
+{
+  gsize n = strlen(needle);
+  for (; p + n <= end; p++)
+  {
+    p = memchr(p, needle[0], end - p);
+    if (!p || p + n > end)
+      return NULL;
+    if (memcmp(p, needle, n) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+/* Returns the end of a string quoted with @q whose body starts at @p.
+ * Sets @state if the string runs on past @end into the next piece, which
+ * only triple-quoted and backtick strings do. */
+static const gchar *
+syntax_scan_string_body(const gchar *p, const gchar *end, gchar q, gboolean triple, SyntaxState *state)
+{
+  if (triple)
+  {
+    gchar close[4] = {q, q, q, '\0'};
+    const gchar *c = syntax_find(p, end, close);
+    if (c)
+      return c + 3;
+    *state = q == '"' ? SYNTAX_STATE_TRIPLE_DOUBLE : SYNTAX_STATE_TRIPLE_SINGLE;
+    return end;
+  }
+
+  for (; p < end; p++)
+  {
+    if (*p == '\\' && p + 1 < end)
+      p++;
+    else if (*p == q)
+      return p + 1;
+    else if (*p == '\n' && q != '`')
+      return p;
+  }
+  if (q == '`')
+    *state = SYNTAX_STATE_BACKTICK;
+  return end;
+}
+
+/* Returns the end of the string literal starting at @p. */
+static const gchar *
+syntax_scan_string(const SyntaxLexer *lx, const gchar *p, const gchar *end, SyntaxState *state)
+{
+  gchar q = *p;
+  if ((lx->flags & SYNTAX_TRIPLE_QUOTES) && end - p >= 3 && p[1] == q && p[2] == q)
+    return syntax_scan_string_body(p + 3, end, q, TRUE, state);
+  return syntax_scan_string_body(p + 1, end, q, FALSE, state);
+}
+
+/* Returns the end of the block comment whose body starts at @p. */
+static const gchar *
+syntax_scan_block_comment(const SyntaxLexer *lx, const gchar *p, const gchar *end, SyntaxState *state)
+{
+  const gchar *close = syntax_find(p, end, lx->block_close);
+  if (close)
+    return close + strlen(lx->block_close);
+  *state = SYNTAX_STATE_BLOCK_COMMENT;
+  return end;
+}
+
+/* Returns the end of what was left open by the previous piece, which
+ * starts at @p: a comment or string, or @p itself for code. */
+static const gchar *
+syntax_scan_continued(const SyntaxLexer *lx,
+                      const gchar *p,
+                      const gchar *end,
+                      SyntaxState state,
+                      SyntaxToken *token,
+                      SyntaxState *state_out)
+{
+  *token = SYNTAX_TOKEN_STRING;
+  switch (state)
+  {
+    case SYNTAX_STATE_BLOCK_COMMENT:
+      *token = SYNTAX_TOKEN_COMMENT;
+      return lx->block_close ? syntax_scan_block_comment(lx, p, end, state_out) : p;
+    case SYNTAX_STATE_TRIPLE_DOUBLE:
+      return syntax_scan_string_body(p, end, '"', TRUE, state_out);
+    case SYNTAX_STATE_TRIPLE_SINGLE:
+      return syntax_scan_string_body(p, end, '\'', TRUE, state_out);
+    case SYNTAX_STATE_BACKTICK:
+      return syntax_scan_string_body(p, end, '`', FALSE, state_out);
+    case SYNTAX_STATE_CODE:
+    default:
+      return p;
+  }
+}
+
+static gboolean
+syntax_is_word_char(const SyntaxLexer *lx, gchar c)
+{
+  return g_ascii_isalnum(c) || c == '_' || (c && strchr(lx->word_extra, c));
+}
+
+/* True when the next non-blank character on this line is ':' (YAML/JSON keys). */
+static gboolean
+syntax_followed_by_colon(const gchar *p, const gchar *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p < end && *p == ':';
+}
+
+/* One pass over @code starting in *@state, leaving in it the state at the
+ * end. With @out NULL it only tracks the state, without a deadline. */
+static gboolean
+syntax_lex(const SyntaxLexer *lx, GString *out, const gchar *code, gsize len, SyntaxState *state, gint64 deadline)
+{
+  const gchar *p = code;
+  const gchar *end = code + len;
+  const gchar *next_check = p + SYNTAX_CHECK_EVERY;
+  gboolean caseless = (lx->flags & SYNTAX_CASELESS) != 0;
+
+  SyntaxToken continued = SYNTAX_TOKEN_COMMENT;
+  SyntaxState from = *state;
+  *state = SYNTAX_STATE_CODE;
+  p = syntax_scan_continued(lx, p, end, from, &continued, state);
+  if (out && p > code)
+    syntax_append_token(out, continued, code, p - code);
+  const gchar *plain = p; /* start of pending unhighlighted text */
+  gboolean line_start = p == code;
+
+  while (p < end)
+  {
+    if (out && p >= next_check)
+    {
+      next_check = p + SYNTAX_CHECK_EVERY;
+      if (g_get_monotonic_time() > deadline)
+        break;
+    }
+
+    gchar c = *p;
+    const gchar *tok_end = NULL;
+    SyntaxToken token = SYNTAX_TOKEN_COMMENT;
+    gboolean prev_blank = (p == code) || g_ascii_isspace(p[-1]);
+
+    if (c == '\n')
+    {
+      line_start = TRUE;
+      p++;
+      continue;
+    }
+    if (c == ' ' || c == '\t')
+    {
+      p++;
+      continue;
+    }
+
+    gsize lc_len = lx->line_comment ? strlen(lx->line_comment) : 0;
+    if (lc_len > 0 && (gsize)(end - p) >= lc_len && memcmp(p, lx->line_comment, lc_len) == 0 &&
+        (!(lx->flags & SYNTAX_COMMENT_AT_WORD) || prev_blank))
+    {
+      tok_end = memchr(p, '\n', end - p);
+      tok_end = tok_end ? tok_end : end;
+      token = SYNTAX_TOKEN_COMMENT;
+    }
+    else if (lx->block_open && (gsize)(end - p) >= strlen(lx->block_open) &&
+             memcmp(p, lx->block_open, strlen(lx->block_open)) == 0)
+    {
+      tok_end = syntax_scan_block_comment(lx, p + strlen(lx->block_open), end, state);
+      token = SYNTAX_TOKEN_COMMENT;
+    }
+    else if ((lx->flags & SYNTAX_PREPROC) && line_start && c == '#')
+    {
+      tok_end = memchr(p, '\n', end - p);
+      tok_end = tok_end ? tok_end : end;
+      token = SYNTAX_TOKEN_PREPROC;
+    }
+    else if (strchr(lx->quotes, c))
+    {
+      tok_end = syntax_scan_string(lx, p, end, state);
+      token = ((lx->flags & SYNTAX_KEYS) && syntax_followed_by_colon(tok_end, end)) ? SYNTAX_TOKEN_KEY
+                                                                                   : SYNTAX_TOKEN_STRING;
+    }
+    else if (g_ascii_isdigit(c) || (c == '-' && p + 1 < end && g_ascii_isdigit(p[1]) && prev_blank))
+    {
+      tok_end = p + 1;
+      while (tok_end < end && (g_ascii_isalnum(*tok_end) || *tok_end == '.' || *tok_end == '_'))
+        tok_end++;
+      token = SYNTAX_TOKEN_NUMBER;
+    }
+    else if ((lx->flags & SYNTAX_VARIABLES) && c == '$' && p + 1 < end)
+    {
+      tok_end = p + 1;
+      if (*tok_end == '{')
+      {
+        const gchar *close = memchr(tok_end, '}', end - tok_end);
+        tok_end = close ? close + 1 : tok_end + 1;
+      }
+      else
+      {
+        while (tok_end < end && (g_ascii_isalnum(*tok_end) || *tok_end == '_'))
+          tok_end++;
+      }
+      token = SYNTAX_TOKEN_VARIABLE;
+      if (tok_end == p + 1)
+        tok_end = NULL;
+    }
+    else if (g_ascii_isalpha(c) || c == '_')
+    {
+      const gchar *w = p + 1;
+      while (w < end && syntax_is_word_char(lx, *w))
+        w++;
+      gsize n = (gsize)(w - p);
+      if (!out)
+      {
+        /* Words never change the state; only their end matters. */
+        line_start = FALSE;
+        p = w;
+        continue;
+      }
+      if ((lx->flags & SYNTAX_KEYS) && syntax_followed_by_colon(w, end))
+      {
+        tok_end = w;
+        token = SYNTAX_TOKEN_KEY;
+      }
+      else if (syntax_words_contain(&lx->keywords, p, n, caseless))
+      {
+        tok_end = w;
+        token = SYNTAX_TOKEN_KEYWORD;
+      }
+      else if (syntax_words_contain(&lx->literals, p, n, caseless))
+      {
+        tok_end = w;
+        token = SYNTAX_TOKEN_LITERAL;
+      }
+      else
+      {
+        /* Skip the whole word so digits inside identifiers stay plain. */
+        line_start = FALSE;
+        p = w;
+        continue;
+      }
+    }
+
+    line_start = FALSE;
+    if (!tok_end)
+    {
+      p++;
+      continue;
+    }
+
+    if (out)
+    {
+      syntax_append_escaped(out, plain, p - plain);
+      syntax_append_token(out, token, p, tok_end - p);
+    }
+    p = tok_end;
+    plain = p;
+  }
+
+  if (out)
+    syntax_append_escaped(out, plain, end - plain);
+  return p >= end;
+}
+
+SyntaxState
+syntax_highlight_scan(const gchar *code, gsize len, const gchar *lang, SyntaxState state)
+{
+  const SyntaxLexer *lx = syntax_lexer_for(lang);
+  if (!lx || !code)
+    return SYNTAX_STATE_CODE;
+  syntax_lex(lx, NULL, code, len, &state, 0);
+  return state;
+}
+
+gboolean
+syntax_highlight_append(GString *out,
+                        const gchar *code,
+                        gsize len,
+                        const gchar *lang,
+                        SyntaxState state,
+                        gint64 budget_us)
+{
+  const SyntaxLexer *lx = syntax_lexer_for(lang);
+  if (!lx || !code)
+  {
+    syntax_append_escaped(out, code ? code : "", code ? len : 0);
+    return TRUE;
+  }
+  return syntax_lex(lx, out, code, len, &state, g_get_monotonic_time() + budget_us);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glib.h>
+
+/* Per code-block highlighting budget when no other bound applies. */
+#define SYNTAX_HIGHLIGHT_BUDGET_US 4000
+
+/* What a piece of code ends inside of. Code split into pieces (on line
+ * boundaries) is highlighted piece by piece, each starting in the state the
+ * one before it ended in, so a comment or string spanning them stays one. */
+typedef enum
+{
+  SYNTAX_STATE_CODE,
+  SYNTAX_STATE_BLOCK_COMMENT,
+  SYNTAX_STATE_TRIPLE_DOUBLE, /* """ string */
+  SYNTAX_STATE_TRIPLE_SINGLE, /* ''' string */
+  SYNTAX_STATE_BACKTICK,      /* `command` */
+} SyntaxState;
+
+gboolean syntax_highlight_supported(const gchar *lang);
+
+/* The state at the end of @code when it starts in @state, for the piece
+ * that follows it. */
+SyntaxState syntax_highlight_scan(const gchar *code, gsize len, const gchar *lang, SyntaxState state);
+
+/* Appends Pango markup for @code (escaped, with colour spans) to @out,
+ * starting in @state. Unknown languages are only escaped. Once @budget_us has
+ * elapsed the rest of the input is escaped without highlighting; returns
+ * FALSE in that case. */
+gboolean syntax_highlight_append(GString *out,
+                                 const gchar *code,
+                                 gsize len,
+                                 const gchar *lang,
+                                 SyntaxState state,
+                                 gint64 budget_us);
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include "vector-index.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* On-disk format, in native byte order (it is a local cache):
+ *
+ *   header | vectors | chunks | files | strings
+ *
+ * Vectors are n_chunks rows of dim floats, starting on a 64-byte boundary
+ * so rows stay aligned in the mapping. Chunks and files point into the
+ * strings, which are NUL-terminated. A file's chunks are consecutive. */
+#define VECTOR_INDEX_MAGIC "OAV1"
+#define VECTOR_INDEX_ALIGN 64
+#define VECTOR_INDEX_PAD(off) (((off) + 7) & ~(guint64)7)
+
+typedef struct
+{
+  gchar magic[4];
+  guint32 dim;
+  guint32 n_chunks;
+  guint32 n_files;
+  guint64 vectors_off;
+  guint64 chunks_off;
+  guint64 files_off;
+  guint64 strings_off;
+  guint64 strings_len;
+  guint32 model_off;
+  guint32 reserved;
+} VectorIndexHeader;
+
+typedef struct
+{
+  guint32 file;
+  guint32 text_off;
+} VectorIndexChunk;
+
+typedef struct
+{
+  gint64 mtime;
+  guint64 size;
+  guint32 path_off;
+  guint32 first_chunk;
+  guint32 n_chunks;
+  guint32 reserved;
+} VectorIndexFile;
+
+struct _VectorIndex
+{
+  gint ref_count;
+  GMappedFile *map;
+  const VectorIndexHeader *header;
+  const gfloat *vectors;
+  const VectorIndexChunk *chunks;
+  const VectorIndexFile *files;
+  const gchar *strings;
+  GHashTable *paths; /* path (in the mapping) -> file number + 1 */
+};
+
+struct _VectorIndexWriter
+{
+  guint dim;
+  GArray *vectors; /* gfloat */
+  GArray *chunks; /* VectorIndexChunk */
+  GArray *files; /* VectorIndexFile */
+  GString *strings;
+  guint32 model_off;
+};
+
+static gboolean
+vector_index_range_ok(guint64 off, guint64 len, gsize file_len)
+{
+  return off <= file_len && len <= file_len - off;
+}
+
+static gboolean
+vector_index_validate(VectorIndex *index, gsize len)
+{
+  const VectorIndexHeader *h = index->header;
+  if (len < sizeof *h || memcmp(h->magic, VECTOR_INDEX_MAGIC, 4) != 0 || h->dim == 0)
+    return FALSE;
+  if (h->vectors_off % VECTOR_INDEX_ALIGN != 0 ||
+      !vector_index_range_ok(h->vectors_off, (guint64)h->n_chunks * h->dim * sizeof(gfloat), len) ||
+      !vector_index_range_ok(h->chunks_off, (guint64)h->n_chunks * sizeof(VectorIndexChunk), len) ||
+      !vector_index_range_ok(h->files_off, (guint64)h->n_files * sizeof(VectorIndexFile), len) ||
+      !vector_index_range_ok(h->strings_off, h->strings_len, len) || h->strings_len == 0)
+    return FALSE;
+  if (h->chunks_off % sizeof(guint32) != 0 || h->files_off % sizeof(gint64) != 0)
+    return FALSE;
+
+  const gchar *base = g_mapped_file_get_contents(index->map);
+  index->vectors = (const gfloat *)(base + h->vectors_off);
+  index->chunks = (const VectorIndexChunk *)(base + h->chunks_off);
+  index->files = (const VectorIndexFile *)(base + h->files_off);
+  index->strings = base + h->strings_off;
+  /* Every string ends before the blob does. */
+  if (index->strings[h->strings_len - 1] != '\0' || h->model_off >= h->strings_len)
+    return FALSE;
+
+  for (guint32 i = 0; i < h->n_chunks; i++)
+  {
+    if (index->chunks[i].file >= h->n_files || index->chunks[i].text_off >= h->strings_len)
+      return FALSE;
+  }
+  for (guint32 i = 0; i < h->n_files; i++)
+  {
+    const VectorIndexFile *f = &index->files[i];
+    if (f->path_off >= h->strings_len || f->first_chunk > h->n_chunks || f->n_chunks > h->n_chunks - f->first_chunk)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+VectorIndex *
+vector_index_open(const gchar *path, GError **error)
+{
+  GMappedFile *map = g_mapped_file_new(path, FALSE, error);
+  if (!map)
+    return NULL;
+
+  VectorIndex *index = g_new0(VectorIndex, 1);
+  index->ref_count = 1;
+  index->map = map;
+  index->header = (const VectorIndexHeader *)g_mapped_file_get_contents(map);
+  if (!index->header || !vector_index_validate(index, g_mapped_file_get_length(map)))
+  {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a valid vector index", path);
+    vector_index_unref(index);
+    return NULL;
+  }
+
+  index->paths = g_hash_table_new(g_str_hash, g_str_equal);
+  for (guint32 i = 0; i < index->header->n_files; i++)
+    g_hash_table_insert(index->paths, (gpointer)(index->strings + index->files[i].path_off), GUINT_TO_POINTER(i + 1));
+  return index;
+}
+
+VectorIndex *
+vector_index_ref(VectorIndex *index)
+{
+  g_atomic_int_inc(&index->ref_count);
+  return index;
+}
+
+void
+vector_index_unref(VectorIndex *index)
+{
+  if (!index || !g_atomic_int_dec_and_test(&index->ref_count))
+    return;
+  if (index->paths)
+    g_hash_table_destroy(index->paths);
+  g_mapped_file_unref(index->map);
+  g_free(index);
+}
+
+guint
+vector_index_get_dim(const VectorIndex *index)
+{
+  return index->header->dim;
+}
+
+guint
+vector_index_get_count(const VectorIndex *index)
+{
+  return index->header->n_chunks;
+}
+
+guint
+vector_index_get_file_count(const VectorIndex *index)
+{
+  return index->header->n_files;
+}
+
+const gchar *
+vector_index_get_model(const VectorIndex *index)
+{
+  return index->strings + index->header->model_off;
+}
+
+gboolean
+vector_index_lookup_file(const VectorIndex *index,
+                         const gchar *path,
+                         gint64 mtime,
+                         guint64 size,
+                         guint *first_chunk,
+                         guint *n_chunks)
+{
+  guint n = GPOINTER_TO_UINT(g_hash_table_lookup(index->paths, path));
+  if (n == 0)
+    return FALSE;
+  const VectorIndexFile *f = &index->files[n - 1];
+  if (f->mtime != mtime || f->size != size)
+    return FALSE;
+  *first_chunk = f->first_chunk;
+  *n_chunks = f->n_chunks;
+  return TRUE;
+}
+
+const gchar *
+vector_index_get_text(const VectorIndex *index, guint chunk)
+{
+  g_return_val_if_fail(chunk < index->header->n_chunks, NULL);
+  return index->strings + index->chunks[chunk].text_off;
+}
+
+const gchar *
+vector_index_get_path(const VectorIndex *index, guint chunk)
+{
+  g_return_val_if_fail(chunk < index->header->n_chunks, NULL);
+  return index->strings + index->files[index->chunks[chunk].file].path_off;
+}
+
+const gfloat *
+vector_index_get_vector(const VectorIndex *index, guint chunk)
+{
+  g_return_val_if_fail(chunk < index->header->n_chunks, NULL);
+  return index->vectors + (gsize)chunk * index->header->dim;
+}
+
+/* Eight independent sums: the compiler keeps them in vector registers and
+ * vectorizes the loop without having to reorder float additions. */
+static inline gfloat
+vector_index_dot(const gfloat *restrict a, const gfloat *restrict b, guint n)
+{
+  gfloat sum[8] = {0};
+  guint i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    for (guint j = 0; j < 8; j++)
+      sum[j] += a[i + j] * b[i + j];
+  }
+  gfloat total = 0;
+  for (; i < n; i++)
+    total += a[i] * b[i];
+  for (guint j = 0; j < 8; j++)
+    total += sum[j];
+  return total;
+}
+
+guint
+vector_index_search(const VectorIndex *index, const gfloat *query, VectorIndexHit *hits, guint k)
+{
+  guint dim = index->header->dim;
+  guint found = 0;
+  for (guint32 c = 0; c < index->header->n_chunks && k > 0; c++)
+  {
+    gfloat score = vector_index_dot(index->vectors + (gsize)c * dim, query, dim);
+    if (found == k && score <= hits[k - 1].score)
+      continue;
+    /* k is small: insertion into the sorted hits beats a heap. */
+    guint i = found < k ? found++ : k - 1;
+    while (i > 0 && hits[i - 1].score < score)
+    {
+      hits[i] = hits[i - 1];
+      i--;
+    }
+    hits[i] = (VectorIndexHit){c, score};
+  }
+  return found;
+}
+
+void
+vector_index_normalize(gfloat *vector, guint dim)
+{
+  gdouble norm = 0;
+  for (guint i = 0; i < dim; i++)
+    norm += (gdouble)vector[i] * vector[i];
+  if (norm <= 0)
+    return;
+  gfloat scale = (gfloat)(1.0 / sqrt(norm));
+  for (guint i = 0; i < dim; i++)
+    vector[i] *= scale;
+}
+
+static guint32
+vector_index_writer_add_string(VectorIndexWriter *writer, const gchar *s)
+{
+  guint32 off = (guint32)writer->strings->len;
+  g_string_append_len(writer->strings, s, (gssize)strlen(s) + 1);
+  return off;
+}
+
+VectorIndexWriter *
+vector_index_writer_new(guint dim, const gchar *model)
+{
+  VectorIndexWriter *writer = g_new0(VectorIndexWriter, 1);
+  writer->dim = dim;
+  writer->vectors = g_array_new(FALSE, FALSE, sizeof(gfloat));
+  writer->chunks = g_array_new(FALSE, FALSE, sizeof(VectorIndexChunk));
+  writer->files = g_array_new(FALSE, FALSE, sizeof(VectorIndexFile));
+  writer->strings = g_string_new(NULL);
+  writer->model_off = vector_index_writer_add_string(writer, model ? model : "");
+  return writer;
+}
+
+void
+vector_index_writer_free(VectorIndexWriter *writer)
+{
+  if (!writer)
+    return;
+  g_array_unref(writer->vectors);
+  g_array_unref(writer->chunks);
+  g_array_unref(writer->files);
+  g_string_free(writer->strings, TRUE);
+  g_free(writer);
+}
+
+void
+vector_index_writer_add_file(VectorIndexWriter *writer, const gchar *path, gint64 mtime, guint64 size)
+{
+  VectorIndexFile f = {0};
+  f.mtime = mtime;
+  f.size = size;
+  f.path_off = vector_index_writer_add_string(writer, path);
+  f.first_chunk = writer->chunks->len;
+  g_array_append_val(writer->files, f);
+}
+
+void
+vector_index_writer_add_chunk(VectorIndexWriter *writer, const gchar *text, const gfloat *vector)
+{
+  g_return_if_fail(writer->files->len > 0);
+
+  VectorIndexChunk chunk = {writer->files->len - 1, vector_index_writer_add_string(writer, text)};
+  g_array_append_val(writer->chunks, chunk);
+  g_array_append_vals(writer->vectors, vector, writer->dim);
+  vector_index_normalize(&g_array_index(writer->vectors, gfloat, writer->vectors->len - writer->dim), writer->dim);
+  g_array_index(writer->files, VectorIndexFile, writer->files->len - 1).n_chunks++;
+}
+
+guint
+vector_index_writer_get_count(const VectorIndexWriter *writer)
+{
+  return writer->chunks->len;
+}
+
+static gboolean
+vector_index_write_at(FILE *fp, guint64 off, const void *data, gsize len)
+{
+  if (len == 0)
+    return TRUE;
+  return fseeko(fp, (off_t)off, SEEK_SET) == 0 && fwrite(data, 1, len, fp) == len;
+}
+
+/* Written to a temporary file and renamed over @path, so readers that have
+ * the old index mapped keep it intact. Gaps between sections read as
+ * zeros. */
+gboolean
+vector_index_writer_save(VectorIndexWriter *writer, const gchar *path, GError **error)
+{
+  VectorIndexHeader h = {0};
+  memcpy(h.magic, VECTOR_INDEX_MAGIC, 4);
+  h.dim = writer->dim;
+  h.n_chunks = writer->chunks->len;
+  h.n_files = writer->files->len;
+  h.vectors_off = VECTOR_INDEX_ALIGN;
+  h.chunks_off = VECTOR_INDEX_PAD(h.vectors_off + (guint64)writer->vectors->len * sizeof(gfloat));
+  h.files_off = VECTOR_INDEX_PAD(h.chunks_off + (guint64)writer->chunks->len * sizeof(VectorIndexChunk));
+  h.strings_off = h.files_off + (guint64)writer->files->len * sizeof(VectorIndexFile);
+  h.strings_len = writer->strings->len;
+  h.model_off = writer->model_off;
+
+  g_autofree gchar *tmp = g_strconcat(path, ".tmp", NULL);
+  FILE *fp = g_fopen(tmp, "wb");
+  if (!fp)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s", tmp);
+    return FALSE;
+  }
+  gboolean ok = vector_index_write_at(fp, 0, &h, sizeof h) &&
+                vector_index_write_at(fp, h.vectors_off, writer->vectors->data, writer->vectors->len * sizeof(gfloat)) &&
+                vector_index_write_at(fp, h.chunks_off, writer->chunks->data, writer->chunks->len * sizeof(VectorIndexChunk)) &&
+                vector_index_write_at(fp, h.files_off, writer->files->data, writer->files->len * sizeof(VectorIndexFile)) &&
+                vector_index_write_at(fp, h.strings_off, writer->strings->str, writer->strings->len);
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || g_rename(tmp, path) != 0)
+  {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s", path);
+    g_unlink(tmp);
+    return FALSE;
+  }
+  return TRUE;
+}
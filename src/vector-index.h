@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glib.h>
+
+/* A read-only, memory-mapped index of text chunks and their unit-length
+ * embedding vectors, grouped by the file they came from. Written whole by
+ * VectorIndexWriter and replaced atomically, so a reader's mapping never
+ * changes under it. Safe to search from any thread. */
+typedef struct _VectorIndex VectorIndex;
+
+typedef struct
+{
+  guint chunk;
+  gfloat score; /* cosine similarity */
+} VectorIndexHit;
+
+/* NULL, with @error set, if @path is missing or not a valid index. */
+VectorIndex *vector_index_open(const gchar *path, GError **error);
+VectorIndex *vector_index_ref(VectorIndex *index);
+void vector_index_unref(VectorIndex *index);
+
+guint vector_index_get_dim(const VectorIndex *index);
+guint vector_index_get_count(const VectorIndex *index);
+guint vector_index_get_file_count(const VectorIndex *index);
+/* The embeddings model the vectors came from. */
+const gchar *vector_index_get_model(const VectorIndex *index);
+
+/* The chunks of @path if it was indexed with this @mtime and @size. */
+gboolean vector_index_lookup_file(const VectorIndex *index,
+                                  const gchar *path,
+                                  gint64 mtime,
+                                  guint64 size,
+                                  guint *first_chunk,
+                                  guint *n_chunks);
+const gchar *vector_index_get_text(const VectorIndex *index, guint chunk);
+const gchar *vector_index_get_path(const VectorIndex *index, guint chunk);
+const gfloat *vector_index_get_vector(const VectorIndex *index, guint chunk);
+
+/* The @k best chunks for the unit-length @query, best first, scanning every
+ * vector. Returns how many were found. */
+guint vector_index_search(const VectorIndex *index, const gfloat *query, VectorIndexHit *hits, guint k);
+
+/* Scales @vector to unit length; all zeros stay as they are. */
+void vector_index_normalize(gfloat *vector, guint dim);
+
+typedef struct _VectorIndexWriter VectorIndexWriter;
+
+VectorIndexWriter *vector_index_writer_new(guint dim, const gchar *model);
+void vector_index_writer_free(VectorIndexWriter *writer);
+/* Chunks added next belong to this file, until the next one. */
+void vector_index_writer_add_file(VectorIndexWriter *writer, const gchar *path, gint64 mtime, guint64 size);
+/* @vector is normalized on the way in. */
+void vector_index_writer_add_chunk(VectorIndexWriter *writer, const gchar *text, const gfloat *vector);
+guint vector_index_writer_get_count(const VectorIndexWriter *writer);
+gboolean vector_index_writer_save(VectorIndexWriter *writer, const gchar *path, GError **error);
@@ -0,0 +1,500 @@
+/* Command-line front-end on the same core as the panel plugin.
+ *
+ *   xfce-ask-cli [OPTION...] [PROMPT...]
+ *
+ * Without PROMPT, every non-empty line of stdin is sent as its own
+ * question (or as follow-ups with --follow-up). With --batch FILE, PROMPT
+ * is a template asked of every line of FILE, --jobs at a time, and the
+ * answers go to --output (see batch.h). Settings come from the panel
+ * plugin's rc file and the API key from the keyring, so this runs exactly
+ * the code path the panel uses. */
+#define _GNU_SOURCE
+#include <glib-unix.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "attachment.h"
+#include "batch.h"
+#include "conversation.h"
+#include "history.h"
+#include "keyring.h"
+#include "log.h"
+#include "markdown-pango.h"
+#include "openai-client.h"
+#include "request-scheduler.h"
+#include "settings.h"
+
+#define CLI_FOLLOWUP_MAX_TURNS 6
+
+typedef struct
+{
+  OpenaiAskSettings settings;
+  gchar *api_key;
+  Conversation *conversation;
+  GPtrArray *attachments; /* --attach files, sent with the first question */
+  History *history;
+  gint64 conversation_id;
+  GMainLoop *loop;
+  gboolean follow_up;
+  gboolean ansi;
+  gboolean timing;
+  gboolean interactive;
+  gboolean single; /* prompt given on the command line; stdin is not read */
+  gint64 sent_us;
+  gint failures;
+  Batch *batch;
+  gboolean progress; /* stderr is a terminal: redraw one status line */
+} CliState;
+
+/* Pango markup to ANSI escapes. Only what markdown-pango and the
+ * highlighter emit is understood; everything else passes through as text. */
+typedef struct
+{
+  gboolean bold;
+  gboolean italic;
+  gboolean underline;
+  gboolean dim;
+  gchar fg[8];
+  gchar bg[8];
+} CliStyle;
+
+typedef struct
+{
+  GString *out;
+  GArray *stack; /* element-type CliStyle */
+} CliAnsi;
+
+static void
+cli_ansi_color(GString *out, gint base, const gchar *hex)
+{
+  guint r = 0, g = 0, b = 0;
+  if (hex[0] == '#' && sscanf(hex + 1, "%02x%02x%02x", &r, &g, &b) == 3)
+    g_string_append_printf(out, "\033[%d;2;%u;%u;%um", base, r, g, b);
+}
+
+static void
+cli_ansi_start(GMarkupParseContext *context,
+               const gchar *element,
+               const gchar **names,
+               const gchar **values,
+               gpointer user_data,
+               GError **error)
+{
+  (void)context;
+  (void)error;
+  CliAnsi *ansi = user_data;
+  CliStyle style = {0};
+  if (ansi->stack->len > 0)
+    style = g_array_index(ansi->stack, CliStyle, ansi->stack->len - 1);
+
+  if (g_strcmp0(element, "b") == 0)
+    style.bold = TRUE;
+  else if (g_strcmp0(element, "i") == 0)
+    style.italic = TRUE;
+  else if (g_strcmp0(element, "u") == 0 || g_strcmp0(element, "a") == 0)
+    style.underline = TRUE;
+
+  for (guint i = 0; names && names[i]; i++)
+  {
+    if (g_strcmp0(names[i], "foreground") == 0)
+      g_strlcpy(style.fg, values[i], sizeof(style.fg));
+    else if (g_strcmp0(names[i], "background") == 0)
+      g_strlcpy(style.bg, values[i], sizeof(style.bg));
+    else if ((g_strcmp0(names[i], "weight") == 0 || g_strcmp0(names[i], "font_weight") == 0) &&
+             g_strcmp0(values[i], "bold") == 0)
+      style.bold = TRUE;
+    else if (g_strcmp0(names[i], "style") == 0 && g_strcmp0(values[i], "italic") == 0)
+      style.italic = TRUE;
+    else if (g_strcmp0(names[i], "fgalpha") == 0)
+      style.dim = TRUE;
+  }
+  g_array_append_val(ansi->stack, style);
+}
+
+static void
+cli_ansi_end(GMarkupParseContext *context, const gchar *element, gpointer user_data, GError **error)
+{
+  (void)context;
+  (void)element;
+  (void)error;
+  CliAnsi *ansi = user_data;
+  if (ansi->stack->len > 1)
+    g_array_set_size(ansi->stack, ansi->stack->len - 1);
+}
+
+static void
+cli_ansi_text(GMarkupParseContext *context, const gchar *text, gsize len, gpointer user_data, GError **error)
+{
+  (void)context;
+  (void)error;
+  CliAnsi *ansi = user_data;
+  const CliStyle *style = &g_array_index(ansi->stack, CliStyle, ansi->stack->len - 1);
+
+  g_string_append(ansi->out, "\033[0m");
+  if (style->bold)
+    g_string_append(ansi->out, "\033[1m");
+  if (style->dim)
+    g_string_append(ansi->out, "\033[2m");
+  if (style->italic)
+    g_string_append(ansi->out, "\033[3m");
+  if (style->underline)
+    g_string_append(ansi->out, "\033[4m");
+  if (style->fg[0])
+    cli_ansi_color(ansi->out, 38, style->fg);
+  if (style->bg[0])
+    cli_ansi_color(ansi->out, 48, style->bg);
+  g_string_append_len(ansi->out, text, (gssize)len);
+}
+
+static gchar *
+cli_render_ansi(const gchar *answer)
+{
+  g_autofree gchar *markup = markdown_to_pango(answer, NULL);
+  g_autofree gchar *doc = g_strconcat("<markup>", markup, "</markup>", NULL);
+
+  static const GMarkupParser parser = {cli_ansi_start, cli_ansi_end, cli_ansi_text, NULL, NULL};
+  CliAnsi ansi = {g_string_new(NULL), g_array_new(FALSE, TRUE, sizeof(CliStyle))};
+  g_array_set_size(ansi.stack, 1);
+  GMarkupParseContext *ctx = g_markup_parse_context_new(&parser, 0, &ansi, NULL);
+  gboolean ok = g_markup_parse_context_parse(ctx, doc, -1, NULL) && g_markup_parse_context_end_parse(ctx, NULL);
+  g_markup_parse_context_free(ctx);
+  g_array_unref(ansi.stack);
+
+  if (!ok)
+  {
+    g_string_free(ansi.out, TRUE);
+    return g_strdup(answer);
+  }
+  g_string_append(ansi.out, "\033[0m");
+  return g_string_free(ansi.out, FALSE);
+}
+
+static void cli_next(CliState *st);
+
+static void
+cli_on_result(OpenaiClientResult *result, gpointer user_data)
+{
+  CliState *st = user_data;
+  if (st->timing)
+    g_printerr("[%.1f ms]\n", (g_get_monotonic_time() - st->sent_us) / 1000.0);
+
+  if (!result->ok)
+  {
+    g_printerr("xfce-ask-cli: %s\n", result->error_message ? result->error_message : "Request failed.");
+    st->failures++;
+  }
+  else
+  {
+    const ConversationTurn *question = conversation_get_last(st->conversation, CONVERSATION_ROLE_USER);
+    if (st->history && question)
+      history_append(st->history, st->conversation_id, st->settings.model, question->content, result->content);
+    conversation_append(st->conversation, CONVERSATION_ROLE_ASSISTANT, result->content);
+
+    g_autofree gchar *text = st->ansi ? cli_render_ansi(result->content) : g_strdup(result->content);
+    fputs(text, stdout);
+    if (!g_str_has_suffix(text, "\n"))
+      fputc('\n', stdout);
+    fflush(stdout);
+  }
+  cli_next(st);
+}
+
+static void
+cli_send(CliState *st, const gchar *prompt)
+{
+  g_autoptr(GPtrArray) attachments = g_steal_pointer(&st->attachments);
+  if (!attachments)
+    attachments = attachment_list_new();
+  g_autoptr(GError) error = NULL;
+  if (!attachment_add_references(attachments, prompt, &error))
+  {
+    g_printerr("xfce-ask-cli: %s\n", error->message);
+    st->failures++;
+    cli_next(st);
+    return;
+  }
+
+  if (!st->follow_up || conversation_get_length(st->conversation) == 0)
+  {
+    conversation_clear(st->conversation);
+    conversation_set_system(st->conversation, st->settings.system_prompt);
+    st->conversation_id = g_get_real_time();
+  }
+  conversation_append(st->conversation, CONVERSATION_ROLE_USER, prompt);
+
+  gint64 hold_us = openai_client_get_hold_us(st->settings.endpoint, st->api_key, st->conversation, attachments);
+  if (hold_us > 0)
+    g_printerr("xfce-ask-cli: rate limit reached, waiting %.1f s\n", hold_us / 1e6);
+  st->sent_us = g_get_monotonic_time();
+  openai_client_send_chat_async(st->settings.endpoint,
+                                st->api_key,
+                                st->settings.model,
+                                st->settings.temperature,
+                                st->conversation,
+                                attachments,
+                                NULL,
+                                cli_on_result,
+                                st);
+}
+
+/* Reads the next non-empty line of stdin and sends it, or quits at EOF. */
+static void
+cli_next(CliState *st)
+{
+  gchar line[64 * 1024];
+  if (st->single)
+  {
+    g_main_loop_quit(st->loop);
+    return;
+  }
+  for (;;)
+  {
+    if (st->interactive)
+    {
+      fputs("> ", stdout);
+      fflush(stdout);
+    }
+    if (!fgets(line, sizeof(line), stdin))
+    {
+      g_main_loop_quit(st->loop);
+      return;
+    }
+    g_strstrip(line);
+    if (*line)
+      break;
+  }
+  cli_send(st, line);
+}
+
+static void
+cli_on_batch_progress(Batch *batch, const BatchProgress *progress, gpointer user_data)
+{
+  (void)batch;
+  CliState *st = user_data;
+  if (!st->progress)
+    return;
+  g_autofree gchar *text = batch_progress_describe(progress);
+  g_printerr("\r\033[K%s", text);
+}
+
+static void
+cli_on_batch_done(Batch *batch, const BatchProgress *progress, const GError *error, gpointer user_data)
+{
+  CliState *st = user_data;
+  if (st->progress)
+    g_printerr("\r\033[K");
+  g_printerr("xfce-ask-cli: %u of %u lines in %s (%u kept from an earlier run, %u failed), "
+             "%u requests in %.1f s, %.1f requests/s\n",
+             progress->written,
+             progress->total,
+             batch_get_output_path(batch),
+             progress->resumed,
+             progress->failed,
+             progress->requests,
+             progress->elapsed_us / 1e6,
+             batch_progress_get_rate(progress));
+  if (error)
+  {
+    gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_printerr("xfce-ask-cli: %s%s\n", error->message, cancelled ? " Run the same command again to resume." : "");
+    st->failures++;
+  }
+  st->failures += progress->failed > 0;
+  g_main_loop_quit(st->loop);
+}
+
+/* Ctrl+C cancels the running requests and writes nothing more, so the
+ * output stays resumable. */
+static gboolean
+cli_on_sigint(gpointer user_data)
+{
+  CliState *st = user_data;
+  batch_cancel(st->batch);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+cli_run_batch(CliState *st, const gchar *template, const gchar *input, const gchar *output, gint jobs)
+{
+  g_autofree gchar *default_output = output ? NULL : batch_default_output_path(input);
+  g_autoptr(GError) error = NULL;
+  st->batch = batch_open(template, input, output ? output : default_output, &error);
+  if (!st->batch)
+  {
+    g_printerr("xfce-ask-cli: %s\n", error->message);
+    return FALSE;
+  }
+  /* Batch requests are background work, which leaves the endpoint's last
+   * slot free; here there are no questions to keep it for. */
+  request_scheduler_set_limit(request_scheduler_get_default(), st->settings.endpoint, (guint)jobs + 1);
+  BatchOptions options = {
+    .endpoint = st->settings.endpoint,
+    .api_key = st->api_key,
+    .model = st->settings.model,
+    .temperature = st->settings.temperature,
+    .system_prompt = st->settings.system_prompt,
+    .jobs = (guint)jobs,
+    .owner = request_scheduler_new_owner(),
+  };
+  st->progress = isatty(STDERR_FILENO);
+  g_unix_signal_add(SIGINT, cli_on_sigint, st);
+  batch_start(st->batch, &options, cli_on_batch_progress, cli_on_batch_done, st);
+  g_main_loop_run(st->loop);
+  return TRUE;
+}
+
+int
+main(int argc, char **argv)
+{
+  gchar *config = NULL;
+  gchar *endpoint = NULL;
+  gchar *model = NULL;
+  gchar *backend = NULL;
+  gchar *system_prompt = NULL;
+  gdouble temperature = -1.0;
+  gboolean follow_up = FALSE;
+  gboolean raw = FALSE;
+  gboolean color = FALSE;
+  gboolean no_history = FALSE;
+  gboolean timing = FALSE;
+  gchar **attach = NULL;
+  gchar *batch = NULL;
+  gchar *output = NULL;
+  gint jobs = BATCH_DEFAULT_JOBS;
+  gchar **words = NULL;
+  GOptionEntry entries[] = {
+    {"config", 'c', 0, G_OPTION_ARG_FILENAME, &config, "Plugin rc file (default: the panel's)", "FILE"},
+    {"endpoint", 'e', 0, G_OPTION_ARG_STRING, &endpoint, "Chat completions endpoint", "URL"},
+    {"model", 'm', 0, G_OPTION_ARG_STRING, &model, "Model name", "NAME"},
+    {"backend", 'b', 0, G_OPTION_ARG_STRING, &backend, "Server type: openai, ollama or llama.cpp", "NAME"},
+    {"system", 's', 0, G_OPTION_ARG_STRING, &system_prompt, "System prompt", "TEXT"},
+    {"temperature", 't', 0, G_OPTION_ARG_DOUBLE, &temperature, "Sampling temperature", "T"},
+    {"follow-up", 'f', 0, G_OPTION_ARG_NONE, &follow_up, "Send stdin lines as one conversation", NULL},
+    {"raw", 'r', 0, G_OPTION_ARG_NONE, &raw, "Print answers as markdown", NULL},
+    {"color", 0, 0, G_OPTION_ARG_NONE, &color, "Render answers even when stdout is not a terminal", NULL},
+    {"no-history", 0, 0, G_OPTION_ARG_NONE, &no_history, "Do not record exchanges in the history", NULL},
+    {"timing", 0, 0, G_OPTION_ARG_NONE, &timing, "Print each request's latency on stderr", NULL},
+    {"attach", 'a', 0, G_OPTION_ARG_FILENAME_ARRAY, &attach, "Attach FILE to the first question (repeatable)", "FILE"},
+    {"batch", 0, 0, G_OPTION_ARG_FILENAME, &batch, "Ask PROMPT of every line of FILE ({} stands for the line)", "FILE"},
+    {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Batch answers file (default: FILE.answers.jsonl)", "FILE"},
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Batch requests at once (default 4)", "N"},
+    {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &words, NULL, "[PROMPT...]"},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- ask an OpenAI-compatible endpoint");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("xfce-ask-cli: %s\n", error->message);
+    return 2;
+  }
+  if (batch && (!words || !words[0]))
+  {
+    g_printerr("xfce-ask-cli: --batch needs a PROMPT template\n");
+    return 2;
+  }
+  if (jobs < 1 || jobs > BATCH_MAX_JOBS)
+  {
+    g_printerr("xfce-ask-cli: --jobs must be between 1 and %d\n", BATCH_MAX_JOBS);
+    return 2;
+  }
+
+  openai_ask_log_init();
+  CliState st = {0};
+  openai_ask_settings_init(&st.settings);
+  g_autofree gchar *rc = config ? g_strdup(config) : openai_ask_settings_find_panel_rc();
+  if (config && !openai_ask_settings_load(&st.settings, rc))
+    g_printerr("xfce-ask-cli: cannot read %s, using defaults\n", rc);
+  else if (!config)
+    openai_ask_settings_load(&st.settings, rc);
+
+  if (endpoint)
+  {
+    g_free(st.settings.endpoint);
+    st.settings.endpoint = endpoint;
+  }
+  if (model)
+  {
+    g_free(st.settings.model);
+    st.settings.model = model;
+  }
+  if (backend)
+  {
+    g_free(st.settings.backend);
+    st.settings.backend = backend;
+  }
+  if (system_prompt)
+  {
+    g_free(st.settings.system_prompt);
+    st.settings.system_prompt = system_prompt;
+  }
+  if (temperature >= 0.0)
+    st.settings.temperature = temperature;
+
+  st.api_key = keyring_lookup_api_key(st.settings.endpoint);
+  if (st.settings.endpoint)
+    openai_client_set_backend(st.settings.endpoint, openai_client_backend_from_name(st.settings.backend));
+  st.conversation = conversation_new(CLI_FOLLOWUP_MAX_TURNS);
+  st.loop = g_main_loop_new(NULL, FALSE);
+  st.follow_up = follow_up;
+  st.ansi = !raw && (color || isatty(STDOUT_FILENO));
+  st.timing = timing;
+  st.interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+  st.attachments = attachment_list_new();
+  for (guint i = 0; attach && attach[i]; i++)
+  {
+    Attachment *attachment = attachment_new_file(attach[i], &error);
+    if (!attachment || !attachment_add(st.attachments, attachment, &error))
+    {
+      g_printerr("xfce-ask-cli: %s\n", error->message);
+      return 2;
+    }
+  }
+  g_strfreev(attach);
+  if (!no_history)
+  {
+    g_autofree gchar *history_path = history_default_path();
+    st.history = history_new(history_path, NULL, NULL);
+  }
+
+  if (!st.settings.endpoint || !*st.settings.endpoint || !st.settings.model || !*st.settings.model)
+  {
+    g_printerr("xfce-ask-cli: no endpoint or model configured\n");
+    st.failures++;
+  }
+  else if (batch)
+  {
+    g_autofree gchar *template = g_strjoinv(" ", words);
+    if (!cli_run_batch(&st, template, batch, output, jobs))
+      st.failures++;
+  }
+  else if (words && words[0])
+  {
+    g_autofree gchar *prompt = g_strjoinv(" ", words);
+    st.single = TRUE;
+    cli_send(&st, prompt);
+    g_main_loop_run(st.loop);
+  }
+  else
+  {
+    cli_next(&st);
+    g_main_loop_run(st.loop);
+  }
+
+  batch_free(st.batch);
+  history_free(st.history);
+  conversation_free(st.conversation);
+  g_clear_pointer(&st.attachments, g_ptr_array_unref);
+  g_main_loop_unref(st.loop);
+  g_free(st.api_key);
+  openai_ask_settings_clear(&st.settings);
+  g_strfreev(words);
+  g_free(batch);
+  g_free(output);
+  g_free(config);
+  return st.failures > 0 ? 1 : 0;
+}
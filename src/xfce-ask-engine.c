@@ -0,0 +1,312 @@
+/* xfce-ask-engine: sends chat requests on behalf of the panel plugin.
+ *
+ * Started by D-Bus activation on the first request from a plugin instance
+ * that has "Use shared engine" enabled. All instances then share one HTTP
+ * connection pool and one keyring cache, and a hung or crashing request
+ * stays out of the panel process. Exits after a while without requests. */
+#include <gio/gio.h>
+#include <glib-unix.h>
+#include <signal.h>
+
+#include "conversation.h"
+#include "engine-client.h"
+#include "keyring.h"
+#include "log.h"
+#include "metrics.h"
+#include "openai-client.h"
+#include "settings.h"
+
+#define ENGINE_IDLE_TIMEOUT_S 600
+
+static const gchar engine_introspection_xml[] =
+  "<node>"
+  "  <interface name='" ENGINE_INTERFACE "'>"
+  "    <method name='Ask'>"
+  "      <arg type='t' name='tag' direction='in'/>"
+  "      <arg type='s' name='endpoint' direction='in'/>"
+  "      <arg type='s' name='model' direction='in'/>"
+  "      <arg type='d' name='temperature' direction='in'/>"
+  "      <arg type='a(ss)' name='messages' direction='in'/>"
+  "      <arg type='b' name='ok' direction='out'/>"
+  "      <arg type='i' name='http_status' direction='out'/>"
+  "      <arg type='s' name='content' direction='out'/>"
+  "      <arg type='s' name='error' direction='out'/>"
+  "    </method>"
+  "    <method name='Cancel'>"
+  "      <arg type='t' name='tag' direction='in'/>"
+  "    </method>"
+  "    <method name='ForgetKey'>"
+  "      <arg type='s' name='endpoint' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+typedef struct
+{
+  GMainLoop *loop;
+  GHashTable *pending; /* "sender:tag" -> EngineRequest */
+  guint idle_source_id;
+  guint idle_timeout_s;
+} Engine;
+
+typedef struct
+{
+  Engine *engine;
+  gchar *key;
+  GDBusMethodInvocation *invocation;
+  GCancellable *cancellable;
+} EngineRequest;
+
+static void
+engine_request_free(EngineRequest *req)
+{
+  g_free(req->key);
+  g_clear_object(&req->invocation);
+  g_clear_object(&req->cancellable);
+  g_free(req);
+}
+
+static gboolean
+engine_on_idle_timeout(gpointer user_data)
+{
+  Engine *engine = user_data;
+  engine->idle_source_id = 0;
+  openai_ask_log("engine: idle, exiting");
+  g_main_loop_quit(engine->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+engine_update_idle(Engine *engine)
+{
+  g_clear_handle_id(&engine->idle_source_id, g_source_remove);
+  if (g_hash_table_size(engine->pending) == 0 && engine->idle_timeout_s > 0)
+    engine->idle_source_id = g_timeout_add_seconds(engine->idle_timeout_s, engine_on_idle_timeout, engine);
+}
+
+static gchar *
+engine_request_key(GDBusMethodInvocation *invocation, guint64 tag)
+{
+  return g_strdup_printf("%s:%" G_GUINT64_FORMAT, g_dbus_method_invocation_get_sender(invocation), tag);
+}
+
+static void
+engine_on_client_result(OpenaiClientResult *result, gpointer user_data)
+{
+  EngineRequest *req = user_data;
+  Engine *engine = req->engine;
+
+  openai_ask_log("engine: %s done ok=%d status=%d", req->key, result->ok, result->http_status);
+  g_dbus_method_invocation_return_value(req->invocation,
+                                        g_variant_new("(biss)",
+                                                      result->ok,
+                                                      result->http_status,
+                                                      result->content ? result->content : "",
+                                                      result->error_message ? result->error_message : ""));
+  g_hash_table_remove(engine->pending, req->key);
+  engine_update_idle(engine);
+}
+
+static void
+engine_handle_ask(Engine *engine, GVariant *parameters, GDBusMethodInvocation *invocation)
+{
+  guint64 tag = 0;
+  const gchar *endpoint = NULL;
+  const gchar *model = NULL;
+  gdouble temperature = 0.0;
+  g_autoptr(GVariant) messages = NULL;
+  g_variant_get(parameters, "(t&s&sd@a(ss))", &tag, &endpoint, &model, &temperature, &messages);
+
+  if (!*endpoint || !*model)
+  {
+    g_dbus_method_invocation_return_value(invocation,
+                                          g_variant_new("(biss)", FALSE, 0, "", "No endpoint or model configured."));
+    return;
+  }
+
+  g_autofree gchar *api_key = keyring_lookup_api_key(endpoint);
+  if (!api_key || !*api_key)
+  {
+    g_dbus_method_invocation_return_value(
+      invocation,
+      g_variant_new("(biss)",
+                    FALSE,
+                    0,
+                    "",
+                    "No API key found for this endpoint.\nRight-click the plugin → Properties → save an API key."));
+    return;
+  }
+
+  Conversation *conversation = engine_conversation_from_variant(messages);
+
+  EngineRequest *req = g_new0(EngineRequest, 1);
+  req->engine = engine;
+  req->key = engine_request_key(invocation, tag);
+  req->invocation = g_object_ref(invocation);
+  req->cancellable = g_cancellable_new();
+  g_hash_table_replace(engine->pending, req->key, req);
+  engine_update_idle(engine);
+
+  openai_ask_log("engine: %s ask model=%s turns=%u", req->key, model, conversation_get_length(conversation));
+  openai_client_send_chat_async(endpoint,
+                                api_key,
+                                model,
+                                temperature,
+                                conversation,
+                                NULL,
+                                req->cancellable,
+                                engine_on_client_result,
+                                req);
+  conversation_free(conversation);
+}
+
+static void
+engine_on_method_call(GDBusConnection *connection,
+                      const gchar *sender,
+                      const gchar *object_path,
+                      const gchar *interface_name,
+                      const gchar *method_name,
+                      GVariant *parameters,
+                      GDBusMethodInvocation *invocation,
+                      gpointer user_data)
+{
+  (void)connection;
+  (void)sender;
+  (void)object_path;
+  (void)interface_name;
+  Engine *engine = user_data;
+
+  if (g_strcmp0(method_name, "Ask") == 0)
+    return engine_handle_ask(engine, parameters, invocation);
+
+  if (g_strcmp0(method_name, "Cancel") == 0)
+  {
+    guint64 tag = 0;
+    g_variant_get(parameters, "(t)", &tag);
+    g_autofree gchar *key = engine_request_key(invocation, tag);
+    EngineRequest *req = g_hash_table_lookup(engine->pending, key);
+    if (req)
+      g_cancellable_cancel(req->cancellable);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+    return;
+  }
+
+  if (g_strcmp0(method_name, "ForgetKey") == 0)
+  {
+    const gchar *endpoint = NULL;
+    g_variant_get(parameters, "(&s)", &endpoint);
+    keyring_forget_cached(endpoint);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+    return;
+  }
+
+  g_dbus_method_invocation_return_error(
+    invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method %s", method_name);
+}
+
+static const GDBusInterfaceVTable engine_vtable = {
+  engine_on_method_call,
+  NULL,
+  NULL,
+  {0},
+};
+
+static void
+engine_on_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  (void)name;
+  Engine *engine = user_data;
+
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDBusNodeInfo) info = g_dbus_node_info_new_for_xml(engine_introspection_xml, &error);
+  if (!info || !g_dbus_connection_register_object(connection,
+                                                  ENGINE_OBJECT_PATH,
+                                                  info->interfaces[0],
+                                                  &engine_vtable,
+                                                  engine,
+                                                  NULL,
+                                                  &error))
+  {
+    g_printerr("xfce-ask-engine: %s\n", error ? error->message : "cannot export object");
+    g_main_loop_quit(engine->loop);
+  }
+}
+
+static void
+engine_on_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  (void)connection;
+  Engine *engine = user_data;
+  g_printerr("xfce-ask-engine: could not own %s\n", name);
+  g_main_loop_quit(engine->loop);
+}
+
+static gboolean
+engine_on_signal(gpointer user_data)
+{
+  Engine *engine = user_data;
+  g_main_loop_quit(engine->loop);
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main(int argc, char **argv)
+{
+  gint idle_timeout = ENGINE_IDLE_TIMEOUT_S;
+  gboolean replace = FALSE;
+  GOptionEntry entries[] = {
+    {"idle-timeout", 0, 0, G_OPTION_ARG_INT, &idle_timeout, "Exit after SECONDS without requests (0 = never)", "SECONDS"},
+    {"replace", 'r', 0, G_OPTION_ARG_NONE, &replace, "Replace a running engine", NULL},
+    {NULL, 0, 0, 0, NULL, NULL, NULL},
+  };
+  g_autoptr(GOptionContext) opts = g_option_context_new("- shared request engine for XFCE Ask");
+  g_option_context_add_main_entries(opts, entries, NULL);
+  g_autoptr(GError) error = NULL;
+  if (!g_option_context_parse(opts, &argc, &argv, &error))
+  {
+    g_printerr("xfce-ask-engine: %s\n", error->message);
+    return 2;
+  }
+
+  openai_ask_log_init();
+  metrics_start_export("engine");
+
+  /* Requests carry their endpoint but not its server type; that comes from
+   * the panel's settings as they were when the engine started. */
+  OpenaiAskSettings settings;
+  openai_ask_settings_init(&settings);
+  g_autofree gchar *rc = openai_ask_settings_find_panel_rc();
+  openai_ask_settings_load(&settings, rc);
+  openai_client_set_backend(settings.endpoint, openai_client_backend_from_name(settings.backend));
+  openai_ask_settings_clear(&settings);
+
+  Engine engine = {0};
+  engine.loop = g_main_loop_new(NULL, FALSE);
+  engine.pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)engine_request_free);
+  engine.idle_timeout_s = (guint)MAX(idle_timeout, 0);
+
+  GBusNameOwnerFlags flags = G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT;
+  if (replace)
+    flags |= G_BUS_NAME_OWNER_FLAGS_REPLACE;
+  guint owner_id = g_bus_own_name(G_BUS_TYPE_SESSION,
+                                  ENGINE_BUS_NAME,
+                                  flags,
+                                  engine_on_bus_acquired,
+                                  NULL,
+                                  engine_on_name_lost,
+                                  &engine,
+                                  NULL);
+  g_unix_signal_add(SIGINT, engine_on_signal, &engine);
+  g_unix_signal_add(SIGTERM, engine_on_signal, &engine);
+  engine_update_idle(&engine);
+
+  g_main_loop_run(engine.loop);
+  metrics_flush_exports();
+
+  /* Callers see their pending Ask calls fail with NoReply. */
+  g_bus_unown_name(owner_id);
+  g_clear_handle_id(&engine.idle_source_id, g_source_remove);
+  g_hash_table_destroy(engine.pending);
+  g_main_loop_unref(engine.loop);
+  return 0;
+}